@@ -0,0 +1,140 @@
+// compare bytes/event and ns/event of IFTRACER_ENCODING=fixed and varint
+//
+// usage: iftracer_encoding_bench [calls]
+// the parent process runs itself for each encoding because the encoding is
+// fixed at process startup
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace {
+volatile uint64_t sink = 0;
+
+// instrumented workload: a few distinct leaf functions called from a loop
+template <int N>
+__attribute__((noinline)) void leaf(uint64_t i) {
+  sink = sink + i * N;
+}
+__attribute__((noinline)) void middle(uint64_t i) {
+  switch (i & 3) {
+    case 0:
+      leaf<0>(i);
+      break;
+    case 1:
+      leaf<1>(i);
+      break;
+    case 2:
+      leaf<2>(i);
+      break;
+    default:
+      leaf<3>(i);
+      break;
+  }
+}
+
+__attribute__((no_instrument_function)) int run_child(uint64_t calls) {
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < calls; i++) {
+    middle(i);
+  }
+  auto end = std::chrono::steady_clock::now();
+  // enter + exit of middle() and leaf()
+  uint64_t events = calls * 4;
+  uint64_t elapsed_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+          .count();
+  printf("%llu %llu\n", static_cast<unsigned long long>(events),
+         static_cast<unsigned long long>(elapsed_ns));
+  return 0;
+}
+
+__attribute__((no_instrument_function)) uint64_t trace_file_size(
+    const std::string& directory) {
+  uint64_t size = 0;
+  DIR* dir      = opendir(directory.c_str());
+  if (dir == nullptr) {
+    return 0;
+  }
+  while (struct dirent* entry = readdir(dir)) {
+    std::string path = directory + "/" + entry->d_name;
+    struct stat stbuf;
+    if (strncmp(entry->d_name, "iftracer.out.", 13) == 0 &&
+        strstr(entry->d_name, ".maps") == nullptr &&
+        stat(path.c_str(), &stbuf) == 0) {
+      size += stbuf.st_size;
+    }
+    if (entry->d_name[0] != '.') {
+      unlink(path.c_str());
+    }
+  }
+  closedir(dir);
+  return size;
+}
+
+__attribute__((no_instrument_function)) bool run_encoding(
+    const char* self, const std::string& calls, const char* encoding) {
+  char directory[] = "/tmp/iftracer_encoding_bench.XXXXXX";
+  if (mkdtemp(directory) == nullptr) {
+    perror("mkdtemp");
+    return false;
+  }
+  std::string command = std::string("IFTRACER_ENCODING=") + encoding +
+                        " IFTRACER_OUTPUT_DIRECTORY=" + directory +
+                        " IFTRACER_MODULE_MAP=0 '" + self + "' --child " +
+                        calls;
+  FILE* fp = popen(command.c_str(), "r");
+  if (fp == nullptr) {
+    perror("popen");
+    return false;
+  }
+  unsigned long long events = 0, elapsed_ns = 0;
+  int n = fscanf(fp, "%llu %llu", &events, &elapsed_ns);
+  pclose(fp);
+  uint64_t size = trace_file_size(directory);
+  rmdir(directory);
+  if (n != 2 || events == 0) {
+    std::cerr << "failed to run " << encoding << std::endl;
+    return false;
+  }
+  printf("%-8s %12llu %12llu %12.2f %12.2f\n", encoding, events,
+         static_cast<unsigned long long>(size),
+         static_cast<double>(size) / events,
+         static_cast<double>(elapsed_ns) / events);
+  return true;
+}
+}  // namespace
+
+__attribute__((no_instrument_function)) int main(int argc,
+                                                 const char* argv[]) {
+  if (argc >= 3 && std::string(argv[1]) == "--child") {
+    return run_child(std::strtoull(argv[2], nullptr, 10));
+  }
+  {
+    // this launcher process is also traced: drop its own trace files
+    const char* env       = getenv("IFTRACER_OUTPUT_DIRECTORY");
+    std::string directory = env != nullptr ? env : "./";
+    env                   = getenv("IFTRACER_OUTPUT_FILE_PREFIX");
+    std::string prefix    = env != nullptr ? env : "iftracer.out.";
+    std::string trace_file =
+        directory + "/" + prefix + std::to_string(getpid());
+    unlink(trace_file.c_str());
+    unlink((trace_file + ".maps").c_str());
+  }
+  std::string calls = argc >= 2 ? argv[1] : "10000000";
+  printf("%-8s %12s %12s %12s %12s\n", "encoding", "events", "bytes",
+         "bytes/event", "ns/event");
+  bool ret = true;
+  for (const char* encoding : {"fixed", "varint"}) {
+    ret &= run_encoding(argv[0], calls, encoding);
+  }
+  return ret ? 0 : 1;
+}
@@ -0,0 +1,373 @@
+// hook overhead of each path of the tracer (ns/event and latency
+// percentiles) as machine-readable json
+//
+// usage: iftracer_bench [--calls N] [--threads N] [--case NAME]
+// --calls  : instrumented calls per thread and case (default: 1000000)
+// --threads: max threads of the threads case (default: number of cores, 2 at
+//            least)
+// --case   : run only this case
+//
+// cases (an op is timed one by one):
+//   baseline      : call of a function which is not instrumented
+//   empty         : instrumented empty function (enter + exit)
+//   recursion     : 64 nested instrumented calls
+//   scope_logger  : iftracer::ScopeLogger of a StringId
+//   async_logger  : iftracer::AsyncLogger of a StringId
+//   instant_logger: iftracer::InstantLogger of a StringId
+//   flush         : 64 empty calls per op, the flush threshold is crossed
+//                   every 256 ops or so
+//   prepare_write : same as flush after the initial buffer is filled, so the
+//                   buffer is extended every 32 ops or so
+//   threads       : empty on 1, 2, 4, ... threads at once
+// each case runs in a child process because options are fixed at process
+// startup, also with runtime variants (env) and with iftracer_bench_<build>
+// binaries next to this one which link the library built with other options
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "iftracer.hpp"
+
+namespace {
+volatile uint64_t sink = 0;
+
+__attribute__((noinline, no_instrument_function)) void baseline_function(
+    uint64_t i) {
+  sink = sink + i;
+}
+__attribute__((noinline)) void empty_function(uint64_t i) { sink = sink + i; }
+__attribute__((noinline)) void recursive_function(int depth) {
+  if (depth > 1) {
+    recursive_function(depth - 1);
+  }
+  sink = sink + depth;
+}
+
+__attribute__((no_instrument_function)) void baseline_op(uint64_t i) {
+  baseline_function(i);
+}
+__attribute__((no_instrument_function)) void empty_op(uint64_t i) {
+  empty_function(i);
+}
+__attribute__((no_instrument_function)) void recursion_op(uint64_t i) {
+  recursive_function(64);
+}
+__attribute__((no_instrument_function)) void scope_logger_op(uint64_t i) {
+  static const iftracer::StringId string_id("scope");
+  iftracer::ScopeLogger scope_logger(string_id);
+  sink = sink + i;
+}
+__attribute__((no_instrument_function)) void async_logger_op(uint64_t i) {
+  static const iftracer::StringId string_id("async");
+  iftracer::AsyncLogger async_logger;
+  async_logger.Enter(string_id);
+  sink = sink + i;
+  async_logger.Exit();
+}
+__attribute__((no_instrument_function)) void instant_logger_op(uint64_t i) {
+  static const iftracer::StringId string_id("instant");
+  iftracer::InstantLogger instant_logger(string_id);
+  sink = sink + i;
+}
+__attribute__((no_instrument_function)) void batch_op(uint64_t i) {
+  for (int j = 0; j < 64; j++) {
+    empty_function(i + j);
+  }
+}
+
+struct Case {
+  const char* name;
+  void (*op)(uint64_t);
+  uint64_t calls_per_op;
+  // records of the binary format (extend events are not recorded by
+  // IFTRACE_TEXT_FORMAT)
+  uint64_t events_per_op;
+};
+const Case cases[] = {
+    {"baseline", baseline_op, 1, 0},
+    {"empty", empty_op, 1, 2},
+    {"recursion", recursion_op, 64, 128},
+    {"scope_logger", scope_logger_op, 1, 2},
+    {"async_logger", async_logger_op, 1, 2},
+    {"instant_logger", instant_logger_op, 1, 1},
+    {"flush", batch_op, 64, 128},
+    {"prepare_write", batch_op, 64, 128},
+    {"threads", empty_op, 1, 2},
+};
+
+__attribute__((no_instrument_function)) const Case* find_case(
+    const std::string& name) {
+  for (const Case& c : cases) {
+    if (name == c.name) {
+      return &c;
+    }
+  }
+  return nullptr;
+}
+
+// same as IFTRACER_INIT_BUFFER of the hook
+__attribute__((no_instrument_function)) uint64_t init_buffer_size() {
+  const char* env = getenv("IFTRACER_INIT_BUFFER");
+  uint64_t size =
+      env != nullptr ? 8192 * std::strtoull(env, nullptr, 10) : 0;
+  return std::max<uint64_t>(size, 8192 * (4 * 1024));
+}
+
+__attribute__((no_instrument_function)) void run_ops(
+    const Case* c, uint64_t ops, uint64_t warmup_ops,
+    std::vector<uint32_t>* latencies) {
+  // the logger of the thread is initialized by the first hook
+  for (uint64_t i = 0; i < warmup_ops; i++) {
+    c->op(i);
+  }
+  latencies->resize(ops);
+  auto pre = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < ops; i++) {
+    c->op(i);
+    auto now = std::chrono::steady_clock::now();
+    (*latencies)[i] = static_cast<uint32_t>(std::min<int64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - pre)
+            .count(),
+        UINT32_MAX));
+    pre = now;
+  }
+}
+
+// print: ops events elapsed_ns p50 p90 p99 p999 p9999 max
+__attribute__((no_instrument_function)) int run_child(const Case* c,
+                                                      int threads,
+                                                      uint64_t calls) {
+  uint64_t ops        = std::max<uint64_t>(calls / c->calls_per_op, 1);
+  uint64_t warmup_ops = 1000;
+  if (std::string(c->name) == "prepare_write") {
+    // 4B/event at least (varint)
+    warmup_ops = init_buffer_size() / 4 / c->events_per_op;
+  }
+  std::vector<std::vector<uint32_t>> latencies(threads);
+  if (threads == 1) {
+    run_ops(c, ops, warmup_ops, &latencies[0]);
+  } else {
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+      workers.emplace_back(run_ops, c, ops, warmup_ops, &latencies[i]);
+    }
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+  }
+  std::vector<uint32_t> all;
+  for (const std::vector<uint32_t>& l : latencies) {
+    all.insert(all.end(), l.begin(), l.end());
+  }
+  std::sort(all.begin(), all.end());
+  auto percentile = [&](double p) -> unsigned long long {
+    return all[std::min<size_t>(all.size() * p, all.size() - 1)];
+  };
+  // sum of the timed ops (threads run the warmup at different times)
+  unsigned long long elapsed_ns = 0;
+  for (uint32_t latency : all) {
+    elapsed_ns += latency;
+  }
+  printf("%llu %llu %llu %llu %llu %llu %llu %llu %llu\n",
+         static_cast<unsigned long long>(all.size()),
+         static_cast<unsigned long long>(all.size() * c->events_per_op),
+         elapsed_ns, percentile(0.5), percentile(0.9), percentile(0.99),
+         percentile(0.999), percentile(0.9999), percentile(1.0));
+  return 0;
+}
+
+__attribute__((no_instrument_function)) void remove_files(
+    const std::string& directory) {
+  DIR* dir = opendir(directory.c_str());
+  if (dir == nullptr) {
+    return;
+  }
+  while (struct dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] != '.') {
+      unlink((directory + "/" + entry->d_name).c_str());
+    }
+  }
+  closedir(dir);
+  rmdir(directory.c_str());
+}
+
+struct Result {
+  unsigned long long ops = 0, events = 0, elapsed_ns = 0;
+  unsigned long long p50 = 0, p90 = 0, p99 = 0, p999 = 0, p9999 = 0, max = 0;
+};
+
+__attribute__((no_instrument_function)) bool run_variant(
+    const std::string& binary, const Case* c, const char* env, int threads,
+    uint64_t calls, Result* result) {
+  char directory[] = "/tmp/iftracer_bench.XXXXXX";
+  if (mkdtemp(directory) == nullptr) {
+    perror("mkdtemp");
+    return false;
+  }
+  std::string command = std::string(env) +
+                        " IFTRACER_OUTPUT_DIRECTORY=" + directory +
+                        " IFTRACER_MODULE_MAP=0 '" + binary + "' --child " +
+                        c->name + " " + std::to_string(threads) + " " +
+                        std::to_string(calls);
+  FILE* fp = popen(command.c_str(), "r");
+  int n    = 0;
+  if (fp != nullptr) {
+    n = fscanf(fp, "%llu %llu %llu %llu %llu %llu %llu %llu %llu",
+               &result->ops, &result->events, &result->elapsed_ns,
+               &result->p50, &result->p90, &result->p99, &result->p999,
+               &result->p9999, &result->max);
+    pclose(fp);
+  } else {
+    perror("popen");
+  }
+  remove_files(directory);
+  if (n != 9 || result->ops == 0) {
+    std::cerr << "failed to run " << c->name << " of " << binary
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+__attribute__((no_instrument_function)) bool executable(
+    const std::string& path) {
+  return access(path.c_str(), X_OK) == 0;
+}
+}  // namespace
+
+__attribute__((no_instrument_function)) int main(int argc,
+                                                 const char* argv[]) {
+  if (argc >= 5 && std::string(argv[1]) == "--child") {
+    const Case* c = find_case(argv[2]);
+    if (c == nullptr) {
+      return 1;
+    }
+    return run_child(c, std::atoi(argv[3]),
+                     std::strtoull(argv[4], nullptr, 10));
+  }
+  {
+    // this launcher process is also traced: drop its own trace files
+    const char* env       = getenv("IFTRACER_OUTPUT_DIRECTORY");
+    std::string directory = env != nullptr ? env : "./";
+    env                   = getenv("IFTRACER_OUTPUT_FILE_PREFIX");
+    std::string prefix    = env != nullptr ? env : "iftracer.out.";
+    std::string trace_file =
+        directory + "/" + prefix + std::to_string(getpid());
+    unlink(trace_file.c_str());
+    unlink((trace_file + ".maps").c_str());
+  }
+  uint64_t calls  = 1000000;
+  int max_threads = std::max<int>(std::thread::hardware_concurrency(), 2);
+  std::string only_case;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string option = argv[i];
+    if (option == "--calls") {
+      calls = std::strtoull(argv[i + 1], nullptr, 10);
+    } else if (option == "--threads") {
+      max_threads = std::max(std::atoi(argv[i + 1]), 1);
+    } else if (option == "--case") {
+      only_case = argv[i + 1];
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--calls N] [--threads N] [--case NAME]" << std::endl;
+      return 1;
+    }
+  }
+  if (argc % 2 == 0 || (!only_case.empty() && !find_case(only_case))) {
+    std::cerr << "usage: " << argv[0]
+              << " [--calls N] [--threads N] [--case NAME]" << std::endl;
+    return 1;
+  }
+
+  // the library of this binary is built with the configured options
+  struct Build {
+    const char* name;
+    std::string binary;
+  };
+  std::vector<Build> builds = {{"default", argv[0]}};
+  for (const char* name : {"disable_cpu_id", "text_format"}) {
+    std::string binary = std::string(argv[0]) + "_" + name;
+    if (executable(binary)) {
+      builds.push_back({name, binary});
+    }
+  }
+  // IFTRACER_LOCK_FREE_QUEUE only enables IFTRACER_ASYNC_MUNMAP by default
+  struct Variant {
+    const char* case_name;
+    const char* name;
+    const char* env;
+  };
+  const Variant variants[] = {
+      {"flush", "lock_free_queue", "IFTRACER_ASYNC_MUNMAP=1"},
+      {"prepare_write", "sync_extend", "IFTRACER_MAP_AHEAD=0"},
+  };
+
+  printf("{\n");
+  printf("  \"benchmark\": \"iftracer_bench\",\n");
+  printf("  \"calls\": %llu,\n", static_cast<unsigned long long>(calls));
+  printf("  \"hardware_concurrency\": %u,\n",
+         std::thread::hardware_concurrency());
+  printf("  \"results\": [");
+  bool ret   = true;
+  bool first = true;
+  auto run   = [&](const Build& build, const Case* c, const char* variant,
+                 const char* env, int threads) {
+    std::cerr << "[" << build.name << "] " << c->name << " " << variant
+              << " threads=" << threads << std::endl;
+    Result result;
+    if (!run_variant(build.binary, c, env, threads, calls, &result)) {
+      ret = false;
+      return;
+    }
+    printf("%s\n    {\"build\": \"%s\", \"case\": \"%s\", \"variant\": \"%s\", "
+           "\"env\": \"%s\", \"threads\": %d, \"ops\": %llu, "
+           "\"events\": %llu, \"ns_per_op\": %.2f, ",
+           first ? "" : ",", build.name, c->name, variant, env, threads,
+           result.ops, result.events,
+           static_cast<double>(result.elapsed_ns) / result.ops);
+    if (result.events != 0) {
+      printf("\"ns_per_event\": %.2f, ",
+             static_cast<double>(result.elapsed_ns) / result.events);
+    } else {
+      printf("\"ns_per_event\": null, ");
+    }
+    printf("\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, "
+           "\"p999_ns\": %llu, \"p9999_ns\": %llu, \"max_ns\": %llu}",
+           result.p50, result.p90, result.p99, result.p999, result.p9999,
+           result.max);
+    fflush(stdout);
+    first = false;
+  };
+  for (const Build& build : builds) {
+    for (const Case& c : cases) {
+      if (!only_case.empty() && only_case != c.name) {
+        continue;
+      }
+      if (std::string(c.name) == "threads") {
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+          run(build, &c, "default", "", threads);
+        }
+        continue;
+      }
+      run(build, &c, "default", "", 1);
+      for (const Variant& variant : variants) {
+        if (variant.case_name == std::string(c.name)) {
+          run(build, &c, variant.name, variant.env, 1);
+        }
+      }
+    }
+  }
+  printf("\n  ]\n}\n");
+  return ret ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+// compare ns/scope, heap allocations/scope and bytes/scope of ScopeLogger
+// with std::string texts and interned iftracer::StringId
+//
+// usage: iftracer_string_id_bench [scopes]
+// each variant runs in a child process which writes trace files into a
+// temporary directory
+// this file is not instrumented: only the extend events are recorded
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include "iftracer.hpp"
+
+namespace {
+uint64_t allocation_count = 0;
+}  // namespace
+
+void* operator new(size_t size) {
+  allocation_count++;
+  void* p = malloc(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t size) noexcept { free(p); }
+
+namespace {
+volatile uint64_t sink = 0;
+
+__attribute__((noinline)) void dynamic_text_scope(uint64_t i) {
+  iftracer::ScopeLogger scope_logger(std::to_string(i % 100) +
+                                     ":text of the scope logger");
+  sink = sink + i;
+}
+__attribute__((noinline)) void literal_text_scope(uint64_t i) {
+  // longer than the small string buffer
+  iftracer::ScopeLogger scope_logger("literal text of the scope logger");
+  sink = sink + i;
+}
+__attribute__((noinline)) void string_id_scope(uint64_t i) {
+  static const iftracer::StringId string_id("literal text of the scope logger");
+  iftracer::ScopeLogger scope_logger(string_id);
+  sink = sink + i;
+}
+
+struct Variant {
+  const char* name;
+  void (*scope)(uint64_t);
+} variants[] = {
+    {"dynamic", dynamic_text_scope},
+    {"literal", literal_text_scope},
+    {"string_id", string_id_scope},
+};
+
+int run_child(const std::string& name, uint64_t scopes) {
+  for (auto& variant : variants) {
+    if (name != variant.name) {
+      continue;
+    }
+    // warm up: string_define and the first pages of the trace file
+    for (uint64_t i = 0; i < 1000; i++) {
+      variant.scope(i);
+    }
+    uint64_t allocations = allocation_count;
+    auto start           = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < scopes; i++) {
+      variant.scope(i);
+    }
+    auto end    = std::chrono::steady_clock::now();
+    allocations = allocation_count - allocations;
+    uint64_t elapsed_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count();
+    printf("%llu %llu %llu\n", static_cast<unsigned long long>(scopes),
+           static_cast<unsigned long long>(elapsed_ns),
+           static_cast<unsigned long long>(allocations));
+    return 0;
+  }
+  return 1;
+}
+
+uint64_t trace_file_size(const std::string& directory) {
+  uint64_t size = 0;
+  DIR* dir      = opendir(directory.c_str());
+  if (dir == nullptr) {
+    return 0;
+  }
+  while (struct dirent* entry = readdir(dir)) {
+    std::string path = directory + "/" + entry->d_name;
+    struct stat stbuf;
+    if (strncmp(entry->d_name, "iftracer.out.", 13) == 0 &&
+        strstr(entry->d_name, ".maps") == nullptr &&
+        stat(path.c_str(), &stbuf) == 0) {
+      size += stbuf.st_size;
+    }
+    if (entry->d_name[0] != '.') {
+      unlink(path.c_str());
+    }
+  }
+  closedir(dir);
+  return size;
+}
+
+bool run_variant(const char* self, const std::string& scopes,
+                 const char* name) {
+  char directory[] = "/tmp/iftracer_string_id_bench.XXXXXX";
+  if (mkdtemp(directory) == nullptr) {
+    perror("mkdtemp");
+    return false;
+  }
+  std::string command = std::string("IFTRACER_OUTPUT_DIRECTORY=") + directory +
+                        " IFTRACER_MODULE_MAP=0 '" + self + "' --child " +
+                        name + " " + scopes;
+  FILE* fp = popen(command.c_str(), "r");
+  if (fp == nullptr) {
+    perror("popen");
+    return false;
+  }
+  unsigned long long count = 0, elapsed_ns = 0, allocations = 0;
+  int n = fscanf(fp, "%llu %llu %llu", &count, &elapsed_ns, &allocations);
+  pclose(fp);
+  uint64_t size = trace_file_size(directory);
+  rmdir(directory);
+  if (n != 3 || count == 0) {
+    std::cerr << "failed to run " << name << std::endl;
+    return false;
+  }
+  printf("%-10s %12llu %12.2f %14.2f %14.2f\n", name, count,
+         static_cast<double>(elapsed_ns) / count,
+         static_cast<double>(allocations) / count,
+         static_cast<double>(size) / count);
+  return true;
+}
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+  if (argc >= 4 && std::string(argv[1]) == "--child") {
+    return run_child(argv[2], std::strtoull(argv[3], nullptr, 10));
+  }
+  std::string scopes = argc >= 2 ? argv[1] : "10000000";
+  printf("%-10s %12s %12s %14s %14s\n", "text", "scopes", "ns/scope",
+         "allocs/scope", "bytes/scope");
+  bool ret = true;
+  for (auto& variant : variants) {
+    ret &= run_variant(argv[0], scopes, variant.name);
+  }
+  return ret ? 0 : 1;
+}
@@ -0,0 +1,276 @@
+// compare hook latency of IFTRACER_WRITER=mmap and buffered
+// (IFTRACER_MAP_AHEAD=0 and IFTRACER_COMPRESS, with ratio and throughput of
+// the codec per core)
+//
+// usage: iftracer_writer_bench [calls] [--load]
+// --load: another thread keeps writing and fsync()ing large files to the
+//         output directory so that the writeback competes with the tracer
+// the parent process runs itself for each writer because the writer is
+// fixed at process startup
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lz_codec.hpp"
+
+namespace {
+volatile uint64_t sink = 0;
+
+// instrumented workload: a few distinct leaf functions called from a loop
+template <int N>
+__attribute__((noinline)) void leaf(uint64_t i) {
+  sink = sink + i * N;
+}
+__attribute__((noinline)) void middle(uint64_t i) {
+  switch (i & 3) {
+    case 0:
+      leaf<0>(i);
+      break;
+    case 1:
+      leaf<1>(i);
+      break;
+    case 2:
+      leaf<2>(i);
+      break;
+    default:
+      leaf<3>(i);
+      break;
+  }
+}
+
+// latency of each middle() call (4 hooks) including Flush()
+__attribute__((no_instrument_function)) int run_child(uint64_t calls) {
+  std::vector<uint32_t> latencies(calls);
+  auto start = std::chrono::steady_clock::now();
+  auto pre   = start;
+  for (uint64_t i = 0; i < calls; i++) {
+    middle(i);
+    auto now = std::chrono::steady_clock::now();
+    latencies[i] = static_cast<uint32_t>(std::min<int64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - pre)
+            .count(),
+        UINT32_MAX));
+    pre = now;
+  }
+  uint64_t elapsed_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(pre - start)
+          .count();
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) -> unsigned long long {
+    return latencies[std::min<size_t>(calls * p, calls - 1)];
+  };
+  // enter + exit of middle() and leaf()
+  printf("%llu %llu %llu %llu %llu %llu\n",
+         static_cast<unsigned long long>(calls * 4),
+         static_cast<unsigned long long>(elapsed_ns), percentile(0.5),
+         percentile(0.99), percentile(0.999), percentile(1.0));
+  return 0;
+}
+
+struct CodecResult {
+  uint64_t raw_size        = 0;
+  uint64_t compressed_size = 0;
+  double compress_sec      = 0;
+  double decompress_sec    = 0;
+};
+
+// compress the trace file in blocks of the flush size on this core
+__attribute__((no_instrument_function)) void measure_codec(
+    const std::string& path, CodecResult* result) {
+  const size_t block_size = 4096 * 64;
+  std::vector<uint8_t> data(block_size);
+  std::vector<uint8_t> compressed(iftracer::lz::CompressBound(block_size));
+  std::vector<uint8_t> decompressed(block_size);
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (fp == nullptr) {
+    return;
+  }
+  size_t size;
+  while ((size = fread(data.data(), 1, block_size, fp)) > 0) {
+    auto start = std::chrono::steady_clock::now();
+    size_t compressed_size = iftracer::lz::Compress(
+        data.data(), size, compressed.data(), compressed.size());
+    auto middle = std::chrono::steady_clock::now();
+    bool ret    = iftracer::lz::Decompress(compressed.data(), compressed_size,
+                                           decompressed.data(), size);
+    auto end    = std::chrono::steady_clock::now();
+    if (!ret || memcmp(data.data(), decompressed.data(), size) != 0) {
+      std::cerr << "wrong round trip: " << path << std::endl;
+    }
+    result->raw_size += size;
+    result->compressed_size += compressed_size;
+    result->compress_sec +=
+        std::chrono::duration<double>(middle - start).count();
+    result->decompress_sec +=
+        std::chrono::duration<double>(end - middle).count();
+  }
+  fclose(fp);
+}
+
+// return the size of trace files
+__attribute__((no_instrument_function)) uint64_t remove_files(
+    const std::string& directory, CodecResult* codec_result) {
+  uint64_t size = 0;
+  DIR* dir      = opendir(directory.c_str());
+  if (dir == nullptr) {
+    return 0;
+  }
+  while (struct dirent* entry = readdir(dir)) {
+    std::string path = directory + "/" + entry->d_name;
+    struct stat stbuf;
+    if (strncmp(entry->d_name, "iftracer.out.", 13) == 0 &&
+        strstr(entry->d_name, ".maps") == nullptr &&
+        stat(path.c_str(), &stbuf) == 0) {
+      size += stbuf.st_size;
+      if (codec_result != nullptr) {
+        measure_codec(path, codec_result);
+      }
+    }
+    if (entry->d_name[0] != '.') {
+      unlink(path.c_str());
+    }
+  }
+  closedir(dir);
+  return size;
+}
+
+// keep the disk busy until stop
+__attribute__((no_instrument_function)) void run_load(
+    std::string directory, std::atomic<bool>* stop) {
+  std::vector<char> data(1 << 20, 'x');
+  std::string filename = directory + "/load.bin";
+  while (!stop->load()) {
+    int fd = open(filename.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0666);
+    if (fd < 0) {
+      perror("open");
+      return;
+    }
+    for (int i = 0; i < 64 && !stop->load(); i++) {
+      if (write(fd, data.data(), data.size()) < 0) {
+        perror("write");
+        break;
+      }
+    }
+    fsync(fd);
+    close(fd);
+  }
+  unlink(filename.c_str());
+}
+
+__attribute__((no_instrument_function)) bool run_writer(
+    const char* self, const std::string& calls, const char* name,
+    const char* env, bool load, CodecResult* codec_result) {
+  char directory[] = "/tmp/iftracer_writer_bench.XXXXXX";
+  if (mkdtemp(directory) == nullptr) {
+    perror("mkdtemp");
+    return false;
+  }
+  std::atomic<bool> stop(false);
+  std::thread loader;
+  if (load) {
+    loader = std::thread(run_load, std::string(directory), &stop);
+  }
+  std::string command = std::string(env) +
+                        " IFTRACER_OUTPUT_DIRECTORY=" + directory +
+                        " IFTRACER_MODULE_MAP=0 '" + self + "' --child " +
+                        calls;
+  FILE* fp = popen(command.c_str(), "r");
+  unsigned long long events = 0, elapsed_ns = 0;
+  unsigned long long p50 = 0, p99 = 0, p999 = 0, max = 0;
+  int n = 0;
+  if (fp != nullptr) {
+    n = fscanf(fp, "%llu %llu %llu %llu %llu %llu", &events, &elapsed_ns,
+               &p50, &p99, &p999, &max);
+    pclose(fp);
+  } else {
+    perror("popen");
+  }
+  stop.store(true);
+  if (loader.joinable()) {
+    loader.join();
+  }
+  uint64_t size = remove_files(directory, codec_result);
+  rmdir(directory);
+  if (n != 6 || events == 0) {
+    std::cerr << "failed to run " << name << std::endl;
+    return false;
+  }
+  printf("%-18s %10llu %12llu %10.2f %8llu %8llu %8llu %10llu\n", name,
+         events, static_cast<unsigned long long>(size),
+         static_cast<double>(elapsed_ns) / events, p50, p99, p999, max);
+  return true;
+}
+}  // namespace
+
+__attribute__((no_instrument_function)) int main(int argc,
+                                                 const char* argv[]) {
+  if (argc >= 3 && std::string(argv[1]) == "--child") {
+    return run_child(std::strtoull(argv[2], nullptr, 10));
+  }
+  {
+    // this launcher process is also traced: drop its own trace files
+    const char* env       = getenv("IFTRACER_OUTPUT_DIRECTORY");
+    std::string directory = env != nullptr ? env : "./";
+    env                   = getenv("IFTRACER_OUTPUT_FILE_PREFIX");
+    std::string prefix    = env != nullptr ? env : "iftracer.out.";
+    std::string trace_file =
+        directory + "/" + prefix + std::to_string(getpid());
+    unlink(trace_file.c_str());
+    unlink((trace_file + ".maps").c_str());
+  }
+  std::string calls = "2000000";
+  bool load         = false;
+  for (int i = 1; i < argc; i++) {
+    if (std::string(argv[i]) == "--load") {
+      load = true;
+    } else {
+      calls = argv[i];
+    }
+  }
+  struct Variant {
+    const char* name;
+    const char* env;
+  };
+  const Variant variants[] = {
+      {"mmap", "IFTRACER_WRITER=mmap"},
+      {"mmap(sync extend)", "IFTRACER_WRITER=mmap IFTRACER_MAP_AHEAD=0"},
+      {"buffered(io_uring)", "IFTRACER_WRITER=buffered IFTRACER_IO_URING=1"},
+      {"buffered(pwritev)", "IFTRACER_WRITER=buffered IFTRACER_IO_URING=0"},
+      {"buffered(direct)", "IFTRACER_WRITER=buffered IFTRACER_DIRECT_IO=1"},
+      {"buffered(lz)", "IFTRACER_WRITER=buffered IFTRACER_COMPRESS=1"},
+  };
+  // latencies are per middle() call, i.e. 4 hooks
+  printf("%-18s %10s %12s %10s %8s %8s %8s %10s\n", "writer", "events",
+         "bytes", "ns/event", "p50[ns]", "p99[ns]", "p999[ns]", "max[ns]");
+  bool ret = true;
+  // the codec is measured on the uncompressed trace of mmap
+  CodecResult codec_result;
+  for (const Variant& variant : variants) {
+    ret &= run_writer(argv[0], calls, variant.name, variant.env, load,
+                      variant.env == variants[0].env ? &codec_result
+                                                     : nullptr);
+  }
+  if (codec_result.compressed_size != 0) {
+    printf("\n%-18s %8s %22s %22s\n", "codec", "ratio",
+           "compress[MB/s/core]", "decompress[MB/s/core]");
+    printf("%-18s %8.2f %22.1f %22.1f\n", "lz",
+           static_cast<double>(codec_result.raw_size) /
+               codec_result.compressed_size,
+           codec_result.raw_size / codec_result.compress_sec / 1e6,
+           codec_result.raw_size / codec_result.decompress_sec / 1e6);
+  }
+  return ret ? 0 : 1;
+}
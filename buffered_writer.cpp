@@ -0,0 +1,531 @@
+#include "buffered_writer.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if __linux__ && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define IFTRACER_HAS_IO_URING 1
+#endif
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lz_codec.hpp"
+#include "trace_format.hpp"
+
+namespace {
+struct WriteRequest {
+  int fd;
+  const uint8_t* data;
+  size_t size;
+  // compress: set by the background writer
+  size_t offset;
+  BufferedWriter* writer;
+  int index;
+  bool compress;
+};
+
+// write size bytes or return errno
+int write_all(int fd, const uint8_t* data, size_t size, size_t offset) {
+  while (size > 0) {
+    struct iovec iov = {const_cast<uint8_t*>(data), size};
+    ssize_t n        = pwritev(fd, &iov, 1, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return n < 0 ? errno : EIO;
+    }
+    data += n;
+    size -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+// format::FrameHeader and compressed data (stored if not compressible)
+size_t encode_frame(const uint8_t* data, size_t size,
+                    std::vector<uint8_t>* frame) {
+  using iftracer::format::FrameHeader;
+  frame->resize(sizeof(FrameHeader) + size);
+  FrameHeader header;
+  header.raw_size        = static_cast<uint32_t>(size);
+  header.compressed_size = static_cast<uint32_t>(iftracer::lz::Compress(
+      data, size, frame->data() + sizeof(FrameHeader), size - 1));
+  if (header.compressed_size == 0) {
+    header.compressed_size = header.raw_size;
+    memcpy(frame->data() + sizeof(FrameHeader), data, size);
+  }
+  memcpy(frame->data(), &header, sizeof(header));
+  return sizeof(FrameHeader) + header.compressed_size;
+}
+
+#ifdef IFTRACER_HAS_IO_URING
+// minimal io_uring by raw syscalls (no liburing dependency)
+class IoUring {
+ public:
+  bool Setup(unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fd_ = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd_ < 0) {
+      return false;
+    }
+    entries_ = params.sq_entries;
+    iovecs_.resize(entries_);
+    size_t sq_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_map) {
+      sq_size = cq_size = std::max(sq_size, cq_size);
+    }
+    uint8_t* sq = reinterpret_cast<uint8_t*>(
+        mmap(nullptr, sq_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING));
+    if (sq == MAP_FAILED) {
+      return false;
+    }
+    uint8_t* cq = sq;
+    if (!single_map) {
+      cq = reinterpret_cast<uint8_t*>(
+          mmap(nullptr, cq_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING));
+      if (cq == MAP_FAILED) {
+        return false;
+      }
+    }
+    sqes_ = reinterpret_cast<struct io_uring_sqe*>(
+        mmap(nullptr, params.sq_entries * sizeof(struct io_uring_sqe),
+             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+             IORING_OFF_SQES));
+    if (sqes_ == MAP_FAILED) {
+      return false;
+    }
+    sq_head_  = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_  = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_  = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head_  = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_  = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_  = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+  }
+  unsigned Entries() const { return entries_; }
+
+  // write all requests (at most Entries()) and return errno of each request
+  // false if io_uring_enter() failed: the requests are written by pwritev()
+  // and the ring must not be used anymore
+  bool Write(const std::vector<WriteRequest>& requests,
+             std::vector<int>* errors) {
+    unsigned tail = *sq_tail_;
+    for (size_t i = 0; i < requests.size(); i++) {
+      // iovecs_ outlive the requests in flight
+      iovecs_[i].iov_base = const_cast<uint8_t*>(requests[i].data);
+      iovecs_[i].iov_len  = requests[i].size;
+      unsigned index      = tail & sq_mask_;
+      struct io_uring_sqe* sqe = &sqes_[index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode    = IORING_OP_WRITEV;
+      sqe->fd        = requests[i].fd;
+      sqe->addr      = reinterpret_cast<uint64_t>(&iovecs_[i]);
+      sqe->len       = 1;
+      sqe->off       = requests[i].offset;
+      sqe->user_data = i;
+      sq_array_[index] = index;
+      tail++;
+    }
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+    errors->assign(requests.size(), 0);
+    std::vector<ssize_t> results(requests.size(), -EIO);
+    size_t submitted = 0;
+    size_t completed = 0;
+    bool ok          = true;
+    // after a failure only the submitted requests are waited for
+    while (completed < (ok ? requests.size() : submitted)) {
+      unsigned to_submit = ok ? requests.size() - submitted : 0;
+      unsigned to_wait   = (ok ? requests.size() : submitted) - completed;
+      int ret = syscall(__NR_io_uring_enter, fd_, to_submit, to_wait,
+                        IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (ret < 0 && errno != EINTR) {
+        if (ok) {
+          std::cerr << "[iftracer] io_uring_enter(): " << std::strerror(errno)
+                    << ", use pwritev()" << std::endl;
+          ok = false;
+        } else {
+          // the kernel completes the submitted requests anyway
+          std::this_thread::yield();
+        }
+      } else if (ret > 0) {
+        submitted += std::min<unsigned>(ret, to_submit);
+      }
+      unsigned head = *cq_head_;
+      while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+        results[cqe->user_data]  = cqe->res;
+        completed++;
+        head++;
+      }
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+    if (!ok) {
+      // withdraw the entries which the kernel did not accept
+      __atomic_store_n(sq_tail_, __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE),
+                       __ATOMIC_RELEASE);
+    }
+    for (size_t i = 0; i < requests.size(); i++) {
+      const WriteRequest& request = requests[i];
+      // short write or failure: the rest is written synchronously
+      size_t written = results[i] > 0 ? results[i] : 0;
+      if (written < request.size) {
+        (*errors)[i] = write_all(request.fd, request.data + written,
+                                 request.size - written,
+                                 request.offset + written);
+      }
+    }
+    return ok;
+  }
+
+ private:
+  int fd_           = -1;
+  unsigned entries_ = 0;
+  unsigned* sq_head_  = nullptr;
+  unsigned* sq_tail_  = nullptr;
+  unsigned sq_mask_   = 0;
+  unsigned* sq_array_ = nullptr;
+  struct io_uring_sqe* sqes_ = nullptr;
+  unsigned* cq_head_         = nullptr;
+  unsigned* cq_tail_         = nullptr;
+  unsigned cq_mask_          = 0;
+  struct io_uring_cqe* cqes_ = nullptr;
+  std::vector<struct iovec> iovecs_;
+};
+#endif
+
+bool io_uring_flag = true;
+
+// process-wide writer thread of completed buffers
+// NOTE: never destroyed because loggers use it until process exit
+class BackgroundWriter {
+ public:
+  static BackgroundWriter& Get() {
+    static BackgroundWriter* background_writer = new BackgroundWriter();
+    return *background_writer;
+  }
+  void Post(const WriteRequest& request) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      requests_.push_back(request);
+    }
+    posted_.notify_one();
+  }
+  const char* BackendName() const {
+    return io_uring_ ? "io_uring" : "pwritev";
+  }
+
+ private:
+  BackgroundWriter() {
+#ifdef IFTRACER_HAS_IO_URING
+    io_uring_ = io_uring_flag && ring_.Setup(max_batch_size);
+#endif
+    std::thread([this]() { Run(); }).detach();
+  }
+  void Run() {
+    std::vector<WriteRequest> requests;
+    std::vector<int> errors;
+    std::vector<std::vector<uint8_t>> frames(max_batch_size);
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        posted_.wait(lock, [this]() { return !requests_.empty(); });
+        size_t n = std::min(requests_.size(), max_batch_size);
+        requests.assign(requests_.begin(), requests_.begin() + n);
+        requests_.erase(requests_.begin(), requests_.begin() + n);
+      }
+      // frames of a writer are appended in the order of requests
+      for (size_t i = 0; i < requests.size(); i++) {
+        WriteRequest& request = requests[i];
+        if (request.compress) {
+          request.size = encode_frame(request.data, request.size, &frames[i]);
+          request.data = frames[i].data();
+          request.offset = request.writer->compressed_offset_;
+          request.writer->compressed_offset_ += request.size;
+        }
+      }
+      bool written = false;
+#ifdef IFTRACER_HAS_IO_URING
+      if (io_uring_) {
+        written = true;
+        if (!ring_.Write(requests, &errors)) {
+          io_uring_ = false;
+        }
+      }
+#endif
+      if (!written) {
+        errors.resize(requests.size());
+        for (size_t i = 0; i < requests.size(); i++) {
+          errors[i] = write_all(requests[i].fd, requests[i].data,
+                                requests[i].size, requests[i].offset);
+        }
+      }
+      for (size_t i = 0; i < requests.size(); i++) {
+        requests[i].writer->OnWritten(requests[i].index, errors[i]);
+      }
+    }
+  }
+
+  static constexpr size_t max_batch_size = 64;
+  // false after a failure of io_uring_enter()
+  std::atomic<bool> io_uring_{false};
+#ifdef IFTRACER_HAS_IO_URING
+  IoUring ring_;
+#endif
+  std::mutex mutex_;
+  std::condition_variable posted_;
+  std::deque<WriteRequest> requests_;
+};
+constexpr size_t BackgroundWriter::max_batch_size;
+}  // namespace
+
+void BufferedWriter::SetIoUring(bool io_uring) { io_uring_flag = io_uring; }
+const char* BufferedWriter::BackendName() {
+  return BackgroundWriter::Get().BackendName();
+}
+
+bool BufferedWriter::Open(std::string filename, size_t size, int64_t offset) {
+  size_t page_size = getpagesize();
+  // frames have any size and are appended to the end of the file
+  align_size_ = compress_ ? 1 : page_size;
+  int open_flag     = O_CREAT | O_RDWR | O_CLOEXEC;
+  if (offset == 0) {
+    open_flag |= O_TRUNC;
+  }
+  fd_ = -1;
+#ifdef O_DIRECT
+  // frames are not aligned
+  if (direct_io_ && !compress_) {
+    fd_ = open(filename.c_str(), open_flag | O_DIRECT, 0666);
+  }
+#endif
+  if (fd_ < 0) {
+    fd_ = open(filename.c_str(), open_flag, 0666);
+  }
+  if (fd_ < 0) {
+    AddErrorMessageWithErrono("Open(): open():", errno);
+    return false;
+  }
+  size_t file_size = 0;
+  if (offset < 0) {
+    struct stat stbuf;
+    if (fstat(fd_, &stbuf) != 0) {
+      AddErrorMessageWithErrono("Open(): fstat():", errno);
+      close(fd_);
+      return false;
+    }
+    file_size = stbuf.st_size;
+  }
+  size_t hugepage_size = 2 * 1024 * 1024;
+  mapping_size_ = (std::max(buffer_size_, page_size * 2) + page_size - 1) /
+                  page_size * page_size;
+  if (hugepage_) {
+    mapping_size_ =
+        (mapping_size_ + hugepage_size - 1) / hugepage_size * hugepage_size;
+  }
+  int map_flag = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+  // no page fault in the hook
+  map_flag |= MAP_POPULATE;
+#endif
+  for (int i = 0; i < 2; i++) {
+    void* buffer = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (hugepage_) {
+      buffer = mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE,
+                    map_flag | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (buffer == MAP_FAILED) {
+      buffer = mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE, map_flag,
+                    -1, 0);
+#ifdef MADV_HUGEPAGE
+      if (buffer != MAP_FAILED && hugepage_) {
+        madvise(buffer, mapping_size_, MADV_HUGEPAGE);
+      }
+#endif
+    }
+    if (buffer == MAP_FAILED) {
+      AddErrorMessageWithErrono("Open(): mmap():", errno);
+      FreeBuffers();
+      close(fd_);
+      return false;
+    }
+    buffers_[i] = reinterpret_cast<uint8_t*>(buffer);
+    busy_[i].store(false);
+  }
+  write_error_.store(0);
+  current_           = 0;
+  head_              = buffers_[current_];
+  map_size_          = mapping_size_;
+  compressed_offset_ = file_size;
+  if (compress_) {
+    // FileOffset() is the offset in the uncompressed data of this writer
+    file_size = 0;
+  }
+  head_offset_  = file_size / align_size_ * align_size_;
+  file_offset_  = file_size;
+  local_offset_ = file_size - head_offset_;
+  cursor_       = head_ + local_offset_;
+  // the last partial page is written again with the following records
+  if (local_offset_ != 0 &&
+      pread(fd_, head_, align_size_, head_offset_) <
+          static_cast<ssize_t>(local_offset_)) {
+    AddErrorMessageWithErrono("Open(): pread():", errno);
+    FreeBuffers();
+    close(fd_);
+    return false;
+  }
+  // start the background writer outside of the hook
+  BackgroundWriter::Get();
+  is_open_ = true;
+  return true;
+}
+
+bool BufferedWriter::Close() {
+  if (!IsOpen()) {
+    AddErrorMessage("Close(): no opening buffer:");
+    return false;
+  }
+  is_open_ = false;
+  // both buffers must be idle before munmap()
+  bool ret = WaitWritten(0);
+  ret      = WaitWritten(1) && ret;
+  if (compress_ && local_offset_ != 0) {
+    std::vector<uint8_t> frame;
+    size_t size = encode_frame(head_, local_offset_, &frame);
+    if (ret && !WriteAll(frame.data(), size, compressed_offset_)) {
+      ret = false;
+    }
+    compressed_offset_ += size;
+  } else if (!compress_) {
+    // O_DIRECT writes whole pages and the file is truncated to the data size
+    size_t size =
+        (local_offset_ + align_size_ - 1) / align_size_ * align_size_;
+    memset(cursor_, 0, size - local_offset_);
+    if (ret && !WriteAll(head_, size, head_offset_)) {
+      ret = false;
+    }
+  }
+  if (ftruncate(fd_, compress_ ? compressed_offset_ : file_offset_) != 0) {
+    AddErrorMessageWithErrono("Close(): ftruncate():", errno);
+    ret = false;
+  }
+  if (close(fd_) != 0) {
+    AddErrorMessageWithErrono("Close(): close():", errno);
+    ret = false;
+  }
+  fd_ = -1;
+  FreeBuffers();
+  return ret;
+}
+
+bool BufferedWriter::Flush(size_t size) {
+  if (local_offset_ < size || local_offset_ < align_size_) {
+    return false;
+  }
+  return Submit();
+}
+
+bool BufferedWriter::PrepareWrite(size_t size) {
+  if (CheckCapacity(size)) {
+    return true;
+  }
+  // the partial page is carried over to the next buffer
+  if (local_offset_ % align_size_ + size > map_size_) {
+    AddErrorMessage("PrepareWrite(): too large data for buffer:");
+    return false;
+  }
+  return Submit();
+}
+
+bool BufferedWriter::Submit() {
+  size_t size = local_offset_ / align_size_ * align_size_;
+  int next    = 1 - current_;
+  if (!WaitWritten(next)) {
+    return false;
+  }
+  if (size != 0) {
+    busy_[current_].store(true, std::memory_order_relaxed);
+    BackgroundWriter::Get().Post(WriteRequest{fd_, head_, size, head_offset_,
+                                              this, current_, compress_});
+  }
+  uint8_t* next_head = buffers_[next];
+  memcpy(next_head, head_ + size, local_offset_ - size);
+  current_ = next;
+  head_    = next_head;
+  head_offset_ += size;
+  local_offset_ -= size;
+  cursor_ = head_ + local_offset_;
+  return true;
+}
+
+void BufferedWriter::OnWritten(int index, int error) {
+  if (error != 0) {
+    write_error_.store(error);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    busy_[index].store(false, std::memory_order_release);
+  }
+  written_.notify_all();
+}
+
+bool BufferedWriter::WaitWritten(int index) {
+  if (busy_[index].load(std::memory_order_acquire)) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    written_.wait(lock, [this, index]() {
+      return !busy_[index].load(std::memory_order_acquire);
+    });
+  }
+  int error = write_error_.exchange(0);
+  if (error != 0) {
+    AddErrorMessageWithErrono("write():", error);
+    return false;
+  }
+  return true;
+}
+
+bool BufferedWriter::WriteAll(const uint8_t* data, size_t size,
+                              size_t offset) {
+  int error = write_all(fd_, data, size, offset);
+  if (error != 0) {
+    AddErrorMessageWithErrono("write():", error);
+    return false;
+  }
+  return true;
+}
+
+void BufferedWriter::FreeBuffers() {
+  for (int i = 0; i < 2; i++) {
+    if (buffers_[i] != nullptr) {
+      munmap(buffers_[i], mapping_size_);
+    }
+    buffers_[i] = nullptr;
+  }
+  head_   = nullptr;
+  cursor_ = nullptr;
+}
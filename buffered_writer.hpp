@@ -0,0 +1,81 @@
+#ifndef BUFFERED_WRITER_HPP_INCLUDED
+#define BUFFERED_WRITER_HPP_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "trace_writer.hpp"
+
+// trace file writer with two prefaulted anonymous buffers (IFTRACER_WRITER)
+//
+// the hook fills one buffer while the other one is written to the file by
+// the process-wide background writer thread (io_uring, or pwritev())
+// so neither page faults, munmap() nor writeback of MAP_SHARED pages happen
+// in the hook, which waits only when the disk cannot keep up
+// NOTE: unlike MmapWriter, buffered data is lost on abnormal termination
+class BufferedWriter : public TraceWriter {
+ public:
+  BufferedWriter(){};
+  ~BufferedWriter() {
+    if (IsOpen()) {
+      Close();
+    }
+  };
+  // size of each buffer (call before Open())
+  void SetBufferSize(size_t buffer_size) { buffer_size_ = buffer_size; }
+  // O_DIRECT: fallback to the page cache if the file system rejects it
+  void SetDirectIo(bool direct_io) { direct_io_ = direct_io; }
+  // MAP_HUGETLB (fallback to madvise(MADV_HUGEPAGE))
+  void SetHugepage(bool hugepage) { hugepage_ = hugepage; }
+  // write each flushed buffer as a compressed frame (format::FrameHeader)
+  // in the background writer thread (O_DIRECT is not used)
+  void SetCompress(bool compress) { compress_ = compress; }
+  // process-wide backend of the background writer (before the first Open())
+  static void SetIoUring(bool io_uring);
+  // "io_uring" or "pwritev" (available after the first Open())
+  static const char* BackendName();
+
+  // size is not used (buffers are SetBufferSize())
+  bool Open(std::string filename, size_t size, int64_t offset) override;
+  bool Close() override;
+  // write the complete pages of the buffer in the background and continue
+  // in the other buffer (size is the threshold checked by the caller)
+  bool Flush(size_t size) override;
+  bool PrepareWrite(size_t size) override;
+
+  // called by the background writer thread
+  // error: errno of the write (0: success)
+  void OnWritten(int index, int error);
+
+  // private:
+  bool Submit();
+  bool WaitWritten(int index);
+  bool WriteAll(const uint8_t* data, size_t size, size_t offset);
+  void FreeBuffers();
+
+  size_t buffer_size_ = 4096 * 72;
+  bool direct_io_     = false;
+  bool hugepage_      = false;
+  bool compress_      = false;
+
+  int fd_ = -1;
+  // file writes are aligned for O_DIRECT (1: compress_)
+  size_t align_size_ = 4096;
+  // compress_: file offset of the next frame
+  // (updated by the background writer while buffers are busy)
+  size_t compressed_offset_ = 0;
+  // file offset of head_ (aligned)
+  size_t head_offset_  = 0;
+  size_t mapping_size_ = 0;
+  uint8_t* buffers_[2] = {nullptr, nullptr};
+  int current_         = 0;
+  std::atomic<bool> busy_[2];
+  std::atomic<int> write_error_{0};
+  std::mutex mutex_;
+  std::condition_variable written_;
+};
+
+#endif  // BUFFERED_WRITER_HPP_INCLUDED
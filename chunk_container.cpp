@@ -0,0 +1,97 @@
+#include "chunk_container.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+namespace iftracer {
+namespace {
+// chunks which the file holds at first (the file is sparse)
+constexpr size_t initial_capacity = 16;
+}  // namespace
+
+bool ChunkContainer::Open(const std::string& filename,
+                          const format::ContainerHeader& header) {
+  Close();
+  size_t page_size = getpagesize();
+  chunk_size_ = (header.chunk_size + page_size - 1) / page_size * page_size;
+  if (chunk_size_ < sizeof(header) ||
+      chunk_size_ <= sizeof(format::ChunkHeader)) {
+    error_message_ = "Open(): too small chunk size:" + error_message_;
+    return false;
+  }
+  fd_ = open(filename.c_str(), O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd_ < 0) {
+    AddErrorMessageWithErrono("Open(): open():", errno);
+    return false;
+  }
+  format::ContainerHeader aligned_header = header;
+  aligned_header.chunk_size = static_cast<uint32_t>(chunk_size_);
+  if (pwrite(fd_, &aligned_header, sizeof(aligned_header), 0) !=
+      static_cast<ssize_t>(sizeof(aligned_header))) {
+    AddErrorMessageWithErrono("Open(): pwrite():", errno);
+    Close();
+    return false;
+  }
+  if (!Grow(initial_capacity - 1)) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void ChunkContainer::Close() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  fd_ = -1;
+  next_chunk_index_.store(0);
+  capacity_.store(0);
+}
+
+bool ChunkContainer::Allocate(size_t* chunk_offset) {
+  size_t chunk_index =
+      next_chunk_index_.fetch_add(1, std::memory_order_relaxed);
+  // ftruncate() of Grow() happens before the release store of capacity_, so
+  // the chunk is backed by the file when it is mapped
+  if (chunk_index >= capacity_.load(std::memory_order_acquire) &&
+      !Grow(chunk_index)) {
+    return false;
+  }
+  // the first slot is the header
+  *chunk_offset = (chunk_index + 1) * chunk_size_;
+  return true;
+}
+
+bool ChunkContainer::Grow(size_t chunk_index) {
+  std::lock_guard<std::mutex> lock(grow_mutex_);
+  size_t capacity = capacity_.load(std::memory_order_relaxed);
+  if (chunk_index < capacity) {
+    return true;
+  }
+  size_t new_capacity = std::max(capacity * 2, chunk_index + 1);
+  if (ftruncate(fd_, (new_capacity + 1) * chunk_size_) != 0) {
+    AddErrorMessageWithErrono("Allocate(): ftruncate():", errno);
+    return false;
+  }
+  capacity_.store(new_capacity, std::memory_order_release);
+  return true;
+}
+
+std::string ChunkContainer::GetErrorMessage() {
+  std::lock_guard<std::mutex> lock(grow_mutex_);
+  std::string tmp = error_message_;
+  error_message_.clear();
+  return tmp;
+}
+
+void ChunkContainer::AddErrorMessageWithErrono(std::string message,
+                                               int errno_value) {
+  error_message_ =
+      message + std::string(std::strerror(errno_value)) + ":" + error_message_;
+}
+}  // namespace iftracer
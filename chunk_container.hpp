@@ -0,0 +1,53 @@
+#ifndef CHUNK_CONTAINER_HPP_INCLUDED
+#define CHUNK_CONTAINER_HPP_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "trace_format.hpp"
+
+namespace iftracer {
+// process-wide trace file which is split into fixed size chunks
+// (IFTRACER_CONTAINER, see format::ContainerHeader)
+//
+// chunks are handed out by a lock-free counter and the file grows by
+// doubling under a lock only when the counter passes the capacity
+// writers map their chunk of Fd() by themselves (MmapWriter::OpenChunk())
+class ChunkContainer {
+ public:
+  ChunkContainer(){};
+  ~ChunkContainer() { Close(); };
+  ChunkContainer(const ChunkContainer&) = delete;
+  ChunkContainer& operator=(const ChunkContainer&) = delete;
+
+  // header.chunk_size is rounded up to the page size
+  bool Open(const std::string& filename, const format::ContainerHeader& header);
+  bool IsOpen() const { return fd_ >= 0; }
+  void Close();
+  int Fd() const { return fd_; }
+  size_t ChunkSize() const { return chunk_size_; }
+  // file offset of an unused chunk
+  bool Allocate(size_t* chunk_offset);
+  // id of a new chain of chunks (0 is invalid id)
+  uint32_t NewStreamId() { return next_stream_id_.fetch_add(1) + 1; }
+  std::string GetErrorMessage();
+
+ private:
+  bool Grow(size_t chunk_index);
+  void AddErrorMessageWithErrono(std::string message, int errno_value);
+
+  int fd_            = -1;
+  size_t chunk_size_ = 0;
+  std::atomic<size_t> next_chunk_index_{0};
+  // number of chunks which the file can hold
+  std::atomic<size_t> capacity_{0};
+  std::atomic<uint32_t> next_stream_id_{0};
+  std::mutex grow_mutex_;
+  std::string error_message_ = "";
+};
+}  // namespace iftracer
+
+#endif  // CHUNK_CONTAINER_HPP_INCLUDED
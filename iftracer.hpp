@@ -2,15 +2,103 @@
 #define IFTRACER_HPP_INCLUDED
 
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
 #include <string>
+#include <type_traits>
 
 namespace iftracer {
+class StringId;
+class Arg;
+
+// counters and latency histograms of the tracer itself (see GetTracerStats())
+struct TracerStats {
+  // log2 buckets: buckets[i] counts [2^i, 2^(i+1)) ns
+  // (buckets[0] also counts 0 and the last one counts the rest)
+  struct Latency {
+    uint64_t count       = 0;
+    uint64_t total_ns    = 0;
+    uint64_t max_ns      = 0;
+    uint64_t buckets[32] = {};
+  };
+  // records written to trace files
+  uint64_t events = 0;
+  // bytes of running threads are updated at extension and flush
+  uint64_t bytes = 0;
+  // buffer extensions (remap, next chunk or next ring segment)
+  uint64_t remaps = 0;
+  uint64_t flushes = 0;
+  // events lost because the buffer could not be extended
+  uint64_t dropped_events = 0;
+  uint64_t cpu_id_lookups = 0;
+  Latency prepare_write;
+  // synchronous munmap() of flushed pages with the default writer
+  Latency flush;
+  // IFTRACER_ASYNC_MUNMAP: from the flush to munmap() by the worker
+  Latency async_munmap;
+};
+
 #ifdef IFTRACER_ENABLE_API
 void ExtendEventDurationEnter();
 void ExtendEventDurationExit(const std::string& text);
 void ExtendEventAsyncEnter(const std::string& text);
 void ExtendEventAsyncExit(const std::string& text);
 void ExtendEventInstant(const std::string& text);
+// write ring buffers to trace files (only with IFTRACER_RING_BUFFER)
+void Dump();
+// start and stop recording function calls (thread safe, async-signal-safe)
+// functions which are running at Disable() are closed at that time
+// extend events of the API are recorded also while disabled
+void Enable();
+void Disable();
+bool IsEnabled();
+
+// process-wide id of the text (thread safe, 0 is invalid)
+uint32_t InternString(const char* text);
+// no allocation and no text copy (see StringId)
+void ExtendEventDurationExit(const StringId& string_id);
+void ExtendEventAsyncEnter(const StringId& string_id);
+void ExtendEventAsyncExit(const StringId& string_id);
+void ExtendEventInstant(const StringId& string_id);
+// with typed args (see Arg, at most 16 args per event)
+void ExtendEventDurationExit(const std::string& text, const Arg* args,
+                             size_t arg_count);
+void ExtendEventAsyncEnter(const std::string& text, const Arg* args,
+                           size_t arg_count);
+void ExtendEventAsyncExit(const std::string& text, const Arg* args,
+                          size_t arg_count);
+void ExtendEventInstant(const std::string& text, const Arg* args,
+                        size_t arg_count);
+void ExtendEventDurationExit(const StringId& string_id, const Arg* args,
+                             size_t arg_count);
+void ExtendEventAsyncEnter(const StringId& string_id, const Arg* args,
+                           size_t arg_count);
+void ExtendEventAsyncExit(const StringId& string_id, const Arg* args,
+                          size_t arg_count);
+void ExtendEventInstant(const StringId& string_id, const Arg* args,
+                        size_t arg_count);
+// sample of the counter track of the name (see Counter())
+void CounterInt64(const StringId& name, int64_t value);
+void CounterDouble(const StringId& name, double value);
+// events linked across threads by a 64bit id (unique in the process)
+// flow arrow from FlowStart() through FlowStep() to FlowEnd()
+// AsyncBegin() and AsyncEnd() may be called on different threads
+//   uint64_t id = iftracer::NewEventId();
+//   iftracer::AsyncBegin(kRequest, id);  // acceptor thread
+//   iftracer::FlowStart(kEnqueue, id);
+//   ...
+//   iftracer::FlowEnd(kEnqueue, id);  // worker thread
+//   iftracer::AsyncEnd(kRequest, id);
+uint64_t NewEventId();
+void FlowStart(const StringId& name, uint64_t id);
+void FlowStep(const StringId& name, uint64_t id);
+void FlowEnd(const StringId& name, uint64_t id);
+void AsyncBegin(const StringId& name, uint64_t id);
+void AsyncEnd(const StringId& name, uint64_t id);
+// totals of all threads including exited ones (thread safe)
+void GetTracerStats(TracerStats* stats);
 #else
 inline void ExtendEventDurationEnter() {
   // do nothing used only for passing build
@@ -27,8 +115,189 @@ inline void ExtendEventAsyncExit(const std::string& text) {
 inline void ExtendEventInstant(const std::string& text) {
   // do nothing used only for passing build
 }
+inline void Dump() {
+  // do nothing used only for passing build
+}
+inline void Enable() {
+  // do nothing used only for passing build
+}
+inline void Disable() {
+  // do nothing used only for passing build
+}
+inline bool IsEnabled() {
+  // do nothing used only for passing build
+  return false;
+}
+inline uint32_t InternString(const char* text) {
+  // do nothing used only for passing build
+  return 0;
+}
+inline void ExtendEventDurationExit(const StringId& string_id) {
+  // do nothing used only for passing build
+}
+inline void ExtendEventAsyncEnter(const StringId& string_id) {
+  // do nothing used only for passing build
+}
+inline void ExtendEventAsyncExit(const StringId& string_id) {
+  // do nothing used only for passing build
+}
+inline void ExtendEventInstant(const StringId& string_id) {
+  // do nothing used only for passing build
+}
+inline void ExtendEventDurationExit(const std::string& text, const Arg* args,
+                                    size_t arg_count) {
+  // do nothing used only for passing build
+}
+inline void ExtendEventAsyncEnter(const std::string& text, const Arg* args,
+                                  size_t arg_count) {
+  // do nothing used only for passing build
+}
+inline void ExtendEventAsyncExit(const std::string& text, const Arg* args,
+                                 size_t arg_count) {
+  // do nothing used only for passing build
+}
+inline void ExtendEventInstant(const std::string& text, const Arg* args,
+                               size_t arg_count) {
+  // do nothing used only for passing build
+}
+inline void ExtendEventDurationExit(const StringId& string_id, const Arg* args,
+                                    size_t arg_count) {
+  // do nothing used only for passing build
+}
+inline void ExtendEventAsyncEnter(const StringId& string_id, const Arg* args,
+                                  size_t arg_count) {
+  // do nothing used only for passing build
+}
+inline void ExtendEventAsyncExit(const StringId& string_id, const Arg* args,
+                                 size_t arg_count) {
+  // do nothing used only for passing build
+}
+inline void ExtendEventInstant(const StringId& string_id, const Arg* args,
+                               size_t arg_count) {
+  // do nothing used only for passing build
+}
+inline void CounterInt64(const StringId& name, int64_t value) {
+  // do nothing used only for passing build
+}
+inline void CounterDouble(const StringId& name, double value) {
+  // do nothing used only for passing build
+}
+inline uint64_t NewEventId() {
+  // do nothing used only for passing build
+  return 0;
+}
+inline void FlowStart(const StringId& name, uint64_t id) {
+  // do nothing used only for passing build
+}
+inline void FlowStep(const StringId& name, uint64_t id) {
+  // do nothing used only for passing build
+}
+inline void FlowEnd(const StringId& name, uint64_t id) {
+  // do nothing used only for passing build
+}
+inline void AsyncBegin(const StringId& name, uint64_t id) {
+  // do nothing used only for passing build
+}
+inline void AsyncEnd(const StringId& name, uint64_t id) {
+  // do nothing used only for passing build
+}
+inline void GetTracerStats(TracerStats* stats) {
+  // do nothing used only for passing build
+  *stats = TracerStats();
+}
 #endif
 
+// interned text which is recorded as 4B id
+// (the text itself is written once per trace file)
+//
+// intern once and reuse it at hot path
+//   static const iftracer::StringId kEating("eating");
+//   auto scope_logger = iftracer::ScopeLogger(kEating);
+class StringId {
+ public:
+  __attribute__((no_instrument_function)) StringId() {}
+  __attribute__((no_instrument_function)) explicit StringId(const char* text)
+      : id_(InternString(text)) {}
+  __attribute__((no_instrument_function)) uint32_t Id() const { return id_; }
+  __attribute__((no_instrument_function)) bool IsValid() const {
+    return id_ != 0;
+  }
+
+ private:
+  uint32_t id_ = 0;
+};
+
+// typed argument of extend events which is written in binary and formatted
+// only by the converter ("args" of chrome trace)
+// the key (and the value of kString) is an interned StringId
+//   static const iftracer::StringId kDepth("depth");
+//   iftracer::InstantLogger(kEnqueue, {{kDepth, queue.size()}});
+class Arg {
+ public:
+  // same as format::arg_*
+  enum Type : uint32_t {
+    kInt64   = 0,
+    kDouble  = 1,
+    kPointer = 2,
+    kString  = 3,
+  };
+
+  template <class T, typename std::enable_if<std::is_integral<T>::value,
+                                             int>::type = 0>
+  __attribute__((no_instrument_function)) Arg(const StringId& key, T value)
+      : key_(key.Id()),
+        type_(kInt64),
+        value_(static_cast<uint64_t>(static_cast<int64_t>(value))) {}
+  template <class T, typename std::enable_if<
+                         std::is_floating_point<T>::value, int>::type = 0>
+  __attribute__((no_instrument_function)) Arg(const StringId& key, T value)
+      : key_(key.Id()), type_(kDouble) {
+    double v = static_cast<double>(value);
+    memcpy(&value_, &v, sizeof(value_));
+  }
+  __attribute__((no_instrument_function)) Arg(const StringId& key,
+                                               const void* value)
+      : key_(key.Id()),
+        type_(kPointer),
+        value_(reinterpret_cast<uintptr_t>(value)) {}
+  __attribute__((no_instrument_function)) Arg(const StringId& key,
+                                               const StringId& value)
+      : key_(key.Id()), type_(kString), value_(value.Id()) {}
+
+  __attribute__((no_instrument_function)) uint32_t Key() const {
+    return key_;
+  }
+  __attribute__((no_instrument_function)) Type GetType() const {
+    return static_cast<Type>(type_);
+  }
+  // raw bits (int64, double, pointer or string id)
+  __attribute__((no_instrument_function)) uint64_t Value() const {
+    return value_;
+  }
+
+ private:
+  uint32_t key_   = 0;
+  uint32_t type_  = kInt64;
+  uint64_t value_ = 0;
+};
+
+// counter track ("C" event of chrome trace) such as queue depth
+// a sample is a fixed size record as cheap as a function enter record
+//   static const iftracer::StringId kQueueDepth("queue depth");
+//   iftracer::Counter(kQueueDepth, queue.size());
+template <class T, typename std::enable_if<std::is_integral<T>::value,
+                                           int>::type = 0>
+__attribute__((no_instrument_function)) inline void Counter(
+    const StringId& name, T value) {
+  CounterInt64(name, static_cast<int64_t>(value));
+}
+template <class T, typename std::enable_if<std::is_floating_point<T>::value,
+                                           int>::type = 0>
+__attribute__((no_instrument_function)) inline void Counter(
+    const StringId& name, T value) {
+  CounterDouble(name, static_cast<double>(value));
+}
+
 class ScopeLogger {
  public:
   // non copyable
@@ -39,6 +308,10 @@ class ScopeLogger {
       const std::string& text) {
     Enter(text);
   }
+  __attribute__((no_instrument_function)) explicit ScopeLogger(
+      const StringId& string_id) {
+    Enter(string_id);
+  }
   __attribute__((no_instrument_function)) ~ScopeLogger() {
     if (entered_flag_) {
       Exit();
@@ -58,22 +331,59 @@ class ScopeLogger {
     iftracer::ExtendEventDurationEnter();
   }
 
-  __attribute__((no_instrument_function)) void Exit() { Exit(text_); }
+  __attribute__((no_instrument_function)) void Enter(
+      const StringId& string_id) {
+    assert(!entered_flag_);
+    entered_flag_ = true;
+    SetText(string_id);
+    iftracer::ExtendEventDurationEnter();
+  }
+
+  __attribute__((no_instrument_function)) void Exit() {
+    if (string_id_.IsValid()) {
+      Exit(string_id_);
+      return;
+    }
+    Exit(text_);
+  }
 
   __attribute__((no_instrument_function)) void Exit(const std::string& text) {
     assert(entered_flag_);
     iftracer::ExtendEventDurationExit(text);
     entered_flag_ = false;
   }
+  __attribute__((no_instrument_function)) void Exit(
+      const StringId& string_id) {
+    assert(entered_flag_);
+    iftracer::ExtendEventDurationExit(string_id);
+    entered_flag_ = false;
+  }
+  // args are recorded with the exit (args of the duration event)
+  __attribute__((no_instrument_function)) void Exit(
+      std::initializer_list<Arg> args) {
+    assert(entered_flag_);
+    if (string_id_.IsValid()) {
+      iftracer::ExtendEventDurationExit(string_id_, args.begin(), args.size());
+    } else {
+      iftracer::ExtendEventDurationExit(text_, args.begin(), args.size());
+    }
+    entered_flag_ = false;
+  }
 
   __attribute__((no_instrument_function)) void SetText(
       const std::string& text) {
-    text_ = text;
+    text_      = text;
+    string_id_ = StringId();
+  }
+  __attribute__((no_instrument_function)) void SetText(
+      const StringId& string_id) {
+    string_id_ = string_id;
   }
 
  private:
   bool entered_flag_ = false;
   std::string text_;
+  StringId string_id_;
 };
 
 class AsyncLogger {
@@ -86,18 +396,57 @@ class AsyncLogger {
     text_         = text;
     ExtendEventAsyncEnter(text);
   }
+  __attribute__((no_instrument_function)) void Enter(
+      const StringId& string_id) {
+    assert(!entered_flag_);
+    entered_flag_ = true;
+    string_id_    = string_id;
+    ExtendEventAsyncEnter(string_id);
+  }
+  __attribute__((no_instrument_function)) void Enter(
+      const std::string& text, std::initializer_list<Arg> args) {
+    assert(!entered_flag_);
+    entered_flag_ = true;
+    text_         = text;
+    ExtendEventAsyncEnter(text, args.begin(), args.size());
+  }
+  __attribute__((no_instrument_function)) void Enter(
+      const StringId& string_id, std::initializer_list<Arg> args) {
+    assert(!entered_flag_);
+    entered_flag_ = true;
+    string_id_    = string_id;
+    ExtendEventAsyncEnter(string_id, args.begin(), args.size());
+  }
 
   __attribute__((no_instrument_function)) void Exit() {
     assert(entered_flag_);
+    if (string_id_.IsValid()) {
+      ExtendEventAsyncExit(string_id_);
+      return;
+    }
     ExtendEventAsyncExit(text_);
   }
   __attribute__((no_instrument_function)) void Exit(const std::string& text) {
     ExtendEventAsyncExit(text);
   }
+  __attribute__((no_instrument_function)) void Exit(
+      const StringId& string_id) {
+    ExtendEventAsyncExit(string_id);
+  }
+  __attribute__((no_instrument_function)) void Exit(
+      std::initializer_list<Arg> args) {
+    assert(entered_flag_);
+    if (string_id_.IsValid()) {
+      ExtendEventAsyncExit(string_id_, args.begin(), args.size());
+      return;
+    }
+    ExtendEventAsyncExit(text_, args.begin(), args.size());
+  }
 
  private:
   bool entered_flag_ = false;
   std::string text_;
+  StringId string_id_;
 };
 
 class InstantLogger {
@@ -107,11 +456,55 @@ class InstantLogger {
   InstantLogger(const std::string& text) {
     Call(text);
   }
+  __attribute__((no_instrument_function))
+  InstantLogger(const StringId& string_id) {
+    Call(string_id);
+  }
+  __attribute__((no_instrument_function))
+  InstantLogger(const std::string& text, std::initializer_list<Arg> args) {
+    Call(text, args);
+  }
+  __attribute__((no_instrument_function))
+  InstantLogger(const StringId& string_id, std::initializer_list<Arg> args) {
+    Call(string_id, args);
+  }
 
   __attribute__((no_instrument_function)) void Call(const std::string& text) {
     ExtendEventInstant(text);
   }
+  __attribute__((no_instrument_function)) void Call(
+      const StringId& string_id) {
+    ExtendEventInstant(string_id);
+  }
+  __attribute__((no_instrument_function)) void Call(
+      const std::string& text, std::initializer_list<Arg> args) {
+    ExtendEventInstant(text, args.begin(), args.size());
+  }
+  __attribute__((no_instrument_function)) void Call(
+      const StringId& string_id, std::initializer_list<Arg> args) {
+    ExtendEventInstant(string_id, args.begin(), args.size());
+  }
 };
 }  // namespace iftracer
 
+#define IFTRACER_CONCAT_INTERNAL(a, b) a##b
+#define IFTRACER_CONCAT(a, b) IFTRACER_CONCAT_INTERNAL(a, b)
+// scope logger of a text literal which is interned at the first call
+//   IFTRACER_SCOPE("eating");
+#define IFTRACER_SCOPE(text)                                                \
+  static const iftracer::StringId IFTRACER_CONCAT(iftracer_string_id_,     \
+                                                  __LINE__)(text);          \
+  iftracer::ScopeLogger IFTRACER_CONCAT(iftracer_scope_logger_, __LINE__)( \
+      IFTRACER_CONCAT(iftracer_string_id_, __LINE__))
+
+// counter of a text literal which is interned at the first call
+//   IFTRACER_COUNTER("queue depth", queue.size());
+#define IFTRACER_COUNTER(text, value)                                     \
+  do {                                                                    \
+    static const iftracer::StringId IFTRACER_CONCAT(iftracer_string_id_, \
+                                                    __LINE__)(text);      \
+    iftracer::Counter(IFTRACER_CONCAT(iftracer_string_id_, __LINE__),     \
+                      (value));                                           \
+  } while (0)
+
 #endif  // IFTRACER_HPP_INCLUDED
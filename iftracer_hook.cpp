@@ -13,25 +13,47 @@ __attribute__((init_priority(101)))
 FastLoggerCaller fast_logger_caller(tls_init_trigger);
 }  // namespace
 
+#include <dlfcn.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <sched.h>
 #include <sys/mman.h>
 #include <sys/syscall.h>
+#if __linux__ && __has_include(<sys/rseq.h>) && \
+    (defined(__x86_64__) || defined(__aarch64__))
+#include <sys/rseq.h>
+#define IFTRACER_HAS_RSEQ 1
+#endif
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
 #include <chrono>
 #include <csignal>
 #include <cstring>
-#include <functional>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
-#include "mmap_writer.hpp"
-#include "queue_worker.hpp"
-
-#ifdef IFTRACER_LOCK_FREE_QUEUE
-#include "lock-free-queue-worker.hpp"
+// this file defines the API
+#ifndef IFTRACER_ENABLE_API
+#define IFTRACER_ENABLE_API
 #endif
+#include "buffered_writer.hpp"
+#include "chunk_container.hpp"
+#include "iftracer.hpp"
+#include "mmap_writer.hpp"
+#include "module_snapshot.hpp"
+#include "munmap_service.hpp"
+#include "telemetry.hpp"
+#include "trace_clock.hpp"
+#include "trace_format.hpp"
 
 extern "C" {
 void __cyg_profile_func_enter(void* func_address, void* call_site);
@@ -64,11 +86,13 @@ pid_t __attribute__((no_instrument_function)) gettid() {
 #error "Non supported os"
 #endif
 
+#ifdef IFTRACE_TEXT_FORMAT
 uint64_t get_current_micro_timestamp() {
   return std::chrono::duration_cast<std::chrono::microseconds>(
              std::chrono::system_clock::now().time_since_epoch())
       .count();
 }
+#endif
 }  // namespace
 
 namespace {
@@ -149,13 +173,300 @@ bool get_async_munmap_flag() {
   }();
   return async_munmap_flag;
 }
-}  // namespace
 
-namespace {
-using ExtraInfo  = uint32_t;
-using ExtendType = uint32_t;
+// IFTRACER_ENCODING=fixed|varint
+uint16_t get_file_version() {
+  static uint16_t file_version = []() {
+    char* env = getenv("IFTRACER_ENCODING");
+    if (env != nullptr && std::string(env) == "varint") {
+      return iftracer::format::file_version_varint;
+    }
+    if (env != nullptr && std::string(env) != "fixed") {
+      std::cerr << "[iftracer] unknown IFTRACER_ENCODING=" << env
+                << ", use fixed" << std::endl;
+    }
+    return iftracer::format::file_version_fixed;
+  }();
+  return file_version;
+}
+
+// IFTRACER_RING_BUFFER=<4KB unit> (0: disabled)
+size_t get_ring_buffer_size() {
+  static size_t ring_buffer_size = []() {
+    size_t ring_buffer_size = 0;
+    char* env               = getenv("IFTRACER_RING_BUFFER");
+    if (env != nullptr) {
+      ring_buffer_size = 4096 * std::stoull(std::string(env));
+    }
+    if (ring_buffer_size != 0 && ring_buffer_size < 4096 * 16) {
+      ring_buffer_size = 4096 * 16;
+    }
+    return ring_buffer_size;
+  }();
+  return ring_buffer_size;
+}
+
+// IFTRACER_CONTAINER=<chunk size in 4KB unit> (0: disabled)
+size_t get_container_chunk_size() {
+  static size_t chunk_size = []() {
+    size_t chunk_size = 0;
+    char* env         = getenv("IFTRACER_CONTAINER");
+    if (env != nullptr) {
+      chunk_size = 4096 * std::stoull(std::string(env));
+    }
+    if (chunk_size != 0 && chunk_size < 4096 * 16) {
+      chunk_size = 4096 * 16;
+    }
+    return chunk_size;
+  }();
+  return chunk_size;
+}
+
+// IFTRACER_WRITER=mmap|buffered
+bool get_buffered_writer_flag() {
+  static bool buffered_writer_flag = []() {
+    char* env = getenv("IFTRACER_WRITER");
+    if (env != nullptr && std::string(env) == "buffered") {
+      return true;
+    }
+    if (env != nullptr && std::string(env) != "mmap") {
+      std::cerr << "[iftracer] unknown IFTRACER_WRITER=" << env
+                << ", use mmap" << std::endl;
+    }
+    return false;
+  }();
+  return buffered_writer_flag;
+}
+
+// IFTRACER_DIRECT_IO=1: O_DIRECT (buffered writer)
+bool get_direct_io_flag() {
+  static bool direct_io_flag = []() {
+    char* env = getenv("IFTRACER_DIRECT_IO");
+    return env != nullptr && std::stoi(env) != 0;
+  }();
+  return direct_io_flag;
+}
+
+// IFTRACER_HUGEPAGE=1: hugepage buffers (buffered writer)
+bool get_hugepage_flag() {
+  static bool hugepage_flag = []() {
+    char* env = getenv("IFTRACER_HUGEPAGE");
+    return env != nullptr && std::stoi(env) != 0;
+  }();
+  return hugepage_flag;
+}
+
+// IFTRACER_IO_URING=0: pwritev() instead of io_uring (buffered writer)
+bool get_io_uring_flag() {
+  static bool io_uring_flag = []() {
+    char* env = getenv("IFTRACER_IO_URING");
+    return env == nullptr || std::stoi(env) != 0;
+  }();
+  return io_uring_flag;
+}
+
+// IFTRACER_MAP_AHEAD=0: extend the mapping in the hook (mmap writer)
+bool get_map_ahead_flag() {
+  static bool map_ahead_flag = []() {
+    char* env = getenv("IFTRACER_MAP_AHEAD");
+    return env == nullptr || std::stoi(env) != 0;
+  }();
+  return map_ahead_flag;
+}
+
+// IFTRACER_COMPRESS=1: compressed frames (buffered writer)
+bool get_compress_flag() {
+  static bool compress_flag = []() {
+    char* env = getenv("IFTRACER_COMPRESS");
+    return env != nullptr && std::stoi(env) != 0;
+  }();
+  return compress_flag;
+}
+
+// IFTRACER_MIN_DURATION=<ns>
+uint64_t get_min_duration_ns() {
+  static uint64_t min_duration_ns = []() -> uint64_t {
+    char* env = getenv("IFTRACER_MIN_DURATION");
+    if (env != nullptr) {
+      return std::stoull(env);
+    }
+    return 0;
+  }();
+  return min_duration_ns;
+}
+
+// IFTRACER_KEYFRAME=<4KB unit>: keyframe every N bytes (0: disabled)
+size_t get_keyframe_interval() {
+  static size_t keyframe_interval = []() -> size_t {
+    char* env = getenv("IFTRACER_KEYFRAME");
+    if (env != nullptr) {
+      return 4096 * std::stoull(env);
+    }
+    return 4096 * 256;
+  }();
+  return keyframe_interval;
+}
+// IFTRACER_KEYFRAME_MS=<ms>: keyframe every N ms (0: disabled)
+uint64_t get_keyframe_period_ms() {
+  static uint64_t keyframe_period_ms = []() -> uint64_t {
+    char* env = getenv("IFTRACER_KEYFRAME_MS");
+    if (env != nullptr) {
+      return std::stoull(env);
+    }
+    return 1000;
+  }();
+  return keyframe_period_ms;
+}
+bool get_keyframe_flag() {
+  return get_keyframe_interval() != 0 || get_keyframe_period_ms() != 0;
+}
+// IFTRACER_KEYFRAME_STACK=0: keyframes without the call stack
+bool get_keyframe_stack_flag() {
+  static bool keyframe_stack_flag = []() {
+    char* env = getenv("IFTRACER_KEYFRAME_STACK");
+    return env == nullptr || std::stoi(env) != 0;
+  }();
+  return keyframe_stack_flag;
+}
+
+// IFTRACER_KEYFRAME: remove "<trace file>.index" of a previous run
+// the index of a container is created with the header here and threads
+// append their entries
+void reset_index_file(const std::string& trace_filename, bool container) {
+  std::string filename = trace_filename + ".index";
+  if (!container || !get_keyframe_flag()) {
+    unlink(filename.c_str());
+    return;
+  }
+  int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0666);
+  if (fd < 0) {
+    std::cerr << "[iftracer] open():" << std::strerror(errno) << ":"
+              << filename << std::endl;
+    return;
+  }
+  iftracer::format::IndexHeader header;
+  header.entry_size = sizeof(iftracer::format::IndexEntry);
+  if (write(fd, &header, sizeof(header)) !=
+      static_cast<ssize_t>(sizeof(header))) {
+    std::cerr << "[iftracer] write():" << std::strerror(errno) << ":"
+              << filename << std::endl;
+  }
+  close(fd);
+}
+
+#ifndef IFTRACER_DISABLE_CPU_ID
+// IFTRACER_CPU_ID_PERIOD=<N>: check cpu id every N events
+uint32_t get_cpu_id_period() {
+  static uint32_t cpu_id_period = []() -> uint32_t {
+    char* env = getenv("IFTRACER_CPU_ID_PERIOD");
+    if (env != nullptr && std::stoul(env) > 1) {
+      return std::stoul(env);
+    }
+    return 1;
+  }();
+  return cpu_id_period;
+}
+#endif
+
+// process-wide interned strings of iftracer::StringId
+class StringTable {
+ public:
+  uint32_t Intern(const char* text) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = ids_.find(text);
+    if (it != ids_.end()) {
+      return it->second;
+    }
+    texts_.push_back(text);
+    // 0 is invalid id
+    uint32_t id = texts_.size();
+    ids_.emplace(texts_.back(), id);
+    return id;
+  }
+  bool Get(uint32_t id, std::string* text) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (id == 0 || id > texts_.size()) {
+      return false;
+    }
+    *text = texts_[id - 1];
+    return true;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::unordered_map<std::string, uint32_t> ids_;
+  std::vector<std::string> texts_;
+};
+// NOTE: never destroyed because loggers use it until process exit
+StringTable& get_string_table() {
+  static StringTable* string_table = new StringTable();
+  return *string_table;
+}
+
+bool get_module_map_flag() {
+  static bool module_map_flag = []() {
+    char* env = getenv("IFTRACER_MODULE_MAP");
+    if (env != nullptr) {
+      return std::stoi(env) != 0;
+    }
+    return true;
+  }();
+  return module_map_flag;
+}
+
+bool get_stats_flag() {
+  static bool stats_flag = []() {
+    char* env = getenv("IFTRACER_STATS");
+    if (env != nullptr) {
+      return std::stoi(env) != 0;
+    }
+    return false;
+  }();
+  return stats_flag;
+}
+
+// IFTRACER_CALIBRATE: measure the cost of hooks at startup
+bool get_calibrate_flag() {
+  static bool calibrate_flag = []() {
+    char* env = getenv("IFTRACER_CALIBRATE");
+    if (env != nullptr) {
+      return std::stoi(env) != 0;
+    }
+    return true;
+  }();
+  return calibrate_flag;
+}
+// IFTRACER_START_DISABLED=1: record nothing until iftracer::Enable()
+bool get_start_disabled_flag() {
+  static bool start_disabled_flag = []() {
+    char* env = getenv("IFTRACER_START_DISABLED");
+    return env != nullptr && std::stoi(env) != 0;
+  }();
+  return start_disabled_flag;
+}
+// IFTRACER_TOGGLE_SIGNAL=1: SIGUSR1 switches Enable()/Disable()
+// (enabled by default with IFTRACER_START_DISABLED)
+bool get_toggle_signal_flag() {
+  static bool toggle_signal_flag = []() {
+    char* env = getenv("IFTRACER_TOGGLE_SIGNAL");
+    if (env != nullptr) {
+      return std::stoi(env) != 0;
+    }
+    return get_start_disabled_flag();
+  }();
+  return toggle_signal_flag;
+}
+
+// format::FileHeader::hook_overhead_ps of all files (get_hook_overhead_ps())
+std::atomic<uint32_t> hook_overhead_ps(0);
+std::once_flag calibration_once;
+// function address of the hooks called by the calibration
+void calibration_target() {}
 }  // namespace
 
+using namespace iftracer::format;
+
 class Logger {
  public:
   explicit Logger(int64_t offset);
@@ -165,23 +476,194 @@ class Logger {
   void Exit(void* func_address, void* call_site);
   void Finalize();
 
-  static const int64_t TRUNCATE = 0;
-  static const int64_t LAST     = -1;
+  static const int64_t TRUNCATE    = 0;
+  static const int64_t LAST        = -1;
+  // scratch ring buffer without file and self-telemetry
+  static const int64_t CALIBRATION = -2;
 
+  // cost of one hook in picoseconds (0: failed)
+  // Enter()/Exit() of a CALIBRATION logger without IFTRACER_MIN_DURATION
+  static uint32_t CalibrateHookOverhead();
+
+  // args: at most format::max_args
   void ExtendEventDurationEnter();
-  void ExtendEventDurationExit(const std::string& text);
-  void ExtendEventAsyncEnter(const std::string& text);
-  void ExtendEventAsyncExit(const std::string& text);
-  void ExtendEventInstant(const std::string& text);
+  void ExtendEventDurationExit(const std::string& text,
+                               const iftracer::Arg* args = nullptr,
+                               uint32_t arg_count        = 0);
+  void ExtendEventAsyncEnter(const std::string& text,
+                             const iftracer::Arg* args = nullptr,
+                             uint32_t arg_count        = 0);
+  void ExtendEventAsyncExit(const std::string& text,
+                            const iftracer::Arg* args = nullptr,
+                            uint32_t arg_count        = 0);
+  void ExtendEventInstant(const std::string& text,
+                          const iftracer::Arg* args = nullptr,
+                          uint32_t arg_count        = 0);
+  // format::no_cpu_id ends cpu tracking
+  void ExtendEventCpuMigration(uint32_t cpu_id);
+  // value_type: format::arg_int64 or arg_double (raw bits of value)
+  void ExtendEventCounter(uint32_t string_id, uint32_t value_type,
+                          uint64_t value);
+  // phase: format::id_flow_* or id_async_*
+  void ExtendEventId(uint32_t string_id, uint32_t phase, uint64_t id);
+  // interned text (iftracer::InternString())
+  void ExtendEventDurationExit(uint32_t string_id,
+                               const iftracer::Arg* args = nullptr,
+                               uint32_t arg_count        = 0);
+  void ExtendEventAsyncEnter(uint32_t string_id,
+                             const iftracer::Arg* args = nullptr,
+                             uint32_t arg_count        = 0);
+  void ExtendEventAsyncExit(uint32_t string_id,
+                            const iftracer::Arg* args = nullptr,
+                            uint32_t arg_count        = 0);
+  void ExtendEventInstant(uint32_t string_id,
+                          const iftracer::Arg* args = nullptr,
+                          uint32_t arg_count        = 0);
+
+  // write the ring buffer to the trace file (IFTRACER_RING_BUFFER)
+  // self: called by the owner thread
+  bool DumpRing(bool self);
+
+  void CountCpuIdLookup() { stats_.Add(iftracer::telemetry::cpu_id_lookups); }
+
+  // generation: current even trace_generation (called before each hook)
+  void CheckGeneration(uint32_t generation) {
+    if (__builtin_expect(generation != generation_, 0)) {
+      Resume(generation);
+    }
+  }
 
  private:
+  // extend the buffer and record the latency
+  bool PrepareWrite(size_t size);
+  bool ExtendBuffer(size_t size);
+  // add bytes written since the last call to stats_
+  void CountWrittenBytes();
+  void WriteCheckpoint();
+  // IFTRACER_CONTAINER: map the current chunk of this thread again (LAST) or
+  // the next chunk of the stream
+  bool OpenChunk(bool next);
+  // record data_size of the chunk and unmap it
+  bool CloseChunk();
   bool ExtendEventWriteHeader(ExtraInfo event, ExtendType extend_type,
                               size_t reservation_buffer_size);
+  void ExtendEventWriteText(ExtraInfo event, ExtendType extend_type,
+                            const std::string& text,
+                            const iftracer::Arg* args, uint32_t arg_count);
+  void ExtendEventWriteStringId(ExtraInfo event, ExtendType extend_type,
+                                uint32_t string_id,
+                                const iftracer::Arg* args,
+                                uint32_t arg_count);
+  bool IsStringDefined(uint32_t string_id) const;
+  bool WriteStringDefine(uint32_t string_id, size_t next_record_size);
+  bool DefineStrings(const uint32_t* string_ids, size_t count,
+                     size_t record_size);
+  void WriteArgs(const iftracer::Arg* args, uint32_t arg_count);
+  // encoding of 8B values in the varint encoding
+  enum class VarintValue { kUnsigned, kZigzag, kRaw };
+  void ExtendEventWriteValue(ExtendType extend_type, uint32_t string_id,
+                             uint64_t value, VarintValue varint_value);
   void InternalProcessEnter();
   void InternalProcessExit();
+  uint32_t TimestampDiffWithOffset(uint64_t timestamp);
+  void WriteTimestampSync(uint64_t timestamp);
+  size_t WriteVarintEnter(uint64_t timestamp, uintptr_t address);
+  void WriteVarintExit(uint64_t timestamp);
+  void PushEnterRecord(size_t begin_offset, uint64_t base_timestamp,
+                       uint64_t timestamp);
+  bool ElideExit(uint64_t timestamp);
+  bool NeedKeyframe(uint64_t timestamp) {
+    return timestamp >= next_keyframe_timestamp_ ||
+           writer_->FileOffset() >= next_keyframe_offset_;
+  }
+  // write a keyframe and reserve next_record_size bytes after it
+  bool WriteKeyframe(uint64_t timestamp, size_t next_record_size);
+  void PushFrame(uintptr_t address) {
+    if (depth_ < max_keyframe_stack && keyframe_stack_) {
+      keyframe_stack_[depth_] = address;
+    }
+    depth_++;
+    hook_events_++;
+  }
+  void PopFrame() {
+    if (depth_ > 0) {
+      depth_--;
+    }
+    hook_events_++;
+  }
+  // write the keyframes of this thread to the index file
+  void WriteIndex();
+  // tracing was disabled since the last hook of this thread
+  void Resume(uint32_t generation);
+  // write the exits of the running functions at timestamp (or later)
+  // their exits may have been skipped while disabled
+  void CloseFrames(uint64_t timestamp);
 
-  MmapWriter mw_;
+  MmapWriter mmap_writer_;
+  // IFTRACER_WRITER=buffered (created at the first use)
+  std::unique_ptr<BufferedWriter> buffered_writer_;
+  // hot path writes through the backend of the current file
+  TraceWriter* writer_ = &mmap_writer_;
   size_t flush_buffer_size_;
+  // file_version_varint
+  bool varint_ = false;
+  // function address of each function_id (direct-mapped)
+  std::unique_ptr<uintptr_t[]> function_id_cache_;
+
+  // IFTRACER_MIN_DURATION: enter records which can be rewound at exit
+  struct EnterRecord {
+    size_t begin_offset;
+    size_t end_offset;
+    // timestamp of decoder at begin_offset
+    uint64_t base_timestamp;
+    uint64_t timestamp;
+    uint32_t elided_calls;
+  };
+  static const size_t max_enter_depth = 256;
+  uint64_t min_duration_ticks_ = 0;
+  std::unique_ptr<EnterRecord[]> enter_records_;
+  size_t enter_depth_ = 0;
+  // timestamp of extend records instead of Now() (0: Now())
+  uint64_t extend_timestamp_ = 0;
+
+  // IFTRACER_KEYFRAME (disabled by default for the last loggers)
+  size_t keyframe_interval_         = 0;
+  uint64_t keyframe_period_ticks_   = 0;
+  size_t next_keyframe_offset_      = SIZE_MAX;
+  uint64_t next_keyframe_timestamp_ = UINT64_MAX;
+  // enter and exit records in the file and functions which are entered and
+  // not exited (outermost max_keyframe_stack, IFTRACER_KEYFRAME_STACK)
+  uint64_t hook_events_ = 0;
+  uint32_t depth_       = 0;
+  std::unique_ptr<uintptr_t[]> keyframe_stack_;
+  std::vector<IndexEntry> index_entries_;
+
+  // trace_generation which this logger has recorded
+  uint32_t generation_ = 0;
+  // frames before Disable() are closed: exits without enter are skipped
+  bool resumed_ = false;
+
+  // bitmap of string ids which are defined in this file
+  std::vector<uint64_t> defined_string_ids_;
+  // incremented by WriteCheckpoint() which resets defined_string_ids_
+  uint64_t checkpoint_count_ = 0;
+
+  // IFTRACER_RING_BUFFER: the header is written at dump
+  bool ring_ = false;
+  FileHeader header_;
+  // file offsets of timestamp_sync records where decoding can start
+  std::deque<size_t> checkpoints_;
+  std::mutex ring_mutex_;
+
+  // IFTRACER_CONTAINER: chunks instead of the own file (nullptr: disabled)
+  iftracer::ChunkContainer* container_ = nullptr;
+
+  // self-telemetry (registered while the thread_local logger is alive)
+  iftracer::telemetry::ThreadStats stats_;
+  // file offset at the last CountWrittenBytes()
+  size_t written_offset_ = 0;
+  // CALIBRATION logger with the scratch ring buffer
+  bool scratch_ = false;
 };
 
 namespace {
@@ -200,57 +682,196 @@ bool is_main_thread() {
 }
 
 uint64_t get_base_timestamp() {
-  static uint64_t base_timestamp = get_current_micro_timestamp();
+  static uint64_t base_timestamp = iftracer::trace_clock::Now();
   return base_timestamp;
 };
-thread_local uint64_t pre_timestamp = get_base_timestamp();
+// get_base_timestamp() at the construction of the thread_local logger
+// NOTE: constant initialization, so that CalibrateHookOverhead() does not
+// construct the thread_local logger by the access
+thread_local uint64_t pre_timestamp = 0;
 
-uint32_t get_current_micro_timestamp_diff_with_offset() {
-  uint64_t timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
-                           std::chrono::system_clock::now().time_since_epoch())
-                           .count();
-  constexpr uint64_t timestamp_diff_offset = 1;
-  uint64_t timestamp_diff = timestamp - pre_timestamp + timestamp_diff_offset;
-  pre_timestamp           = timestamp;
-  return static_cast<uint32_t>(timestamp_diff);
+// measured once by the first caller (0: IFTRACER_CALIBRATE=0 or failed)
+uint32_t get_hook_overhead_ps() {
+  std::call_once(calibration_once, []() {
+    if (get_calibrate_flag()) {
+      hook_overhead_ps.store(Logger::CalibrateHookOverhead(),
+                             std::memory_order_release);
+    }
+  });
+  return hook_overhead_ps.load(std::memory_order_acquire);
 }
 
-#ifndef IFTRACER_LOCK_FREE_QUEUE
-std::function<int(void*, size_t)> get_async_munmap_func() {
-  const int parallel_number = 1;
-  static iftracer::QueueWorker<std::tuple<void*, size_t>> munmaper(
-      parallel_number, [](std::tuple<void*, size_t> arg) {
-        void*& addr    = std::get<0>(arg);
-        size_t& length = std::get<1>(arg);
-        if (munmap(addr, length) != 0) {
-          // no error handling
-          return;
-        }
-      });
-  return [](void* addr, size_t length) {
-    std::tuple<void*, size_t> arg = std::make_tuple(addr, length);
-    munmaper.Post(arg);
-    return 0;
-  };
+// IFTRACER_CONTAINER: "<prefix><pid>.chunks" shared by all threads
+// NOTE: never destroyed because loggers use it until process exit
+iftracer::ChunkContainer* get_chunk_container() {
+  static iftracer::ChunkContainer* container = []() {
+    std::string filename = get_output_directory() + "/" +
+                           get_output_file_prefix() +
+                           std::to_string(get_cached_pid()) + ".chunks";
+    ContainerHeader header;
+    header.version          = get_file_version();
+    header.pid              = get_cached_pid();
+    header.chunk_size       = get_container_chunk_size();
+    header.base_timestamp   = get_base_timestamp();
+    header.ticks_per_second = iftracer::trace_clock::TicksPerSecond();
+    header.clock_source     = iftracer::trace_clock::Source();
+    header.hook_overhead_ps = get_hook_overhead_ps();
+    auto* container         = new iftracer::ChunkContainer();
+    if (!container->Open(filename, header)) {
+      std::cerr << container->GetErrorMessage() << filename << std::endl;
+      std::cerr << "[iftracer] failed to open container, write to files"
+                << std::endl;
+      delete container;
+      return static_cast<iftracer::ChunkContainer*>(nullptr);
+    }
+    reset_index_file(filename, true);
+    return container;
+  }();
+  return container;
 }
-#else
-std::function<int(void*, size_t)> get_async_munmap_func() {
-  const int buffer_number = 128;
-  static iftracer::LockFreeQueueWorker<std::tuple<void*, size_t>> munmaper(
-      buffer_number, [](std::tuple<void*, size_t> arg) {
-        void*& addr    = std::get<0>(arg);
-        size_t& length = std::get<1>(arg);
-        if (munmap(addr, length) != 0) {
-          // no error handling
-          return;
+// chunks of this thread (also used by LAST loggers after the destructor)
+thread_local uint32_t chunk_stream_id = 0;
+thread_local uint32_t chunk_sequence  = 0;
+// file offset of the current chunk (0: none)
+thread_local size_t chunk_offset = 0;
+
+// iftracer::ModuleGeneration() at the last snapshot
+std::atomic<uint64_t> module_generation(0);
+
+// "<prefix><pid>.maps" is used by offline tools to resolve addresses of
+// shared libraries and PIE (see module_snapshot.hpp)
+void write_module_snapshot() {
+  if (!get_module_map_flag()) {
+    return;
+  }
+  static std::mutex mutex;
+  static bool first_snapshot = true;
+  std::lock_guard<std::mutex> lock(mutex);
+  uint64_t generation = iftracer::ModuleGeneration();
+  if (!first_snapshot &&
+      generation == module_generation.load(std::memory_order_relaxed)) {
+    // written by another thread
+    return;
+  }
+  module_generation.store(generation, std::memory_order_relaxed);
+  std::string filename = get_output_directory() + "/" +
+                         get_output_file_prefix() +
+                         std::to_string(get_cached_pid()) + ".maps";
+  std::string error_message;
+  if (!iftracer::WriteModuleSnapshot(filename, iftracer::trace_clock::Now(),
+                                     first_snapshot, &error_message)) {
+    std::cerr << error_message << std::endl;
+  }
+  first_snapshot = false;
+}
+// dlopen() is detected at buffer extension, keyframes, dlclose() and thread
+// exit instead of wrapping it, because dlopen() resolves RUNPATH, $ORIGIN
+// and the namespace from its caller
+// the snapshot is later than dlopen(): the tools resolve addresses which
+// are not in a snapshot by the next ones
+void check_module_snapshot() {
+  if (get_module_map_flag() &&
+      iftracer::ModuleGeneration() !=
+          module_generation.load(std::memory_order_relaxed)) {
+    write_module_snapshot();
+  }
+}
+
+// IFTRACER_ASYNC_MUNMAP: flushed pages are unmapped by the worker thread
+// NOTE: never destroyed because loggers use it until process exit
+iftracer::MunmapService& get_munmap_service() {
+  static iftracer::MunmapService* munmap_service =
+      new iftracer::MunmapService();
+  return *munmap_service;
+}
+int async_munmap(void* addr, size_t length) {
+  return get_munmap_service().Post(addr, length);
+}
+
+// IFTRACER_STATS: telemetry of all threads at the exit of the main thread
+// NOTE: other threads may be still running
+void write_stats_file() {
+  if (!get_stats_flag()) {
+    return;
+  }
+  iftracer::telemetry::Snapshot snapshot;
+  iftracer::telemetry::Collect(&snapshot);
+  std::string filename = get_output_directory() + "/" +
+                         get_output_file_prefix() +
+                         std::to_string(get_cached_pid()) + ".stats";
+  std::string error_message;
+  if (!iftracer::telemetry::WriteSnapshot(filename, snapshot,
+                                          &error_message)) {
+    std::cerr << error_message << std::endl;
+  }
+}
+
+// IFTRACER_RING_BUFFER: loggers whose ring buffer is dumped on demand
+// NOTE: never destroyed because the dump thread may run until process exit
+std::mutex& ring_logger_mutex() {
+  static std::mutex* mutex = new std::mutex();
+  return *mutex;
+}
+std::vector<Logger*>& ring_loggers() {
+  static std::vector<Logger*>* loggers = new std::vector<Logger*>();
+  return *loggers;
+}
+void register_ring_logger(Logger* ring_logger) {
+  std::lock_guard<std::mutex> lock(ring_logger_mutex());
+  ring_loggers().push_back(ring_logger);
+}
+void unregister_ring_logger(Logger* ring_logger) {
+  std::lock_guard<std::mutex> lock(ring_logger_mutex());
+  auto& loggers = ring_loggers();
+  loggers.erase(std::remove(loggers.begin(), loggers.end(), ring_logger),
+                loggers.end());
+}
+// self: logger of the caller thread (may be nullptr)
+void dump_ring_buffers(Logger* self) {
+  std::lock_guard<std::mutex> lock(ring_logger_mutex());
+  for (Logger* ring_logger : ring_loggers()) {
+    ring_logger->DumpRing(ring_logger == self);
+  }
+}
+
+#if __linux__
+// SIGUSR2 handler only wakes up the dump thread (async-signal-safe)
+int ring_dump_pipe[2] = {-1, -1};
+void ring_dump_signal_handler(int sig) {
+  char c      = 0;
+  ssize_t ret = write(ring_dump_pipe[1], &c, sizeof(c));
+  (void)ret;
+}
+void start_ring_dump_service() {
+  static std::once_flag once;
+  std::call_once(once, []() {
+    if (pipe2(ring_dump_pipe, O_CLOEXEC) != 0) {
+      std::cerr << "[iftracer] pipe2(): " << std::strerror(errno) << std::endl;
+      return;
+    }
+    std::thread([]() {
+      char c = 0;
+      while (true) {
+        ssize_t ret = read(ring_dump_pipe[0], &c, sizeof(c));
+        if (ret < 0 && errno == EINTR) {
+          continue;
         }
-      });
-  return [](void* addr, size_t length) {
-    std::tuple<void*, size_t> arg = std::make_tuple(addr, length);
-    munmaper.Post(arg);
-    return 0;
-  };
+        if (ret <= 0) {
+          break;
+        }
+        dump_ring_buffers(nullptr);
+      }
+    }).detach();
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = ring_dump_signal_handler;
+    sa.sa_flags   = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, nullptr);
+  });
 }
+#else
+void start_ring_dump_service() {}
 #endif
 
 // WARN: destructors which are called after this logger destructor cannot access this logger variable
@@ -268,96 +889,702 @@ struct ForceLoggerDestructor {
 #endif
 
 thread_local int pre_cpu_id = -1;
+// events until the next cpu id check (IFTRACER_CPU_ID_PERIOD)
+thread_local uint32_t cpu_id_countdown = 0;
 
 void start_cpu_id_event();
 void end_cpu_id_event();
 void check_cpu_id_event();
+
+// even: tracing is enabled, odd: disabled (iftracer::Enable()/Disable())
+// the hooks check it before any thread_local variable
+std::atomic<uint32_t> trace_generation(0);
+// trace_clock::Now() at the last Disable()
+std::atomic<uint64_t> disabled_timestamp(0);
+
+void toggle_signal_handler(int sig) {
+  if (iftracer::IsEnabled()) {
+    iftracer::Disable();
+  } else {
+    iftracer::Enable();
+  }
+}
+// before the hooks of other static initializers
+struct TraceSwitch {
+  TraceSwitch() {
+    // select the clock source outside of the signal handler
+    disabled_timestamp.store(iftracer::trace_clock::Now());
+    // before the loggers of all threads whether tracing is enabled or not
+    get_hook_overhead_ps();
+    if (get_start_disabled_flag()) {
+      trace_generation.store(1);
+    }
+    if (get_toggle_signal_flag()) {
+      struct sigaction sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = toggle_signal_handler;
+      sa.sa_flags   = SA_RESTART;
+      sigemptyset(&sa.sa_mask);
+      sigaction(SIGUSR1, &sa, nullptr);
+    }
+  }
+};
+#if __linux__
+__attribute__((init_priority(101)))
+#endif
+TraceSwitch trace_switch;
 }  // namespace
 
 Logger::Logger(int64_t offset) {
+  if (offset == Logger::TRUNCATE) {
+    iftracer::telemetry::Register(&stats_);
+  }
   Initialize(offset);
   if (offset == Logger::TRUNCATE) {
-    if (!is_main_thread()) {
+    // the thread may have entered functions while disabled
+    generation_ = trace_generation.load(std::memory_order_acquire);
+    resumed_    = generation_ != 0;
+    if (is_main_thread()) {
+      write_module_snapshot();
+    } else {
       ExtendEventAsyncEnter("[thread lifetime]");
     }
     start_cpu_id_event();
   }
 }
 Logger::~Logger() {
+  if (scratch_) {
+    return;
+  }
+  bool main_logger = false;
   if (tls_init_trigger != 0) {
+    if (generation_ != trace_generation.load(std::memory_order_acquire)) {
+      CloseFrames(disabled_timestamp.load(std::memory_order_relaxed));
+    }
     end_cpu_id_event();
+    check_module_snapshot();
     if (!is_main_thread()) {
       ExtendEventAsyncExit("[thread lifetime]");
     }
     Finalize();
+    main_logger = is_main_thread();
 
     // below value is used to know loggre lifetime
     // the reason why use int is that basic type has no destructor
     tls_init_trigger = 0;
   }
+  // the last loggers are merged too
+  iftracer::telemetry::Unregister(&stats_);
+  if (main_logger) {
+    write_stats_file();
+  }
 };
 
 void Logger::Initialize(int64_t offset) {
+  varint_ = get_file_version() == file_version_varint;
+  if (varint_ && !function_id_cache_) {
+    function_id_cache_.reset(new uintptr_t[function_id_cache_size]());
+  }
+  if (offset == Logger::TRUNCATE) {
+    pre_timestamp = get_base_timestamp();
+  }
+  if (offset == Logger::CALIBRATION) {
+    // a round of CalibrateHookOverhead() fits in a segment (size / 16)
+    scratch_ = mmap_writer_.OpenRing(4096 * 1024);
+    if (!scratch_) {
+      std::cerr << mmap_writer_.GetErrorMessage() << std::endl;
+    }
+    flush_buffer_size_ = SIZE_MAX;
+    return;
+  }
+  if (get_min_duration_ns() != 0) {
+    min_duration_ticks_ = static_cast<uint64_t>(
+        static_cast<unsigned __int128>(get_min_duration_ns()) *
+        iftracer::trace_clock::TicksPerSecond() / 1000000000);
+    if (min_duration_ticks_ == 0) {
+      min_duration_ticks_ = 1;
+    }
+    if (!enter_records_) {
+      enter_records_.reset(new EnterRecord[max_enter_depth]);
+    }
+  }
   std::string filename = get_output_directory() + "/" +
                          get_output_file_prefix() + std::to_string(tid);
-  mw_.SetExtendSize(get_extend_buffer_size());
+  mmap_writer_.SetExtendSize(get_extend_buffer_size());
   size_t buffer_size = 4096 * 4;  // used only for last extend
   if (offset >= 0) {
     buffer_size = get_init_buffer_size();
   }
-  bool ret = mw_.Open(filename, buffer_size, offset);
-  if (!ret) {
-    std::cerr << mw_.GetErrorMessage() << std::endl;
-    assert(false && "failed to open file at Logger::Initialize()");
+  if (offset == 0 && get_ring_buffer_size() != 0) {
+    ring_ = mmap_writer_.OpenRing(get_ring_buffer_size());
+    if (!ring_) {
+      std::cerr << writer_->GetErrorMessage() << std::endl;
+      std::cerr << "[iftracer] failed to open ring buffer, write to file"
+                << std::endl;
+    }
+  }
+  if (!ring_ && get_container_chunk_size() != 0 &&
+      (offset == 0 || chunk_offset != 0)) {
+    container_ = get_chunk_container();
+    if (container_ != nullptr && !OpenChunk(offset == 0)) {
+      std::cerr << writer_->GetErrorMessage() << std::endl;
+      assert(false && "failed to open chunk at Logger::Initialize()");
+    }
+  }
+  writer_ = &mmap_writer_;
+  // the last logger appends to the file with MmapWriter
+  // unless the file consists of compressed frames
+  if (!ring_ && container_ == nullptr &&
+      ((offset == 0 && get_buffered_writer_flag()) || get_compress_flag())) {
+    if (!buffered_writer_) {
+      BufferedWriter::SetIoUring(get_io_uring_flag());
+      buffered_writer_.reset(new BufferedWriter());
+      buffered_writer_->SetBufferSize(
+          offset == 0 ? get_flush_buffer_size() + get_extend_buffer_size()
+                      : buffer_size);
+      buffered_writer_->SetDirectIo(get_direct_io_flag());
+      buffered_writer_->SetHugepage(get_hugepage_flag() && offset == 0);
+      buffered_writer_->SetCompress(get_compress_flag());
+    }
+    if (buffered_writer_->Open(filename, buffer_size, offset)) {
+      writer_ = buffered_writer_.get();
+    } else {
+      std::cerr << buffered_writer_->GetErrorMessage() << std::endl;
+      std::cerr << "[iftracer] failed to open buffered writer, use mmap"
+                << std::endl;
+    }
+  }
+  if (!ring_ && container_ == nullptr && writer_ == &mmap_writer_) {
+    // the last logger is opened at each hook
+    mmap_writer_.SetMapAhead(get_map_ahead_flag() && offset >= 0);
+    bool ret = writer_->Open(filename, buffer_size, offset);
+    if (!ret) {
+      std::cerr << writer_->GetErrorMessage() << std::endl;
+      assert(false && "failed to open file at Logger::Initialize()");
+    }
   }
+  written_offset_    = writer_->FileOffset();
   flush_buffer_size_ = get_flush_buffer_size();
-  if (get_async_munmap_flag()) {
-    mw_.SetMunmapHook(get_async_munmap_func());
+  if (offset == Logger::TRUNCATE) {
+    if (container_ == nullptr) {
+      reset_index_file(filename, false);
+    }
+    // ring buffers have their own checkpoints
+    if (!ring_ && get_keyframe_flag()) {
+      keyframe_interval_ = get_keyframe_interval();
+      keyframe_period_ticks_ = static_cast<uint64_t>(
+          static_cast<unsigned __int128>(get_keyframe_period_ms()) *
+          iftracer::trace_clock::TicksPerSecond() / 1000);
+      if (get_keyframe_stack_flag() && !keyframe_stack_) {
+        keyframe_stack_.reset(new uintptr_t[max_keyframe_stack]);
+      }
+      next_keyframe_offset_ = keyframe_interval_ != 0
+                                  ? writer_->FileOffset() + keyframe_interval_
+                                  : SIZE_MAX;
+      next_keyframe_timestamp_ =
+          keyframe_period_ticks_ != 0
+              ? iftracer::trace_clock::Now() + keyframe_period_ticks_
+              : UINT64_MAX;
+    }
+  }
+  if (get_async_munmap_flag() && !ring_ && container_ == nullptr) {
+    // start the worker outside of the hook
+    get_munmap_service();
+    mmap_writer_.SetMunmapHook(async_munmap);
+  }
+  if (container_ != nullptr) {
+    // the header is in the container and chunks are unmapped at once
+    flush_buffer_size_ = SIZE_MAX;
+    return;
   }
   // write header
   if (offset == 0) {
-    uint64_t base_timestamp                    = get_base_timestamp();
-    *reinterpret_cast<uint64_t*>(mw_.Cursor()) = base_timestamp;
-    mw_.Seek(sizeof(uint64_t));
-    // pid_t is basically int
-    *reinterpret_cast<pid_t*>(mw_.Cursor()) = get_cached_pid();
-    mw_.Seek(sizeof(pid_t));
     // pid_t is basically int
-    *reinterpret_cast<pid_t*>(mw_.Cursor()) = tid;
-    mw_.Seek(sizeof(pid_t));
+    header_.pid              = get_cached_pid();
+    header_.tid              = tid;
+    header_.base_timestamp   = get_base_timestamp();
+    header_.ticks_per_second = iftracer::trace_clock::TicksPerSecond();
+    header_.clock_source     = iftracer::trace_clock::Source();
+    header_.hook_overhead_ps = get_hook_overhead_ps();
+    header_.version          = get_file_version();
+    if (ring_) {
+      // the beginning of the ring is decoded from the header
+      checkpoints_.push_back(0);
+      flush_buffer_size_ = SIZE_MAX;
+      register_ring_logger(this);
+      start_ring_dump_service();
+    } else {
+      memcpy(writer_->Cursor(), &header_, sizeof(header_));
+      writer_->Seek(sizeof(header_));
+    }
   }
 }
-void Logger::Finalize() {
-  bool ret = mw_.Close();
+
+uint32_t Logger::CalibrateHookOverhead() {
+#if __linux__ && !defined(IFTRACE_TEXT_FORMAT)
+  const int rounds          = 10;
+  const int calls_per_round = 1000;
+  // enter and exit records of a round with the margin of Enter()/Exit()
+  const size_t round_size = calls_per_round * 2 * 32 + 256;
+  Logger scratch(Logger::CALIBRATION);
+  if (!scratch.scratch_) {
+    return 0;
+  }
+  // thread_local state shared with the logger of this thread
+  // NOTE: no thread_local variable which needs dynamic initialization (e.g.
+  // logger) is accessed, so this can run before the logger of this thread
+  uint64_t timestamp = pre_timestamp;
+  uint32_t countdown = cpu_id_countdown;
+  // the countdown of the cpu id check never reaches the logger of this
+  // thread
+  cpu_id_countdown = UINT32_MAX;
+  void* address    = reinterpret_cast<void*>(&calibration_target);
+  // the fastest round is the least disturbed one
+  uint64_t min_ticks = UINT64_MAX;
+  for (int i = 0; i < rounds; i++) {
+    // no buffer extension and [internal] events in the round
+    if (!scratch.writer_->CheckCapacity(round_size) &&
+        !scratch.writer_->PrepareWrite(round_size)) {
+      std::cerr << scratch.writer_->GetErrorMessage() << std::endl;
+      min_ticks = 0;
+      break;
+    }
+    uint64_t begin = iftracer::trace_clock::Now();
+    for (int j = 0; j < calls_per_round; j++) {
+      scratch.Enter(address, nullptr);
+      scratch.Exit(address, nullptr);
+    }
+    min_ticks = std::min(min_ticks, iftracer::trace_clock::Now() - begin);
+  }
+  pre_timestamp    = timestamp;
+  cpu_id_countdown = countdown;
+  return static_cast<uint32_t>(std::min<unsigned __int128>(
+      static_cast<unsigned __int128>(min_ticks) * 1000000000000ULL /
+          iftracer::trace_clock::TicksPerSecond() / (calls_per_round * 2),
+      UINT32_MAX));
+#else
+  return 0;
+#endif
+}
+
+// NOTE: caller must call writer_->CheckCapacity(size) before
+bool Logger::PrepareWrite(size_t size) {
+  check_module_snapshot();
+  CountWrittenBytes();
+  uint64_t begin_ns = iftracer::telemetry::NowNs();
+  bool ret          = ExtendBuffer(size);
+  stats_.Record(iftracer::telemetry::prepare_write_latency,
+                iftracer::telemetry::NowNs() - begin_ns);
+  if (container_ != nullptr) {
+    // offsets of the next chunk
+    written_offset_ = writer_->FileOffset();
+  }
+  return ret;
+}
+
+bool Logger::ExtendBuffer(size_t size) {
+  if (container_ != nullptr) {
+    if (sizeof(ChunkHeader) + size > container_->ChunkSize()) {
+      writer_->AddErrorMessage("PrepareWrite(): too large data for chunk:");
+      return false;
+    }
+    return CloseChunk() && OpenChunk(true);
+  }
+  if (!ring_) {
+    return writer_->PrepareWrite(size);
+  }
+  if (!writer_->PrepareWrite(size + timestamp_sync_size)) {
+    return false;
+  }
+  WriteCheckpoint();
+  return true;
+}
+
+// NOTE: unsigned wrap-around also subtracts rewound bytes
+void Logger::CountWrittenBytes() {
+  size_t offset = writer_->FileOffset();
+  stats_.Add(iftracer::telemetry::bytes, offset - written_offset_);
+  written_offset_ = offset;
+}
+
+bool Logger::OpenChunk(bool next) {
+  if (next) {
+    if (!container_->Allocate(&chunk_offset)) {
+      writer_->AddErrorMessage(container_->GetErrorMessage());
+      return false;
+    }
+    if (chunk_stream_id == 0) {
+      chunk_stream_id = container_->NewStreamId();
+    }
+  }
+  if (!mmap_writer_.OpenChunk(container_->Fd(), chunk_offset,
+                     container_->ChunkSize())) {
+    return false;
+  }
+  ChunkHeader* header = reinterpret_cast<ChunkHeader*>(writer_->Cursor());
+  if (next) {
+    header->tid             = tid;
+    header->stream_id       = chunk_stream_id;
+    header->sequence        = chunk_sequence++;
+    header->first_timestamp = pre_timestamp;
+    header->data_size       = 0;
+    // readers ignore the chunk until magic is written
+    __atomic_store_n(&header->magic, chunk_magic, __ATOMIC_RELEASE);
+  }
+  writer_->Seek(sizeof(ChunkHeader) + header->data_size);
+  return true;
+}
+
+bool Logger::CloseChunk() {
+  ChunkHeader* header =
+      reinterpret_cast<ChunkHeader*>(mmap_writer_.ChunkHead());
+  header->data_size =
+      static_cast<uint32_t>(writer_->BufferedDataSize() - sizeof(ChunkHeader));
+  return writer_->Close();
+}
+
+// write timestamp_sync from which the ring buffer can be decoded
+// (called at least once every mmap_writer_.RingSegmentSize() bytes)
+void Logger::WriteCheckpoint() {
+  std::lock_guard<std::mutex> lock(ring_mutex_);
+  size_t offset = writer_->FileOffset();
+  if (varint_) {
+    uint8_t* p = writer_->Cursor();
+    p          = write_varint(p, varint_head(0, varint_extend_kind));
+    p          = write_varint(p, timestamp_sync);
+    p          = write_varint(p, pre_timestamp);
+    writer_->Seek(p - writer_->Cursor());
+    // function_define records before the checkpoint may be overwritten
+    memset(function_id_cache_.get(), 0,
+           sizeof(uintptr_t) * function_id_cache_size);
+  } else {
+    WriteTimestampSync(pre_timestamp);
+  }
+  // so are string_define records
+  std::fill(defined_string_ids_.begin(), defined_string_ids_.end(), 0);
+  checkpoint_count_++;
+  checkpoints_.push_back(offset);
+  // record current cpu after the checkpoint at next check
+  pre_cpu_id       = -1;
+  cpu_id_countdown = 1;
+  // drop overwritten checkpoints
+  while (checkpoints_.front() + mmap_writer_.RingSize() <
+         mmap_writer_.FileOffset()) {
+    checkpoints_.pop_front();
+  }
+}
+
+bool Logger::DumpRing(bool self) {
+  std::vector<uint8_t> data;
+  {
+    std::lock_guard<std::mutex> lock(ring_mutex_);
+    if (!mmap_writer_.IsOpen()) {
+      return false;
+    }
+    // the owner thread may be writing ahead of the end concurrently and
+    // it cannot pass the next checkpoint while ring_mutex_ is locked
+    size_t end =
+        __atomic_load_n(&mmap_writer_.file_offset_, __ATOMIC_ACQUIRE);
+    size_t margin = self ? 0 : mmap_writer_.RingSegmentSize() * 2;
+    size_t begin  = end;
+    for (size_t checkpoint : checkpoints_) {
+      if (checkpoint + mmap_writer_.RingSize() >= end + margin) {
+        begin = checkpoint;
+        break;
+      }
+    }
+    const uint8_t* p = mmap_writer_.RingData(begin);
+    data.assign(p, p + (end - begin));
+  }
+  std::string filename = get_output_directory() + "/" +
+                         get_output_file_prefix() +
+                         std::to_string(header_.tid);
+  // readers never see a partially written file
+  std::string tmp_filename = filename + ".tmp";
+  int fd = open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0666);
+  if (fd < 0) {
+    std::cerr << "DumpRing(): open():" << std::strerror(errno) << ":"
+              << tmp_filename << std::endl;
+    return false;
+  }
+  bool ret = write(fd, &header_, sizeof(header_)) ==
+                 static_cast<ssize_t>(sizeof(header_)) &&
+             write(fd, data.data(), data.size()) ==
+                 static_cast<ssize_t>(data.size());
+  if (!ret) {
+    std::cerr << "DumpRing(): write():" << std::strerror(errno) << ":"
+              << tmp_filename << std::endl;
+  }
+  close(fd);
+  if (ret && rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    std::cerr << "DumpRing(): rename():" << std::strerror(errno) << ":"
+              << filename << std::endl;
+    ret = false;
+  }
   if (!ret) {
-    std::cerr << mw_.GetErrorMessage() << std::endl;
+    unlink(tmp_filename.c_str());
   }
+  return ret;
 }
 
-namespace {
-constexpr uint32_t timestamp_size      = sizeof(uint32_t) * 8;
-constexpr ExtraInfo unset_flag_mask    = (0x1UL << (timestamp_size - 2)) - 1;
-constexpr ExtraInfo normal_enter_flag  = 0x0UL << (timestamp_size - 2);
-constexpr ExtraInfo exntend_enter_flag = 0x1UL << (timestamp_size - 2);
-constexpr ExtraInfo normal_exit_flag   = 0x2UL << (timestamp_size - 2);
-constexpr ExtraInfo exntend_exit_flag  = 0x3UL << (timestamp_size - 2);
-uint32_t set_flag_to_timestamp(uint32_t timestamp, ExtraInfo flag) {
-  return (timestamp & unset_flag_mask) | flag;
-}
-constexpr ExtendType duration_enter = 0x0;
-constexpr ExtendType duration_exit  = 0x1;
-constexpr ExtendType async_enter    = 0x2;
-constexpr ExtendType async_exit     = 0x3;
-constexpr ExtendType instant        = 0x4;
-}  // namespace
+// NOTE: caller must reserve timestamp_sync_size bytes for WriteTimestampSync()
+inline uint32_t Logger::TimestampDiffWithOffset(uint64_t timestamp) {
+  uint64_t timestamp_diff = timestamp - pre_timestamp + timestamp_diff_offset;
+  pre_timestamp           = timestamp;
+  if (__builtin_expect(timestamp_diff > max_timestamp_diff_with_offset, 0)) {
+    WriteTimestampSync(timestamp);
+    return timestamp_diff_offset;
+  }
+  return static_cast<uint32_t>(timestamp_diff);
+}
 
-namespace iftracer {
-void ExtendEventDurationEnter();
-void ExtendEventDurationExit(const std::string& text);
-void ExtendEventAsyncEnter(const std::string& text);
-void ExtendEventAsyncExit(const std::string& text);
-void ExtendEventInstant(const std::string& text);
+// NOTE: caller must reserve max_varint_size * 6 bytes
+// return file offset of the enter record (after function_define)
+inline size_t Logger::WriteVarintEnter(uint64_t timestamp, uintptr_t address) {
+  uint64_t timestamp_diff = timestamp - pre_timestamp;
+  pre_timestamp           = timestamp;
+  uint32_t function_id    = function_id_slot(address);
+  uint8_t* p              = writer_->Cursor();
+  if (__builtin_expect(function_id_cache_[function_id] != address, 0)) {
+    function_id_cache_[function_id] = address;
+    p = write_varint(p, varint_head(0, varint_extend_kind));
+    p = write_varint(p, function_define);
+    p = write_varint(p, function_id);
+    p = write_varint(p, address);
+    writer_->Seek(p - writer_->Cursor());
+  }
+  size_t begin_offset = writer_->FileOffset();
+  p = write_varint(p, varint_head(timestamp_diff, varint_enter_kind));
+  p = write_varint(p, function_id);
+  writer_->Seek(p - writer_->Cursor());
+  return begin_offset;
+}
+
+inline void Logger::PushEnterRecord(size_t begin_offset,
+                                    uint64_t base_timestamp,
+                                    uint64_t timestamp) {
+  // deeper records are not elided
+  if (enter_depth_ < max_enter_depth) {
+    EnterRecord& record   = enter_records_[enter_depth_];
+    record.begin_offset   = begin_offset;
+    record.end_offset     = writer_->FileOffset();
+    record.base_timestamp = base_timestamp;
+    record.timestamp      = timestamp;
+    record.elided_calls   = 0;
+  }
+  enter_depth_++;
+}
+
+// rewind the matching enter record if it is the last record and short
+bool Logger::ElideExit(uint64_t timestamp) {
+  if (enter_depth_ == 0) {
+    return false;
+  }
+  size_t depth = --enter_depth_;
+  if (depth >= max_enter_depth) {
+    return false;
+  }
+  EnterRecord& record = enter_records_[depth];
+  if (record.end_offset == writer_->FileOffset() &&
+      timestamp - record.timestamp < min_duration_ticks_ &&
+      writer_->Rewind(record.end_offset - record.begin_offset)) {
+    // elided time is included in the diff of the next record
+    pre_timestamp = record.base_timestamp;
+    if (depth > 0 && depth - 1 < max_enter_depth) {
+      enter_records_[depth - 1].elided_calls += record.elided_calls + 1;
+    }
+    return true;
+  }
+  if (record.elided_calls != 0) {
+    static const iftracer::StringId kElided("[elided]");
+    static const iftracer::StringId kCalls("calls");
+    iftracer::Arg arg(kCalls, record.elided_calls);
+    // the duration of the parent excludes writing the instant
+    extend_timestamp_ = timestamp;
+    ExtendEventInstant(kElided.Id(), &arg, 1);
+    extend_timestamp_ = 0;
+  }
+  return false;
+}
+
+inline void Logger::WriteVarintExit(uint64_t timestamp) {
+  uint64_t timestamp_diff = timestamp - pre_timestamp;
+  pre_timestamp           = timestamp;
+  uint8_t* p              = writer_->Cursor();
+  p = write_varint(p, varint_head(timestamp_diff, varint_exit_kind));
+  writer_->Seek(p - writer_->Cursor());
+}
+
+void Logger::WriteTimestampSync(uint64_t timestamp) {
+  *reinterpret_cast<uint32_t*>(writer_->Cursor()) =
+      set_flag_to_timestamp(timestamp_diff_offset, extend_enter_flag);
+  writer_->Seek(sizeof(uint32_t));
+  *reinterpret_cast<ExtendType*>(writer_->Cursor()) = timestamp_sync;
+  writer_->Seek(sizeof(ExtendType));
+  memcpy(writer_->Cursor(), &timestamp, sizeof(timestamp));
+  writer_->Seek(sizeof(timestamp));
+}
+
+// the thread can be decoded from here without the records before
+bool Logger::WriteKeyframe(uint64_t timestamp, size_t next_record_size) {
+  check_module_snapshot();
+  uint32_t stack_size =
+      keyframe_stack_ ? std::min(depth_, max_keyframe_stack) : 0;
+  size_t size = max_keyframe_size(stack_size) + next_record_size;
+  if (!writer_->CheckCapacity(size) && !PrepareWrite(size)) {
+    return false;
+  }
+  IndexEntry entry;
+  entry.timestamp = timestamp;
+  entry.offset    = container_ != nullptr
+                        ? chunk_offset + writer_->BufferedDataSize()
+                        : writer_->FileOffset();
+  entry.stream_id = container_ != nullptr ? chunk_stream_id : 0;
+  entry.depth     = depth_;
+  if (varint_) {
+    uint8_t* p = writer_->Cursor();
+    p          = write_varint(p, varint_head(0, varint_extend_kind));
+    p          = write_varint(p, keyframe);
+    p          = write_varint(p, timestamp);
+    p          = write_varint(p, hook_events_);
+    p          = write_varint(p, depth_);
+    p          = write_varint(p, stack_size);
+    for (uint32_t i = 0; i < stack_size; i++) {
+      p = write_varint(p, keyframe_stack_[i]);
+    }
+    writer_->Seek(p - writer_->Cursor());
+    // function_define records before the keyframe are not decoded
+    memset(function_id_cache_.get(), 0,
+           sizeof(uintptr_t) * function_id_cache_size);
+  } else {
+    uint32_t head[] = {
+        set_flag_to_timestamp(timestamp_diff_offset, extend_enter_flag),
+        keyframe};
+    uint32_t depth[] = {depth_, stack_size};
+    uint8_t* p       = writer_->Cursor();
+    memcpy(p, head, sizeof(head));
+    memcpy(p + sizeof(head), &timestamp, sizeof(timestamp));
+    memcpy(p + sizeof(head) + sizeof(timestamp), &hook_events_,
+           sizeof(hook_events_));
+    memcpy(p + sizeof(head) + sizeof(timestamp) + sizeof(hook_events_), depth,
+           sizeof(depth));
+    writer_->Seek(sizeof(head) + sizeof(timestamp) + sizeof(hook_events_) +
+                  sizeof(depth));
+    memcpy(writer_->Cursor(), keyframe_stack_.get(),
+           sizeof(uintptr_t) * stack_size);
+    writer_->Seek(sizeof(uintptr_t) * stack_size);
+  }
+  pre_timestamp = timestamp;
+  // so are string_define records
+  std::fill(defined_string_ids_.begin(), defined_string_ids_.end(), 0);
+  checkpoint_count_++;
+  // record current cpu after the keyframe at next check
+  pre_cpu_id       = -1;
+  cpu_id_countdown = 1;
+  index_entries_.push_back(entry);
+  if (keyframe_interval_ != 0) {
+    next_keyframe_offset_ = writer_->FileOffset() + keyframe_interval_;
+  }
+  if (keyframe_period_ticks_ != 0) {
+    next_keyframe_timestamp_ = timestamp + keyframe_period_ticks_;
+  }
+  return true;
+}
+
+void Logger::WriteIndex() {
+  if (index_entries_.empty()) {
+    return;
+  }
+  std::string filename = get_output_directory() + "/" +
+                         get_output_file_prefix();
+  int flags = O_WRONLY | O_CLOEXEC;
+  std::string data;
+  if (container_ != nullptr) {
+    // the header is written at the creation of the container
+    filename += std::to_string(get_cached_pid()) + ".chunks.index";
+    flags |= O_APPEND;
+  } else {
+    filename += std::to_string(header_.tid) + ".index";
+    flags |= O_CREAT | O_TRUNC;
+    IndexHeader header;
+    header.entry_size = sizeof(IndexEntry);
+    data.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+  // one write() so that entries of threads are not interleaved
+  data.append(reinterpret_cast<const char*>(index_entries_.data()),
+              sizeof(IndexEntry) * index_entries_.size());
+  index_entries_.clear();
+  int fd = open(filename.c_str(), flags, 0666);
+  if (fd < 0) {
+    std::cerr << "WriteIndex(): open():" << std::strerror(errno) << ":"
+              << filename << std::endl;
+    return;
+  }
+  if (write(fd, data.data(), data.size()) !=
+      static_cast<ssize_t>(data.size())) {
+    std::cerr << "WriteIndex(): write():" << std::strerror(errno) << ":"
+              << filename << std::endl;
+  }
+  close(fd);
+}
+
+void Logger::Resume(uint32_t generation) {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  CloseFrames(disabled_timestamp.load(std::memory_order_relaxed));
+  generation_ = generation;
+  resumed_    = true;
+  // the thread may have migrated while disabled
+  cpu_id_countdown = 1;
+}
+
+// NOTE: IFTRACE_TEXT_FORMAT has no call stack and exits are not closed
+void Logger::CloseFrames(uint64_t timestamp) {
+#ifndef IFTRACE_TEXT_FORMAT
+  const size_t max_n = 256;
+  // records of the API may be written while disabled
+  timestamp = std::max(timestamp, pre_timestamp);
+  while (depth_ > 0) {
+    if (!writer_->CheckCapacity(max_n) && !PrepareWrite(max_n)) {
+      std::cerr << writer_->GetErrorMessage() << std::endl;
+      stats_.Add(iftracer::telemetry::dropped_events);
+      break;
+    }
+    if (varint_) {
+      WriteVarintExit(timestamp);
+    } else {
+      uint32_t timestamp_diff = TimestampDiffWithOffset(timestamp);
+      *reinterpret_cast<uint32_t*>(writer_->Cursor()) =
+          set_flag_to_timestamp(timestamp_diff, normal_exit_flag);
+      writer_->Seek(sizeof(uint32_t));
+    }
+    PopFrame();
+    stats_.Add(iftracer::telemetry::events);
+  }
+  // the enter records are not the last records anymore
+  enter_depth_ = 0;
+#endif
+}
 
+void Logger::Finalize() {
+  if (ring_) {
+    unregister_ring_logger(this);
+    // other threads may be still running at process exit
+    if (is_main_thread()) {
+      dump_ring_buffers(nullptr);
+    }
+    DumpRing(true);
+    ring_ = false;
+  }
+  CountWrittenBytes();
+  bool ret = container_ != nullptr ? CloseChunk() : writer_->Close();
+  if (!ret) {
+    std::cerr << writer_->GetErrorMessage() << std::endl;
+  }
+  WriteIndex();
+}
+
+namespace iftracer {
 void ExtendEventDurationEnter() { logger.ExtendEventDurationEnter(); }
 void ExtendEventDurationExit(const std::string& text) {
   logger.ExtendEventDurationExit(text);
@@ -371,146 +1598,563 @@ void ExtendEventAsyncExit(const std::string& text) {
 void ExtendEventInstant(const std::string& text) {
   logger.ExtendEventInstant(text);
 }
-}  // namespace iftracer
+void Dump() { dump_ring_buffers(&logger); }
+
+void Enable() {
+  uint32_t generation = trace_generation.load(std::memory_order_relaxed);
+  while ((generation & 1) != 0 &&
+         !trace_generation.compare_exchange_weak(generation, generation + 1,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+  }
+}
+void Disable() {
+  uint32_t generation = trace_generation.load(std::memory_order_relaxed);
+  if ((generation & 1) != 0) {
+    return;
+  }
+  disabled_timestamp.store(trace_clock::Now(), std::memory_order_relaxed);
+  while ((generation & 1) == 0 &&
+         !trace_generation.compare_exchange_weak(generation, generation + 1,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+  }
+}
+bool IsEnabled() {
+  return (trace_generation.load(std::memory_order_relaxed) & 1) == 0;
+}
+
+uint32_t InternString(const char* text) {
+  return get_string_table().Intern(text);
+}
+void ExtendEventDurationExit(const StringId& string_id) {
+  logger.ExtendEventDurationExit(string_id.Id());
+}
+void ExtendEventAsyncEnter(const StringId& string_id) {
+  logger.ExtendEventAsyncEnter(string_id.Id());
+}
+void ExtendEventAsyncExit(const StringId& string_id) {
+  logger.ExtendEventAsyncExit(string_id.Id());
+}
+void ExtendEventInstant(const StringId& string_id) {
+  logger.ExtendEventInstant(string_id.Id());
+}
+
+void CounterInt64(const StringId& name, int64_t value) {
+  logger.ExtendEventCounter(name.Id(), arg_int64,
+                            static_cast<uint64_t>(value));
+}
+void CounterDouble(const StringId& name, double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  logger.ExtendEventCounter(name.Id(), arg_double, bits);
+}
+
+uint64_t NewEventId() {
+  // pid in the upper bits: unique also among processes of a trace
+  static std::atomic<uint32_t> sequence(0);
+  return (static_cast<uint64_t>(get_cached_pid()) << 32) |
+         (sequence.fetch_add(1, std::memory_order_relaxed) + 1);
+}
+void FlowStart(const StringId& name, uint64_t id) {
+  logger.ExtendEventId(name.Id(), id_flow_start, id);
+}
+void FlowStep(const StringId& name, uint64_t id) {
+  logger.ExtendEventId(name.Id(), id_flow_step, id);
+}
+void FlowEnd(const StringId& name, uint64_t id) {
+  logger.ExtendEventId(name.Id(), id_flow_end, id);
+}
+void AsyncBegin(const StringId& name, uint64_t id) {
+  logger.ExtendEventId(name.Id(), id_async_begin, id);
+}
+void AsyncEnd(const StringId& name, uint64_t id) {
+  logger.ExtendEventId(name.Id(), id_async_end, id);
+}
 
 namespace {
-inline std::string cpu_id_text(int cpu_id) {
-  return std::string("CPU:") + std::to_string(cpu_id);
+void copy_latency(const telemetry::Histogram& histogram,
+                  TracerStats::Latency* latency) {
+  static_assert(sizeof(latency->buckets) == sizeof(histogram.buckets),
+                "TracerStats::Latency must have the same buckets");
+  latency->count    = histogram.count;
+  latency->total_ns = histogram.total_ns;
+  latency->max_ns   = histogram.max_ns;
+  memcpy(latency->buckets, histogram.buckets, sizeof(latency->buckets));
+}
+}  // namespace
+void GetTracerStats(TracerStats* stats) {
+  telemetry::Snapshot snapshot;
+  telemetry::Collect(&snapshot);
+  *stats                = TracerStats();
+  stats->events         = snapshot.counters[telemetry::events];
+  stats->bytes          = snapshot.counters[telemetry::bytes];
+  stats->dropped_events = snapshot.counters[telemetry::dropped_events];
+  stats->cpu_id_lookups = snapshot.counters[telemetry::cpu_id_lookups];
+  copy_latency(snapshot.latencies[telemetry::prepare_write_latency],
+               &stats->prepare_write);
+  copy_latency(snapshot.latencies[telemetry::flush_latency], &stats->flush);
+  copy_latency(snapshot.latencies[telemetry::async_munmap_latency],
+               &stats->async_munmap);
+  stats->remaps  = stats->prepare_write.count;
+  stats->flushes = stats->flush.count;
+}
+
+static_assert(Arg::kInt64 == arg_int64 && Arg::kDouble == arg_double &&
+                  Arg::kPointer == arg_pointer && Arg::kString == arg_string,
+              "Arg::Type must be the same as format::arg_*");
+static_assert(sizeof(Arg) == fixed_arg_size, "unexpected size of Arg");
+void ExtendEventDurationExit(const std::string& text, const Arg* args,
+                             size_t arg_count) {
+  logger.ExtendEventDurationExit(text, args,
+                                 std::min<size_t>(arg_count, max_args));
+}
+void ExtendEventAsyncEnter(const std::string& text, const Arg* args,
+                           size_t arg_count) {
+  logger.ExtendEventAsyncEnter(text, args,
+                               std::min<size_t>(arg_count, max_args));
 }
+void ExtendEventAsyncExit(const std::string& text, const Arg* args,
+                          size_t arg_count) {
+  logger.ExtendEventAsyncExit(text, args,
+                              std::min<size_t>(arg_count, max_args));
+}
+void ExtendEventInstant(const std::string& text, const Arg* args,
+                        size_t arg_count) {
+  logger.ExtendEventInstant(text, args,
+                            std::min<size_t>(arg_count, max_args));
+}
+void ExtendEventDurationExit(const StringId& string_id, const Arg* args,
+                             size_t arg_count) {
+  logger.ExtendEventDurationExit(string_id.Id(), args,
+                                 std::min<size_t>(arg_count, max_args));
+}
+void ExtendEventAsyncEnter(const StringId& string_id, const Arg* args,
+                           size_t arg_count) {
+  logger.ExtendEventAsyncEnter(string_id.Id(), args,
+                               std::min<size_t>(arg_count, max_args));
+}
+void ExtendEventAsyncExit(const StringId& string_id, const Arg* args,
+                          size_t arg_count) {
+  logger.ExtendEventAsyncExit(string_id.Id(), args,
+                              std::min<size_t>(arg_count, max_args));
+}
+void ExtendEventInstant(const StringId& string_id, const Arg* args,
+                        size_t arg_count) {
+  logger.ExtendEventInstant(string_id.Id(), args,
+                            std::min<size_t>(arg_count, max_args));
+}
+}  // namespace iftracer
+
+namespace {
 #ifdef IFTRACER_DISABLE_CPU_ID
 void start_cpu_id_event() {}
 void end_cpu_id_event() {}
 void check_cpu_id_event() {}
 #else
+inline int read_cpu_id() {
+#ifdef IFTRACER_HAS_RSEQ
+  // rseq area registered by glibc(>=2.35) is updated by the kernel at every
+  // migration, so the cpu id is just a load from TLS
+  if (__rseq_size != 0) {
+    const struct rseq* area = reinterpret_cast<const struct rseq*>(
+        reinterpret_cast<const char*>(__builtin_thread_pointer()) +
+        __rseq_offset);
+    int cpu_id =
+        static_cast<int>(__atomic_load_n(&area->cpu_id, __ATOMIC_RELAXED));
+    if (cpu_id >= 0) {
+      return cpu_id;
+    }
+  }
+#endif
+  // vDSO getcpu()
+  return sched_getcpu();
+}
 void start_cpu_id_event() {
-  int cpu_id             = sched_getcpu();
-  std::string enter_text = cpu_id_text(cpu_id);
-  iftracer::ExtendEventAsyncEnter(enter_text);
-  pre_cpu_id = cpu_id;
-}
-void end_cpu_id_event() {
-  std::string exit_text = cpu_id_text(pre_cpu_id);
-  iftracer::ExtendEventAsyncExit(exit_text);
-}
-void check_cpu_id_event() {
-  int cpu_id = sched_getcpu();
-  if (cpu_id != pre_cpu_id) {
-    // std::string text = std::string("TID:") + std::to_string(tid) + std::string(", CPU:") + std::to_string(pre_cpu_id) + std::string("->") + std::to_string(cpu_id);
-    // std::string text = "cpu switched";  // static message generate same color at chrome tracer
-    // iftracer::ExtendEventInstant(text);
-
-    std::string exit_text = cpu_id_text(pre_cpu_id);
-    iftracer::ExtendEventAsyncExit(exit_text);
-    std::string enter_text = cpu_id_text(cpu_id);
-    iftracer::ExtendEventAsyncEnter(enter_text);
+  logger.CountCpuIdLookup();
+  pre_cpu_id       = read_cpu_id();
+  cpu_id_countdown = get_cpu_id_period();
+  logger.ExtendEventCpuMigration(pre_cpu_id);
+}
+void end_cpu_id_event() { logger.ExtendEventCpuMigration(no_cpu_id); }
+inline void check_cpu_id_event() {
+  if (cpu_id_countdown > 1) {
+    cpu_id_countdown--;
+    return;
+  }
+  // after thread_local logger destructor called
+  if (tls_init_trigger == 0) {
+    return;
+  }
+  cpu_id_countdown = get_cpu_id_period();
+  logger.CountCpuIdLookup();
+  int cpu_id = read_cpu_id();
+  if (__builtin_expect(cpu_id != pre_cpu_id, 0)) {
+    logger.ExtendEventCpuMigration(cpu_id);
     pre_cpu_id = cpu_id;
   }
 }
 #endif
 }  // namespace
 
-void Logger::InternalProcessEnter() { ExtendEventDurationEnter(); }
-void Logger::InternalProcessExit() { ExtendEventDurationExit("[internal]"); }
+// ring buffer extension is cheap enough to be not recorded
+void Logger::InternalProcessEnter() {
+  if (!ring_) {
+    ExtendEventDurationEnter();
+  }
+}
+void Logger::InternalProcessExit() {
+  if (!ring_) {
+    ExtendEventDurationExit("[internal]");
+  }
+}
 
 bool Logger::ExtendEventWriteHeader(ExtraInfo event, ExtendType extend_type,
                                     size_t reservation_buffer_size) {
 #ifdef IFTRACE_TEXT_FORMAT
+  // extend events have no text representation
+  return false;
 #else
-  uint32_t micro_duration_diff = get_current_micro_timestamp_diff_with_offset();
-  reservation_buffer_size += sizeof(uint32_t) + sizeof(ExtendType);
-  if (!mw_.CheckCapacity(reservation_buffer_size) &&
-      !mw_.PrepareWrite(reservation_buffer_size)) {
-    std::cerr << mw_.GetErrorMessage() << std::endl;
+  uint64_t timestamp = extend_timestamp_ != 0 ? extend_timestamp_
+                                              : iftracer::trace_clock::Now();
+  reservation_buffer_size +=
+      sizeof(uint32_t) + sizeof(ExtendType) + timestamp_sync_size;
+  if (!writer_->CheckCapacity(reservation_buffer_size) &&
+      !PrepareWrite(reservation_buffer_size)) {
+    std::cerr << writer_->GetErrorMessage() << std::endl;
+    stats_.Add(iftracer::telemetry::dropped_events);
     return false;
   }
+  stats_.Add(iftracer::telemetry::events);
 
-  *reinterpret_cast<uint32_t*>(mw_.Cursor()) =
-      set_flag_to_timestamp(micro_duration_diff, event);
-  mw_.Seek(sizeof(uint32_t));
+  if (varint_) {
+    uint64_t timestamp_diff = timestamp - pre_timestamp;
+    pre_timestamp           = timestamp;
+    uint8_t* p              = writer_->Cursor();
+    p = write_varint(p, varint_head(timestamp_diff, varint_extend_kind));
+    p = write_varint(p, extend_type);
+    writer_->Seek(p - writer_->Cursor());
+    return true;
+  }
+  uint32_t timestamp_diff = TimestampDiffWithOffset(timestamp);
+  *reinterpret_cast<uint32_t*>(writer_->Cursor()) =
+      set_flag_to_timestamp(timestamp_diff, event);
+  writer_->Seek(sizeof(uint32_t));
 
-  *reinterpret_cast<ExtendType*>(mw_.Cursor()) = extend_type;
-  mw_.Seek(sizeof(ExtendType));
-#endif
+  *reinterpret_cast<ExtendType*>(writer_->Cursor()) = extend_type;
+  writer_->Seek(sizeof(ExtendType));
   return true;
+#endif
 }
 
-void Logger::ExtendEventDurationEnter() {
-  if (!Logger::ExtendEventWriteHeader(exntend_enter_flag, duration_enter, 0)) {
-    return;
+namespace {
+// fixed size of args (also enough for varint args)
+size_t args_size(uint32_t arg_count) {
+  return arg_count == 0 ? 0 : sizeof(uint32_t) + fixed_arg_size * arg_count;
+}
+// string ids which must be defined before the args
+size_t collect_arg_string_ids(const iftracer::Arg* args, uint32_t arg_count,
+                              uint32_t* string_ids) {
+  size_t count = 0;
+  for (uint32_t i = 0; i < arg_count; i++) {
+    string_ids[count++] = args[i].Key();
+    if (args[i].GetType() == iftracer::Arg::kString) {
+      string_ids[count++] = static_cast<uint32_t>(args[i].Value());
+    }
   }
+  return count;
 }
-void Logger::ExtendEventDurationExit(const std::string& text) {
-  constexpr int text_align    = 4;
-  int reservation_buffer_size = text.size() + text_align;
-  if (!Logger::ExtendEventWriteHeader(exntend_exit_flag, duration_exit,
-                                      reservation_buffer_size)) {
+}  // namespace
+
+void Logger::ExtendEventWriteText(ExtraInfo event, ExtendType extend_type,
+                                  const std::string& text,
+                                  const iftracer::Arg* args,
+                                  uint32_t arg_count) {
+  int32_t text_size        = text.size();
+  size_t aligned_text_size = iftracer::format::aligned_text_size(text_size);
+  // also enough for varint text_size and unpadded text
+  size_t payload_size =
+      sizeof(int32_t) + aligned_text_size + args_size(arg_count);
+  if (arg_count != 0) {
+    uint32_t string_ids[max_args * 2];
+    if (!DefineStrings(string_ids,
+                       collect_arg_string_ids(args, arg_count, string_ids),
+                       sizeof(uint32_t) + sizeof(ExtendType) +
+                           timestamp_sync_size + payload_size)) {
+      return;
+    }
+    extend_type |= args_flag;
+  }
+  if (!Logger::ExtendEventWriteHeader(event, extend_type, payload_size)) {
     return;
   }
+  if (varint_) {
+    uint8_t* p = write_varint(writer_->Cursor(), text_size);
+    text.copy(reinterpret_cast<char*>(p), text_size);
+    writer_->Seek(p + text_size - writer_->Cursor());
+  } else {
+    *reinterpret_cast<int32_t*>(writer_->Cursor()) = text_size;
+    writer_->Seek(sizeof(int32_t));
+    text.copy(reinterpret_cast<char*>(writer_->Cursor()), text_size);
+    writer_->Seek(aligned_text_size);
+  }
+  if (arg_count != 0) {
+    WriteArgs(args, arg_count);
+  }
+}
 
-  int32_t text_size                         = text.size();
-  *reinterpret_cast<int32_t*>(mw_.Cursor()) = text_size;
-  mw_.Seek(sizeof(int32_t));
-  text.copy(reinterpret_cast<char*>(mw_.Cursor()), text_size);
-  size_t aligned_text_size =
-      (((text_size) + (text_align - 1)) & ~(text_align - 1));
-  mw_.Seek(aligned_text_size);
+// NOTE: string_define is written before the first use in this file
+void Logger::ExtendEventWriteStringId(ExtraInfo event, ExtendType extend_type,
+                                      uint32_t string_id,
+                                      const iftracer::Arg* args,
+                                      uint32_t arg_count) {
+  size_t payload_size = sizeof(uint32_t) + args_size(arg_count);
+  uint32_t string_ids[1 + max_args * 2];
+  string_ids[0] = string_id;
+  if (!DefineStrings(string_ids,
+                     1 + collect_arg_string_ids(args, arg_count,
+                                                string_ids + 1),
+                     sizeof(uint32_t) + sizeof(ExtendType) +
+                         timestamp_sync_size + payload_size)) {
+    return;
+  }
+  if (arg_count != 0) {
+    extend_type |= args_flag;
+  }
+  if (!Logger::ExtendEventWriteHeader(event, extend_type | string_id_flag,
+                                      payload_size)) {
+    return;
+  }
+  if (varint_) {
+    uint8_t* p = write_varint(writer_->Cursor(), string_id);
+    writer_->Seek(p - writer_->Cursor());
+  } else {
+    *reinterpret_cast<uint32_t*>(writer_->Cursor()) = string_id;
+    writer_->Seek(sizeof(uint32_t));
+  }
+  if (arg_count != 0) {
+    WriteArgs(args, arg_count);
+  }
 }
-void Logger::ExtendEventAsyncEnter(const std::string& text) {
-  constexpr int text_align    = 4;
-  int reservation_buffer_size = text.size() + text_align;
-  if (!Logger::ExtendEventWriteHeader(exntend_enter_flag, async_enter,
-                                      reservation_buffer_size)) {
+
+// NOTE: caller must reserve args_size(arg_count) bytes
+void Logger::WriteArgs(const iftracer::Arg* args, uint32_t arg_count) {
+  if (varint_) {
+    uint8_t* p = write_varint(writer_->Cursor(), arg_count);
+    for (uint32_t i = 0; i < arg_count; i++) {
+      p              = write_varint(p, args[i].Key());
+      p              = write_varint(p, args[i].GetType());
+      uint64_t value = args[i].Value();
+      switch (args[i].GetType()) {
+        case iftracer::Arg::kInt64:
+          p = write_varint(p, zigzag_encode(static_cast<int64_t>(value)));
+          break;
+        case iftracer::Arg::kDouble:
+          memcpy(p, &value, sizeof(value));
+          p += sizeof(value);
+          break;
+        default:
+          p = write_varint(p, value);
+          break;
+      }
+    }
+    writer_->Seek(p - writer_->Cursor());
     return;
   }
+  *reinterpret_cast<uint32_t*>(writer_->Cursor()) = arg_count;
+  writer_->Seek(sizeof(uint32_t));
+  // same layout as iftracer::Arg
+  memcpy(writer_->Cursor(), args, fixed_arg_size * arg_count);
+  writer_->Seek(fixed_arg_size * arg_count);
+}
 
-  int32_t text_size                         = text.size();
-  *reinterpret_cast<int32_t*>(mw_.Cursor()) = text_size;
-  mw_.Seek(sizeof(int32_t));
-  text.copy(reinterpret_cast<char*>(mw_.Cursor()), text_size);
-  size_t aligned_text_size =
-      (((text_size) + (text_align - 1)) & ~(text_align - 1));
-  mw_.Seek(aligned_text_size);
+bool Logger::IsStringDefined(uint32_t string_id) const {
+  size_t index = string_id / 64;
+  return index < defined_string_ids_.size() &&
+         (defined_string_ids_[index] & (1ULL << (string_id % 64))) != 0;
 }
-void Logger::ExtendEventAsyncExit(const std::string& text) {
-  constexpr int text_align    = 4;
-  int reservation_buffer_size = text.size() + text_align;
-  if (!Logger::ExtendEventWriteHeader(exntend_exit_flag, async_exit,
-                                      reservation_buffer_size)) {
-    return;
+
+// write string_define of undefined string ids and reserve record_size bytes
+// for the record which uses them
+bool Logger::DefineStrings(const uint32_t* string_ids, size_t count,
+                           size_t record_size) {
+  while (true) {
+    // reserve before checking the bitmap because a checkpoint of the ring
+    // buffer resets it
+    if (!writer_->CheckCapacity(record_size) && !PrepareWrite(record_size)) {
+      std::cerr << writer_->GetErrorMessage() << std::endl;
+      stats_.Add(iftracer::telemetry::dropped_events);
+      return false;
+    }
+    uint64_t checkpoint_count = checkpoint_count_;
+    for (size_t i = 0; i < count; i++) {
+      if (__builtin_expect(!IsStringDefined(string_ids[i]), 0) &&
+          !WriteStringDefine(string_ids[i], record_size)) {
+        return false;
+      }
+    }
+    // a string_define crossed a checkpoint: define the others again
+    if (__builtin_expect(checkpoint_count == checkpoint_count_, 1)) {
+      return true;
+    }
   }
+}
 
-  int32_t text_size                         = text.size();
-  *reinterpret_cast<int32_t*>(mw_.Cursor()) = text_size;
-  mw_.Seek(sizeof(int32_t));
-  text.copy(reinterpret_cast<char*>(mw_.Cursor()), text_size);
-  size_t aligned_text_size =
-      (((text_size) + (text_align - 1)) & ~(text_align - 1));
-  mw_.Seek(aligned_text_size);
+// next_record_size: reserved for the record which uses the string_id
+bool Logger::WriteStringDefine(uint32_t string_id, size_t next_record_size) {
+  std::string text;
+  if (!get_string_table().Get(string_id, &text)) {
+    return false;
+  }
+  int32_t text_size        = text.size();
+  size_t aligned_text_size = iftracer::format::aligned_text_size(text_size);
+  if (!Logger::ExtendEventWriteHeader(
+          extend_exit_flag, string_define,
+          sizeof(uint32_t) + sizeof(int32_t) + aligned_text_size +
+              next_record_size)) {
+    return false;
+  }
+  if (varint_) {
+    uint8_t* p = write_varint(writer_->Cursor(), string_id);
+    p          = write_varint(p, text_size);
+    text.copy(reinterpret_cast<char*>(p), text_size);
+    writer_->Seek(p + text_size - writer_->Cursor());
+  } else {
+    *reinterpret_cast<uint32_t*>(writer_->Cursor()) = string_id;
+    writer_->Seek(sizeof(uint32_t));
+    *reinterpret_cast<int32_t*>(writer_->Cursor()) = text_size;
+    writer_->Seek(sizeof(int32_t));
+    text.copy(reinterpret_cast<char*>(writer_->Cursor()), text_size);
+    writer_->Seek(aligned_text_size);
+  }
+  size_t index = string_id / 64;
+  if (index >= defined_string_ids_.size()) {
+    defined_string_ids_.resize(index + 1, 0);
+  }
+  defined_string_ids_[index] |= 1ULL << (string_id % 64);
+  return true;
 }
-void Logger::ExtendEventInstant(const std::string& text) {
-  constexpr int text_align    = 4;
-  int reservation_buffer_size = text.size() + text_align;
-  if (!Logger::ExtendEventWriteHeader(exntend_exit_flag, instant,
-                                      reservation_buffer_size)) {
+
+void Logger::ExtendEventDurationEnter() {
+  if (!Logger::ExtendEventWriteHeader(extend_enter_flag, duration_enter, 0)) {
     return;
   }
+}
+void Logger::ExtendEventDurationExit(const std::string& text,
+                                     const iftracer::Arg* args,
+                                     uint32_t arg_count) {
+  ExtendEventWriteText(extend_exit_flag, duration_exit, text, args, arg_count);
+}
+void Logger::ExtendEventAsyncEnter(const std::string& text,
+                                   const iftracer::Arg* args,
+                                   uint32_t arg_count) {
+  ExtendEventWriteText(extend_enter_flag, async_enter, text, args, arg_count);
+}
+void Logger::ExtendEventAsyncExit(const std::string& text,
+                                  const iftracer::Arg* args,
+                                  uint32_t arg_count) {
+  ExtendEventWriteText(extend_exit_flag, async_exit, text, args, arg_count);
+}
+void Logger::ExtendEventInstant(const std::string& text,
+                                const iftracer::Arg* args,
+                                uint32_t arg_count) {
+  ExtendEventWriteText(extend_exit_flag, instant, text, args, arg_count);
+}
+void Logger::ExtendEventDurationExit(uint32_t string_id,
+                                     const iftracer::Arg* args,
+                                     uint32_t arg_count) {
+  ExtendEventWriteStringId(extend_exit_flag, duration_exit, string_id, args,
+                           arg_count);
+}
+void Logger::ExtendEventAsyncEnter(uint32_t string_id,
+                                   const iftracer::Arg* args,
+                                   uint32_t arg_count) {
+  ExtendEventWriteStringId(extend_enter_flag, async_enter, string_id, args,
+                           arg_count);
+}
+void Logger::ExtendEventAsyncExit(uint32_t string_id,
+                                  const iftracer::Arg* args,
+                                  uint32_t arg_count) {
+  ExtendEventWriteStringId(extend_exit_flag, async_exit, string_id, args,
+                           arg_count);
+}
+void Logger::ExtendEventInstant(uint32_t string_id,
+                                const iftracer::Arg* args,
+                                uint32_t arg_count) {
+  ExtendEventWriteStringId(extend_exit_flag, instant, string_id, args,
+                           arg_count);
+}
+void Logger::ExtendEventCpuMigration(uint32_t cpu_id) {
+  ExtendEventWriteHeader(extend_exit_flag, cpu_migration_type(cpu_id), 0);
+}
+void Logger::ExtendEventCounter(uint32_t string_id, uint32_t value_type,
+                                uint64_t value) {
+  ExtendEventWriteValue(
+      counter_type(value_type), string_id, value,
+      value_type == arg_int64 ? VarintValue::kZigzag : VarintValue::kRaw);
+}
+void Logger::ExtendEventId(uint32_t string_id, uint32_t phase, uint64_t id) {
+  ExtendEventWriteValue(id_event_type(phase), string_id, id,
+                        VarintValue::kUnsigned);
+}
 
-  int32_t text_size                         = text.size();
-  *reinterpret_cast<int32_t*>(mw_.Cursor()) = text_size;
-  mw_.Seek(sizeof(int32_t));
-  text.copy(reinterpret_cast<char*>(mw_.Cursor()), text_size);
-  size_t aligned_text_size =
-      (((text_size) + (text_align - 1)) & ~(text_align - 1));
-  mw_.Seek(aligned_text_size);
+// string_id -> 8B value record (counter and id_event)
+// one reservation and one store of the whole record like enter records
+void Logger::ExtendEventWriteValue(ExtendType extend_type, uint32_t string_id,
+                                   uint64_t value, VarintValue varint_value) {
+#ifdef IFTRACE_TEXT_FORMAT
+  // extend events have no text representation
+  return;
+#else
+  // also enough for varint string_id and value
+  size_t record_size = sizeof(uint32_t) + sizeof(ExtendType) +
+                       timestamp_sync_size + max_varint_size * 2;
+  if (!DefineStrings(&string_id, 1, record_size)) {
+    return;
+  }
+  uint64_t timestamp = iftracer::trace_clock::Now();
+  if (varint_) {
+    uint64_t timestamp_diff = timestamp - pre_timestamp;
+    pre_timestamp           = timestamp;
+    uint8_t* p              = writer_->Cursor();
+    p = write_varint(p, varint_head(timestamp_diff, varint_extend_kind));
+    p = write_varint(p, extend_type);
+    p = write_varint(p, string_id);
+    switch (varint_value) {
+      case VarintValue::kUnsigned:
+        p = write_varint(p, value);
+        break;
+      case VarintValue::kZigzag:
+        p = write_varint(p, zigzag_encode(static_cast<int64_t>(value)));
+        break;
+      case VarintValue::kRaw:
+        memcpy(p, &value, sizeof(value));
+        p += sizeof(value);
+        break;
+    }
+    writer_->Seek(p - writer_->Cursor());
+    stats_.Add(iftracer::telemetry::events);
+    return;
+  }
+  uint32_t head[] = {
+      set_flag_to_timestamp(TimestampDiffWithOffset(timestamp),
+                            extend_exit_flag),
+      extend_type, string_id};
+  memcpy(writer_->Cursor(), head, sizeof(head));
+  memcpy(writer_->Cursor() + sizeof(head), &value, sizeof(value));
+  writer_->Seek(sizeof(head) + sizeof(value));
+  stats_.Add(iftracer::telemetry::events);
+#endif
 }
 
 void Logger::Enter(void* func_address, void* call_site) {
   // printf("[%d][%"PRIu64"][trace func][enter]:%p call %p\n", tid, micro_since_epoch, call_site, func_address);
   int max_n = 256;
-  if (!mw_.CheckCapacity(max_n)) {
+  if (!writer_->CheckCapacity(max_n)) {
     InternalProcessEnter();
-    if (!mw_.PrepareWrite(max_n)) {
-      std::cerr << mw_.GetErrorMessage() << std::endl;
+    if (!PrepareWrite(max_n)) {
+      std::cerr << writer_->GetErrorMessage() << std::endl;
+      stats_.Add(iftracer::telemetry::dropped_events);
       InternalProcessExit();
       return;
     }
@@ -525,37 +2169,72 @@ void Logger::Enter(void* func_address, void* call_site) {
       reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(func_address) & (~1));
 #ifdef IFTRACE_TEXT_FORMAT
   uint64_t micro_since_epoch = get_current_micro_timestamp();
-  int n = snprintf(reinterpret_cast<char*>(mw_.Cursor()), max_n,
+  int n = snprintf(reinterpret_cast<char*>(writer_->Cursor()), max_n,
                    "%d %" PRIu64 " enter %p %p\n", tid, micro_since_epoch,
                    call_site, normalized_func_address);
-  mw_.Seek(n);
+  writer_->Seek(n);
 #else
-  uint32_t micro_duration_diff = get_current_micro_timestamp_diff_with_offset();
-  *reinterpret_cast<uint32_t*>(mw_.Cursor()) =
-      set_flag_to_timestamp(micro_duration_diff, normal_enter_flag);
-  mw_.Seek(sizeof(uint32_t));
-  *reinterpret_cast<uintptr_t*>(mw_.Cursor()) =
-      reinterpret_cast<uintptr_t>(normalized_func_address);
-  mw_.Seek(sizeof(uintptr_t));
+  uint64_t timestamp = iftracer::trace_clock::Now();
+  if (__builtin_expect(NeedKeyframe(timestamp), 0) &&
+      !WriteKeyframe(timestamp, max_n)) {
+    std::cerr << writer_->GetErrorMessage() << std::endl;
+    stats_.Add(iftracer::telemetry::dropped_events);
+    return;
+  }
+  uint64_t base_timestamp = pre_timestamp;
+  size_t begin_offset     = 0;
+  if (varint_) {
+    begin_offset = WriteVarintEnter(
+        timestamp, reinterpret_cast<uintptr_t>(normalized_func_address));
+  } else {
+    uint32_t timestamp_diff = TimestampDiffWithOffset(timestamp);
+    if (timestamp_diff == timestamp_diff_offset) {
+      // timestamp_sync may be written before the record
+      base_timestamp = timestamp;
+    }
+    begin_offset = writer_->FileOffset();
+    *reinterpret_cast<uint32_t*>(writer_->Cursor()) =
+        set_flag_to_timestamp(timestamp_diff, normal_enter_flag);
+    writer_->Seek(sizeof(uint32_t));
+    *reinterpret_cast<uintptr_t*>(writer_->Cursor()) =
+        reinterpret_cast<uintptr_t>(normalized_func_address);
+    writer_->Seek(sizeof(uintptr_t));
+  }
+  PushFrame(reinterpret_cast<uintptr_t>(normalized_func_address));
+  if (min_duration_ticks_ != 0) {
+    PushEnterRecord(begin_offset, base_timestamp, timestamp);
+  }
 #endif
+  stats_.Add(iftracer::telemetry::events);
 }
 
 void Logger::Exit(void* func_address, void* call_site) {
   // printf("[%d][%"PRIu64"][trace func][exit]:%p call %p\n", tid, micro_since_epoch, call_site, func_address);
+#ifndef IFTRACE_TEXT_FORMAT
+  // the enter was before Disable() and the frame is closed by Resume()
+  if (depth_ == 0 && resumed_) {
+    return;
+  }
+#endif
   int max_n = 256;
-  if (!mw_.CheckCapacity(max_n)) {
+  if (!writer_->CheckCapacity(max_n)) {
     InternalProcessEnter();
-    if (!mw_.PrepareWrite(max_n)) {
-      std::cerr << mw_.GetErrorMessage() << std::endl;
+    if (!PrepareWrite(max_n)) {
+      std::cerr << writer_->GetErrorMessage() << std::endl;
+      stats_.Add(iftracer::telemetry::dropped_events);
       InternalProcessExit();
       return;
     }
     InternalProcessExit();
   } else {
     size_t flush_buffer_size = flush_buffer_size_;
-    if (mw_.BufferedDataSize() >= flush_buffer_size) {
+    if (writer_->BufferedDataSize() >= flush_buffer_size) {
       InternalProcessEnter();
-      mw_.Flush(flush_buffer_size);
+      CountWrittenBytes();
+      uint64_t begin_ns = iftracer::telemetry::NowNs();
+      writer_->Flush(flush_buffer_size);
+      stats_.Record(iftracer::telemetry::flush_latency,
+                    iftracer::telemetry::NowNs() - begin_ns);
       InternalProcessExit();
     }
   }
@@ -564,23 +2243,50 @@ void Logger::Exit(void* func_address, void* call_site) {
   void* normalized_func_address =
       reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(func_address) & (~1));
   uint64_t micro_since_epoch = get_current_micro_timestamp();
-  int n = snprintf(reinterpret_cast<char*>(mw_.Cursor()), max_n,
+  int n = snprintf(reinterpret_cast<char*>(writer_->Cursor()), max_n,
                    "%d %" PRIu64 " exit %p %p\n", tid, micro_since_epoch,
                    call_site, normalized_func_address);
-  mw_.Seek(n);
+  writer_->Seek(n);
 #else
-  uint32_t micro_duration_diff = get_current_micro_timestamp_diff_with_offset();
-  *reinterpret_cast<uint32_t*>(mw_.Cursor()) =
-      set_flag_to_timestamp(micro_duration_diff, normal_exit_flag);
-  mw_.Seek(sizeof(uint32_t));
+  uint64_t timestamp = iftracer::trace_clock::Now();
+  if (min_duration_ticks_ != 0 && ElideExit(timestamp)) {
+    // the enter record is rewound and the exit is not written
+    PopFrame();
+    hook_events_ -= 2;
+    stats_.Sub(iftracer::telemetry::events);
+    check_cpu_id_event();
+    return;
+  }
+  if (__builtin_expect(NeedKeyframe(timestamp), 0) &&
+      !WriteKeyframe(timestamp, max_n)) {
+    std::cerr << writer_->GetErrorMessage() << std::endl;
+    stats_.Add(iftracer::telemetry::dropped_events);
+    return;
+  }
+  if (varint_) {
+    WriteVarintExit(timestamp);
+  } else {
+    uint32_t timestamp_diff = TimestampDiffWithOffset(timestamp);
+    *reinterpret_cast<uint32_t*>(writer_->Cursor()) =
+        set_flag_to_timestamp(timestamp_diff, normal_exit_flag);
+    writer_->Seek(sizeof(uint32_t));
+  }
+  PopFrame();
 #endif
+  stats_.Add(iftracer::telemetry::events);
 
   check_cpu_id_event();
 }
 
 void __attribute__((no_instrument_function))
 __cyg_profile_func_enter(void* func_address, void* call_site) {
+  // disabled: neither the logger nor thread_local variables are touched
+  uint32_t generation = trace_generation.load(std::memory_order_relaxed);
+  if (__builtin_expect(generation & 1, 0)) {
+    return;
+  }
   if (tls_init_trigger != 0) {
+    logger.CheckGeneration(generation);
     logger.Enter(func_address, call_site);
   } else {
     // after thread_local logger destructor called
@@ -593,7 +2299,13 @@ __cyg_profile_func_enter(void* func_address, void* call_site) {
 
 void __attribute__((no_instrument_function))
 __cyg_profile_func_exit(void* func_address, void* call_site) {
+  // disabled: neither the logger nor thread_local variables are touched
+  uint32_t generation = trace_generation.load(std::memory_order_relaxed);
+  if (__builtin_expect(generation & 1, 0)) {
+    return;
+  }
   if (tls_init_trigger != 0) {
+    logger.CheckGeneration(generation);
     logger.Exit(func_address, call_site);
   } else {
     // after thread_local logger destructor called
@@ -603,3 +2315,23 @@ __cyg_profile_func_exit(void* func_address, void* call_site) {
     // printf("[call after tracer destructor][ exit][%d]: %p calls %p\n", tid, call_site, func_address);
   }
 }
+
+#if __linux__
+// dlclose() does not depend on its caller unlike dlopen()
+// NOTE: this wrapper is used when libiftracer is linked to the executable
+// or preloaded
+extern "C" {
+int dlclose(void* handle) {
+  using dlclose_func_type = int (*)(void*);
+  static dlclose_func_type real_dlclose =
+      reinterpret_cast<dlclose_func_type>(dlsym(RTLD_NEXT, "dlclose"));
+  // modules loaded since the last snapshot are recorded before unloading
+  check_module_snapshot();
+  int ret = real_dlclose(handle);
+  if (ret == 0) {
+    check_module_snapshot();
+  }
+  return ret;
+}
+}
+#endif
@@ -0,0 +1,173 @@
+#include "lz_codec.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace iftracer {
+namespace lz {
+namespace {
+constexpr int hash_bits         = 12;
+constexpr size_t min_match      = 4;
+constexpr size_t max_offset     = 65535;
+// the last match starts at least 12 bytes before the end and the last 5
+// bytes are literals (same as LZ4, so decoders can copy without checks)
+constexpr size_t match_margin   = 12;
+constexpr size_t literal_margin = 5;
+
+inline uint32_t load32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+inline uint32_t hash(uint32_t v) {
+  return (v * 2654435761u) >> (32 - hash_bits);
+}
+// length of 15 or more continues in 255 steps
+inline uint8_t* write_length(uint8_t* op, size_t length) {
+  for (; length >= 255; length -= 255) {
+    *op++ = 255;
+  }
+  *op++ = static_cast<uint8_t>(length);
+  return op;
+}
+inline bool read_length(const uint8_t** ip, const uint8_t* end,
+                        size_t* length) {
+  uint8_t v;
+  do {
+    if (*ip >= end) {
+      return false;
+    }
+    v = *(*ip)++;
+    *length += v;
+  } while (v == 255);
+  return true;
+}
+// worst case size of a sequence
+inline size_t sequence_bound(size_t literals, size_t match_length) {
+  return 1 + literals / 255 + 1 + literals + 2 + match_length / 255 + 1;
+}
+}  // namespace
+
+size_t Compress(const uint8_t* src, size_t size, uint8_t* dst,
+                size_t capacity) {
+  uint32_t table[1 << hash_bits];
+  memset(table, 0, sizeof(table));
+  const uint8_t* ip      = src;
+  const uint8_t* anchor  = src;
+  const uint8_t* end     = src + size;
+  uint8_t* op            = dst;
+  uint8_t* op_end        = dst + capacity;
+  if (size > match_margin) {
+    const uint8_t* match_limit = end - match_margin;
+    const uint8_t* copy_limit  = end - literal_margin;
+    while (ip < match_limit) {
+      uint32_t v          = load32(ip);
+      uint32_t& entry     = table[hash(v)];
+      const uint8_t* ref  = src + entry;
+      entry               = static_cast<uint32_t>(ip - src);
+      if (ref >= ip || static_cast<size_t>(ip - ref) > max_offset ||
+          load32(ref) != v) {
+        // skip faster in data without matches
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+      const uint8_t* match_end = ip + min_match;
+      ref += min_match;
+      while (match_end < copy_limit && *match_end == *ref) {
+        match_end++;
+        ref++;
+      }
+      size_t literals     = ip - anchor;
+      size_t match_length = match_end - ip - min_match;
+      if (static_cast<size_t>(op_end - op) <
+          sequence_bound(literals, match_length)) {
+        return 0;
+      }
+      uint8_t* token = op++;
+      *token         = static_cast<uint8_t>(
+          (literals < 15 ? literals : 15) << 4 |
+          (match_length < 15 ? match_length : 15));
+      if (literals >= 15) {
+        op = write_length(op, literals - 15);
+      }
+      memcpy(op, anchor, literals);
+      op += literals;
+      uint16_t offset = static_cast<uint16_t>(match_end - ref);
+      memcpy(op, &offset, sizeof(offset));
+      op += sizeof(offset);
+      if (match_length >= 15) {
+        op = write_length(op, match_length - 15);
+      }
+      ip = anchor = match_end;
+    }
+  }
+  size_t literals = end - anchor;
+  if (static_cast<size_t>(op_end - op) < sequence_bound(literals, 0)) {
+    return 0;
+  }
+  *op++ = static_cast<uint8_t>((literals < 15 ? literals : 15) << 4);
+  if (literals >= 15) {
+    op = write_length(op, literals - 15);
+  }
+  memcpy(op, anchor, literals);
+  op += literals;
+  return op - dst;
+}
+
+bool Decompress(const uint8_t* src, size_t size, uint8_t* dst,
+                size_t raw_size) {
+  const uint8_t* ip  = src;
+  const uint8_t* end = src + size;
+  uint8_t* op        = dst;
+  uint8_t* op_end    = dst + raw_size;
+  while (ip < end) {
+    uint8_t token   = *ip++;
+    size_t literals = token >> 4;
+    if (literals == 15 && !read_length(&ip, end, &literals)) {
+      return false;
+    }
+    if (static_cast<size_t>(end - ip) < literals ||
+        static_cast<size_t>(op_end - op) < literals) {
+      return false;
+    }
+    memcpy(op, ip, literals);
+    ip += literals;
+    op += literals;
+    // the last sequence has no match
+    if (ip == end) {
+      break;
+    }
+    uint16_t offset;
+    if (static_cast<size_t>(end - ip) < sizeof(offset)) {
+      return false;
+    }
+    memcpy(&offset, ip, sizeof(offset));
+    ip += sizeof(offset);
+    size_t match_length = token & 15;
+    if (match_length == 15 && !read_length(&ip, end, &match_length)) {
+      return false;
+    }
+    match_length += min_match;
+    if (offset == 0 || static_cast<size_t>(op - dst) < offset ||
+        static_cast<size_t>(op_end - op) < match_length) {
+      return false;
+    }
+    const uint8_t* ref = op - offset;
+    if (offset >= match_length) {
+      memcpy(op, ref, match_length);
+      op += match_length;
+    } else {
+      // overlapped copy repeats the last offset bytes, so the copied
+      // pattern doubles at each step
+      uint8_t* match_end = op + match_length;
+      while (op < match_end) {
+        size_t n = std::min<size_t>(op - ref, match_end - op);
+        memcpy(op, ref, n);
+        op += n;
+      }
+    }
+  }
+  return op == op_end;
+}
+}  // namespace lz
+}  // namespace iftracer
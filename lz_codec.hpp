@@ -0,0 +1,25 @@
+#ifndef LZ_CODEC_HPP_INCLUDED
+#define LZ_CODEC_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+namespace iftracer {
+// embedded LZ77 codec of IFTRACER_COMPRESS frames (format::FrameHeader)
+//
+// the block format is that of LZ4 (token, literals, 2B offset, match length)
+// and the compressor is a single pass greedy matcher with a small hash table,
+// which favors speed over ratio: trace records are highly repetitive
+namespace lz {
+// worst case size of compressed data
+constexpr size_t CompressBound(size_t size) { return size + size / 255 + 16; }
+// return compressed size (0: it does not fit in capacity)
+size_t Compress(const uint8_t* src, size_t size, uint8_t* dst,
+                size_t capacity);
+// return false if src is broken or is not exactly raw_size bytes
+bool Decompress(const uint8_t* src, size_t size, uint8_t* dst,
+                size_t raw_size);
+}  // namespace lz
+}  // namespace iftracer
+
+#endif  // LZ_CODEC_HPP_INCLUDED
@@ -55,13 +55,20 @@ int main(int argc, const char* argv[]) {
     hoge();
     fuga();
 
+    static const iftracer::StringId kThreadStart("thread start");
+    static const iftracer::StringId kIndex("index");
+    static const iftracer::StringId kSpawn("spawn");
     iftracer::AsyncLogger async_logger;
     async_logger.Enter("thread loop start");
     for (int i = 0; i < 10; i++) {
+      IFTRACER_COUNTER("loop index", i);
       iftracer::AsyncLogger async_logger;
       async_logger.Enter("for loop");
+      uint64_t spawn_id = iftracer::NewEventId();
+      iftracer::FlowStart(kSpawn, spawn_id);
       std::thread th([&] {
-        iftracer::InstantLogger("thread start");
+        iftracer::FlowEnd(kSpawn, spawn_id);
+        iftracer::InstantLogger(kThreadStart, {{kIndex, i}});
         hoge();
         fuga();
         hoge();
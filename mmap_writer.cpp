@@ -4,15 +4,57 @@
 #include <inttypes.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <cstdint>
 #include <cstring>
+#include <deque>
 #include <string>
+#include <thread>
 
-bool MmapWriter::IsOpen() { return is_open_; }
+namespace {
+// maps windows of all MmapWriter (SetMapAhead()) one by one
+// NOTE: never destroyed because writers use it until process exit
+class MapAheadWorker {
+ public:
+  static MapAheadWorker& Get() {
+    static MapAheadWorker* map_ahead_worker = new MapAheadWorker();
+    return *map_ahead_worker;
+  }
+  void Post(MmapWriter* writer) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      writers_.push_back(writer);
+    }
+    posted_.notify_one();
+  }
+
+ private:
+  MapAheadWorker() {
+    std::thread([this]() { Run(); }).detach();
+  }
+  void Run() {
+    while (true) {
+      MmapWriter* writer;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        posted_.wait(lock, [this]() { return !writers_.empty(); });
+        writer = writers_.front();
+        writers_.pop_front();
+      }
+      writer->MapAhead();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable posted_;
+  std::deque<MmapWriter*> writers_;
+};
+}  // namespace
 
 // offset == 0: truncate file
 // offset  < 0: seek to last offset, extend size
-bool MmapWriter::Open(std::string filename, size_t size, int64_t offset = 0) {
+bool MmapWriter::Open(std::string filename, size_t size, int64_t offset) {
   if (debug_ && IsOpen()) {
     AddErrorMessage("Open(): already open map");
     return false;
@@ -68,6 +110,9 @@ bool MmapWriter::Open(std::string filename, size_t size, int64_t offset = 0) {
   local_offset_ = offset % PAGE_SIZE;
   cursor_       = reinterpret_cast<uint8_t*>(head_) + local_offset_;
   is_open_      = true;
+  if (map_ahead_) {
+    PostMapAhead(nullptr, 0);
+  }
   if (verbose_) {
     printf("cursor_:%p\n", cursor_);
     printf("file_offset_:%zu\n", file_offset_);
@@ -75,11 +120,111 @@ bool MmapWriter::Open(std::string filename, size_t size, int64_t offset = 0) {
   }
   return true;
 }
+bool MmapWriter::OpenRing(size_t ring_size) {
+  if (debug_ && IsOpen()) {
+    AddErrorMessage("OpenRing(): already open map");
+    return false;
+  }
+#if __linux__
+  ring_size_         = PAGE_ALIGNED(ring_size);
+  ring_segment_size_ = PAGE_ALIGNED(ring_size_ / 16);
+  fd_                = memfd_create("iftracer-ring", MFD_CLOEXEC);
+  if (fd_ < 0) {
+    AddErrorMessageWithErrono("OpenRing(): memfd_create():", errno);
+    return false;
+  }
+  if (ftruncate(fd_, ring_size_) != 0) {
+    AddErrorMessageWithErrono("OpenRing(): ftruncate():", errno);
+    close(fd_);
+    return false;
+  }
+  // reserve address range for two views
+  void* head = mmap(nullptr, ring_size_ * 2, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (head == MAP_FAILED) {
+    AddErrorMessageWithErrono("OpenRing(): mmap():", errno);
+    close(fd_);
+    return false;
+  }
+  ring_head_ = reinterpret_cast<uint8_t*>(head);
+  for (int i = 0; i < 2; i++) {
+    void* view = mmap(ring_head_ + ring_size_ * i, ring_size_,
+                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd_, 0);
+    if (view == MAP_FAILED) {
+      AddErrorMessageWithErrono("OpenRing(): mmap():", errno);
+      munmap(ring_head_, ring_size_ * 2);
+      close(fd_);
+      return false;
+    }
+  }
+  head_         = ring_head_;
+  map_size_     = ring_segment_size_;
+  file_offset_  = 0;
+  local_offset_ = 0;
+  cursor_       = head_;
+  is_open_      = true;
+  return true;
+#else
+  AddErrorMessage("OpenRing(): ring buffer is not supported:");
+  return false;
+#endif
+}
+
+bool MmapWriter::OpenChunk(int fd, size_t chunk_offset, size_t chunk_size) {
+  if (debug_ && IsOpen()) {
+    AddErrorMessage("OpenChunk(): already open map");
+    return false;
+  }
+  head_ = reinterpret_cast<uint8_t*>(mmap(nullptr, chunk_size,
+                                          PROT_READ | PROT_WRITE, MAP_SHARED,
+                                          fd, chunk_offset));
+  if (head_ == MAP_FAILED) {
+    AddErrorMessageWithErrono("OpenChunk(): mmap():", errno);
+    return false;
+  }
+  // file_offset_ continues as the offset in the stream of chunks
+  fd_           = fd;
+  chunk_size_   = chunk_size;
+  map_size_     = chunk_size;
+  local_offset_ = 0;
+  cursor_       = head_;
+  is_open_      = true;
+  return true;
+}
+
 bool MmapWriter::Close() {
   if (debug_ && !IsOpen()) {
     AddErrorMessage("Close(): no opening map:");
     return false;
   }
+  if (IsChunk()) {
+    is_open_ = false;
+    if (munmap(head_, map_size_) != 0) {
+      AddErrorMessageWithErrono("Close(): munmap():", errno);
+      return false;
+    }
+    return true;
+  }
+  if (IsRing()) {
+    bool ret = true;
+    if (munmap(ring_head_, ring_size_ * 2) != 0) {
+      AddErrorMessageWithErrono("Close(): munmap():", errno);
+      ret = false;
+    }
+    if (close(fd_) != 0) {
+      AddErrorMessageWithErrono("Close(): close():", errno);
+      ret = false;
+    }
+    is_open_ = false;
+    return ret;
+  }
+  if (map_ahead_) {
+    WaitMapAhead();
+    if (ahead_head_ != nullptr) {
+      munmap(ahead_head_, ahead_size_);
+      ahead_head_ = nullptr;
+    }
+  }
   if (verbose_) {
     printf("[Close]\n");
     printf("file_offset_:%zu\n", file_offset_);
@@ -111,7 +256,8 @@ bool MmapWriter::Close() {
 }
 
 bool MmapWriter::Flush(size_t size) {
-  if (local_offset_ < size) {
+  // ring buffer is never written back and chunk is unmapped at once
+  if (IsRing() || IsChunk() || local_offset_ < size) {
     return false;
   }
   size_t aligned_size = PAGE_ALIGNED_ROUND_DOWN(size);
@@ -141,52 +287,167 @@ bool MmapWriter::Flush(size_t size) {
   return true;
 }
 
-bool MmapWriter::CheckCapacity(size_t size) {
-  if (local_offset_ + size <= map_size_) {
+bool MmapWriter::PrepareWrite(size_t size) {
+  if (IsRing()) {
+    if (size > ring_size_ / 2) {
+      AddErrorMessage("PrepareWrite(): too large data for ring buffer:");
+      return false;
+    }
+    // second view is the same memory as the first one
+    if (local_offset_ >= ring_size_) {
+      local_offset_ -= ring_size_;
+      cursor_ -= ring_size_;
+    }
+    map_size_ = local_offset_ + std::max(ring_segment_size_, size);
     return true;
   }
-  return false;
-}
-
-bool MmapWriter::PrepareWrite(size_t size) {
   if (CheckCapacity(size)) {
     return true;
   }
-  if (!Close()) {
+  if (IsChunk()) {
+    AddErrorMessage("PrepareWrite(): chunk is full:");
+    return false;
+  }
+  if (map_ahead_) {
+    WaitMapAhead();
+    size_t aligned_offset = PAGE_ALIGNED_ROUND_DOWN(file_offset_);
+    if (ahead_head_ != nullptr && aligned_offset >= ahead_offset_ &&
+        file_offset_ + size <= ahead_offset_ + ahead_size_) {
+      // the written part of the overlap is kept (rewindable)
+      uint8_t* retired_head = head_;
+      size_t retired_size   = map_size_;
+      head_                 = ahead_head_;
+      map_size_             = ahead_size_;
+      local_offset_         = file_offset_ - ahead_offset_;
+      cursor_               = head_ + local_offset_;
+      aligned_file_size_    = ahead_offset_ + ahead_size_;
+      ahead_head_           = nullptr;
+      PostMapAhead(retired_head, retired_size);
+      return true;
+    }
+    // too large record (or failed to map): the file is already grown
+    if (ahead_head_ != nullptr) {
+      munmap(ahead_head_, ahead_size_);
+      ahead_head_        = nullptr;
+      aligned_file_size_ = ahead_offset_ + ahead_size_;
+    }
+  }
+  if (!Remap(size)) {
     AddErrorMessage("PrepareWrite():");
     return false;
   }
+  if (map_ahead_) {
+    PostMapAhead(nullptr, 0);
+  }
+  return true;
+}
+
+bool MmapWriter::Remap(size_t size) {
   size_t extend_size = extend_size_;
   if (extend_size < size) {
     extend_size = PAGE_ALIGNED(size);
   }
-  size_t new_file_size = aligned_file_size_ + extend_size;
-  size_t new_offset =
-      PAGE_ALIGNED_ROUND_DOWN(file_offset_) + (local_offset_ % PAGE_SIZE);
-  if (!Open(filename_, new_file_size, new_offset)) {
-    AddErrorMessage("PrepareWrite():");
+  size_t new_file_size  = aligned_file_size_ + extend_size;
+  size_t aligned_offset = PAGE_ALIGNED_ROUND_DOWN(file_offset_);
+  if (munmap(head_, map_size_) != 0) {
+    AddErrorMessageWithErrono("Remap(): munmap():", errno);
+    return false;
+  }
+  int error = GrowFile(new_file_size);
+  if (error != 0) {
+    AddErrorMessageWithErrono("Remap(): fallocate():", error);
+    close(fd_);
+    is_open_ = false;
+    return false;
+  }
+  aligned_file_size_ = new_file_size;
+  map_size_          = aligned_file_size_ - aligned_offset;
+  head_              = reinterpret_cast<uint8_t*>(
+      mmap(nullptr, map_size_, PROT_WRITE, MAP_SHARED, fd_, aligned_offset));
+  if (head_ == MAP_FAILED) {
+    AddErrorMessageWithErrono("Remap(): mmap():", errno);
+    close(fd_);
+    is_open_ = false;
     return false;
   }
+  local_offset_ = file_offset_ - aligned_offset;
+  cursor_       = head_ + local_offset_;
   return true;
 }
 
-void MmapWriter::Seek(size_t n) {
-  file_offset_ += n;
-  local_offset_ += n;
-  cursor_ += n;
+int MmapWriter::GrowFile(size_t size) {
+  if (size <= aligned_file_size_) {
+    return 0;
+  }
+#if __linux__
+  // allocate blocks now rather than at page faults in the hook
+  if (fallocate(fd_, 0, aligned_file_size_, size - aligned_file_size_) ==
+      0) {
+    return 0;
+  }
+  if (errno != EOPNOTSUPP && errno != ENOSYS) {
+    return errno;
+  }
+#endif
+  if (ftruncate(fd_, size) != 0) {
+    return errno;
+  }
+  return 0;
+}
+
+void MmapWriter::PostMapAhead(uint8_t* retired_head, size_t retired_size) {
+  size_t overlap_size = std::min(ahead_overlap_size_, aligned_file_size_);
+  ahead_offset_       = aligned_file_size_ - overlap_size;
+  ahead_size_         = overlap_size + extend_size_;
+  retired_head_       = retired_head;
+  retired_size_       = retired_size;
+  ahead_busy_.store(true, std::memory_order_relaxed);
+  MapAheadWorker::Get().Post(this);
 }
 
-std::string MmapWriter::GetErrorMessage() {
-  std::string tmp = error_message_;
-  error_message_.clear();
-  return tmp;
+void MmapWriter::MapAhead() {
+  if (retired_head_ != nullptr) {
+    // no error handling (same as the async munmap)
+    munmap(retired_head_, retired_size_);
+  }
+  uint8_t* head = nullptr;
+  if (GrowFile(ahead_offset_ + ahead_size_) == 0) {
+    void* addr =
+        mmap(nullptr, ahead_size_, PROT_WRITE, MAP_SHARED, fd_, ahead_offset_);
+    if (addr != MAP_FAILED) {
+      head = reinterpret_cast<uint8_t*>(addr);
+      PrefaultForWrite(head, ahead_size_);
+    }
+  }
+  // notify in the lock because the writer may be closed right after
+  std::lock_guard<std::mutex> lock(ahead_mutex_);
+  ahead_head_ = head;
+  ahead_busy_.store(false, std::memory_order_release);
+  ahead_mapped_.notify_all();
 }
 
-void MmapWriter::AddErrorMessage(std::string message) {
-  error_message_ = message + error_message_;
+// MAP_POPULATE of a shared mapping faults pages only for read, and the
+// first store in the hook would still fault to make each page writable
+void MmapWriter::PrefaultForWrite(uint8_t* head, size_t size) {
+#ifdef MADV_POPULATE_WRITE
+  // Linux 5.14 or later
+  if (madvise(head, size, MADV_POPULATE_WRITE) == 0) {
+    return;
+  }
+#endif
+  size_t page_size = getpagesize();
+  for (size_t offset = 0; offset < size; offset += page_size) {
+    // the overlap with the current window may be written by the hook:
+    // adding 0 atomically keeps the data
+    __atomic_fetch_add(head + offset, 0, __ATOMIC_RELAXED);
+  }
 }
-void MmapWriter::AddErrorMessageWithErrono(std::string message,
-                                           int errno_value) {
-  error_message_ =
-      message + std::string(std::strerror(errno)) + ":" + error_message_;
+
+void MmapWriter::WaitMapAhead() {
+  // always locked so that the map-ahead thread has released the lock
+  // before Close() returns
+  std::unique_lock<std::mutex> lock(ahead_mutex_);
+  ahead_mapped_.wait(lock, [this]() {
+    return !ahead_busy_.load(std::memory_order_acquire);
+  });
 }
@@ -4,11 +4,15 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
-#include <functional>
+#include <mutex>
 #include <string>
 
-class MmapWriter {
+#include "trace_writer.hpp"
+
+class MmapWriter : public TraceWriter {
  public:
   MmapWriter(){};
   ~MmapWriter() {
@@ -17,25 +21,41 @@ class MmapWriter {
     }
   };
   void SetExtendSize(size_t extend_size) { extend_size_ = extend_size; };
-  bool IsOpen();
-  bool Open(std::string filename, size_t size, int64_t offset);
-  bool Close();
-  bool Flush(size_t size);
-  size_t BufferedDataSize() { return local_offset_; };
-  bool CheckCapacity(size_t size);
-  bool PrepareWrite(size_t size);
-  void Seek(size_t n);
-  std::string GetErrorMessage();
-  uint8_t* Cursor() { return cursor_; }
-  void SetMunmapHook(
-      std::function<int(void* addr, size_t length)> munmap_func) {
+  // map the next window of the file by the process-wide map-ahead thread
+  // while the current one is filled, so that PrepareWrite() only swaps
+  // pointers at the end of the window (call before Open())
+  void SetMapAhead(bool map_ahead) { map_ahead_ = map_ahead; }
+  bool Open(std::string filename, size_t size, int64_t offset) override;
+  // fixed size circular buffer on memfd which is mapped twice back to back
+  // so that records never straddle the wrap (nothing is written to a file)
+  // PrepareWrite() is called at least every RingSegmentSize() bytes
+  bool OpenRing(size_t ring_size);
+  bool IsRing() { return ring_size_ != 0; }
+  size_t RingSize() { return ring_size_; }
+  size_t RingSegmentSize() { return ring_segment_size_; }
+  // contiguous RingSize() bytes from the position of the file offset
+  const uint8_t* RingData(size_t file_offset) {
+    return ring_head_ + file_offset % ring_size_;
+  }
+  // chunk_size bytes at chunk_offset of a file shared with other writers
+  // (see chunk_container.hpp): the file is neither truncated nor closed
+  // records never straddle chunks, so PrepareWrite() fails when it is full
+  bool OpenChunk(int fd, size_t chunk_offset, size_t chunk_size);
+  bool IsChunk() { return chunk_size_ != 0; }
+  // beginning of the chunk (never flushed)
+  uint8_t* ChunkHead() { return head_; }
+  bool Close() override;
+  bool Flush(size_t size) override;
+  bool PrepareWrite(size_t size) override;
+  // called instead of munmap() by Flush() (e.g. MunmapService::Post())
+  void SetMunmapHook(int (*munmap_func)(void* addr, size_t length)) {
     munmap_func_ = munmap_func;
   }
 
-  // private:
-  void AddErrorMessage(std::string message);
-  void AddErrorMessageWithErrono(std::string message, int errno_value);
+  // called by the map-ahead thread
+  void MapAhead();
 
+  // private:
   const bool verbose_ = false;
 #ifdef IFTRACE_DEBUG
   const bool debug_ = true;
@@ -45,18 +65,46 @@ class MmapWriter {
   size_t extend_size_ = 4096 * 4;
 
   std::string filename_     = "";
-  bool is_open_             = false;
   int fd_                   = 0;
-  uint8_t* head_            = nullptr;
   size_t aligned_file_size_ = 0;
-  size_t map_size_          = 0;
-  size_t file_offset_       = 0;
-  size_t local_offset_      = 0;
-  // NOTE: cursor_ = head_ + local_offset_
-  uint8_t* cursor_           = nullptr;
-  std::string error_message_ = "";
 
-  std::function<int(void* addr, size_t length)> munmap_func_ = munmap;
+  // ring buffer mode
+  size_t ring_size_         = 0;
+  size_t ring_segment_size_ = 0;
+  uint8_t* ring_head_       = nullptr;
+
+  // chunk mode
+  size_t chunk_size_ = 0;
+
+  int (*munmap_func_)(void* addr, size_t length) = munmap;
+
+  // unmap the current window, grow the file and map it again from the page
+  // of the cursor (synchronous, without closing the file)
+  bool Remap(size_t size);
+  // grow the file from aligned_file_size_ to size (fallocate() if supported)
+  // return errno (0: success)
+  int GrowFile(size_t size);
+  // request the window after aligned_file_size_ (and unmap the retired one)
+  void PostMapAhead(uint8_t* retired_head, size_t retired_size);
+  void WaitMapAhead();
+  // make the pages writable without faults in the hook
+  static void PrefaultForWrite(uint8_t* head, size_t size);
+
+  // map-ahead mode
+  bool map_ahead_ = false;
+  // the next window starts this size before the end of the current one, so
+  // it contains the page of the cursor for records up to this size
+  size_t ahead_overlap_size_ = 4096 * 4;
+  // set by the caller before posting (file offset and size of the window)
+  size_t ahead_offset_   = 0;
+  size_t ahead_size_     = 0;
+  uint8_t* retired_head_ = nullptr;
+  size_t retired_size_   = 0;
+  // set by the map-ahead thread (nullptr: failed)
+  uint8_t* ahead_head_ = nullptr;
+  std::atomic<bool> ahead_busy_{false};
+  std::mutex ahead_mutex_;
+  std::condition_variable ahead_mapped_;
 
   // NOTE: below value is declared as field for initialize this class constructor timing
   const size_t PAGE_SIZE = getpagesize();
@@ -6,8 +6,11 @@
 #include <iterator>
 #include <vector>
 
+#include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "buffered_writer.hpp"
 #include "mmap_writer.hpp"
 
 int main(const int argc, const char* argv[]) {
@@ -35,6 +38,14 @@ int main(const int argc, const char* argv[]) {
       std::cerr << mw.GetErrorMessage() << std::endl;
       break;
     }
+    if (i % 10 == 0) {
+      // discarded data
+      memset(mw.cursor_, 0xff, unit_size);
+      mw.Seek(unit_size);
+      ret = mw.Rewind(unit_size);
+      assert(ret || !"failed to rewind");
+      assert(mw.cursor_[unit_size - 1] == 0 || !"not zero filled");
+    }
     memset(mw.cursor_, i % 256, unit_size);
     memset(&expected_data[unit_size * i], i % 256, unit_size);
     mw.Seek(unit_size);
@@ -58,5 +69,158 @@ int main(const int argc, const char* argv[]) {
   for (size_t i = 0; i < expected_data.size(); i++) {
     assert(result_data[i] == expected_data[i] || !"wrong data");
   }
+
+  // map-ahead: windows are swapped at the end (records larger than the
+  // overlap of windows remap synchronously)
+  {
+    MmapWriter ahead;
+    ahead.SetExtendSize(extend_size);
+    ahead.SetMapAhead(true);
+    ret = ahead.Open(filename, 4096 * 2, 0);
+    if (!ret) {
+      std::cerr << ahead.GetErrorMessage() << std::endl;
+      return 1;
+    }
+    std::vector<uint8_t> expected_ahead;
+    for (int i = 0; i < loop_num; i++) {
+      size_t size = i % 300 == 299 ? ahead.ahead_overlap_size_ + 4096 : 100;
+      if (!ahead.CheckCapacity(size)) {
+        ret = ahead.PrepareWrite(size);
+        if (!ret) {
+          std::cerr << ahead.GetErrorMessage() << std::endl;
+          return 1;
+        }
+      }
+      if (i % 10 == 0) {
+        memset(ahead.cursor_, 0xff, size);
+        ahead.Seek(size);
+        ret = ahead.Rewind(size);
+        assert(ret || !"failed to rewind");
+      }
+      memset(ahead.cursor_, i % 256, size);
+      expected_ahead.insert(expected_ahead.end(), size, i % 256);
+      ahead.Seek(size);
+      if (ahead.BufferedDataSize() >= 4096 * 3) {
+        ret = ahead.Flush(4096 * 3);
+        assert(ret || !"failed to flush");
+      }
+    }
+    ret = ahead.Close();
+    if (!ret) {
+      std::cerr << ahead.GetErrorMessage() << std::endl;
+      return 1;
+    }
+    std::ifstream ahead_file(filename, std::ios::in | std::ios::binary);
+    std::vector<uint8_t> ahead_data(
+        (std::istreambuf_iterator<char>(ahead_file)),
+        std::istreambuf_iterator<char>());
+    assert(ahead_data == expected_ahead || !"wrong map-ahead data");
+  }
+
+  // chunks of a file shared with other writers: records never straddle
+  // chunks and Close() neither truncates nor closes the file
+  size_t chunk_size = 4096;
+  int fd            = open(filename.c_str(), O_RDWR);
+  assert(fd >= 0 || !"failed to open shared file");
+  // unused chunks are zero filled
+  ret = ftruncate(fd, chunk_size) == 0 && ftruncate(fd, chunk_size * 3) == 0;
+  assert(ret || !"failed to extend shared file");
+  std::vector<uint8_t> expected_chunks(chunk_size * 3, 0);
+  for (size_t chunk_offset : {chunk_size * 2, chunk_size}) {
+    MmapWriter chunk;
+    ret = chunk.OpenChunk(fd, chunk_offset, chunk_size);
+    if (!ret) {
+      std::cerr << chunk.GetErrorMessage() << std::endl;
+      return 1;
+    }
+    for (int i = 0; chunk.PrepareWrite(unit_size); i++) {
+      memset(chunk.cursor_, i + 1, unit_size);
+      memset(&expected_chunks[chunk_offset + unit_size * i], i + 1,
+             unit_size);
+      chunk.Seek(unit_size);
+    }
+    assert(!chunk.Flush(4096) || !"chunk is flushed");
+    ret = chunk.Close();
+    assert(ret || !"failed to close chunk");
+  }
+  std::vector<uint8_t> chunk_data(chunk_size * 4, 0);
+  ssize_t read_size = pread(fd, chunk_data.data(), chunk_data.size(), 0);
+  assert(read_size == static_cast<ssize_t>(chunk_size * 3) ||
+         !"wrong shared file size");
+  ret = close(fd) == 0;
+  assert(ret || !"shared file is closed by chunk");
+  assert(memcmp(&chunk_data[chunk_size], &expected_chunks[chunk_size],
+                chunk_size * 2) == 0 ||
+         !"wrong chunk data");
+
+#if __linux__
+  // ring buffer keeps the latest ring_size bytes contiguously
+  size_t ring_size = 4096 * 16;
+  MmapWriter ring;
+  ret = ring.OpenRing(ring_size);
+  if (!ret) {
+    std::cerr << ring.GetErrorMessage() << std::endl;
+    return 1;
+  }
+  for (int i = 0; i < loop_num; i++) {
+    if (!ring.CheckCapacity(unit_size)) {
+      ret = ring.PrepareWrite(unit_size);
+      assert(ret || !"failed to prepare ring buffer");
+    }
+    memset(ring.cursor_, i % 256, unit_size);
+    ring.Seek(unit_size);
+  }
+  assert(ring.FileOffset() == expected_data.size() || !"wrong ring offset");
+  size_t begin = ring.FileOffset() - ring_size;
+  assert(memcmp(ring.RingData(begin), &expected_data[begin], ring_size) == 0 ||
+         !"wrong ring data");
+  ret = ring.Close();
+  if (!ret) {
+    std::cerr << ring.GetErrorMessage() << std::endl;
+    return 1;
+  }
+#endif
+
+  // buffered writer: the same data through the background writer, and the
+  // partial page is written again when the file is reopened to append
+  for (int64_t open_offset : {0, -1}) {
+    BufferedWriter bw;
+    bw.SetBufferSize(4096 * 2);
+    ret = bw.Open(filename, 0, open_offset);
+    if (!ret) {
+      std::cerr << bw.GetErrorMessage() << std::endl;
+      return 1;
+    }
+    int begin = open_offset == 0 ? 0 : loop_num / 2;
+    int end   = open_offset == 0 ? loop_num / 2 : loop_num;
+    for (int i = begin; i < end; i++) {
+      if (!bw.CheckCapacity(unit_size)) {
+        ret = bw.PrepareWrite(unit_size);
+        assert(ret || !"failed to prepare buffer");
+      }
+      if (i % 10 == 0) {
+        memset(bw.cursor_, 0xff, unit_size);
+        bw.Seek(unit_size);
+        ret = bw.Rewind(unit_size);
+        assert(ret || !"failed to rewind");
+      }
+      memset(bw.cursor_, i % 256, unit_size);
+      bw.Seek(unit_size);
+      if (bw.BufferedDataSize() >= 4096) {
+        ret = bw.Flush(4096);
+        assert(ret || !"failed to flush");
+      }
+    }
+    ret = bw.Close();
+    if (!ret) {
+      std::cerr << bw.GetErrorMessage() << std::endl;
+      return 1;
+    }
+  }
+  std::ifstream buffered_file(filename, std::ios::in | std::ios::binary);
+  std::vector<uint8_t> buffered_data(
+      (std::istreambuf_iterator<char>(buffered_file)),
+      std::istreambuf_iterator<char>());
+  assert(buffered_data == expected_data || !"wrong buffered data");
   return 0;
 }
@@ -0,0 +1,152 @@
+#include "module_snapshot.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#if __linux__
+#include <elf.h>
+#include <link.h>
+#endif
+
+#include <cerrno>
+#include <cstddef>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace iftracer {
+#if __linux__
+namespace {
+std::string hex_string(const uint8_t* data, size_t size) {
+  static const char digits[] = "0123456789abcdef";
+  std::string s;
+  for (size_t i = 0; i < size; i++) {
+    s += digits[data[i] >> 4];
+    s += digits[data[i] & 0xf];
+  }
+  return s;
+}
+
+std::string find_build_id(const struct dl_phdr_info* info) {
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+    if (phdr.p_type != PT_NOTE) {
+      continue;
+    }
+    const uint8_t* p =
+        reinterpret_cast<const uint8_t*>(info->dlpi_addr + phdr.p_vaddr);
+    const uint8_t* end = p + phdr.p_memsz;
+    while (p + sizeof(ElfW(Nhdr)) <= end) {
+      ElfW(Nhdr) nhdr;
+      memcpy(&nhdr, p, sizeof(nhdr));
+      const uint8_t* name = p + sizeof(nhdr);
+      const uint8_t* desc = name + ((nhdr.n_namesz + 3) & ~3);
+      p                   = desc + ((nhdr.n_descsz + 3) & ~3);
+      if (p > end) {
+        break;
+      }
+      if (nhdr.n_type == NT_GNU_BUILD_ID && nhdr.n_namesz == 4 &&
+          memcmp(name, "GNU", 4) == 0) {
+        return hex_string(desc, nhdr.n_descsz);
+      }
+    }
+  }
+  return "-";
+}
+
+std::string main_program_path() {
+  char buf[4096];
+  ssize_t n = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+  if (n <= 0) {
+    return "";
+  }
+  return std::string(buf, n);
+}
+
+struct SnapshotText {
+  std::string text;
+  int module_count = 0;
+};
+
+int append_module(struct dl_phdr_info* info, size_t size, void* data) {
+  SnapshotText& snapshot = *reinterpret_cast<SnapshotText*>(data);
+  std::string& text      = snapshot.text;
+  char buf[128];
+  std::string path(info->dlpi_name != nullptr ? info->dlpi_name : "");
+  // first entry is main program which has empty name
+  if (snapshot.module_count++ == 0 && path.empty()) {
+    path = main_program_path();
+  }
+  snprintf(buf, sizeof(buf), "module %" PRIxPTR " ",
+           static_cast<uintptr_t>(info->dlpi_addr));
+  text += buf + find_build_id(info) + " " + path + "\n";
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+    if (phdr.p_type != PT_LOAD) {
+      continue;
+    }
+    snprintf(buf, sizeof(buf), "segment %" PRIxPTR " %" PRIxPTR " %c%c%c\n",
+             static_cast<uintptr_t>(phdr.p_vaddr),
+             static_cast<uintptr_t>(phdr.p_memsz),
+             (phdr.p_flags & PF_R) ? 'r' : '-',
+             (phdr.p_flags & PF_W) ? 'w' : '-',
+             (phdr.p_flags & PF_X) ? 'x' : '-');
+    text += buf;
+  }
+  return 0;
+}
+}  // namespace
+
+bool WriteModuleSnapshot(const std::string& filename, uint64_t timestamp,
+                         bool truncate, std::string* error_message) {
+  SnapshotText snapshot;
+  snapshot.text = "snapshot " + std::to_string(timestamp) + "\n";
+  dl_iterate_phdr(append_module, &snapshot);
+  const std::string& text = snapshot.text;
+
+  int open_flag = O_CREAT | O_WRONLY | O_APPEND;
+  if (truncate) {
+    open_flag |= O_TRUNC;
+  }
+  int fd = open(filename.c_str(), open_flag, 0666);
+  if (fd < 0) {
+    *error_message = "WriteModuleSnapshot(): open():" +
+                     std::string(std::strerror(errno)) + ":" + filename;
+    return false;
+  }
+  // one write() per snapshot so that concurrent dlopen() do not interleave
+  ssize_t n = write(fd, text.data(), text.size());
+  bool ret  = n == static_cast<ssize_t>(text.size());
+  if (!ret) {
+    *error_message = "WriteModuleSnapshot(): write():" +
+                     std::string(std::strerror(errno)) + ":" + filename;
+  }
+  close(fd);
+  return ret;
+}
+
+uint64_t ModuleGeneration() {
+  uint64_t generation = 0;
+  // the counters are the same in all modules: only the first one is read
+  dl_iterate_phdr(
+      [](struct dl_phdr_info* info, size_t size, void* data) -> int {
+        if (size >= offsetof(struct dl_phdr_info, dlpi_subs) +
+                        sizeof(info->dlpi_subs)) {
+          *reinterpret_cast<uint64_t*>(data) =
+              info->dlpi_adds + info->dlpi_subs;
+        }
+        return 1;
+      },
+      &generation);
+  return generation;
+}
+#else
+bool WriteModuleSnapshot(const std::string& filename, uint64_t timestamp,
+                         bool truncate, std::string* error_message) {
+  // dl_iterate_phdr() is not available
+  return true;
+}
+
+uint64_t ModuleGeneration() { return 0; }
+#endif
+}  // namespace iftracer
@@ -0,0 +1,26 @@
+#ifndef MODULE_SNAPSHOT_HPP_INCLUDED
+#define MODULE_SNAPSHOT_HPP_INCLUDED
+
+#include <cstdint>
+#include <string>
+
+namespace iftracer {
+// append the list of loaded modules (dl_iterate_phdr) to filename
+//
+// text format (one snapshot is valid from its timestamp to the next one):
+//   snapshot <timestamp>
+//   module <load base(hex)> <gnu build-id(hex) or -> <path>
+//   segment <vaddr(hex)> <memsz(hex)> <flags(rwx)>
+//
+// timestamp is in the same clock ticks as trace files (trace_clock.hpp)
+// runtime address = load base + vaddr
+bool WriteModuleSnapshot(const std::string& filename, uint64_t timestamp,
+                         bool truncate, std::string* error_message);
+
+// count of dlopen()/dlclose() which changed the modules of the process
+// (dl_phdr_info::dlpi_adds + dlpi_subs, 0 if not available)
+// cheap enough to poll instead of interposing dlopen()
+uint64_t ModuleGeneration();
+}  // namespace iftracer
+
+#endif  // MODULE_SNAPSHOT_HPP_INCLUDED
@@ -0,0 +1,221 @@
+#include "munmap_service.hpp"
+
+#include <sys/mman.h>
+#if __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+namespace iftracer {
+namespace {
+// ranges retired at once
+constexpr size_t max_batch_size = 256;
+
+void update_max(std::atomic<uint64_t>* max, uint64_t value) {
+  uint64_t current = max->load(std::memory_order_relaxed);
+  while (current < value &&
+         !max->compare_exchange_weak(current, value,
+                                     std::memory_order_relaxed)) {
+  }
+}
+int default_unmap(void* addr, size_t length) { return munmap(addr, length); }
+}  // namespace
+
+MunmapService::MunmapService(size_t capacity, UnmapFunc unmap)
+    : capacity_([capacity]() {
+        size_t n = 2;
+        while (n < capacity) {
+          n *= 2;
+        }
+        return n;
+      }()),
+      mask_(capacity_ - 1),
+      unmap_(unmap != nullptr ? unmap : default_unmap),
+      slots_(new Slot[capacity_]) {
+  for (size_t i = 0; i < capacity_; i++) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  telemetry::Register(&worker_stats_);
+  worker_ = std::thread([this]() { Run(); });
+}
+
+MunmapService::~MunmapService() {
+  stop_flag_.store(true);
+  WakeWorker();
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+  telemetry::Unregister(&worker_stats_);
+}
+
+// bounded MPSC ring: a slot is writable when its sequence is the position
+// and readable when it is the position + 1
+int MunmapService::Post(void* addr, size_t length) {
+  posted_.fetch_add(1, std::memory_order_relaxed);
+  uint64_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  Slot* slot;
+  while (true) {
+    slot = &slots_[pos & mask_];
+    uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+    int64_t diff = static_cast<int64_t>(sequence - pos);
+    if (diff == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // full: the worker is behind, so pay the cost here
+      inline_unmapped_.fetch_add(1, std::memory_order_relaxed);
+      WakeWorker();
+      return unmap_(addr, length);
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  slot->addr    = addr;
+  slot->length  = length;
+  slot->post_ns = telemetry::NowNs();
+  slot->sequence.store(pos + 1, std::memory_order_release);
+  update_max(&max_depth_,
+             pos + 1 - done_.load(std::memory_order_relaxed));
+  // pairs with the fence in WaitForPost(): either the worker sees the slot
+  // or this thread sees sleeping_
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping_.load(std::memory_order_relaxed) != 0) {
+    WakeWorker();
+  }
+  return 0;
+}
+
+void MunmapService::Drain() {
+  uint64_t target = enqueue_pos_.load(std::memory_order_acquire);
+  std::unique_lock<std::mutex> lock(drain_mutex_);
+  drained_.wait(lock, [this, target]() {
+    return done_.load(std::memory_order_acquire) >= target;
+  });
+}
+
+MunmapService::Stats MunmapService::GetStats() const {
+  Stats stats;
+  stats.posted          = posted_.load(std::memory_order_relaxed);
+  stats.inline_unmapped = inline_unmapped_.load(std::memory_order_relaxed);
+  stats.retired         = retired_.load(std::memory_order_relaxed);
+  stats.unmap_calls     = unmap_calls_.load(std::memory_order_relaxed);
+  stats.failed_calls    = failed_calls_.load(std::memory_order_relaxed);
+  uint64_t enqueued     = enqueue_pos_.load(std::memory_order_relaxed);
+  uint64_t done         = done_.load(std::memory_order_relaxed);
+  stats.depth           = enqueued > done ? enqueued - done : 0;
+  stats.max_depth       = max_depth_.load(std::memory_order_relaxed);
+  stats.total_latency_ns = total_latency_ns_.load(std::memory_order_relaxed);
+  stats.max_latency_ns   = max_latency_ns_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+bool MunmapService::Pop(Range* range) {
+  Slot* slot = &slots_[dequeue_pos_ & mask_];
+  if (slot->sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+    return false;
+  }
+  range->addr    = reinterpret_cast<uintptr_t>(slot->addr);
+  range->length  = slot->length;
+  range->post_ns = slot->post_ns;
+  slot->sequence.store(dequeue_pos_ + capacity_, std::memory_order_release);
+  dequeue_pos_++;
+  return true;
+}
+
+void MunmapService::Run() {
+  std::vector<Range> ranges(max_batch_size);
+  while (true) {
+    size_t count = 0;
+    while (count < max_batch_size && Pop(&ranges[count])) {
+      count++;
+    }
+    if (count != 0) {
+      Retire(ranges.data(), count);
+      continue;
+    }
+    if (stop_flag_.load()) {
+      return;
+    }
+    WaitForPost();
+  }
+}
+
+void MunmapService::Retire(Range* ranges, size_t count) {
+  // flushes of a mapping are consecutive ranges
+  std::sort(ranges, ranges + count, [](const Range& a, const Range& b) {
+    return a.addr < b.addr;
+  });
+  size_t calls = 0;
+  for (size_t i = 0; i < count;) {
+    uintptr_t addr = ranges[i].addr;
+    size_t length  = ranges[i].length;
+    size_t j       = i + 1;
+    while (j < count && ranges[j].addr == addr + length) {
+      length += ranges[j].length;
+      j++;
+    }
+    if (unmap_(reinterpret_cast<void*>(addr), length) != 0) {
+      // no error handling (the pages are released at exit)
+      failed_calls_.fetch_add(1, std::memory_order_relaxed);
+    }
+    calls++;
+    uint64_t now = telemetry::NowNs();
+    uint64_t total_latency = 0;
+    for (; i < j; i++) {
+      uint64_t latency = now - ranges[i].post_ns;
+      total_latency += latency;
+      worker_stats_.Record(telemetry::async_munmap_latency, latency);
+      update_max(&max_latency_ns_, latency);
+    }
+    total_latency_ns_.fetch_add(total_latency, std::memory_order_relaxed);
+  }
+  unmap_calls_.fetch_add(calls, std::memory_order_relaxed);
+  retired_.fetch_add(count, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(drain_mutex_);
+    done_.fetch_add(count, std::memory_order_release);
+  }
+  drained_.notify_all();
+}
+
+void MunmapService::WaitForPost() {
+  sleeping_.store(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  Slot* slot = &slots_[dequeue_pos_ & mask_];
+  if (slot->sequence.load(std::memory_order_relaxed) == dequeue_pos_ + 1 ||
+      stop_flag_.load()) {
+    sleeping_.store(0, std::memory_order_relaxed);
+    return;
+  }
+#if __linux__
+  // returns at once if WakeWorker() has already cleared sleeping_
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&sleeping_),
+          FUTEX_WAIT_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+  std::unique_lock<std::mutex> lock(wake_mutex_);
+  wake_.wait(lock, [this]() {
+    return sleeping_.load(std::memory_order_relaxed) == 0;
+  });
+#endif
+  sleeping_.store(0, std::memory_order_relaxed);
+}
+
+void MunmapService::WakeWorker() {
+  if (sleeping_.exchange(0) == 0) {
+    return;
+  }
+#if __linux__
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&sleeping_),
+          FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+  { std::lock_guard<std::mutex> lock(wake_mutex_); }
+  wake_.notify_one();
+#endif
+}
+}  // namespace iftracer
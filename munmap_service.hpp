@@ -0,0 +1,115 @@
+#ifndef MUNMAP_SERVICE_HPP_INCLUDED
+#define MUNMAP_SERVICE_HPP_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "telemetry.hpp"
+
+namespace iftracer {
+// retire flushed pages of MmapWriter on a worker thread (IFTRACER_ASYNC_MUNMAP)
+//
+// Post() pushes the range into a bounded lock-free MPSC ring and wakes the
+// sleeping worker (futex), which drains the ring, sorts the ranges and
+// unmaps adjacent ones by a single call
+// when the ring is full the caller unmaps the range by itself (backpressure
+// without waiting for the worker)
+class MunmapService {
+ public:
+  using UnmapFunc = int (*)(void* addr, size_t length);
+
+  struct Stats {
+    // ranges passed to Post()
+    uint64_t posted = 0;
+    // ranges unmapped by the caller because the ring was full
+    uint64_t inline_unmapped = 0;
+    // ranges unmapped by the worker and the calls for them (coalesced)
+    uint64_t retired      = 0;
+    uint64_t unmap_calls  = 0;
+    uint64_t failed_calls = 0;
+    // ranges in the ring (now and max)
+    uint64_t depth     = 0;
+    uint64_t max_depth = 0;
+    // from Post() to the end of munmap() by the worker (the histogram is in
+    // telemetry::async_munmap_latency)
+    uint64_t total_latency_ns = 0;
+    uint64_t max_latency_ns   = 0;
+  };
+
+  // capacity is rounded up to a power of 2
+  // unmap: munmap() (replaceable for tests)
+  explicit MunmapService(size_t capacity = 1024, UnmapFunc unmap = nullptr);
+  // unmap the rest and stop the worker
+  ~MunmapService();
+  MunmapService(const MunmapService&) = delete;
+  MunmapService& operator=(const MunmapService&) = delete;
+
+  // same signature as munmap() (see MmapWriter::SetMunmapHook())
+  int Post(void* addr, size_t length);
+  // wait until all posted ranges are unmapped
+  void Drain();
+  Stats GetStats() const;
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> sequence;
+    void* addr;
+    size_t length;
+    uint64_t post_ns;
+  };
+  struct Range {
+    uintptr_t addr;
+    size_t length;
+    uint64_t post_ns;
+  };
+
+  void Run();
+  // false if the ring is empty
+  bool Pop(Range* range);
+  void WaitForPost();
+  void WakeWorker();
+  void Retire(Range* ranges, size_t count);
+
+  const size_t capacity_;
+  const size_t mask_;
+  UnmapFunc unmap_;
+  std::unique_ptr<Slot[]> slots_;
+  // producers and the consumer are on different cache lines
+  char padding0_[64];
+  std::atomic<uint64_t> enqueue_pos_{0};
+  char padding1_[64];
+  uint64_t dequeue_pos_ = 0;
+  // 1 while the worker sleeps (futex word)
+  std::atomic<uint32_t> sleeping_{0};
+  char padding2_[64];
+  std::atomic<bool> stop_flag_{false};
+  std::thread worker_;
+
+  // Drain() only
+  std::mutex drain_mutex_;
+  std::condition_variable drained_;
+  std::atomic<uint64_t> done_{0};
+#if !__linux__
+  std::mutex wake_mutex_;
+  std::condition_variable wake_;
+#endif
+
+  std::atomic<uint64_t> posted_{0};
+  std::atomic<uint64_t> inline_unmapped_{0};
+  std::atomic<uint64_t> retired_{0};
+  std::atomic<uint64_t> unmap_calls_{0};
+  std::atomic<uint64_t> failed_calls_{0};
+  std::atomic<uint64_t> max_depth_{0};
+  std::atomic<uint64_t> total_latency_ns_{0};
+  std::atomic<uint64_t> max_latency_ns_{0};
+  // written by the worker
+  telemetry::ThreadStats worker_stats_;
+};
+}  // namespace iftracer
+
+#endif  // MUNMAP_SERVICE_HPP_INCLUDED
@@ -0,0 +1,178 @@
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "munmap_service.hpp"
+
+namespace {
+const size_t page_size    = 4096;
+const int thread_num      = 4;
+const size_t range_num    = 20000;
+const size_t region_pages = range_num * 2;
+
+// pages are fake: count unmap of each page instead
+uintptr_t region_base = 0x100000000;
+std::vector<std::atomic<uint32_t>>* unmapped_pages;
+std::atomic<uint64_t> unmap_calls(0);
+// unmap of the first page waits until it is opened
+std::atomic<bool> gate_closed(false);
+std::atomic<bool> worker_blocked(false);
+
+int count_unmap(void* addr, size_t length) {
+  uintptr_t begin = reinterpret_cast<uintptr_t>(addr);
+  if (begin == region_base && gate_closed.load()) {
+    worker_blocked.store(true);
+    while (gate_closed.load()) {
+      std::this_thread::yield();
+    }
+  }
+  assert(begin % page_size == 0 && length % page_size == 0 && length > 0);
+  for (uintptr_t page = begin; page < begin + length; page += page_size) {
+    (*unmapped_pages)[(page - region_base) / page_size].fetch_add(1);
+  }
+  unmap_calls.fetch_add(1);
+  return 0;
+}
+
+// each thread flushes 1 or 2 pages at a time like MmapWriter::Flush()
+void post_ranges(iftracer::MunmapService* service, int id) {
+  uintptr_t addr = region_base + id * region_pages * page_size;
+  for (size_t i = 0; i < range_num; i++) {
+    size_t length = (i % 2 + 1) * page_size;
+    int ret       = service->Post(reinterpret_cast<void*>(addr), length);
+    assert(ret == 0);
+    (void)ret;
+    addr += length;
+  }
+}
+
+bool check_unmapped_once(size_t pages) {
+  for (size_t i = 0; i < pages; i++) {
+    if ((*unmapped_pages)[i].load() != 1) {
+      std::cerr << "page " << i << " is unmapped "
+                << (*unmapped_pages)[i].load() << " times" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+}  // namespace
+
+int main() {
+  const size_t total_pages = thread_num * region_pages;
+  // pages of each thread: 1 + 2 + 1 + 2 ...
+  const size_t posted_pages = thread_num * range_num / 2 * 3;
+
+  // small ring: producers overtake the worker and unmap by themselves
+  for (size_t capacity : {size_t(8), size_t(1024)}) {
+    std::vector<std::atomic<uint32_t>> pages(total_pages);
+    unmapped_pages = &pages;
+    unmap_calls.store(0);
+    iftracer::MunmapService::Stats stats;
+    {
+      iftracer::MunmapService service(capacity, count_unmap);
+      std::vector<std::thread> threads;
+      for (int i = 0; i < thread_num; i++) {
+        threads.emplace_back(post_ranges, &service, i);
+      }
+      for (std::thread& thread : threads) {
+        thread.join();
+      }
+      service.Drain();
+      stats = service.GetStats();
+    }
+    for (int i = 0; i < thread_num; i++) {
+      size_t offset = i * region_pages;
+      for (size_t j = 0; j < region_pages; j++) {
+        uint32_t count = pages[offset + j].load();
+        if (count != (j < posted_pages / thread_num ? 1u : 0u)) {
+          std::cerr << "thread " << i << " page " << j << " is unmapped "
+                    << count << " times (capacity " << capacity << ")"
+                    << std::endl;
+          return 1;
+        }
+      }
+    }
+    std::cout << "capacity " << capacity << ": posted " << stats.posted
+              << ", inline " << stats.inline_unmapped << ", retired "
+              << stats.retired << " by " << stats.unmap_calls
+              << " calls, max depth " << stats.max_depth << ", max latency "
+              << stats.max_latency_ns / 1000 << "us" << std::endl;
+    if (stats.posted != thread_num * range_num ||
+        stats.inline_unmapped + stats.retired != stats.posted ||
+        stats.depth != 0 || stats.max_depth > capacity ||
+        stats.failed_calls != 0 ||
+        stats.inline_unmapped + stats.unmap_calls != unmap_calls.load()) {
+      std::cerr << "wrong stats (capacity " << capacity << ")" << std::endl;
+      return 1;
+    }
+    // a batch contains consecutive ranges of the same thread
+    if (stats.retired > 0 && stats.unmap_calls > stats.retired) {
+      std::cerr << "more calls than ranges" << std::endl;
+      return 1;
+    }
+  }
+
+  {
+    // coalesced: ranges posted before the worker wakes up are unmapped once
+    std::vector<std::atomic<uint32_t>> pages(64);
+    unmapped_pages = &pages;
+    unmap_calls.store(0);
+    iftracer::MunmapService service(64, count_unmap);
+    // keep the worker busy so that the rest is queued in the ring
+    gate_closed.store(true);
+    service.Post(reinterpret_cast<void*>(region_base), page_size);
+    while (!worker_blocked.load()) {
+      std::this_thread::yield();
+    }
+    for (size_t i = 1; i < 64; i++) {
+      service.Post(reinterpret_cast<void*>(region_base + i * page_size),
+                   page_size);
+    }
+    gate_closed.store(false);
+    service.Drain();
+    iftracer::MunmapService::Stats stats = service.GetStats();
+    // the first range and the other 63 ranges
+    if (!check_unmapped_once(64) || stats.retired != 64 ||
+        stats.unmap_calls != 2) {
+      std::cerr << "not coalesced: " << stats.unmap_calls << " calls for "
+                << stats.retired << " ranges" << std::endl;
+      return 1;
+    }
+  }
+
+  {
+    // real munmap(): adjacent pages of a mapping
+    const size_t num = 256;
+    uint8_t* head    = static_cast<uint8_t*>(
+        mmap(nullptr, page_size * num, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    assert(head != MAP_FAILED);
+    iftracer::MunmapService service;
+    for (size_t i = 0; i < num; i++) {
+      head[i * page_size] = 1;
+      service.Post(head + i * page_size, page_size);
+    }
+    service.Drain();
+    iftracer::MunmapService::Stats stats = service.GetStats();
+    unsigned char vec;
+    // mincore() fails with ENOMEM for unmapped pages
+    for (size_t i = 0; i < num; i++) {
+      if (mincore(head + i * page_size, page_size, &vec) == 0) {
+        std::cerr << "page " << i << " is still mapped" << std::endl;
+        return 1;
+      }
+    }
+    if (stats.failed_calls != 0 || stats.posted != num) {
+      std::cerr << "failed to munmap" << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
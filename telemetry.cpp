@@ -0,0 +1,196 @@
+#include "telemetry.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace iftracer {
+namespace telemetry {
+namespace {
+class Registry {
+ public:
+  void Register(ThreadStats* stats) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    live_.push_back(stats);
+  }
+  void Unregister(ThreadStats* stats) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    live_.erase(std::remove(live_.begin(), live_.end(), stats), live_.end());
+    stats->Load(&retired_);
+  }
+  void Collect(Snapshot* snapshot) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshot->Merge(retired_);
+    for (ThreadStats* stats : live_) {
+      stats->Load(snapshot);
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<ThreadStats*> live_;
+  // totals of exited threads
+  Snapshot retired_;
+};
+// NOTE: never destroyed because thread_local loggers are destroyed after
+// static variables of the main thread
+Registry& get_registry() {
+  static Registry* registry = new Registry();
+  return *registry;
+}
+}  // namespace
+
+const char* CounterName(Counter counter) {
+  switch (counter) {
+    case events:
+      return "events";
+    case bytes:
+      return "bytes";
+    case dropped_events:
+      return "dropped_events";
+    case cpu_id_lookups:
+      return "cpu_id_lookups";
+    default:
+      return "unknown";
+  }
+}
+const char* LatencyName(Latency latency) {
+  switch (latency) {
+    case prepare_write_latency:
+      return "prepare_write";
+    case flush_latency:
+      return "flush";
+    case async_munmap_latency:
+      return "async_munmap";
+    default:
+      return "unknown";
+  }
+}
+
+void Histogram::Merge(const Histogram& other) {
+  count += other.count;
+  total_ns += other.total_ns;
+  max_ns = std::max(max_ns, other.max_ns);
+  for (int i = 0; i < histogram_buckets; i++) {
+    buckets[i] += other.buckets[i];
+  }
+}
+
+uint64_t Histogram::Percentile(double quantile) const {
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(quantile * count);
+  uint64_t sum  = 0;
+  for (int i = 0; i < histogram_buckets; i++) {
+    sum += buckets[i];
+    if (sum > rank) {
+      // the last bucket has no upper bound
+      if (i + 1 == histogram_buckets) {
+        return max_ns;
+      }
+      return std::min<uint64_t>(max_ns, (2ULL << i) - 1);
+    }
+  }
+  return max_ns;
+}
+
+void Snapshot::Merge(const Snapshot& other) {
+  for (int i = 0; i < counter_count; i++) {
+    counters[i] += other.counters[i];
+  }
+  for (int i = 0; i < latency_count; i++) {
+    latencies[i].Merge(other.latencies[i]);
+  }
+}
+
+uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+ThreadStats::ThreadStats() { Reset(); }
+
+void ThreadStats::Reset() {
+  for (std::atomic<uint64_t>& counter : counters_) {
+    Store(&counter, 0);
+  }
+  for (AtomicHistogram& histogram : latencies_) {
+    Store(&histogram.count, 0);
+    Store(&histogram.total_ns, 0);
+    Store(&histogram.max_ns, 0);
+    for (std::atomic<uint64_t>& bucket : histogram.buckets) {
+      Store(&bucket, 0);
+    }
+  }
+}
+
+void ThreadStats::Load(Snapshot* snapshot) const {
+  for (int i = 0; i < counter_count; i++) {
+    snapshot->counters[i] += Load(counters_[i]);
+  }
+  for (int i = 0; i < latency_count; i++) {
+    Histogram histogram;
+    histogram.count    = Load(latencies_[i].count);
+    histogram.total_ns = Load(latencies_[i].total_ns);
+    histogram.max_ns   = Load(latencies_[i].max_ns);
+    for (int j = 0; j < histogram_buckets; j++) {
+      histogram.buckets[j] = Load(latencies_[i].buckets[j]);
+    }
+    snapshot->latencies[i].Merge(histogram);
+  }
+}
+
+void Register(ThreadStats* stats) { get_registry().Register(stats); }
+void Unregister(ThreadStats* stats) { get_registry().Unregister(stats); }
+void Collect(Snapshot* snapshot) { get_registry().Collect(snapshot); }
+
+bool WriteSnapshot(const std::string& filename, const Snapshot& snapshot,
+                   std::string* error_message) {
+  std::ofstream ofs(filename, std::ios::out | std::ios::trunc);
+  if (!ofs) {
+    *error_message = "WriteSnapshot(): open():" +
+                     std::string(std::strerror(errno)) + ":" + filename;
+    return false;
+  }
+  ofs << "{\"counters\": {";
+  for (int i = 0; i < counter_count; i++) {
+    ofs << (i == 0 ? "" : ", ") << "\""
+        << CounterName(static_cast<Counter>(i))
+        << "\": " << snapshot.counters[i];
+  }
+  ofs << "},\n \"latencies\": {";
+  for (int i = 0; i < latency_count; i++) {
+    const Histogram& histogram = snapshot.latencies[i];
+    ofs << (i == 0 ? "" : ",\n  ") << "\""
+        << LatencyName(static_cast<Latency>(i)) << "\": {"
+        << "\"count\": " << histogram.count
+        << ", \"total_ns\": " << histogram.total_ns
+        << ", \"max_ns\": " << histogram.max_ns
+        << ", \"p50_ns\": " << histogram.Percentile(0.5)
+        << ", \"p99_ns\": " << histogram.Percentile(0.99)
+        << ", \"p999_ns\": " << histogram.Percentile(0.999)
+        << ", \"buckets\": [";
+    int end = histogram_buckets;
+    while (end > 0 && histogram.buckets[end - 1] == 0) {
+      end--;
+    }
+    for (int j = 0; j < end; j++) {
+      ofs << (j == 0 ? "" : ", ") << histogram.buckets[j];
+    }
+    ofs << "]}";
+  }
+  ofs << "}}\n";
+  if (!ofs) {
+    *error_message = "WriteSnapshot(): write():" + filename;
+    return false;
+  }
+  return true;
+}
+}  // namespace telemetry
+}  // namespace iftracer
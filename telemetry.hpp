@@ -0,0 +1,136 @@
+#ifndef TELEMETRY_HPP_INCLUDED
+#define TELEMETRY_HPP_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// self-telemetry: counters and latency histograms of the tracer itself
+//
+// each thread owns a ThreadStats which only the thread writes (relaxed load
+// and store, no locked instruction on the hot path) and any thread reads
+// ThreadStats are registered while the thread is alive and merged into the
+// process totals when it exits (the registry lock is taken only then and at
+// Collect())
+namespace iftracer {
+namespace telemetry {
+enum Counter {
+  // records written to trace files (including extend events)
+  events,
+  // bytes written to trace files (updated at extension, flush and exit)
+  bytes,
+  // events lost because the buffer could not be extended
+  dropped_events,
+  // cpu id reads for cpu_migration events
+  cpu_id_lookups,
+  counter_count,
+};
+enum Latency {
+  // extension of the buffer (remap, next chunk or next ring segment)
+  prepare_write_latency,
+  // Flush() called by the hook (synchronous munmap() of MmapWriter)
+  flush_latency,
+  // from MunmapService::Post() to the end of munmap() by the worker
+  async_munmap_latency,
+  latency_count,
+};
+const char* CounterName(Counter counter);
+const char* LatencyName(Latency latency);
+
+// log2 buckets of nanoseconds: buckets[i] counts [2^i, 2^(i+1)) ns
+// (buckets[0] also counts 0 and the last one counts the rest)
+constexpr int histogram_buckets = 32;
+inline int BucketIndex(uint64_t ns) {
+  if (ns < 2) {
+    return 0;
+  }
+  int index = 63 - __builtin_clzll(ns);
+  return index < histogram_buckets ? index : histogram_buckets - 1;
+}
+
+struct Histogram {
+  uint64_t count                      = 0;
+  uint64_t total_ns                   = 0;
+  uint64_t max_ns                     = 0;
+  uint64_t buckets[histogram_buckets] = {};
+
+  void Merge(const Histogram& other);
+  // upper bound of the bucket of the quantile (0 if empty)
+  uint64_t Percentile(double quantile) const;
+};
+
+struct Snapshot {
+  uint64_t counters[counter_count] = {};
+  Histogram latencies[latency_count];
+
+  void Merge(const Snapshot& other);
+};
+
+uint64_t NowNs();
+
+class ThreadStats {
+ public:
+  ThreadStats();
+  ThreadStats(const ThreadStats&) = delete;
+  ThreadStats& operator=(const ThreadStats&) = delete;
+
+  // NOTE: called only by the owner thread
+  void Add(Counter counter, uint64_t n = 1) {
+    Store(&counters_[counter], Load(counters_[counter]) + n);
+  }
+  void Sub(Counter counter, uint64_t n = 1) {
+    Store(&counters_[counter], Load(counters_[counter]) - n);
+  }
+  void Record(Latency latency, uint64_t ns) {
+    AtomicHistogram& histogram    = latencies_[latency];
+    std::atomic<uint64_t>& bucket = histogram.buckets[BucketIndex(ns)];
+    Store(&bucket, Load(bucket) + 1);
+    Store(&histogram.count, Load(histogram.count) + 1);
+    Store(&histogram.total_ns, Load(histogram.total_ns) + ns);
+    if (ns > Load(histogram.max_ns)) {
+      Store(&histogram.max_ns, ns);
+    }
+  }
+  void Reset();
+  // add the values to snapshot (called by any thread)
+  void Load(Snapshot* snapshot) const;
+
+ private:
+  struct AtomicHistogram {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> max_ns;
+    std::atomic<uint64_t> buckets[histogram_buckets];
+  };
+  static uint64_t Load(const std::atomic<uint64_t>& value) {
+    return value.load(std::memory_order_relaxed);
+  }
+  static void Store(std::atomic<uint64_t>* value, uint64_t n) {
+    value->store(n, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> counters_[counter_count];
+  AtomicHistogram latencies_[latency_count];
+};
+
+// stats are summed by Collect() while registered
+void Register(ThreadStats* stats);
+// merge stats into the totals of exited threads (also for unregistered ones)
+// NOTE: stats must not be written after this call
+void Unregister(ThreadStats* stats);
+// totals of exited threads and the current values of the others
+void Collect(Snapshot* snapshot);
+
+// write snapshot to filename as a json object
+//   {"counters": {"events": 1, ...},
+//    "latencies": {"prepare_write": {"count": 1, "total_ns": 1,
+//                  "max_ns": 1, "p50_ns": 1, "p99_ns": 1, "p999_ns": 1,
+//                  "buckets": [0, 1, ...]}, ...}}
+// buckets are trimmed after the last non-zero one
+bool WriteSnapshot(const std::string& filename, const Snapshot& snapshot,
+                   std::string* error_message);
+}  // namespace telemetry
+}  // namespace iftracer
+
+#endif  // TELEMETRY_HPP_INCLUDED
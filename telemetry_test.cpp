@@ -0,0 +1,107 @@
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "telemetry.hpp"
+
+namespace {
+const int thread_num      = 4;
+const uint64_t record_num = 100000;
+std::atomic<bool> collecting(true);
+
+void record(int id) {
+  iftracer::telemetry::ThreadStats stats;
+  iftracer::telemetry::Register(&stats);
+  for (uint64_t i = 0; i < record_num; i++) {
+    stats.Add(iftracer::telemetry::events);
+    // 1ns .. 2^(id + 10)ns
+    stats.Record(iftracer::telemetry::flush_latency,
+                 i % 2 == 0 ? 1 : 1ULL << (id + 10));
+  }
+  iftracer::telemetry::Unregister(&stats);
+}
+}  // namespace
+
+int main() {
+  using iftracer::telemetry::BucketIndex;
+  assert(BucketIndex(0) == 0 && BucketIndex(1) == 0 && BucketIndex(2) == 1 &&
+         BucketIndex(3) == 1 && BucketIndex(1023) == 9 &&
+         BucketIndex(1024) == 10 && BucketIndex(UINT64_MAX) == 31);
+
+  // live values are read while threads are writing
+  uint64_t pre_events = 0;
+  std::thread collector([&pre_events]() {
+    while (collecting.load()) {
+      iftracer::telemetry::Snapshot snapshot;
+      iftracer::telemetry::Collect(&snapshot);
+      uint64_t events = snapshot.counters[iftracer::telemetry::events];
+      assert(events <= thread_num * record_num);
+      // exited threads keep their values
+      assert(events >= pre_events || !"events decreased");
+      pre_events = events;
+    }
+  });
+  std::vector<std::thread> threads;
+  for (int i = 0; i < thread_num; i++) {
+    threads.emplace_back(record, i);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  collecting.store(false);
+  collector.join();
+
+  iftracer::telemetry::Snapshot snapshot;
+  iftracer::telemetry::Collect(&snapshot);
+  const iftracer::telemetry::Histogram& flush =
+      snapshot.latencies[iftracer::telemetry::flush_latency];
+  if (snapshot.counters[iftracer::telemetry::events] !=
+          thread_num * record_num ||
+      flush.count != thread_num * record_num ||
+      flush.buckets[0] != thread_num * record_num / 2 ||
+      flush.max_ns != 1ULL << (thread_num + 9)) {
+    std::cerr << "wrong totals: events "
+              << snapshot.counters[iftracer::telemetry::events]
+              << ", latencies " << flush.count << std::endl;
+    return 1;
+  }
+  for (int i = 0; i < thread_num; i++) {
+    if (flush.buckets[i + 10] != record_num / 2) {
+      std::cerr << "wrong bucket " << i + 10 << std::endl;
+      return 1;
+    }
+  }
+  // half of them are 1ns and the slowest thread is the last 1/8
+  if (flush.Percentile(0.4) != 1 ||
+      flush.Percentile(0.99) != flush.max_ns) {
+    std::cerr << "wrong percentile: p40 " << flush.Percentile(0.4)
+              << ", p99 " << flush.Percentile(0.99) << std::endl;
+    return 1;
+  }
+
+  std::string filename = "telemetry_test.stats";
+  std::string error_message;
+  if (!iftracer::telemetry::WriteSnapshot(filename, snapshot,
+                                          &error_message)) {
+    std::cerr << error_message << std::endl;
+    return 1;
+  }
+  std::ifstream ifs(filename);
+  std::string json((std::istreambuf_iterator<char>(ifs)),
+                   std::istreambuf_iterator<char>());
+  if (json.find("\"events\": " + std::to_string(thread_num * record_num)) ==
+          std::string::npos ||
+      json.find("\"flush\": {\"count\": " +
+                std::to_string(thread_num * record_num)) ==
+          std::string::npos) {
+    std::cerr << "wrong json: " << json << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,330 @@
+#include "call_tree.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include "proto_writer.hpp"
+
+namespace iftracer {
+namespace {
+// depth first traversal of the nodes
+// enter(node) is called before the children and leave(node) after them
+template <class Enter, class Leave>
+void traverse(const CallTree& tree, Enter enter, Leave leave) {
+  const std::vector<CallTree::Node>& nodes = tree.Nodes();
+  std::vector<std::vector<uint32_t>> children(nodes.size());
+  for (uint32_t i = 1; i < nodes.size(); i++) {
+    children[nodes[i].parent].push_back(i);
+  }
+  // (node, index of the next child)
+  std::vector<std::pair<uint32_t, size_t>> stack;
+  stack.emplace_back(CallTree::root, 0);
+  while (!stack.empty()) {
+    uint32_t node = stack.back().first;
+    size_t index  = stack.back().second++;
+    if (index < children[node].size()) {
+      uint32_t child = children[node][index];
+      enter(child);
+      stack.emplace_back(child, 0);
+      continue;
+    }
+    if (node != CallTree::root) {
+      leave(node);
+    }
+    stack.pop_back();
+  }
+}
+
+// fields of pprof profile.proto
+namespace pprof {
+constexpr uint32_t profile_sample_type         = 1;
+constexpr uint32_t profile_sample              = 2;
+constexpr uint32_t profile_location            = 4;
+constexpr uint32_t profile_function            = 5;
+constexpr uint32_t profile_string_table        = 6;
+constexpr uint32_t profile_default_sample_type = 14;
+constexpr uint32_t value_type_type             = 1;
+constexpr uint32_t value_type_unit             = 2;
+constexpr uint32_t sample_location_id          = 1;
+constexpr uint32_t sample_value                = 2;
+constexpr uint32_t location_id                 = 1;
+constexpr uint32_t location_line               = 4;
+constexpr uint32_t line_function_id            = 1;
+constexpr uint32_t line_line                   = 2;
+constexpr uint32_t function_id                 = 1;
+constexpr uint32_t function_name               = 2;
+constexpr uint32_t function_system_name        = 3;
+constexpr uint32_t function_filename           = 4;
+constexpr uint32_t function_start_line         = 5;
+}  // namespace pprof
+
+class StringTable {
+ public:
+  StringTable() { Intern(""); }
+  uint64_t Intern(const std::string& s) {
+    auto it = indexes_.find(s);
+    if (it != indexes_.end()) {
+      return it->second;
+    }
+    strings_.push_back(s);
+    return indexes_[s] = strings_.size() - 1;
+  }
+  const std::vector<std::string>& Strings() const { return strings_; }
+
+ private:
+  std::vector<std::string> strings_;
+  std::unordered_map<std::string, uint64_t> indexes_;
+};
+}  // namespace
+
+constexpr uint32_t CallTree::root;
+
+CallTree::CallTree() { nodes_.emplace_back(); }
+
+uint32_t CallTree::AddFunction(const Function& function) {
+  std::string key = function.name + '\0' + function.file;
+  auto it         = function_indexes_.find(key);
+  if (it != function_indexes_.end()) {
+    return it->second;
+  }
+  uint32_t index = functions_.size();
+  functions_.push_back(function);
+  function_indexes_.emplace(std::move(key), index);
+  return index;
+}
+
+uint32_t CallTree::Child(uint32_t parent, uint32_t function) {
+  auto it = children_.find(ChildKey(parent, function));
+  if (it != children_.end()) {
+    return it->second;
+  }
+  uint32_t index = nodes_.size();
+  Node node;
+  node.function = function;
+  node.parent   = parent;
+  nodes_.push_back(node);
+  children_.emplace(ChildKey(parent, function), index);
+  return index;
+}
+
+void CallTree::Record(uint32_t node, uint64_t total_ns, uint64_t self_ns) {
+  Node& n = nodes_[node];
+  n.calls++;
+  n.total_ns += total_ns;
+  n.self_ns += self_ns;
+  n.min_ns = std::min(n.min_ns, total_ns);
+  n.max_ns = std::max(n.max_ns, total_ns);
+}
+
+void CallTree::Merge(const CallTree& other) {
+  std::vector<uint32_t> function_map(other.functions_.size());
+  for (size_t i = 0; i < other.functions_.size(); i++) {
+    function_map[i] = AddFunction(other.functions_[i]);
+  }
+  // parents are mapped before their children
+  std::vector<uint32_t> node_map(other.nodes_.size(), root);
+  for (size_t i = 1; i < other.nodes_.size(); i++) {
+    const Node& o = other.nodes_[i];
+    node_map[i]   = Child(node_map[o.parent], function_map[o.function]);
+    Node& n       = nodes_[node_map[i]];
+    n.calls += o.calls;
+    n.total_ns += o.total_ns;
+    n.self_ns += o.self_ns;
+    n.min_ns = std::min(n.min_ns, o.min_ns);
+    n.max_ns = std::max(n.max_ns, o.max_ns);
+  }
+}
+
+void CallTreeBuilder::Enter(uint64_t ns, uint32_t function) {
+  uint32_t parent = stack_.empty() ? CallTree::root : stack_.back().node;
+  Frame frame;
+  frame.node        = tree_->Child(parent, function);
+  frame.enter_ns    = ns;
+  frame.children_ns = 0;
+  // the rest of the enter hook after the timestamp
+  frame.hooks = 1;
+  stack_.push_back(frame);
+}
+
+void CallTreeBuilder::Exit(uint64_t ns) {
+  if (stack_.empty()) {
+    return;
+  }
+  Frame frame = stack_.back();
+  stack_.pop_back();
+  uint64_t duration = ns > frame.enter_ns ? ns - frame.enter_ns : 0;
+  uint64_t overhead = static_cast<uint64_t>(
+      static_cast<unsigned __int128>(frame.hooks) * hook_overhead_ps_ / 1000);
+  duration = duration > overhead ? duration - overhead : 0;
+  uint64_t self =
+      duration > frame.children_ns ? duration - frame.children_ns : 0;
+  tree_->Record(frame.node, duration, self);
+  if (!stack_.empty()) {
+    stack_.back().children_ns += duration;
+    // the hooks of the call and its exit
+    stack_.back().hooks += frame.hooks + 1;
+  }
+}
+
+void CallTreeBuilder::Finish(uint64_t ns) {
+  while (!stack_.empty()) {
+    Exit(ns);
+  }
+}
+
+std::vector<FlatProfileEntry> FlatProfile(const CallTree& tree,
+                                          bool sort_by_self) {
+  const std::vector<CallTree::Node>& nodes = tree.Nodes();
+  std::vector<FlatProfileEntry> entries(tree.Functions().size());
+  for (uint32_t i = 0; i < entries.size(); i++) {
+    entries[i].function = i;
+  }
+  // frames of each function on the current path
+  std::vector<uint32_t> active(entries.size(), 0);
+  traverse(
+      tree,
+      [&](uint32_t index) {
+        const CallTree::Node& node = nodes[index];
+        FlatProfileEntry& entry    = entries[node.function];
+        if (active[node.function]++ == 0) {
+          entry.inclusive_ns += node.total_ns;
+        }
+        entry.calls += node.calls;
+        entry.self_ns += node.self_ns;
+        entry.total_ns += node.total_ns;
+        entry.min_ns = std::min(entry.min_ns, node.min_ns);
+        entry.max_ns = std::max(entry.max_ns, node.max_ns);
+      },
+      [&](uint32_t index) { active[nodes[index].function]--; });
+  entries.erase(std::remove_if(entries.begin(), entries.end(),
+                               [](const FlatProfileEntry& entry) {
+                                 return entry.calls == 0;
+                               }),
+                entries.end());
+  std::stable_sort(entries.begin(), entries.end(),
+                   [sort_by_self](const FlatProfileEntry& a,
+                                  const FlatProfileEntry& b) {
+                     return sort_by_self ? a.self_ns > b.self_ns
+                                         : a.inclusive_ns > b.inclusive_ns;
+                   });
+  return entries;
+}
+
+void WriteFlatProfile(const CallTree& tree, bool sort_by_self,
+                      OutputBuffer* out) {
+  out->Append(
+      "calls\tinclusive_ns\tself_ns\tmin_ns\tmax_ns\tmean_ns\tfunction\t"
+      "file\n");
+  for (const FlatProfileEntry& entry : FlatProfile(tree, sort_by_self)) {
+    const CallTree::Function& function = tree.Functions()[entry.function];
+    out->AppendUint(entry.calls);
+    out->Append('\t');
+    out->AppendUint(entry.inclusive_ns);
+    out->Append('\t');
+    out->AppendUint(entry.self_ns);
+    out->Append('\t');
+    out->AppendUint(entry.min_ns);
+    out->Append('\t');
+    out->AppendUint(entry.max_ns);
+    out->Append('\t');
+    out->AppendUint(entry.MeanNs());
+    out->Append('\t');
+    out->Append(function.name);
+    out->Append('\t');
+    if (!function.file.empty()) {
+      out->Append(function.file);
+      out->Append(':');
+      out->AppendUint(function.line);
+    }
+    out->Append('\n');
+  }
+}
+
+void WriteFoldedStacks(const CallTree& tree, OutputBuffer* out) {
+  const std::vector<CallTree::Node>& nodes = tree.Nodes();
+  std::string path;
+  std::vector<size_t> path_sizes;
+  traverse(
+      tree,
+      [&](uint32_t index) {
+        const CallTree::Node& node = nodes[index];
+        path_sizes.push_back(path.size());
+        if (!path.empty()) {
+          path += ';';
+        }
+        path += tree.Functions()[node.function].name;
+        if (node.self_ns == 0) {
+          return;
+        }
+        out->Append(path);
+        out->Append(' ');
+        out->AppendUint(node.self_ns);
+        out->Append('\n');
+      },
+      [&](uint32_t) {
+        path.resize(path_sizes.back());
+        path_sizes.pop_back();
+      });
+}
+
+void WritePprof(const CallTree& tree, OutputBuffer* out) {
+  const std::vector<CallTree::Node>& nodes = tree.Nodes();
+  ProtoWriter profile;
+  StringTable strings;
+  const char* sample_types[][2] = {{"calls", "count"},
+                                   {"time", "nanoseconds"}};
+  for (auto& sample_type : sample_types) {
+    profile.BeginMessage(pprof::profile_sample_type);
+    profile.AppendVarint(pprof::value_type_type,
+                         strings.Intern(sample_type[0]));
+    profile.AppendVarint(pprof::value_type_unit,
+                         strings.Intern(sample_type[1]));
+    profile.EndMessage();
+  }
+  profile.AppendVarint(pprof::profile_default_sample_type,
+                       strings.Intern("time"));
+
+  // location id and function id are function index + 1
+  std::vector<uint64_t> location_ids;
+  for (uint32_t i = 1; i < nodes.size(); i++) {
+    if (nodes[i].calls == 0) {
+      continue;
+    }
+    // leaf first
+    location_ids.clear();
+    for (uint32_t node = i; node != CallTree::root;
+         node          = nodes[node].parent) {
+      location_ids.push_back(nodes[node].function + 1);
+    }
+    profile.BeginMessage(pprof::profile_sample);
+    profile.AppendPackedVarints(pprof::sample_location_id, location_ids);
+    profile.AppendPackedVarints(pprof::sample_value,
+                                {nodes[i].calls, nodes[i].self_ns});
+    profile.EndMessage();
+  }
+  const std::vector<CallTree::Function>& functions = tree.Functions();
+  for (uint64_t i = 0; i < functions.size(); i++) {
+    profile.BeginMessage(pprof::profile_location);
+    profile.AppendVarint(pprof::location_id, i + 1);
+    profile.BeginMessage(pprof::location_line);
+    profile.AppendVarint(pprof::line_function_id, i + 1);
+    profile.AppendVarint(pprof::line_line, functions[i].line);
+    profile.EndMessage();
+    profile.EndMessage();
+
+    profile.BeginMessage(pprof::profile_function);
+    profile.AppendVarint(pprof::function_id, i + 1);
+    uint64_t name = strings.Intern(functions[i].name);
+    profile.AppendVarint(pprof::function_name, name);
+    profile.AppendVarint(pprof::function_system_name, name);
+    profile.AppendVarint(pprof::function_filename,
+                         strings.Intern(functions[i].file));
+    profile.AppendVarint(pprof::function_start_line, functions[i].line);
+    profile.EndMessage();
+  }
+  for (const std::string& s : strings.Strings()) {
+    profile.AppendString(pprof::profile_string_table, s);
+  }
+  out->Append(profile.Data(), profile.Size());
+}
+}  // namespace iftracer
@@ -0,0 +1,119 @@
+#ifndef CALL_TREE_HPP_INCLUDED
+#define CALL_TREE_HPP_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "output_buffer.hpp"
+
+namespace iftracer {
+// calls aggregated by call path
+// memory is proportional to the number of distinct paths, not of calls
+class CallTree {
+ public:
+  struct Function {
+    std::string name;
+    // empty if unknown
+    std::string file;
+    uint32_t line = 0;
+  };
+  struct Node {
+    uint32_t function = 0;
+    uint32_t parent   = 0;
+    uint64_t calls    = 0;
+    // sum of the durations of the calls
+    uint64_t total_ns = 0;
+    // total_ns without the calls of the children
+    uint64_t self_ns = 0;
+    uint64_t min_ns  = UINT64_MAX;
+    uint64_t max_ns  = 0;
+  };
+  // nodes[root] is the virtual root of the threads
+  // (a node is always after its parent)
+  static constexpr uint32_t root = 0;
+
+  CallTree();
+
+  // index of the function (same name and file are one function)
+  uint32_t AddFunction(const Function& function);
+  // node of function called from parent (created at first call)
+  uint32_t Child(uint32_t parent, uint32_t function);
+  // one call of node
+  void Record(uint32_t node, uint64_t total_ns, uint64_t self_ns);
+  // add other to this tree (functions are matched by name and file)
+  void Merge(const CallTree& other);
+
+  const std::vector<Function>& Functions() const { return functions_; }
+  const std::vector<Node>& Nodes() const { return nodes_; }
+
+ private:
+  static uint64_t ChildKey(uint32_t parent, uint32_t function) {
+    return (static_cast<uint64_t>(parent) << 32) | function;
+  }
+
+  std::vector<Function> functions_;
+  // name + '\0' + file -> function index
+  std::unordered_map<std::string, uint32_t> function_indexes_;
+  std::vector<Node> nodes_;
+  // ChildKey() -> node index
+  std::unordered_map<uint64_t, uint32_t> children_;
+};
+
+// replay enter/exit of one thread into a CallTree
+class CallTreeBuilder {
+ public:
+  // hook_overhead_ps: format::FileHeader::hook_overhead_ps (0: as recorded)
+  // a duration excludes the hooks of the descendants and the own enter hook
+  explicit CallTreeBuilder(CallTree* tree, uint32_t hook_overhead_ps = 0)
+      : tree_(tree), hook_overhead_ps_(hook_overhead_ps) {}
+
+  void Enter(uint64_t ns, uint32_t function);
+  // exits without enter (the trace began in the function) are ignored
+  void Exit(uint64_t ns);
+  // exit the functions which are still running at ns (end of the thread)
+  void Finish(uint64_t ns);
+
+ private:
+  struct Frame {
+    uint32_t node;
+    uint64_t enter_ns;
+    uint64_t children_ns;
+    // hooks between the enter and the exit
+    uint64_t hooks;
+  };
+  CallTree* tree_;
+  uint32_t hook_overhead_ps_;
+  std::vector<Frame> stack_;
+};
+
+// per function statistics of a CallTree
+struct FlatProfileEntry {
+  uint32_t function = 0;
+  uint64_t calls    = 0;
+  // time on the stack (nested calls of recursion are counted once)
+  uint64_t inclusive_ns = 0;
+  uint64_t self_ns      = 0;
+  // duration of one call
+  uint64_t min_ns   = UINT64_MAX;
+  uint64_t max_ns   = 0;
+  uint64_t total_ns = 0;
+  uint64_t MeanNs() const { return calls == 0 ? 0 : total_ns / calls; }
+};
+// sorted by inclusive_ns (or self_ns) in descending order
+std::vector<FlatProfileEntry> FlatProfile(const CallTree& tree,
+                                          bool sort_by_self = false);
+
+// tsv: calls, inclusive_ns, self_ns, min_ns, max_ns, mean_ns, function, file
+void WriteFlatProfile(const CallTree& tree, bool sort_by_self,
+                      OutputBuffer* out);
+// "root;...;leaf self_ns" lines for flamegraph.pl (paths without self time
+// are omitted)
+void WriteFoldedStacks(const CallTree& tree, OutputBuffer* out);
+// pprof profile.proto (not gzipped) with "calls" and "time" sample values
+// (one sample per path)
+void WritePprof(const CallTree& tree, OutputBuffer* out);
+}  // namespace iftracer
+
+#endif  // CALL_TREE_HPP_INCLUDED
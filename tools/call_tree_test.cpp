@@ -0,0 +1,130 @@
+#include <unistd.h>
+
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "call_tree.hpp"
+
+namespace {
+iftracer::CallTree::Function function(const std::string& name) {
+  iftracer::CallTree::Function f;
+  f.name = name;
+  f.file = "/src/" + name + ".cpp";
+  f.line = 1;
+  return f;
+}
+
+std::string read_file(const std::string& filename) {
+  std::ifstream ifs(filename);
+  return std::string((std::istreambuf_iterator<char>(ifs)),
+                     std::istreambuf_iterator<char>());
+}
+}  // namespace
+
+int main() {
+  // thread a: main -> f -> f (recursion), main -> g
+  iftracer::CallTree a;
+  uint32_t a_main = a.AddFunction(function("main"));
+  uint32_t a_f    = a.AddFunction(function("f"));
+  uint32_t a_g    = a.AddFunction(function("g"));
+  iftracer::CallTreeBuilder a_builder(&a);
+  a_builder.Enter(0, a_main);
+  a_builder.Enter(10, a_f);
+  a_builder.Enter(20, a_f);
+  a_builder.Exit(30);
+  a_builder.Exit(50);
+  a_builder.Enter(60, a_g);
+  a_builder.Exit(70);
+  a_builder.Exit(100);
+  a_builder.Finish(100);
+
+  // thread b: began inside a function and ended inside main
+  iftracer::CallTree b;
+  uint32_t b_g    = b.AddFunction(function("g"));
+  uint32_t b_main = b.AddFunction(function("main"));
+  iftracer::CallTreeBuilder b_builder(&b);
+  b_builder.Exit(0);
+  b_builder.Enter(0, b_main);
+  b_builder.Enter(0, b_g);
+  b_builder.Exit(5);
+  b_builder.Finish(20);
+
+  iftracer::CallTree tree;
+  tree.Merge(a);
+  tree.Merge(b);
+  assert(tree.Functions().size() == 3 || !"functions are not merged");
+  // root, main, main;f, main;f;f, main;g
+  assert(tree.Nodes().size() == 5 || !"paths are not merged");
+
+  std::vector<iftracer::FlatProfileEntry> entries = iftracer::FlatProfile(tree);
+  struct Expected {
+    std::string name;
+    uint64_t calls, inclusive_ns, self_ns, min_ns, max_ns, mean_ns;
+  } expected[] = {
+      {"main", 2, 120, 65, 20, 100, 60},
+      {"f", 2, 40, 40, 10, 40, 25},
+      {"g", 2, 15, 15, 5, 10, 7},
+  };
+  assert(entries.size() == 3 || !"wrong number of entries");
+  for (size_t i = 0; i < entries.size(); i++) {
+    const iftracer::FlatProfileEntry& entry = entries[i];
+    const Expected& e                       = expected[i];
+    if (tree.Functions()[entry.function].name != e.name ||
+        entry.calls != e.calls || entry.inclusive_ns != e.inclusive_ns ||
+        entry.self_ns != e.self_ns || entry.min_ns != e.min_ns ||
+        entry.max_ns != e.max_ns || entry.MeanNs() != e.mean_ns) {
+      std::cerr << "wrong flat profile of " << e.name << ": calls "
+                << entry.calls << ", inclusive " << entry.inclusive_ns
+                << ", self " << entry.self_ns << std::endl;
+      return 1;
+    }
+  }
+
+  // hook overhead of 2ns: f excludes its enter hook and main excludes its
+  // enter hook and the enter and exit hooks of f
+  iftracer::CallTree c;
+  uint32_t c_main = c.AddFunction(function("main"));
+  uint32_t c_f    = c.AddFunction(function("f"));
+  iftracer::CallTreeBuilder c_builder(&c, 2000);
+  c_builder.Enter(0, c_main);
+  c_builder.Enter(10, c_f);
+  c_builder.Exit(30);
+  c_builder.Exit(100);
+  const std::vector<iftracer::CallTree::Node>& c_nodes = c.Nodes();
+  // root, main, main;f
+  assert((c_nodes[1].total_ns == 94 && c_nodes[1].self_ns == 76) ||
+         !"wrong compensated duration of main");
+  assert((c_nodes[2].total_ns == 18 && c_nodes[2].self_ns == 18) ||
+         !"wrong compensated duration of f");
+
+  std::string filename = "call_tree_test.out";
+  iftracer::OutputBuffer out;
+  bool ret = out.Open(filename);
+  assert(ret || !"failed to open output");
+  iftracer::WriteFoldedStacks(tree, &out);
+  ret = out.Close();
+  assert(ret || !"failed to write folded stacks");
+  std::string folded = read_file(filename);
+  if (folded != "main 65\nmain;f 30\nmain;f;f 10\nmain;g 15\n") {
+    std::cerr << "wrong folded stacks:\n" << folded << std::endl;
+    return 1;
+  }
+
+  ret = out.Open(filename);
+  assert(ret || !"failed to open output");
+  iftracer::WriteFlatProfile(tree, true, &out);
+  ret = out.Close();
+  assert(ret || !"failed to write flat profile");
+  std::string flat = read_file(filename);
+  if (flat.find("\n2\t120\t65\t20\t100\t60\tmain\t/src/main.cpp:1\n") ==
+      std::string::npos) {
+    std::cerr << "wrong flat profile:\n" << flat << std::endl;
+    return 1;
+  }
+  unlink(filename.c_str());
+  return 0;
+}
@@ -0,0 +1,949 @@
+// convert iftracer.out.<tid> binary files (and iftracer.out.<pid>.chunks
+// containers) to chrome trace json or perfetto protobuf trace
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "module_map.hpp"
+#include "output_buffer.hpp"
+#include "perfetto_proto.hpp"
+#include "proto_writer.hpp"
+#include "tool_common.hpp"
+#include "trace_reader.hpp"
+
+namespace {
+struct Options {
+  // default: output.json or output.pftrace
+  std::string output_file = "";
+  // "json" or "perfetto" (default: perfetto if output_file is *.pftrace)
+  std::string format      = "";
+  std::string prefix      = iftracer::default_trace_file_prefix;
+  size_t jobs             = 0;
+  size_t address_size     = sizeof(uint64_t);
+  std::string elf_file    = "";
+  // subtract the hook overhead from timestamps
+  bool compensate = false;
+  std::vector<std::string> search_directories;
+  std::vector<std::string> paths;
+};
+
+void help(const std::string& app_name) {
+  std::cerr
+      << "usage: " << app_name
+      << " [-e elf_filepath] [-L dir] [-o output.json] [-f format] [-j jobs] "
+         "[-p prefix] [-m32] [--compensate] [files or dirs...]"
+      << std::endl
+      << "    -e: elf file of main program for function names" << std::endl
+      << "        (default: path recorded in <prefix><pid>.maps)" << std::endl
+      << "    -L: directory to search module files (e.g. sysroot)"
+      << std::endl
+      << "    -o: output file (default: output.json, '-' means stdout)"
+      << std::endl
+      << "    -f: json (chrome trace) or perfetto (protobuf)" << std::endl
+      << "        (default: perfetto for *.pftrace, otherwise json)"
+      << std::endl
+      << "    -j: number of worker threads (default: number of cpus)"
+      << std::endl
+      << "    -p: trace file prefix (default: iftracer.out.)" << std::endl
+      << "    -m32: trace files were recorded by 32bit target" << std::endl
+      << "    --compensate: subtract the hook overhead measured at startup"
+      << std::endl
+      << "        from timestamps (durations exclude the hooks of descendants,"
+      << std::endl
+      << "        but each thread moves earlier by its own hooks)" << std::endl
+      << "    default input is iftracer.out.<tid> and iftracer.out.<pid>.chunks"
+      << std::endl
+      << "    at current directory" << std::endl;
+}
+
+bool parse_options(int argc, const char* argv[], Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "-h" || arg == "--help") {
+      return false;
+    } else if (arg == "-e" && i + 1 < argc) {
+      options->elf_file = argv[++i];
+    } else if (arg == "-L" && i + 1 < argc) {
+      options->search_directories.push_back(argv[++i]);
+    } else if (arg == "-o" && i + 1 < argc) {
+      options->output_file = argv[++i];
+    } else if (arg == "-f" && i + 1 < argc) {
+      options->format = argv[++i];
+      if (options->format != "json" && options->format != "perfetto") {
+        std::cerr << "unknown format: " << options->format << std::endl;
+        return false;
+      }
+    } else if (arg == "-j" && i + 1 < argc) {
+      options->jobs = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "-p" && i + 1 < argc) {
+      options->prefix = argv[++i];
+    } else if (arg == "-m32") {
+      options->address_size = sizeof(uint32_t);
+    } else if (arg == "--compensate") {
+      options->compensate = true;
+    } else if (!arg.empty() && arg[0] == '-') {
+      std::cerr << "unknown option: " << arg << std::endl;
+      return false;
+    } else {
+      options->paths.push_back(arg);
+    }
+  }
+  static const std::string perfetto_suffix = ".pftrace";
+  const std::string& output_file           = options->output_file;
+  if (options->format.empty()) {
+    bool is_perfetto_file =
+        output_file.size() >= perfetto_suffix.size() &&
+        output_file.compare(output_file.size() - perfetto_suffix.size(),
+                            perfetto_suffix.size(), perfetto_suffix) == 0;
+    options->format = is_perfetto_file ? "perfetto" : "json";
+  }
+  if (options->output_file.empty()) {
+    options->output_file =
+        options->format == "perfetto" ? "output.pftrace" : "output.json";
+  }
+  return true;
+}
+
+// write chrome trace events of one thread
+// events are separated by ",\n" and there is no leading separator
+class ChromeTraceWriter {
+ public:
+  ChromeTraceWriter(iftracer::TraceReader& reader, iftracer::OutputBuffer& out,
+                    const iftracer::AddressResolver* resolver)
+      : reader_(reader), out_(out), resolver_(resolver) {}
+
+  void Write() {
+    iftracer::TraceEvent event;
+    uint64_t last_timestamp = 0;
+    while (reader_.Next(&event)) {
+      WriteEvent(event);
+      last_timestamp = event.timestamp;
+    }
+    // the thread was still running (or the process was killed)
+    if (cpu_id_ != iftracer::format::no_cpu_id) {
+      WriteCpuEvent("e", last_timestamp, cpu_id_);
+    }
+  }
+
+ private:
+  void BeginEvent(const char* ph, uint64_t timestamp) {
+    if (event_count_++ != 0) {
+      out_.Append(",\n", 2);
+    }
+    out_.Append("{\"ph\":\"");
+    out_.Append(ph);
+    out_.Append("\",\"pid\":");
+    out_.AppendInt(reader_.Pid());
+    out_.Append(",\"tid\":");
+    out_.AppendInt(reader_.Tid());
+    out_.Append(",\"ts\":");
+    out_.AppendMicroseconds(reader_.TicksToNanoseconds(timestamp));
+  }
+  void AppendName(const iftracer::TraceEvent& event) {
+    out_.Append(",\"name\":");
+    out_.AppendJsonString(event.text, event.text_size);
+  }
+  // json has no nan and inf: they are strings
+  void AppendJsonDouble(double v) {
+    if (std::isfinite(v)) {
+      out_.AppendDouble(v);
+      return;
+    }
+    out_.Append('"');
+    out_.AppendDouble(v);
+    out_.Append('"');
+  }
+  // typed args of extend events (pointers are hex strings)
+  void AppendArgs(const iftracer::TraceEvent& event) {
+    if (event.arg_count == 0) {
+      return;
+    }
+    out_.Append(",\"args\":{");
+    for (uint32_t i = 0; i < event.arg_count; i++) {
+      const iftracer::TraceArg& arg = event.args[i];
+      if (i != 0) {
+        out_.Append(',');
+      }
+      out_.AppendJsonString(arg.key, arg.key_size);
+      out_.Append(':');
+      switch (arg.type) {
+        case iftracer::format::arg_int64:
+          out_.AppendInt(arg.int_value);
+          break;
+        case iftracer::format::arg_double:
+          AppendJsonDouble(arg.double_value);
+          break;
+        case iftracer::format::arg_pointer:
+          out_.Append('"');
+          out_.AppendHex(arg.pointer_value);
+          out_.Append('"');
+          break;
+        default:
+          out_.AppendJsonString(arg.text, arg.text_size);
+          break;
+      }
+    }
+    out_.Append('}');
+  }
+
+  void WriteEvent(const iftracer::TraceEvent& event) {
+    using iftracer::TraceEvent;
+    switch (event.type) {
+      case TraceEvent::kEnter:
+        BeginEvent("B", event.timestamp);
+        AppendFunction(event.timestamp, event.address);
+        out_.Append('}');
+        break;
+      case TraceEvent::kExit:
+        BeginEvent("E", event.timestamp);
+        out_.Append('}');
+        break;
+      case TraceEvent::kDurationEnter:
+        duration_stack_.push_back(event.timestamp);
+        break;
+      case TraceEvent::kDurationExit: {
+        uint64_t enter_timestamp = event.timestamp;
+        if (!duration_stack_.empty()) {
+          enter_timestamp = duration_stack_.back();
+          duration_stack_.pop_back();
+        }
+        BeginEvent("X", enter_timestamp);
+        out_.Append(",\"dur\":");
+        out_.AppendMicroseconds(reader_.TicksToNanoseconds(event.timestamp) -
+                                reader_.TicksToNanoseconds(enter_timestamp));
+        AppendName(event);
+        AppendArgs(event);
+        out_.Append('}');
+        break;
+      }
+      case TraceEvent::kAsyncEnter:
+      case TraceEvent::kAsyncExit:
+        BeginEvent(event.type == TraceEvent::kAsyncEnter ? "b" : "e",
+                   event.timestamp);
+        AppendName(event);
+        AppendArgs(event);
+        AppendAsyncId(event);
+        out_.Append('}');
+        break;
+      case TraceEvent::kInstant:
+        BeginEvent("i", event.timestamp);
+        AppendName(event);
+        AppendArgs(event);
+        out_.Append(",\"s\":\"t\"}");
+        break;
+      case TraceEvent::kCounter:
+        // counter tracks are per process in chrome trace
+        BeginEvent("C", event.timestamp);
+        AppendName(event);
+        out_.Append(",\"args\":{\"value\":");
+        if (event.value_type == iftracer::format::arg_int64) {
+          out_.AppendInt(event.int_value);
+        } else {
+          AppendJsonDouble(event.double_value);
+        }
+        out_.Append("}}");
+        break;
+      case TraceEvent::kFlowStart:
+      case TraceEvent::kFlowStep:
+      case TraceEvent::kFlowEnd:
+        // arrows between the enclosing slices of the threads
+        BeginEvent(event.type == TraceEvent::kFlowStart  ? "s"
+                   : event.type == TraceEvent::kFlowStep ? "t"
+                                                         : "f",
+                   event.timestamp);
+        AppendName(event);
+        out_.Append(",\"cat\":\"flow\",\"id\":\"");
+        out_.AppendHex(event.id);
+        out_.Append(event.type == TraceEvent::kFlowEnd ? "\",\"bp\":\"e\"}"
+                                                       : "\"}");
+        break;
+      case TraceEvent::kIdAsyncBegin:
+      case TraceEvent::kIdAsyncEnd:
+        // one track per id even if threads or processes differ
+        BeginEvent(event.type == TraceEvent::kIdAsyncBegin ? "b" : "e",
+                   event.timestamp);
+        AppendName(event);
+        out_.Append(",\"cat\":\"async_id\",\"id2\":{\"global\":\"");
+        out_.AppendHex(event.id);
+        out_.Append("\"}}");
+        break;
+      case TraceEvent::kCpuMigration:
+        if (cpu_id_ != iftracer::format::no_cpu_id) {
+          WriteCpuEvent("e", event.timestamp, cpu_id_);
+        }
+        cpu_id_ = event.cpu_id;
+        if (cpu_id_ != iftracer::format::no_cpu_id) {
+          WriteCpuEvent("b", event.timestamp, cpu_id_);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  void AppendFunction(uint64_t timestamp, uint64_t address) {
+    iftracer::ResolvedAddress resolved;
+    if (resolver_ != nullptr) {
+      resolver_->Resolve(timestamp, address, &resolved);
+    }
+    if (resolved.module == nullptr && resolved.symbol == nullptr) {
+      out_.Append(",\"name\":\"");
+      out_.AppendHex(address);
+      out_.Append('"');
+      return;
+    }
+    if (resolved.symbol == nullptr) {
+      out_.Append(",\"name\":");
+      out_.AppendJsonString(resolver_->Name(resolved, address));
+      return;
+    }
+    const iftracer::Symbolizer* symbolizer = resolved.symbolizer;
+    const iftracer::Symbol* symbol         = resolved.symbol;
+    out_.Append(",\"name\":");
+    out_.AppendJsonString(symbolizer->Name(symbol->name_id));
+    if (symbol->file_id != iftracer::Symbolizer::no_file) {
+      out_.Append(",\"args\":{\"file\":");
+      out_.AppendJsonString(symbolizer->Location(*symbol));
+      out_.Append('}');
+    }
+  }
+
+  // same as "CPU:<n>" async text events of older files
+  void WriteCpuEvent(const char* ph, uint64_t timestamp, uint32_t cpu_id) {
+    std::string text = "CPU:" + std::to_string(cpu_id);
+    BeginEvent(ph, timestamp);
+    out_.Append(",\"name\":");
+    out_.AppendJsonString(text);
+    out_.Append(",\"cat\":\"async\",\"id2\":{\"global\":");
+    out_.AppendJsonString(text);
+    out_.Append("}}");
+  }
+
+  void AppendAsyncId(const iftracer::TraceEvent& event) {
+    // "CPU:<n>" events of all threads share one track per cpu
+    static const char cpu_prefix[] = "CPU:";
+    bool is_cpu_event =
+        event.text_size >= sizeof(cpu_prefix) - 1 &&
+        memcmp(event.text, cpu_prefix, sizeof(cpu_prefix) - 1) == 0;
+    out_.Append(",\"cat\":\"async\",\"id2\":{\"");
+    out_.Append(is_cpu_event ? "global" : "local");
+    out_.Append("\":");
+    out_.AppendJsonString(event.text, event.text_size);
+    out_.Append('}');
+  }
+
+  iftracer::TraceReader& reader_;
+  iftracer::OutputBuffer& out_;
+  const iftracer::AddressResolver* resolver_;
+  uint64_t event_count_ = 0;
+  std::vector<uint64_t> duration_stack_;
+  uint32_t cpu_id_ = iftracer::format::no_cpu_id;
+};
+
+namespace perfetto = iftracer::perfetto;
+
+// write perfetto TracePackets of one thread as one packet sequence
+// names, arg keys and source locations are interned in the sequence and
+// timestamps are incremental, so that a function call is about 25B
+// (the parts of threads are concatenated as a Trace message)
+//
+// tracks:
+//   thread: functions, duration events, instants and flows
+//   process: "async" events and counters (one track per name)
+//   "CPU:<n>": one child track per thread with the cpu residency slices
+//   "[thread lifetime]": child track of the thread
+//   id async events: one global track per id
+// NOTE: timestamps are shown as BOOTTIME of the viewer
+class PerfettoTraceWriter {
+ public:
+  PerfettoTraceWriter(iftracer::TraceReader& reader,
+                      iftracer::OutputBuffer& out,
+                      const iftracer::AddressResolver* resolver,
+                      uint32_t sequence_id)
+      : reader_(reader),
+        out_(out),
+        sequence_id_(sequence_id),
+        functions_(resolver) {}
+
+  void Write() {
+    iftracer::TraceEvent event;
+    uint64_t last_timestamp = 0;
+    bool first              = true;
+    while (reader_.Next(&event)) {
+      if (first) {
+        WriteSequenceHeader(event.timestamp);
+        first = false;
+      }
+      WriteEvent(event);
+      last_timestamp = event.timestamp;
+    }
+    // the thread was still running (or the process was killed)
+    if (cpu_id_ != iftracer::format::no_cpu_id) {
+      EndCpuSlice(last_timestamp);
+    }
+  }
+
+ private:
+  std::string ThreadKey() const {
+    return std::to_string(reader_.Pid()) + ":" +
+           std::to_string(reader_.Tid());
+  }
+
+  // the first packet resets the interned data and the clock of the sequence
+  void WriteSequenceHeader(uint64_t timestamp) {
+    namespace pf  = perfetto;
+    clock_ns_     = reader_.TicksToNanoseconds(timestamp);
+    process_uuid_ =
+        perfetto::TrackUuid("process:" + std::to_string(reader_.Pid()));
+    thread_uuid_ = perfetto::TrackUuid("thread:" + ThreadKey());
+    BeginPacket();
+    packet_.AppendVarint(pf::packet_sequence_flags,
+                         pf::incremental_state_cleared);
+    packet_.BeginMessage(pf::packet_clock_snapshot);
+    packet_.BeginMessage(pf::snapshot_clocks);
+    packet_.AppendVarint(pf::clock_id, pf::clock_boottime);
+    packet_.AppendVarint(pf::clock_timestamp, clock_ns_);
+    packet_.EndMessage();
+    packet_.BeginMessage(pf::snapshot_clocks);
+    packet_.AppendVarint(pf::clock_id, pf::clock_incremental);
+    packet_.AppendVarint(pf::clock_timestamp, clock_ns_);
+    packet_.AppendVarint(pf::clock_is_incremental, 1);
+    packet_.EndMessage();
+    packet_.EndMessage();
+    packet_.BeginMessage(pf::packet_defaults);
+    packet_.AppendVarint(pf::defaults_timestamp_clock_id,
+                         pf::clock_incremental);
+    packet_.BeginMessage(pf::defaults_track_event);
+    packet_.AppendVarint(pf::defaults_track_uuid, thread_uuid_);
+    packet_.EndMessage();
+    packet_.EndMessage();
+    EndPacket();
+
+    BeginPacket();
+    packet_.BeginMessage(pf::packet_track_descriptor);
+    packet_.AppendVarint(pf::track_uuid, process_uuid_);
+    packet_.BeginMessage(pf::track_process);
+    packet_.AppendVarint(pf::process_pid, reader_.Pid());
+    packet_.EndMessage();
+    packet_.EndMessage();
+    EndPacket();
+
+    BeginPacket();
+    packet_.BeginMessage(pf::packet_track_descriptor);
+    packet_.AppendVarint(pf::track_uuid, thread_uuid_);
+    packet_.AppendVarint(pf::track_parent_uuid, process_uuid_);
+    packet_.BeginMessage(pf::track_thread);
+    packet_.AppendVarint(pf::thread_pid, reader_.Pid());
+    packet_.AppendVarint(pf::thread_tid, reader_.Tid());
+    packet_.EndMessage();
+    packet_.EndMessage();
+    EndPacket();
+  }
+
+  // uuid of the track of key (the descriptor is written at first use)
+  // parent_uuid 0 means a global track
+  uint64_t Track(const std::string& key, uint64_t parent_uuid,
+                 const char* name, size_t name_size, bool counter = false) {
+    namespace pf  = perfetto;
+    uint64_t uuid = perfetto::TrackUuid(key);
+    if (!tracks_.insert(uuid).second) {
+      return uuid;
+    }
+    BeginPacket();
+    packet_.BeginMessage(pf::packet_track_descriptor);
+    packet_.AppendVarint(pf::track_uuid, uuid);
+    if (parent_uuid != 0) {
+      packet_.AppendVarint(pf::track_parent_uuid, parent_uuid);
+    }
+    packet_.AppendBytes(pf::track_name, name, name_size);
+    if (counter) {
+      packet_.BeginMessage(pf::track_counter);
+      packet_.EndMessage();
+    }
+    packet_.EndMessage();
+    EndPacket();
+    return uuid;
+  }
+  uint64_t Track(const std::string& key, uint64_t parent_uuid,
+                 const std::string& name) {
+    return Track(key, parent_uuid, name.data(), name.size());
+  }
+
+  void BeginPacket() {
+    packet_.Clear();
+    interned_.Clear();
+    packet_.AppendVarint(perfetto::packet_sequence_id, sequence_id_);
+  }
+  void BeginPacket(uint64_t timestamp) {
+    namespace pf = perfetto;
+    BeginPacket();
+    // NOTE: SEQ_NEEDS_INCREMENTAL_STATE is omitted because the sequence is
+    // never broken
+    uint64_t ns = reader_.TicksToNanoseconds(timestamp);
+    if (ns >= clock_ns_) {
+      packet_.AppendVarint(pf::packet_timestamp, ns - clock_ns_);
+      clock_ns_ = ns;
+      return;
+    }
+    // going back (e.g. begin of a duration event written at its end)
+    packet_.AppendVarint(pf::packet_timestamp, ns);
+    packet_.AppendVarint(pf::packet_timestamp_clock_id, pf::clock_boottime);
+  }
+  void EndPacket() {
+    if (!interned_.Empty()) {
+      packet_.AppendBytes(perfetto::packet_interned_data, interned_.Data(),
+                          interned_.Size());
+    }
+    char head[16];
+    char* p = head;
+    *p++    = static_cast<char>((perfetto::trace_packet << 3) |
+                             iftracer::ProtoWriter::kLengthDelimited);
+    p       = iftracer::ProtoWriter::WriteVarint(p, packet_.Size());
+    out_.Append(head, p - head);
+    out_.Append(packet_.Data(), packet_.Size());
+  }
+
+  // track_uuid 0 means the thread track
+  void BeginTrackEvent(uint64_t timestamp, uint64_t type,
+                       uint64_t track_uuid = 0) {
+    BeginPacket(timestamp);
+    packet_.BeginMessage(perfetto::packet_track_event);
+    packet_.AppendVarint(perfetto::event_type, type);
+    if (track_uuid != 0) {
+      packet_.AppendVarint(perfetto::event_track_uuid, track_uuid);
+    }
+  }
+  void EndTrackEvent() {
+    packet_.EndMessage();
+    EndPacket();
+  }
+  // iid of s in table (new entries are added to the interned data of the
+  // current packet)
+  uint64_t Intern(std::unordered_map<std::string, uint64_t>* table,
+                  uint32_t field, const char* s, size_t n) {
+    std::string key(s, n);
+    auto it = table->find(key);
+    if (it != table->end()) {
+      return it->second;
+    }
+    uint64_t iid = table->size() + 1;
+    table->emplace(std::move(key), iid);
+    interned_.BeginMessage(field);
+    interned_.AppendVarint(perfetto::interned_iid, iid);
+    interned_.AppendBytes(perfetto::interned_name, s, n);
+    interned_.EndMessage();
+    return iid;
+  }
+  void AppendName(const char* s, size_t n) {
+    packet_.AppendVarint(
+        perfetto::event_name_iid,
+        Intern(&event_names_, perfetto::interned_event_names, s, n));
+  }
+  void AppendName(const iftracer::TraceEvent& event) {
+    AppendName(event.text, event.text_size);
+  }
+  void AppendArgs(const iftracer::TraceEvent& event) {
+    namespace pf = perfetto;
+    for (uint32_t i = 0; i < event.arg_count; i++) {
+      const iftracer::TraceArg& arg = event.args[i];
+      packet_.BeginMessage(pf::event_debug_annotations);
+      packet_.AppendVarint(pf::annotation_name_iid,
+                           Intern(&annotation_names_,
+                                  pf::interned_annotation_names, arg.key,
+                                  arg.key_size));
+      switch (arg.type) {
+        case iftracer::format::arg_int64:
+          packet_.AppendVarint(pf::annotation_int_value, arg.int_value);
+          break;
+        case iftracer::format::arg_double:
+          packet_.AppendDouble(pf::annotation_double_value,
+                               arg.double_value);
+          break;
+        case iftracer::format::arg_pointer:
+          packet_.AppendVarint(pf::annotation_pointer_value,
+                               arg.pointer_value);
+          break;
+        default:
+          packet_.AppendBytes(pf::annotation_string_value, arg.text,
+                              arg.text_size);
+          break;
+      }
+      packet_.EndMessage();
+    }
+  }
+
+  void WriteEvent(const iftracer::TraceEvent& event) {
+    using iftracer::TraceEvent;
+    namespace pf = perfetto;
+    switch (event.type) {
+      case TraceEvent::kEnter:
+        BeginTrackEvent(event.timestamp, pf::type_slice_begin);
+        AppendFunction(event.timestamp, event.address);
+        EndTrackEvent();
+        break;
+      case TraceEvent::kExit:
+        BeginTrackEvent(event.timestamp, pf::type_slice_end);
+        EndTrackEvent();
+        break;
+      case TraceEvent::kDurationEnter:
+        duration_stack_.push_back(event.timestamp);
+        break;
+      case TraceEvent::kDurationExit: {
+        uint64_t enter_timestamp = event.timestamp;
+        if (!duration_stack_.empty()) {
+          enter_timestamp = duration_stack_.back();
+          duration_stack_.pop_back();
+        }
+        BeginTrackEvent(enter_timestamp, pf::type_slice_begin);
+        AppendName(event);
+        AppendArgs(event);
+        EndTrackEvent();
+        BeginTrackEvent(event.timestamp, pf::type_slice_end);
+        EndTrackEvent();
+        break;
+      }
+      case TraceEvent::kAsyncEnter:
+      case TraceEvent::kAsyncExit:
+        WriteAsyncEvent(event);
+        break;
+      case TraceEvent::kInstant:
+        BeginTrackEvent(event.timestamp, pf::type_instant);
+        AppendName(event);
+        AppendArgs(event);
+        EndTrackEvent();
+        break;
+      case TraceEvent::kCounter: {
+        uint64_t track =
+            Track("counter:" + std::to_string(reader_.Pid()) + ":" +
+                      std::string(event.text, event.text_size),
+                  process_uuid_, event.text, event.text_size, true);
+        BeginTrackEvent(event.timestamp, pf::type_counter, track);
+        if (event.value_type == iftracer::format::arg_int64) {
+          packet_.AppendVarint(pf::event_counter_value, event.int_value);
+        } else {
+          packet_.AppendDouble(pf::event_double_counter_value,
+                               event.double_value);
+        }
+        EndTrackEvent();
+        break;
+      }
+      case TraceEvent::kFlowStart:
+      case TraceEvent::kFlowStep:
+      case TraceEvent::kFlowEnd:
+        // arrows between the instants in the enclosing slices
+        BeginTrackEvent(event.timestamp, pf::type_instant);
+        AppendName(event);
+        packet_.AppendFixed64(event.type == TraceEvent::kFlowEnd
+                                  ? pf::event_terminating_flow_ids
+                                  : pf::event_flow_ids,
+                              event.id);
+        EndTrackEvent();
+        break;
+      case TraceEvent::kIdAsyncBegin:
+      case TraceEvent::kIdAsyncEnd: {
+        // one track per id even if threads or processes differ
+        char key[32];
+        snprintf(key, sizeof(key), "id:%llx",
+                 static_cast<unsigned long long>(event.id));
+        uint64_t track = Track(key, 0, event.text, event.text_size);
+        if (event.type == TraceEvent::kIdAsyncBegin) {
+          BeginTrackEvent(event.timestamp, pf::type_slice_begin, track);
+          AppendName(event);
+        } else {
+          BeginTrackEvent(event.timestamp, pf::type_slice_end, track);
+        }
+        EndTrackEvent();
+        break;
+      }
+      case TraceEvent::kCpuMigration:
+        if (cpu_id_ != iftracer::format::no_cpu_id) {
+          EndCpuSlice(event.timestamp);
+        }
+        if (event.cpu_id != iftracer::format::no_cpu_id) {
+          BeginCpuSlice(event.timestamp, event.cpu_id);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  void WriteAsyncEvent(const iftracer::TraceEvent& event) {
+    namespace pf = perfetto;
+    bool enter   = event.type == iftracer::TraceEvent::kAsyncEnter;
+    std::string name(event.text, event.text_size);
+    // "CPU:<n>" text events of older files
+    static const char cpu_prefix[] = "CPU:";
+    if (name.compare(0, sizeof(cpu_prefix) - 1, cpu_prefix) == 0) {
+      uint32_t cpu_id = static_cast<uint32_t>(
+          std::strtoul(name.c_str() + sizeof(cpu_prefix) - 1, nullptr, 10));
+      if (cpu_id_ != iftracer::format::no_cpu_id &&
+          (enter || cpu_id == cpu_id_)) {
+        EndCpuSlice(event.timestamp);
+      }
+      if (enter) {
+        BeginCpuSlice(event.timestamp, cpu_id);
+      }
+      return;
+    }
+    uint64_t track;
+    if (name == "[thread lifetime]") {
+      track = Track("lifetime:" + ThreadKey(), thread_uuid_, name);
+    } else {
+      // "local" id of chrome trace: begin and end may be on other threads
+      track = Track("async:" + std::to_string(reader_.Pid()) + ":" + name,
+                    process_uuid_, name);
+    }
+    BeginTrackEvent(event.timestamp,
+                    enter ? pf::type_slice_begin : pf::type_slice_end, track);
+    if (enter) {
+      AppendName(event);
+      AppendArgs(event);
+    }
+    EndTrackEvent();
+  }
+
+  // child tracks of a global "CPU:<n>" track for each thread
+  // (residencies detected by the threads may overlap a little)
+  uint64_t CpuTrack(uint32_t cpu_id) {
+    std::string name = "CPU:" + std::to_string(cpu_id);
+    uint64_t parent  = Track(name, 0, name);
+    return Track(name + ":" + ThreadKey(), parent,
+                 "tid " + std::to_string(reader_.Tid()));
+  }
+  void BeginCpuSlice(uint64_t timestamp, uint32_t cpu_id) {
+    uint64_t track   = CpuTrack(cpu_id);
+    std::string name = "CPU:" + std::to_string(cpu_id);
+    BeginTrackEvent(timestamp, perfetto::type_slice_begin, track);
+    AppendName(name.data(), name.size());
+    EndTrackEvent();
+    cpu_id_ = cpu_id;
+  }
+  void EndCpuSlice(uint64_t timestamp) {
+    BeginTrackEvent(timestamp, perfetto::type_slice_end, CpuTrack(cpu_id_));
+    EndTrackEvent();
+    cpu_id_ = iftracer::format::no_cpu_id;
+  }
+
+  // name and source location of the function
+  void AppendFunction(uint64_t timestamp, uint64_t address) {
+    namespace pf = perfetto;
+    const Function& function = functions_.Get(
+        timestamp, address,
+        [this](const iftracer::ResolvedAddress& resolved,
+               const std::string& name) {
+          Function function;
+          function.name_iid = Intern(&event_names_, pf::interned_event_names,
+                                     name.data(), name.size());
+          const iftracer::Symbol* symbol = resolved.symbol;
+          if (symbol != nullptr &&
+              symbol->file_id != iftracer::Symbolizer::no_file) {
+            function.location_iid = ++location_count_;
+            interned_.BeginMessage(pf::interned_source_locations);
+            interned_.AppendVarint(pf::location_iid, function.location_iid);
+            interned_.AppendString(pf::location_file_name,
+                                   resolved.symbolizer->File(symbol->file_id));
+            interned_.AppendVarint(pf::location_line_number, symbol->line);
+            interned_.EndMessage();
+          }
+          return function;
+        });
+    packet_.AppendVarint(pf::event_name_iid, function.name_iid);
+    if (function.location_iid != 0) {
+      packet_.AppendVarint(pf::event_source_location_iid,
+                           function.location_iid);
+    }
+  }
+
+  struct Function {
+    uint64_t name_iid = 0;
+    // 0: unknown
+    uint64_t location_iid = 0;
+  };
+
+  iftracer::TraceReader& reader_;
+  iftracer::OutputBuffer& out_;
+  uint32_t sequence_id_;
+  uint64_t process_uuid_ = 0;
+  uint64_t thread_uuid_  = 0;
+  // value of the incremental clock
+  uint64_t clock_ns_ = 0;
+  iftracer::ProtoWriter packet_;
+  iftracer::ProtoWriter interned_;
+  std::unordered_set<uint64_t> tracks_;
+  std::unordered_map<std::string, uint64_t> event_names_;
+  std::unordered_map<std::string, uint64_t> annotation_names_;
+  uint64_t location_count_ = 0;
+  iftracer::FunctionCache<Function> functions_;
+  std::vector<uint64_t> duration_stack_;
+  uint32_t cpu_id_ = iftracer::format::no_cpu_id;
+};
+
+bool append_file(int out_fd, const std::string& filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  std::vector<char> buf(1024 * 1024);
+  bool ret = true;
+  while (true) {
+    ssize_t n = read(fd, &buf[0], buf.size());
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      ret = n == 0;
+      break;
+    }
+    for (ssize_t written = 0; written < n;) {
+      ssize_t m = write(out_fd, &buf[written], n - written);
+      if (m < 0 && errno == EINTR) {
+        continue;
+      }
+      if (m < 0) {
+        close(fd);
+        return false;
+      }
+      written += m;
+    }
+  }
+  close(fd);
+  return ret;
+}
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+  Options options;
+  if (!parse_options(argc, argv, &options)) {
+    help(std::string(argv[0]));
+    return 1;
+  }
+  std::vector<std::string> trace_files;
+  std::string error_message;
+  if (!iftracer::ListTraceFiles(options.paths, options.prefix, &trace_files,
+                                &error_message)) {
+    std::cerr << error_message << std::endl;
+    return 1;
+  }
+  if (trace_files.empty()) {
+    std::cerr << "not found trace files" << std::endl;
+    return 1;
+  }
+
+  if (!options.elf_file.empty()) {
+    iftracer::Symbolizer symbolizer;
+    if (!symbolizer.Open(options.elf_file)) {
+      std::cerr << symbolizer.GetErrorMessage() << std::endl;
+      return 1;
+    }
+    std::string warning = symbolizer.GetErrorMessage();
+    if (!warning.empty()) {
+      std::cerr << "[warn] " << warning << std::endl;
+    }
+  }
+  iftracer::ResolverTable resolvers(options.prefix, options.elf_file,
+                                    options.search_directories);
+
+  // each thread (stream of a container) is one job
+  std::vector<iftracer::TraceJob> jobs =
+      iftracer::ListTraceJobs(trace_files, options.jobs);
+
+  // each job is converted into own part file in parallel
+  // and the part files are concatenated in order at last
+  // (a perfetto trace is just a sequence of packets)
+  bool perfetto = options.format == "perfetto";
+  std::string part_prefix =
+      options.output_file == "-" ? std::string("iftracer-conv.tmp")
+                                 : options.output_file;
+  part_prefix += ".part." + std::to_string(getpid()) + ".";
+  std::vector<uint64_t> part_sizes(jobs.size(), 0);
+  // NOTE: not vector<bool> because it is written from worker threads
+  std::vector<char> part_errors(jobs.size(), false);
+  iftracer::RunParallel(jobs.size(), options.jobs, [&](size_t i) {
+    const std::string& trace_file = trace_files[jobs[i].file_index];
+    iftracer::TraceReader reader;
+    reader.SetAddressSize(options.address_size);
+    reader.SetCompensation(options.compensate);
+    if (!reader.Open(trace_file) ||
+        (jobs[i].stream_index != 0 &&
+         !reader.SelectStream(jobs[i].stream_index))) {
+      std::cerr << "[skip] " << reader.GetErrorMessage() << std::endl;
+      return;
+    }
+    iftracer::OutputBuffer out;
+    if (!out.Open(part_prefix + std::to_string(i))) {
+      std::cerr << out.GetErrorMessage() << std::endl;
+      part_errors[i] = true;
+      return;
+    }
+    const iftracer::AddressResolver* resolver =
+        resolvers.Get(trace_file, reader.Pid());
+    if (perfetto) {
+      PerfettoTraceWriter(reader, out, resolver, i + 1).Write();
+    } else {
+      ChromeTraceWriter(reader, out, resolver).Write();
+    }
+    if (reader.HasError()) {
+      std::cerr << "[broken] " << trace_file << ":"
+                << reader.GetErrorMessage() << std::endl;
+    }
+    part_sizes[i] = out.WrittenSize();
+    if (!out.Close()) {
+      std::cerr << out.GetErrorMessage() << std::endl;
+      part_errors[i] = true;
+    }
+  });
+
+  int out_fd = STDOUT_FILENO;
+  if (options.output_file != "-") {
+    out_fd = open(options.output_file.c_str(), O_CREAT | O_WRONLY | O_TRUNC,
+                  0666);
+    if (out_fd < 0) {
+      std::cerr << options.output_file << ":" << std::strerror(errno)
+                << std::endl;
+      return 1;
+    }
+  }
+  bool ret           = true;
+  std::string header = perfetto ? "" : "{\"traceEvents\":[\n";
+  ret &= write(out_fd, header.data(), header.size()) ==
+         static_cast<ssize_t>(header.size());
+  bool first = true;
+  for (size_t i = 0; i < jobs.size(); i++) {
+    std::string part_file = part_prefix + std::to_string(i);
+    if (part_errors[i]) {
+      ret = false;
+    } else if (part_sizes[i] > 0) {
+      if (!first && !perfetto) {
+        ret &= write(out_fd, ",\n", 2) == 2;
+      }
+      first = false;
+      ret &= append_file(out_fd, part_file);
+    }
+    unlink(part_file.c_str());
+  }
+  std::string footer =
+      perfetto ? "" : "\n],\n\"displayTimeUnit\":\"ns\"}\n";
+  ret &= write(out_fd, footer.data(), footer.size()) ==
+         static_cast<ssize_t>(footer.size());
+  if (out_fd != STDOUT_FILENO) {
+    ret &= close(out_fd) == 0;
+  }
+  if (!ret) {
+    std::cerr << "failed to write " << options.output_file << std::endl;
+    return 1;
+  }
+  std::cerr << "[output]: " << options.output_file << std::endl;
+  return 0;
+}
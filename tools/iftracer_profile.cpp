@@ -0,0 +1,228 @@
+// aggregate enter/exit of iftracer.out.<tid> binary files (and
+// iftracer.out.<pid>.chunks containers) into a call tree and write a flat
+// profile, folded stacks or pprof profile
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "call_tree.hpp"
+#include "module_map.hpp"
+#include "output_buffer.hpp"
+#include "tool_common.hpp"
+#include "trace_reader.hpp"
+
+namespace {
+struct Options {
+  // default: stdout (profile.pb for pprof)
+  std::string output_file = "";
+  // "flat", "folded" or "pprof"
+  std::string format   = "flat";
+  bool sort_by_self    = false;
+  std::string prefix   = iftracer::default_trace_file_prefix;
+  size_t jobs          = 0;
+  size_t address_size  = sizeof(uint64_t);
+  std::string elf_file = "";
+  // durations without compensation of the hook overhead
+  bool raw = false;
+  std::vector<std::string> search_directories;
+  std::vector<std::string> paths;
+};
+
+void help(const std::string& app_name) {
+  std::cerr
+      << "usage: " << app_name
+      << " [-f format] [-s sort] [-o output] [-e elf_filepath] [-L dir] "
+         "[-j jobs] [-p prefix] [-m32] [--raw] [files or dirs...]"
+      << std::endl
+      << "    -f: flat (tsv per function), folded (flamegraph.pl input)"
+      << std::endl
+      << "        or pprof (profile.proto) (default: flat)" << std::endl
+      << "    -s: sort key of flat profile: inclusive or self "
+         "(default: inclusive)"
+      << std::endl
+      << "    -o: output file (default: stdout, profile.pb for pprof)"
+      << std::endl
+      << "    -e: elf file of main program for function names" << std::endl
+      << "        (default: path recorded in <prefix><pid>.maps)" << std::endl
+      << "    -L: directory to search module files (e.g. sysroot)"
+      << std::endl
+      << "    -j: number of worker threads (default: number of cpus)"
+      << std::endl
+      << "    -p: trace file prefix (default: iftracer.out.)" << std::endl
+      << "    -m32: trace files were recorded by 32bit target" << std::endl
+      << "    --raw: do not subtract the hook overhead measured at startup"
+      << std::endl
+      << "    default input is iftracer.out.<tid> and iftracer.out.<pid>.chunks"
+      << std::endl
+      << "    at current directory" << std::endl;
+}
+
+bool parse_options(int argc, const char* argv[], Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "-h" || arg == "--help") {
+      return false;
+    } else if (arg == "-f" && i + 1 < argc) {
+      options->format = argv[++i];
+      if (options->format != "flat" && options->format != "folded" &&
+          options->format != "pprof") {
+        std::cerr << "unknown format: " << options->format << std::endl;
+        return false;
+      }
+    } else if (arg == "-s" && i + 1 < argc) {
+      std::string sort = argv[++i];
+      if (sort != "inclusive" && sort != "self") {
+        std::cerr << "unknown sort key: " << sort << std::endl;
+        return false;
+      }
+      options->sort_by_self = sort == "self";
+    } else if (arg == "-o" && i + 1 < argc) {
+      options->output_file = argv[++i];
+    } else if (arg == "-e" && i + 1 < argc) {
+      options->elf_file = argv[++i];
+    } else if (arg == "-L" && i + 1 < argc) {
+      options->search_directories.push_back(argv[++i]);
+    } else if (arg == "-j" && i + 1 < argc) {
+      options->jobs = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "-p" && i + 1 < argc) {
+      options->prefix = argv[++i];
+    } else if (arg == "-m32") {
+      options->address_size = sizeof(uint32_t);
+    } else if (arg == "--raw") {
+      options->raw = true;
+    } else if (!arg.empty() && arg[0] == '-') {
+      std::cerr << "unknown option: " << arg << std::endl;
+      return false;
+    } else {
+      options->paths.push_back(arg);
+    }
+  }
+  if (options->output_file.empty()) {
+    options->output_file = options->format == "pprof" ? "profile.pb" : "-";
+  }
+  return true;
+}
+
+// replay one thread into a CallTree
+class ThreadProfiler {
+ public:
+  ThreadProfiler(iftracer::TraceReader& reader,
+                 const iftracer::AddressResolver* resolver,
+                 iftracer::CallTree* tree, uint32_t hook_overhead_ps)
+      : reader_(reader),
+        tree_(tree),
+        builder_(tree, hook_overhead_ps),
+        functions_(resolver) {}
+
+  void Run() {
+    iftracer::TraceEvent event;
+    uint64_t last_ns = 0;
+    while (reader_.Next(&event)) {
+      last_ns = reader_.TicksToNanoseconds(event.timestamp);
+      if (event.type == iftracer::TraceEvent::kEnter) {
+        builder_.Enter(last_ns, Function(event.timestamp, event.address));
+      } else if (event.type == iftracer::TraceEvent::kExit) {
+        builder_.Exit(last_ns);
+      }
+    }
+    // the thread was still running (or the process was killed)
+    builder_.Finish(last_ns);
+  }
+
+ private:
+  uint32_t Function(uint64_t timestamp, uint64_t address) {
+    return functions_.Get(
+        timestamp, address,
+        [this](const iftracer::ResolvedAddress& resolved,
+               const std::string& name) {
+          iftracer::CallTree::Function function;
+          function.name                  = name;
+          const iftracer::Symbol* symbol = resolved.symbol;
+          if (symbol != nullptr &&
+              symbol->file_id != iftracer::Symbolizer::no_file) {
+            function.file = resolved.symbolizer->File(symbol->file_id);
+            function.line = symbol->line;
+          }
+          return tree_->AddFunction(function);
+        });
+  }
+
+  iftracer::TraceReader& reader_;
+  iftracer::CallTree* tree_;
+  iftracer::CallTreeBuilder builder_;
+  // function index of tree_
+  iftracer::FunctionCache<uint32_t> functions_;
+};
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+  Options options;
+  if (!parse_options(argc, argv, &options)) {
+    help(std::string(argv[0]));
+    return 1;
+  }
+  std::vector<std::string> trace_files;
+  std::string error_message;
+  if (!iftracer::ListTraceFiles(options.paths, options.prefix, &trace_files,
+                                &error_message)) {
+    std::cerr << error_message << std::endl;
+    return 1;
+  }
+  if (trace_files.empty()) {
+    std::cerr << "not found trace files" << std::endl;
+    return 1;
+  }
+  iftracer::ResolverTable resolvers(options.prefix, options.elf_file,
+                                    options.search_directories);
+
+  // each thread is replayed into own tree in parallel and merged at its end
+  // (memory is bounded by the number of distinct call paths)
+  std::vector<iftracer::TraceJob> jobs =
+      iftracer::ListTraceJobs(trace_files, options.jobs);
+  iftracer::CallTree tree;
+  std::mutex tree_mutex;
+  iftracer::RunParallel(jobs.size(), options.jobs, [&](size_t i) {
+    const std::string& trace_file = trace_files[jobs[i].file_index];
+    iftracer::TraceReader reader;
+    reader.SetAddressSize(options.address_size);
+    if (!reader.Open(trace_file) ||
+        (jobs[i].stream_index != 0 &&
+         !reader.SelectStream(jobs[i].stream_index))) {
+      std::cerr << "[skip] " << reader.GetErrorMessage() << std::endl;
+      return;
+    }
+    iftracer::CallTree thread_tree;
+    ThreadProfiler(reader, resolvers.Get(trace_file, reader.Pid()),
+                   &thread_tree, options.raw ? 0 : reader.HookOverheadPs())
+        .Run();
+    if (reader.HasError()) {
+      std::cerr << "[broken] " << trace_file << ":"
+                << reader.GetErrorMessage() << std::endl;
+    }
+    std::lock_guard<std::mutex> lock(tree_mutex);
+    tree.Merge(thread_tree);
+  });
+
+  iftracer::OutputBuffer out;
+  if (!out.Open(options.output_file)) {
+    std::cerr << out.GetErrorMessage() << std::endl;
+    return 1;
+  }
+  if (options.format == "folded") {
+    iftracer::WriteFoldedStacks(tree, &out);
+  } else if (options.format == "pprof") {
+    iftracer::WritePprof(tree, &out);
+  } else {
+    iftracer::WriteFlatProfile(tree, options.sort_by_self, &out);
+  }
+  if (!out.Close()) {
+    std::cerr << out.GetErrorMessage() << std::endl;
+    return 1;
+  }
+  if (options.output_file != "-") {
+    std::cerr << "[output]: " << options.output_file << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,339 @@
+// print the spans of iftracer.out.<tid> binary files (and
+// iftracer.out.<pid>.chunks containers) which match the given conditions
+// with their enclosing functions as csv, chrome trace json or perfetto trace
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "module_map.hpp"
+#include "output_buffer.hpp"
+#include "tool_common.hpp"
+#include "trace_query.hpp"
+#include "trace_reader.hpp"
+
+namespace {
+struct Options {
+  // default: stdout (query.pftrace for perfetto)
+  std::string output_file = "";
+  // "csv", "json" or "perfetto"
+  std::string format = "csv";
+  iftracer::QueryFilter filter;
+  // begin_ns and end_ns of filter are relative to the start of the process
+  bool relative_begin = false;
+  bool relative_end   = false;
+  // empty: all threads
+  std::unordered_set<int32_t> tids;
+  std::string prefix   = iftracer::default_trace_file_prefix;
+  size_t jobs          = 0;
+  size_t address_size  = sizeof(uint64_t);
+  std::string elf_file = "";
+  std::vector<std::string> search_directories;
+  std::vector<std::string> paths;
+};
+
+void help(const std::string& app_name) {
+  std::cerr
+      << "usage: " << app_name
+      << " [-F pattern] [-x pattern] [-t tid,...] [--from time] [--to time] "
+         "[-d duration] [-f format] [-o output] [-e elf_filepath] [-L dir] "
+         "[-j jobs] [-p prefix] [-m32] [files or dirs...]"
+      << std::endl
+      << "    -F: glob of function names (fnmatch, repeatable)" << std::endl
+      << "    -x: glob of the text of duration events and instants "
+         "(repeatable)"
+      << std::endl
+      << "        (default: all functions and text events, with -F only "
+         "functions, with -x only text events)"
+      << std::endl
+      << "    -t: tids of the threads (repeatable, default: all threads)"
+      << std::endl
+      << "    --from, --to: range of the begin of the spans" << std::endl
+      << "        <n>[ns|us|ms|s] of the trace clock (\"ts\" of iftracer-conv)"
+      << std::endl
+      << "        or +<n>[ns|us|ms|s] from the start of the process"
+      << std::endl
+      << "    -d: minimum duration of the spans (e.g. 5ms)" << std::endl
+      << "    -f: csv (one row per span with its stack), json (chrome trace)"
+      << std::endl
+      << "        or perfetto (protobuf) (default: csv)" << std::endl
+      << "    -o: output file (default: stdout, query.pftrace for perfetto)"
+      << std::endl
+      << "    -e: elf file of main program for function names" << std::endl
+      << "        (default: path recorded in <prefix><pid>.maps)" << std::endl
+      << "    -L: directory to search module files (e.g. sysroot)"
+      << std::endl
+      << "    -j: number of worker threads (default: number of cpus)"
+      << std::endl
+      << "    -p: trace file prefix (default: iftracer.out.)" << std::endl
+      << "    -m32: trace files were recorded by 32bit target" << std::endl
+      << "    default input is iftracer.out.<tid> and iftracer.out.<pid>.chunks"
+      << std::endl
+      << "    at current directory" << std::endl;
+}
+
+// "<n>[ns|us|ms|s]" (n can have a fraction) or "+<n>..." (relative)
+bool parse_time(const std::string& arg, uint64_t* ns, bool* relative) {
+  const char* s = arg.c_str();
+  if (relative != nullptr) {
+    *relative = *s == '+';
+    s += *relative;
+  }
+  char* end    = nullptr;
+  double value = std::strtod(s, &end);
+  if (end == s || value < 0) {
+    return false;
+  }
+  std::string unit(end);
+  double scale = 1;
+  if (unit == "s") {
+    scale = 1e9;
+  } else if (unit == "ms") {
+    scale = 1e6;
+  } else if (unit == "us") {
+    scale = 1e3;
+  } else if (unit != "ns" && !unit.empty()) {
+    return false;
+  }
+  *ns = static_cast<uint64_t>(value * scale);
+  return true;
+}
+
+bool parse_tids(const std::string& arg, std::unordered_set<int32_t>* tids) {
+  const char* s = arg.c_str();
+  while (*s != '\0') {
+    char* end = nullptr;
+    long tid  = std::strtol(s, &end, 10);
+    if (end == s || (*end != ',' && *end != '\0')) {
+      return false;
+    }
+    tids->insert(static_cast<int32_t>(tid));
+    s = *end == ',' ? end + 1 : end;
+  }
+  return true;
+}
+
+bool parse_options(int argc, const char* argv[], Options* options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "-h" || arg == "--help") {
+      return false;
+    } else if (arg == "-F" && i + 1 < argc) {
+      options->filter.function_patterns.push_back(argv[++i]);
+    } else if (arg == "-x" && i + 1 < argc) {
+      options->filter.text_patterns.push_back(argv[++i]);
+    } else if (arg == "-t" && i + 1 < argc) {
+      if (!parse_tids(argv[++i], &options->tids)) {
+        std::cerr << "invalid tids: " << argv[i] << std::endl;
+        return false;
+      }
+    } else if (arg == "--from" && i + 1 < argc) {
+      if (!parse_time(argv[++i], &options->filter.begin_ns,
+                      &options->relative_begin)) {
+        std::cerr << "invalid time: " << argv[i] << std::endl;
+        return false;
+      }
+    } else if (arg == "--to" && i + 1 < argc) {
+      if (!parse_time(argv[++i], &options->filter.end_ns,
+                      &options->relative_end)) {
+        std::cerr << "invalid time: " << argv[i] << std::endl;
+        return false;
+      }
+    } else if (arg == "-d" && i + 1 < argc) {
+      if (!parse_time(argv[++i], &options->filter.min_duration_ns,
+                      nullptr)) {
+        std::cerr << "invalid duration: " << argv[i] << std::endl;
+        return false;
+      }
+    } else if (arg == "-f" && i + 1 < argc) {
+      options->format = argv[++i];
+      if (options->format != "csv" && options->format != "json" &&
+          options->format != "perfetto") {
+        std::cerr << "unknown format: " << options->format << std::endl;
+        return false;
+      }
+    } else if (arg == "-o" && i + 1 < argc) {
+      options->output_file = argv[++i];
+    } else if (arg == "-e" && i + 1 < argc) {
+      options->elf_file = argv[++i];
+    } else if (arg == "-L" && i + 1 < argc) {
+      options->search_directories.push_back(argv[++i]);
+    } else if (arg == "-j" && i + 1 < argc) {
+      options->jobs = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "-p" && i + 1 < argc) {
+      options->prefix = argv[++i];
+    } else if (arg == "-m32") {
+      options->address_size = sizeof(uint32_t);
+    } else if (!arg.empty() && arg[0] == '-') {
+      std::cerr << "unknown option: " << arg << std::endl;
+      return false;
+    } else {
+      options->paths.push_back(arg);
+    }
+  }
+  if (options->output_file.empty()) {
+    options->output_file =
+        options->format == "perfetto" ? "query.pftrace" : "-";
+  }
+  return true;
+}
+
+// replay one thread into a TraceQuery
+class ThreadQuery {
+ public:
+  ThreadQuery(iftracer::TraceReader& reader,
+              const iftracer::AddressResolver* resolver,
+              iftracer::TraceQuery* query)
+      : reader_(reader), query_(query), functions_(resolver) {}
+
+  // begin_ns: the thread is decoded from the keyframe before it
+  bool Run(uint64_t begin_ns) {
+    std::vector<uint32_t> stack;
+    uint32_t depth = 0;
+    if (begin_ns > 0) {
+      uint64_t timestamp = reader_.NanosecondsToTicks(begin_ns);
+      if (!reader_.Seek(timestamp)) {
+        return false;
+      }
+      for (uint64_t address : reader_.KeyframeStack()) {
+        stack.push_back(Function(timestamp, address));
+      }
+      depth = reader_.KeyframeDepth();
+    }
+    iftracer::TraceEvent event;
+    uint64_t last_ns = 0;
+    bool first       = true;
+    while (reader_.Next(&event)) {
+      last_ns = reader_.TicksToNanoseconds(event.timestamp);
+      if (first) {
+        // the begin of the functions at the keyframe is unknown
+        query_->Restore(last_ns, stack, depth);
+        first = false;
+      }
+      switch (event.type) {
+        case iftracer::TraceEvent::kEnter:
+          query_->Enter(last_ns, Function(event.timestamp, event.address));
+          break;
+        case iftracer::TraceEvent::kExit:
+          query_->Exit(last_ns);
+          break;
+        case iftracer::TraceEvent::kDurationEnter:
+          query_->DurationEnter(last_ns);
+          break;
+        case iftracer::TraceEvent::kDurationExit:
+          query_->DurationExit(last_ns, event.text, event.text_size);
+          break;
+        case iftracer::TraceEvent::kInstant:
+          query_->Instant(last_ns, event.text, event.text_size);
+          break;
+        default:
+          break;
+      }
+      if (query_->Done(last_ns)) {
+        break;
+      }
+    }
+    // the thread was still running (or the process was killed)
+    query_->Finish(last_ns);
+    return true;
+  }
+
+ private:
+  uint32_t Function(uint64_t timestamp, uint64_t address) {
+    return functions_.Get(timestamp, address,
+                          [this](const iftracer::ResolvedAddress&,
+                                 const std::string& name) {
+                            return query_->AddFunction(name);
+                          });
+  }
+
+  iftracer::TraceReader& reader_;
+  iftracer::TraceQuery* query_;
+  // function index of query_
+  iftracer::FunctionCache<uint32_t> functions_;
+};
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+  Options options;
+  if (!parse_options(argc, argv, &options)) {
+    help(std::string(argv[0]));
+    return 1;
+  }
+  std::vector<std::string> trace_files;
+  std::string error_message;
+  if (!iftracer::ListTraceFiles(options.paths, options.prefix, &trace_files,
+                                &error_message)) {
+    std::cerr << error_message << std::endl;
+    return 1;
+  }
+  if (trace_files.empty()) {
+    std::cerr << "not found trace files" << std::endl;
+    return 1;
+  }
+  iftracer::ResolverTable resolvers(options.prefix, options.elf_file,
+                                    options.search_directories);
+
+  // each thread is scanned in parallel from the keyframe before --from
+  // and until the spans which begin before --to end
+  std::vector<iftracer::TraceJob> jobs =
+      iftracer::ListTraceJobs(trace_files, options.jobs);
+  std::vector<iftracer::QueryResult> results(jobs.size());
+  iftracer::RunParallel(jobs.size(), options.jobs, [&](size_t i) {
+    const std::string& trace_file = trace_files[jobs[i].file_index];
+    iftracer::TraceReader reader;
+    reader.SetAddressSize(options.address_size);
+    if (!reader.Open(trace_file) ||
+        (jobs[i].stream_index != 0 &&
+         !reader.SelectStream(jobs[i].stream_index))) {
+      std::cerr << "[skip] " << reader.GetErrorMessage() << std::endl;
+      return;
+    }
+    if (!options.tids.empty() && options.tids.count(reader.Tid()) == 0) {
+      return;
+    }
+    iftracer::QueryFilter filter = options.filter;
+    uint64_t start_ns = reader.TicksToNanoseconds(reader.BaseTimestamp());
+    if (options.relative_begin) {
+      filter.begin_ns += start_ns;
+    }
+    if (options.relative_end) {
+      filter.end_ns += start_ns;
+    }
+    iftracer::TraceQuery query(filter);
+    if (!ThreadQuery(reader, resolvers.Get(trace_file, reader.Pid()), &query)
+             .Run(filter.begin_ns)) {
+      std::cerr << "[skip] " << reader.GetErrorMessage() << std::endl;
+      return;
+    }
+    if (reader.HasError()) {
+      std::cerr << "[broken] " << trace_file << ":"
+                << reader.GetErrorMessage() << std::endl;
+    }
+    results[i].pid   = reader.Pid();
+    results[i].tid   = reader.Tid();
+    results[i].spans = query.Spans();
+  });
+
+  iftracer::OutputBuffer out;
+  if (!out.Open(options.output_file)) {
+    std::cerr << out.GetErrorMessage() << std::endl;
+    return 1;
+  }
+  if (options.format == "json") {
+    iftracer::WriteQueryJson(results, &out);
+  } else if (options.format == "perfetto") {
+    iftracer::WriteQueryPerfetto(results, &out);
+  } else {
+    iftracer::WriteQueryCsv(results, &out);
+  }
+  if (!out.Close()) {
+    std::cerr << out.GetErrorMessage() << std::endl;
+    return 1;
+  }
+  if (options.output_file != "-") {
+    std::cerr << "[output]: " << options.output_file << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,65 @@
+// resolve hex addresses to "address<TAB>function<TAB>file:line"
+// replacement of addr2func of conv.sh (objdump | grep for each address)
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "symbolizer.hpp"
+
+namespace {
+void help(const std::string& app_name) {
+  std::cerr << "usage: " << app_name << " elf_filepath [hex style addrs...]"
+            << std::endl
+            << "    addresses are read from stdin if no address is given"
+            << std::endl
+            << "    arm thumb bit of addresses is ignored automatically"
+            << std::endl;
+}
+
+void resolve(const iftracer::Symbolizer& symbolizer, const std::string& arg) {
+  char* end        = nullptr;
+  uint64_t address = std::strtoull(arg.c_str(), &end, 16);
+  if (end == arg.c_str()) {
+    return;
+  }
+  const iftracer::Symbol* symbol = symbolizer.Lookup(address);
+  std::cout << arg << '\t';
+  if (symbol == nullptr) {
+    std::cout << "??\t??" << '\n';
+    return;
+  }
+  std::string location = symbolizer.Location(*symbol);
+  std::cout << symbolizer.Name(symbol->name_id) << '\t'
+            << (location.empty() ? "??" : location) << '\n';
+}
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2 || std::string(argv[1]) == "-h" ||
+      std::string(argv[1]) == "--help") {
+    help(std::string(argv[0]));
+    return 1;
+  }
+  iftracer::Symbolizer symbolizer;
+  if (!symbolizer.Open(argv[1])) {
+    std::cerr << symbolizer.GetErrorMessage() << std::endl;
+    return 1;
+  }
+  std::string warning = symbolizer.GetErrorMessage();
+  if (!warning.empty()) {
+    std::cerr << "[warn] " << warning << std::endl;
+  }
+  std::ios::sync_with_stdio(false);
+  if (argc > 2) {
+    for (int i = 2; i < argc; i++) {
+      resolve(symbolizer, argv[i]);
+    }
+  } else {
+    std::string line;
+    while (std::getline(std::cin, line)) {
+      resolve(symbolizer, line);
+    }
+  }
+  return 0;
+}
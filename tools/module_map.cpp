@@ -0,0 +1,269 @@
+#include "module_map.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace iftracer {
+namespace {
+std::string basename_of(const std::string& path) {
+  size_t pos = path.rfind('/');
+  return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+}  // namespace
+
+bool ModuleMap::Open(const std::string& filename) {
+  std::ifstream ifs(filename);
+  if (!ifs) {
+    error_message_ = "Open():" + std::string(std::strerror(errno)) + ":" +
+                     filename + ":" + error_message_;
+    return false;
+  }
+  snapshots_.clear();
+  std::map<std::string, uint32_t> path_ids;
+  std::string line;
+  size_t line_number = 0;
+  while (std::getline(ifs, line)) {
+    line_number++;
+    std::istringstream iss(line);
+    std::string kind;
+    iss >> kind;
+    if (kind == "snapshot") {
+      snapshots_.emplace_back();
+      iss >> snapshots_.back().timestamp;
+    } else if (kind == "module" && !snapshots_.empty()) {
+      Module module;
+      iss >> std::hex >> module.base >> module.build_id;
+      // path may contain spaces
+      std::getline(iss >> std::ws, module.path);
+      module.path_id = path_ids.emplace(module.path, path_ids.size())
+                           .first->second;
+      module.is_main = snapshots_.back().modules.empty();
+      snapshots_.back().modules.push_back(module);
+    } else if (kind == "segment" && !snapshots_.empty() &&
+               !snapshots_.back().modules.empty()) {
+      ModuleSegment segment;
+      iss >> std::hex >> segment.vaddr >> segment.memsz >> segment.flags;
+      snapshots_.back().modules.back().segments.push_back(segment);
+    } else if (!kind.empty()) {
+      error_message_ = "Open(): broken line " + std::to_string(line_number) +
+                       ":" + filename + ":" + error_message_;
+      return false;
+    }
+  }
+  for (auto& snapshot : snapshots_) {
+    for (size_t i = 0; i < snapshot.modules.size(); i++) {
+      const Module& module = snapshot.modules[i];
+      for (auto& segment : module.segments) {
+        ModuleSnapshot::Range range;
+        range.start        = module.base + segment.vaddr;
+        range.end          = range.start + segment.memsz;
+        range.module_index = i;
+        snapshot.ranges.push_back(range);
+      }
+    }
+    std::sort(snapshot.ranges.begin(), snapshot.ranges.end(),
+              [](const ModuleSnapshot::Range& a,
+                 const ModuleSnapshot::Range& b) { return a.start < b.start; });
+  }
+  path_count_ = path_ids.size();
+  std::stable_sort(snapshots_.begin(), snapshots_.end(),
+                   [](const ModuleSnapshot& a, const ModuleSnapshot& b) {
+                     return a.timestamp < b.timestamp;
+                   });
+  return true;
+}
+
+const Module* ModuleMap::Find(uint64_t timestamp, uint64_t address) const {
+  if (snapshots_.empty()) {
+    return nullptr;
+  }
+  // last snapshot taken before the timestamp
+  auto snapshot = std::upper_bound(
+      snapshots_.begin(), snapshots_.end(), timestamp,
+      [](uint64_t ts, const ModuleSnapshot& s) { return ts < s.timestamp; });
+  if (snapshot != snapshots_.begin()) {
+    --snapshot;
+  }
+  // snapshots are taken some time after dlopen(): a module which is not in
+  // the snapshot yet is found in the next ones
+  for (; snapshot != snapshots_.end(); ++snapshot) {
+    auto& ranges = snapshot->ranges;
+    auto range   = std::upper_bound(
+        ranges.begin(), ranges.end(), address,
+        [](uint64_t addr, const ModuleSnapshot::Range& r) {
+          return addr < r.start;
+        });
+    if (range == ranges.begin()) {
+      continue;
+    }
+    --range;
+    if (address < range->end) {
+      return &snapshot->modules[range->module_index];
+    }
+  }
+  return nullptr;
+}
+
+std::string ModuleMap::GetErrorMessage() {
+  std::string tmp = error_message_;
+  error_message_.clear();
+  return tmp;
+}
+
+std::string SymbolizerCache::FindFile(const std::string& path) const {
+  if (access(path.c_str(), R_OK) == 0) {
+    return path;
+  }
+  for (auto& directory : search_directories_) {
+    for (auto& candidate :
+         {directory + "/" + path, directory + "/" + basename_of(path)}) {
+      if (access(candidate.c_str(), R_OK) == 0) {
+        return candidate;
+      }
+    }
+  }
+  return "";
+}
+
+const Symbolizer* SymbolizerCache::Get(const std::string& path,
+                                       const std::string& build_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = symbolizers_.find(path);
+  if (it != symbolizers_.end()) {
+    return it->second.get();
+  }
+  // failed modules are also cached as nullptr
+  std::unique_ptr<Symbolizer>& symbolizer = symbolizers_[path];
+  std::string filename                    = FindFile(path);
+  if (filename.empty()) {
+    std::cerr << "[warn] not found module: " << path << std::endl;
+    return nullptr;
+  }
+  symbolizer.reset(new Symbolizer());
+  if (!symbolizer->Open(filename)) {
+    std::cerr << "[warn] " << symbolizer->GetErrorMessage() << std::endl;
+    symbolizer.reset();
+    return nullptr;
+  }
+  if (!build_id.empty() && build_id != "-" &&
+      !symbolizer->BuildId().empty() && symbolizer->BuildId() != build_id) {
+    std::cerr << "[warn] build-id mismatch: " << filename
+              << " (recorded: " << build_id
+              << ", file: " << symbolizer->BuildId() << ")" << std::endl;
+  }
+  return symbolizer.get();
+}
+
+bool AddressResolver::LoadModuleMap(const std::string& filename) {
+  has_module_map_ = module_map_.Open(filename);
+  if (has_module_map_) {
+    main_slot_ = module_map_.PathCount();
+    symbolizers_.reset(new Slot[main_slot_ + 1]);
+  }
+  return has_module_map_;
+}
+
+const Symbolizer* AddressResolver::GetSymbolizer(
+    uint32_t slot, const std::string& path,
+    const std::string& build_id) const {
+  Slot& entry = symbolizers_[slot];
+  if (entry.loaded.load(std::memory_order_acquire)) {
+    return entry.symbolizer.load(std::memory_order_relaxed);
+  }
+  // other threads may get the same symbolizer at the same time
+  const Symbolizer* symbolizer = cache_.Get(path, build_id);
+  entry.symbolizer.store(symbolizer, std::memory_order_relaxed);
+  entry.loaded.store(true, std::memory_order_release);
+  return symbolizer;
+}
+
+void AddressResolver::Resolve(uint64_t timestamp, uint64_t address,
+                              ResolvedAddress* resolved) const {
+  *resolved = ResolvedAddress();
+  if (!has_module_map_) {
+    if (main_elf_.empty()) {
+      return;
+    }
+    resolved->offset     = address;
+    resolved->symbolizer = GetSymbolizer(main_slot_, main_elf_, "");
+  } else {
+    const Module* module = module_map_.Find(timestamp, address);
+    if (module == nullptr) {
+      return;
+    }
+    resolved->module = module;
+    resolved->offset = address - module->base;
+    if (module->is_main && !main_elf_.empty()) {
+      resolved->symbolizer =
+          GetSymbolizer(main_slot_, main_elf_, module->build_id);
+    } else if (!module->path.empty()) {
+      resolved->symbolizer =
+          GetSymbolizer(module->path_id, module->path, module->build_id);
+    }
+  }
+  if (resolved->symbolizer != nullptr) {
+    resolved->symbol = resolved->symbolizer->Lookup(resolved->offset);
+  }
+}
+
+std::string AddressResolver::Name(const ResolvedAddress& resolved,
+                                  uint64_t address) {
+  char buf[32];
+  if (resolved.symbol != nullptr) {
+    return resolved.symbolizer->Name(resolved.symbol->name_id);
+  }
+  if (resolved.module != nullptr) {
+    snprintf(buf, sizeof(buf), "+0x%llx",
+             static_cast<unsigned long long>(resolved.offset));
+    return basename_of(resolved.module->path) + buf;
+  }
+  snprintf(buf, sizeof(buf), "0x%llx", static_cast<unsigned long long>(address));
+  return buf;
+}
+
+ResolverTable::ResolverTable(
+    const std::string& prefix, const std::string& main_elf,
+    const std::vector<std::string>& search_directories)
+    : prefix_(prefix), main_elf_(main_elf) {
+  for (auto& directory : search_directories) {
+    cache_.AddSearchDirectory(directory);
+  }
+}
+
+const AddressResolver* ResolverTable::Get(const std::string& trace_file,
+                                          int pid) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = resolvers_.find(pid);
+  if (it != resolvers_.end()) {
+    return it->second.get();
+  }
+  std::unique_ptr<AddressResolver>& resolver = resolvers_[pid];
+  resolver.reset(new AddressResolver(cache_, main_elf_));
+  std::string map_file = ModuleMapFile(trace_file, pid);
+  if (access(map_file.c_str(), R_OK) == 0 &&
+      !resolver->LoadModuleMap(map_file)) {
+    std::cerr << "[warn] " << resolver->GetErrorMessage() << std::endl;
+  }
+  if (!resolver->HasModuleMap() && main_elf_.empty()) {
+    resolver.reset();
+  }
+  return resolver.get();
+}
+
+std::string ResolverTable::ModuleMapFile(const std::string& trace_file,
+                                         int pid) const {
+  size_t pos            = trace_file.rfind('/');
+  std::string directory = pos == std::string::npos
+                              ? std::string("")
+                              : trace_file.substr(0, pos + 1);
+  return directory + prefix_ + std::to_string(pid) + ".maps";
+}
+}  // namespace iftracer
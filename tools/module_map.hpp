@@ -0,0 +1,193 @@
+#ifndef MODULE_MAP_HPP_INCLUDED
+#define MODULE_MAP_HPP_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "symbolizer.hpp"
+
+namespace iftracer {
+struct ModuleSegment {
+  uint64_t vaddr = 0;
+  uint64_t memsz = 0;
+  std::string flags;
+};
+
+struct Module {
+  // first module of a snapshot is main program
+  bool is_main  = false;
+  uint64_t base = 0;
+  std::string build_id;
+  std::string path;
+  // same id for the same path in all snapshots (< ModuleMap::PathCount())
+  uint32_t path_id = 0;
+  std::vector<ModuleSegment> segments;
+};
+
+struct ModuleSnapshot {
+  struct Range {
+    uint64_t start        = 0;
+    uint64_t end          = 0;
+    uint32_t module_index = 0;
+  };
+  uint64_t timestamp = 0;
+  std::vector<Module> modules;
+  // runtime address ranges of segments (sorted by start)
+  std::vector<Range> ranges;
+};
+
+// reader of "<prefix><pid>.maps" written by module_snapshot.cpp
+class ModuleMap {
+ public:
+  bool Open(const std::string& filename);
+  // module which contains the address at the timestamp (or in the first
+  // later snapshot which contains it) or nullptr
+  const Module* Find(uint64_t timestamp, uint64_t address) const;
+  const std::vector<ModuleSnapshot>& Snapshots() const { return snapshots_; }
+  // number of distinct module paths
+  uint32_t PathCount() const { return path_count_; }
+  std::string GetErrorMessage();
+
+ private:
+  std::vector<ModuleSnapshot> snapshots_;
+  uint32_t path_count_ = 0;
+  std::string error_message_ = "";
+};
+
+// thread safe cache of Symbolizer for each elf path
+class SymbolizerCache {
+ public:
+  // directory to search module files (e.g. sysroot of cross target)
+  void AddSearchDirectory(const std::string& directory) {
+    search_directories_.push_back(directory);
+  }
+  // return nullptr if the elf file is not available
+  // build_id is checked if it is not "-" or empty
+  const Symbolizer* Get(const std::string& path, const std::string& build_id);
+
+ private:
+  std::string FindFile(const std::string& path) const;
+
+  std::mutex mutex_;
+  std::map<std::string, std::unique_ptr<Symbolizer>> symbolizers_;
+  std::vector<std::string> search_directories_;
+};
+
+struct ResolvedAddress {
+  // nullptr if no module map is used
+  const Module* module = nullptr;
+  // address in the elf file
+  uint64_t offset = 0;
+  // nullptr if not resolved
+  const Symbolizer* symbolizer = nullptr;
+  const Symbol* symbol         = nullptr;
+};
+
+// runtime address -> (module, offset) -> symbol
+class AddressResolver {
+ public:
+  // main_elf: elf file of main program (empty: path recorded in module map)
+  AddressResolver(SymbolizerCache& cache, const std::string& main_elf)
+      : cache_(cache), main_elf_(main_elf), symbolizers_(new Slot[1]) {}
+  // without module map, addresses are resolved by main_elf as they are
+  bool LoadModuleMap(const std::string& filename);
+  bool HasModuleMap() const { return has_module_map_; }
+  void Resolve(uint64_t timestamp, uint64_t address,
+               ResolvedAddress* resolved) const;
+  // function name, "module+0xoffset" or "0xaddress"
+  static std::string Name(const ResolvedAddress& resolved, uint64_t address);
+  std::string GetErrorMessage() { return module_map_.GetErrorMessage(); }
+
+ private:
+  // Symbolizer of a path which is looked up in cache_ at the first use
+  // Resolve() of each event does not take the lock of cache_
+  struct Slot {
+    std::atomic<bool> loaded{false};
+    std::atomic<const Symbolizer*> symbolizer{nullptr};
+  };
+  const Symbolizer* GetSymbolizer(uint32_t slot, const std::string& path,
+                                  const std::string& build_id) const;
+
+  SymbolizerCache& cache_;
+  std::string main_elf_;
+  ModuleMap module_map_;
+  bool has_module_map_ = false;
+  // Module::path_id of module_map_ and main_elf_ (last)
+  std::unique_ptr<Slot[]> symbolizers_;
+  uint32_t main_slot_ = 0;
+};
+
+// value of each function for the tools (e.g. index or interned id)
+// not thread safe: one cache for each trace file
+template <typename Value>
+class FunctionCache {
+ public:
+  // resolver: nullptr if there is neither module map nor elf file
+  explicit FunctionCache(const AddressResolver* resolver)
+      : resolver_(resolver) {}
+
+  // create(resolved, name) returns the value at the first lookup
+  template <typename Create>
+  const Value& Get(uint64_t timestamp, uint64_t address, Create create) {
+    ResolvedAddress resolved;
+    if (resolver_ != nullptr) {
+      resolver_->Resolve(timestamp, address, &resolved);
+    }
+    // same address may be another function after dlclose()
+    Key key(resolved.module,
+            resolved.module != nullptr ? resolved.offset : address);
+    auto it = values_.find(key);
+    if (it == values_.end()) {
+      it = values_
+               .emplace(key, create(resolved,
+                                    AddressResolver::Name(resolved, address)))
+               .first;
+    }
+    return it->second;
+  }
+
+ private:
+  // (module, offset) or (nullptr, address)
+  typedef std::pair<const Module*, uint64_t> Key;
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return std::hash<const Module*>()(key.first) ^
+             std::hash<uint64_t>()(key.second);
+    }
+  };
+
+  const AddressResolver* resolver_;
+  std::unordered_map<Key, Value, KeyHash> values_;
+};
+
+// thread safe AddressResolver of each process which is created at first use
+// from "<prefix><pid>.maps" next to the trace file
+class ResolverTable {
+ public:
+  // main_elf: see AddressResolver
+  ResolverTable(const std::string& prefix, const std::string& main_elf,
+                const std::vector<std::string>& search_directories);
+
+  // nullptr if there is neither module map nor elf file
+  const AddressResolver* Get(const std::string& trace_file, int pid);
+
+ private:
+  std::string ModuleMapFile(const std::string& trace_file, int pid) const;
+
+  std::string prefix_;
+  std::string main_elf_;
+  SymbolizerCache cache_;
+  std::mutex mutex_;
+  std::map<int, std::unique_ptr<AddressResolver>> resolvers_;
+};
+}  // namespace iftracer
+
+#endif  // MODULE_MAP_HPP_INCLUDED
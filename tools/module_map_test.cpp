@@ -0,0 +1,93 @@
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "module_map.hpp"
+#include "module_snapshot.hpp"
+
+namespace sample {
+__attribute__((noinline)) int target_function(int x) { return x * 3 + 1; }
+}  // namespace sample
+
+int main(int argc, const char* argv[]) {
+  std::string filename = "module_map_test.maps";
+  std::string error_message;
+  bool ret =
+      iftracer::WriteModuleSnapshot(filename, 100, true, &error_message);
+  assert(ret || !"failed to write snapshot");
+  // later snapshot is appended
+  ret = iftracer::WriteModuleSnapshot(filename, 200, false, &error_message);
+  assert(ret || !"failed to append snapshot");
+
+  iftracer::ModuleMap module_map;
+  if (!module_map.Open(filename)) {
+    std::cerr << module_map.GetErrorMessage() << std::endl;
+    return 1;
+  }
+  assert(module_map.Snapshots().size() == 2 || !"wrong snapshot count");
+  assert(module_map.Snapshots()[1].timestamp == 200 || !"wrong timestamp");
+
+  uint64_t address = reinterpret_cast<uintptr_t>(&sample::target_function);
+  const iftracer::Module* module = module_map.Find(150, address);
+  assert(module != nullptr || !"not found main program");
+  assert(module->is_main || !"wrong module");
+  // timestamp before first snapshot uses first snapshot
+  assert(module_map.Find(0, address) != nullptr || !"not found");
+
+  // shared library function is found in another module
+  uint64_t libc_address = reinterpret_cast<uintptr_t>(&dlsym);
+  const iftracer::Module* libc_module = module_map.Find(150, libc_address);
+  assert(libc_module != nullptr || !"not found shared library");
+  assert(!libc_module->is_main || !"wrong shared library module");
+
+  iftracer::SymbolizerCache cache;
+  iftracer::AddressResolver resolver(cache, "");
+  ret = resolver.LoadModuleMap(filename);
+  assert(ret || !"failed to load module map");
+  iftracer::ResolvedAddress resolved;
+  resolver.Resolve(150, address, &resolved);
+  assert(resolved.symbol != nullptr || !"not resolved");
+  assert(resolver.Name(resolved, address) == "sample::target_function(int)" ||
+         !"wrong name");
+
+  resolver.Resolve(150, 0, &resolved);
+  assert(resolver.Name(resolved, 0) == "0x0" || !"wrong unresolved name");
+
+  // the value is created once for each function
+  iftracer::FunctionCache<std::string> functions(&resolver);
+  int created = 0;
+  auto create = [&created](const iftracer::ResolvedAddress&,
+                           const std::string& name) {
+    created++;
+    return name;
+  };
+  assert(functions.Get(150, address, create) ==
+             "sample::target_function(int)" ||
+         !"wrong cached name");
+  functions.Get(150, address, create);
+  assert(functions.Get(150, 0, create) == "0x0" || !"wrong cached name");
+  assert(created == 2 || !"function is not cached");
+
+  // module loaded before the snapshot which records it
+  {
+    std::ofstream ofs(filename);
+    ofs << "snapshot 100\nmodule 1000 - /bin/main\nsegment 0 100 r-x\n"
+           "snapshot 200\nmodule 1000 - /bin/main\nsegment 0 100 r-x\n"
+           "module 5000 - /lib/plugin.so\nsegment 0 100 r-x\n";
+  }
+  iftracer::ModuleMap plugin_map;
+  ret = plugin_map.Open(filename);
+  assert(ret || !"failed to open module map");
+  const iftracer::Module* plugin = plugin_map.Find(150, 0x5010);
+  assert((plugin != nullptr && plugin->path == "/lib/plugin.so" &&
+          plugin->path_id == 1) ||
+         !"module of the next snapshot is not found");
+  assert(plugin_map.Find(150, 0x9000) == nullptr || !"wrong module");
+  unlink(filename.c_str());
+  return sample::target_function(0) == 1 ? 0 : 1;
+}
@@ -0,0 +1,153 @@
+#include "output_buffer.hpp"
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace iftracer {
+bool OutputBuffer::Open(const std::string& filename) {
+  Close();
+  filename_ = filename;
+  if (filename == "-") {
+    fp_        = stdout;
+    is_stdout_ = true;
+    return true;
+  }
+  fp_ = fopen(filename.c_str(), "wb");
+  if (fp_ == nullptr) {
+    error_message_ = "Open(): fopen():" + std::string(std::strerror(errno)) +
+                     ":" + filename + ":" + error_message_;
+    return false;
+  }
+  // we have own buffer
+  setvbuf(fp_, nullptr, _IONBF, 0);
+  return true;
+}
+
+bool OutputBuffer::Close() {
+  if (fp_ == nullptr) {
+    return true;
+  }
+  bool ret = Flush();
+  if (is_stdout_) {
+    fflush(fp_);
+  } else if (fclose(fp_) != 0) {
+    error_message_ = "Close(): fclose():" + std::string(std::strerror(errno)) +
+                     ":" + filename_ + ":" + error_message_;
+    ret = false;
+  }
+  fp_        = nullptr;
+  is_stdout_ = false;
+  return ret;
+}
+
+bool OutputBuffer::Flush() {
+  if (size_ == 0) {
+    return true;
+  }
+  size_t n = size_;
+  size_    = 0;
+  WriteDirect(&buffer_[0], n);
+  return !HasError();
+}
+
+void OutputBuffer::WriteDirect(const char* s, size_t n) {
+  written_size_ += n;
+  if (fp_ == nullptr) {
+    return;
+  }
+  if (fwrite(s, 1, n, fp_) != n && error_message_.empty()) {
+    error_message_ = "Flush(): fwrite():" + std::string(std::strerror(errno)) +
+                     ":" + filename_ + ":";
+  }
+}
+
+std::string OutputBuffer::GetErrorMessage() {
+  std::string tmp = error_message_;
+  error_message_.clear();
+  return tmp;
+}
+
+void OutputBuffer::AppendUint(uint64_t v) {
+  char buf[20];
+  char* p = buf + sizeof(buf);
+  do {
+    *--p = '0' + (v % 10);
+    v /= 10;
+  } while (v != 0);
+  Append(p, buf + sizeof(buf) - p);
+}
+
+void OutputBuffer::AppendInt(int64_t v) {
+  if (v < 0) {
+    Append('-');
+    AppendUint(-static_cast<uint64_t>(v));
+    return;
+  }
+  AppendUint(v);
+}
+
+void OutputBuffer::AppendHex(uint64_t v) {
+  static const char digits[] = "0123456789abcdef";
+  char buf[18];
+  char* p = buf + sizeof(buf);
+  do {
+    *--p = digits[v & 0xf];
+    v >>= 4;
+  } while (v != 0);
+  *--p = 'x';
+  *--p = '0';
+  Append(p, buf + sizeof(buf) - p);
+}
+
+void OutputBuffer::AppendJsonString(const char* s, size_t n) {
+  static const char digits[] = "0123456789abcdef";
+  Append('"');
+  size_t begin = 0;
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = s[i];
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    Append(s + begin, i - begin);
+    begin = i + 1;
+    switch (c) {
+      case '"':
+        Append("\\\"", 2);
+        break;
+      case '\\':
+        Append("\\\\", 2);
+        break;
+      case '\n':
+        Append("\\n", 2);
+        break;
+      case '\t':
+        Append("\\t", 2);
+        break;
+      default:
+        char buf[6] = {'\\', 'u', '0', '0', digits[c >> 4], digits[c & 0xf]};
+        Append(buf, sizeof(buf));
+        break;
+    }
+  }
+  Append(s + begin, n - begin);
+  Append('"');
+}
+
+void OutputBuffer::AppendMicroseconds(uint64_t ns) {
+  AppendUint(ns / 1000);
+  uint32_t fraction = ns % 1000;
+  char buf[4]       = {'.', static_cast<char>('0' + fraction / 100),
+                 static_cast<char>('0' + fraction / 10 % 10),
+                 static_cast<char>('0' + fraction % 10)};
+  Append(buf, sizeof(buf));
+}
+
+void OutputBuffer::AppendDouble(double v) {
+  char buf[32];
+  int n = snprintf(buf, sizeof(buf), "%.17g", v);
+  Append(buf, n);
+}
+}  // namespace iftracer
@@ -0,0 +1,73 @@
+#ifndef OUTPUT_BUFFER_HPP_INCLUDED
+#define OUTPUT_BUFFER_HPP_INCLUDED
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace iftracer {
+// fixed size buffered writer with fast number/json formatting
+class OutputBuffer {
+ public:
+  explicit OutputBuffer(size_t capacity = 1024 * 1024) : buffer_(capacity){};
+  ~OutputBuffer() { Close(); };
+  OutputBuffer(const OutputBuffer&) = delete;
+  OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+  // "-" means stdout
+  bool Open(const std::string& filename);
+  bool Close();
+  bool Flush();
+  bool HasError() const { return !error_message_.empty(); }
+  std::string GetErrorMessage();
+  // number of bytes passed to Append*()
+  uint64_t WrittenSize() const { return written_size_ + size_; }
+
+  void Append(const char* s, size_t n) {
+    if (size_ + n > buffer_.size()) {
+      Flush();
+      if (n > buffer_.size()) {
+        WriteDirect(s, n);
+        return;
+      }
+    }
+    memcpy(&buffer_[size_], s, n);
+    size_ += n;
+  }
+  void Append(const char* s) { Append(s, strlen(s)); }
+  void Append(const std::string& s) { Append(s.data(), s.size()); }
+  void Append(char c) {
+    if (size_ + 1 > buffer_.size()) {
+      Flush();
+    }
+    buffer_[size_++] = c;
+  }
+  void AppendUint(uint64_t v);
+  void AppendInt(int64_t v);
+  // 0x prefixed lower case hex
+  void AppendHex(uint64_t v);
+  // quoted and escaped json string
+  void AppendJsonString(const char* s, size_t n);
+  void AppendJsonString(const std::string& s) {
+    AppendJsonString(s.data(), s.size());
+  }
+  // nanoseconds as microseconds with 3 decimal places (chrome trace "ts")
+  void AppendMicroseconds(uint64_t ns);
+  void AppendDouble(double v);
+
+ private:
+  void WriteDirect(const char* s, size_t n);
+
+  std::vector<char> buffer_;
+  size_t size_               = 0;
+  uint64_t written_size_     = 0;
+  FILE* fp_                  = nullptr;
+  bool is_stdout_            = false;
+  std::string filename_      = "";
+  std::string error_message_ = "";
+};
+}  // namespace iftracer
+
+#endif  // OUTPUT_BUFFER_HPP_INCLUDED
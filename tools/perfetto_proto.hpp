@@ -0,0 +1,91 @@
+#ifndef PERFETTO_PROTO_HPP_INCLUDED
+#define PERFETTO_PROTO_HPP_INCLUDED
+
+#include <cstdint>
+#include <string>
+
+namespace iftracer {
+// field numbers of protos/perfetto/trace/*.proto (only the used ones)
+// for ProtoWriter
+namespace perfetto {
+// Trace
+constexpr uint32_t trace_packet = 1;
+// TracePacket
+constexpr uint32_t packet_clock_snapshot     = 6;
+constexpr uint32_t packet_timestamp          = 8;
+constexpr uint32_t packet_sequence_id        = 10;
+constexpr uint32_t packet_track_event        = 11;
+constexpr uint32_t packet_interned_data      = 12;
+constexpr uint32_t packet_sequence_flags     = 13;
+constexpr uint32_t packet_timestamp_clock_id = 58;
+constexpr uint32_t packet_defaults           = 59;
+constexpr uint32_t packet_track_descriptor   = 60;
+constexpr uint64_t incremental_state_cleared = 1;
+// ClockSnapshot and ClockSnapshot.Clock
+constexpr uint32_t snapshot_clocks      = 1;
+constexpr uint32_t clock_id             = 1;
+constexpr uint32_t clock_timestamp      = 2;
+constexpr uint32_t clock_is_incremental = 3;
+constexpr uint64_t clock_boottime       = 6;
+// sequence scoped clock: packet timestamps are diffs from the previous one
+constexpr uint64_t clock_incremental = 64;
+// TracePacketDefaults and TrackEventDefaults
+constexpr uint32_t defaults_timestamp_clock_id = 58;
+constexpr uint32_t defaults_track_event        = 11;
+constexpr uint32_t defaults_track_uuid         = 11;
+// TrackDescriptor, ProcessDescriptor and ThreadDescriptor
+constexpr uint32_t track_uuid        = 1;
+constexpr uint32_t track_name        = 2;
+constexpr uint32_t track_process     = 3;
+constexpr uint32_t track_thread      = 4;
+constexpr uint32_t track_parent_uuid = 5;
+constexpr uint32_t track_counter     = 8;
+constexpr uint32_t process_pid       = 1;
+constexpr uint32_t thread_pid        = 1;
+constexpr uint32_t thread_tid        = 2;
+// TrackEvent
+constexpr uint32_t event_debug_annotations    = 4;
+constexpr uint32_t event_type                 = 9;
+constexpr uint32_t event_name_iid             = 10;
+constexpr uint32_t event_track_uuid           = 11;
+constexpr uint32_t event_categories           = 22;
+constexpr uint32_t event_name                 = 23;
+constexpr uint32_t event_counter_value        = 30;
+constexpr uint32_t event_double_counter_value = 44;
+constexpr uint32_t event_source_location_iid  = 34;
+constexpr uint32_t event_flow_ids             = 47;
+constexpr uint32_t event_terminating_flow_ids = 48;
+constexpr uint64_t type_slice_begin           = 1;
+constexpr uint64_t type_slice_end             = 2;
+constexpr uint64_t type_instant               = 3;
+constexpr uint64_t type_counter               = 4;
+// DebugAnnotation
+constexpr uint32_t annotation_name_iid      = 1;
+constexpr uint32_t annotation_int_value     = 4;
+constexpr uint32_t annotation_double_value  = 5;
+constexpr uint32_t annotation_string_value  = 6;
+constexpr uint32_t annotation_pointer_value = 7;
+// InternedData (EventName and DebugAnnotationName are {iid = 1, name = 2})
+constexpr uint32_t interned_event_names      = 2;
+constexpr uint32_t interned_annotation_names = 3;
+constexpr uint32_t interned_source_locations = 4;
+constexpr uint32_t interned_iid              = 1;
+constexpr uint32_t interned_name             = 2;
+// SourceLocation
+constexpr uint32_t location_iid         = 1;
+constexpr uint32_t location_file_name   = 2;
+constexpr uint32_t location_line_number = 4;
+
+// uuid of a track from a key such as "thread:<pid>:<tid>" (FNV-1a), so
+// that the tracks of iftracer-conv and iftracer-query are the same
+inline uint64_t TrackUuid(const std::string& key) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (char c : key) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+}  // namespace perfetto
+}  // namespace iftracer
+
+#endif  // PERFETTO_PROTO_HPP_INCLUDED
@@ -0,0 +1,31 @@
+#include "proto_writer.hpp"
+
+namespace iftracer {
+void ProtoWriter::AppendPackedVarints(uint32_t field,
+                                      const std::vector<uint64_t>& values) {
+  BeginMessage(field);
+  for (uint64_t v : values) {
+    AppendRawVarint(v);
+  }
+  EndMessage();
+}
+
+void ProtoWriter::BeginMessage(uint32_t field) {
+  AppendTag(field, kLengthDelimited);
+  message_begins_.push_back(data_.size());
+  data_.push_back('\0');
+}
+
+void ProtoWriter::EndMessage() {
+  size_t begin = message_begins_.back();
+  message_begins_.pop_back();
+  size_t size = data_.size() - begin - 1;
+  char buf[10];
+  size_t n = WriteVarint(buf, size) - buf;
+  // most messages are smaller than 128B and need no move
+  if (n > 1) {
+    data_.insert(begin + 1, n - 1, '\0');
+  }
+  memcpy(&data_[begin], buf, n);
+}
+}  // namespace iftracer
@@ -0,0 +1,95 @@
+#ifndef PROTO_WRITER_HPP_INCLUDED
+#define PROTO_WRITER_HPP_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace iftracer {
+// minimal protobuf encoder (wire format only, no schema)
+//
+// nested messages are written in place: BeginMessage() reserves one byte for
+// the length and EndMessage() widens it if the message is 128B or more
+class ProtoWriter {
+ public:
+  enum WireType {
+    kVarint          = 0,
+    kFixed64         = 1,
+    kLengthDelimited = 2,
+    kFixed32         = 5,
+  };
+
+  // also for int32/int64 (negative values are 10B), bool and enum
+  void AppendVarint(uint32_t field, uint64_t v) {
+    AppendTag(field, kVarint);
+    AppendRawVarint(v);
+  }
+  void AppendFixed64(uint32_t field, uint64_t v) {
+    AppendTag(field, kFixed64);
+    AppendRaw(&v, sizeof(v));
+  }
+  void AppendDouble(uint32_t field, double v) {
+    AppendTag(field, kFixed64);
+    AppendRaw(&v, sizeof(v));
+  }
+  // string, bytes or an encoded message
+  void AppendBytes(uint32_t field, const void* p, size_t n) {
+    AppendTag(field, kLengthDelimited);
+    AppendRawVarint(n);
+    AppendRaw(p, n);
+  }
+  void AppendString(uint32_t field, const std::string& s) {
+    AppendBytes(field, s.data(), s.size());
+  }
+  // packed repeated uint64/int64 (negative values are 10B)
+  void AppendPackedVarints(uint32_t field,
+                           const std::vector<uint64_t>& values);
+  void BeginMessage(uint32_t field);
+  void EndMessage();
+
+  const char* Data() const { return data_.data(); }
+  size_t Size() const { return data_.size(); }
+  bool Empty() const { return data_.empty(); }
+  void Clear() {
+    data_.clear();
+    message_begins_.clear();
+  }
+
+  static size_t VarintSize(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+      v >>= 7;
+      n++;
+    }
+    return n;
+  }
+  // write v to p (at most 10B) and return the end
+  static char* WriteVarint(char* p, uint64_t v) {
+    while (v >= 0x80) {
+      *p++ = static_cast<char>(v | 0x80);
+      v >>= 7;
+    }
+    *p++ = static_cast<char>(v);
+    return p;
+  }
+
+ private:
+  void AppendTag(uint32_t field, WireType wire_type) {
+    AppendRawVarint((static_cast<uint64_t>(field) << 3) | wire_type);
+  }
+  void AppendRawVarint(uint64_t v) {
+    char buf[10];
+    data_.append(buf, WriteVarint(buf, v) - buf);
+  }
+  void AppendRaw(const void* p, size_t n) {
+    data_.append(static_cast<const char*>(p), n);
+  }
+
+  std::string data_;
+  // offsets of the length bytes of open messages
+  std::vector<size_t> message_begins_;
+};
+}  // namespace iftracer
+
+#endif  // PROTO_WRITER_HPP_INCLUDED
@@ -0,0 +1,66 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+
+#include "proto_writer.hpp"
+
+namespace {
+std::string bytes(const iftracer::ProtoWriter& writer) {
+  return std::string(writer.Data(), writer.Size());
+}
+}  // namespace
+
+int main() {
+  // examples of the protobuf encoding guide
+  iftracer::ProtoWriter writer;
+  writer.AppendVarint(1, 150);
+  assert(bytes(writer) == std::string("\x08\x96\x01", 3) ||
+         !"wrong varint");
+  writer.Clear();
+  writer.AppendString(2, "testing");
+  assert(bytes(writer) == std::string("\x12\x07testing", 9) ||
+         !"wrong string");
+  writer.Clear();
+  writer.BeginMessage(3);
+  writer.AppendVarint(1, 150);
+  writer.EndMessage();
+  assert(bytes(writer) == std::string("\x1a\x03\x08\x96\x01", 5) ||
+         !"wrong nested message");
+
+  // negative int64 is 10B, fixed64 and double are little endian
+  writer.Clear();
+  writer.AppendVarint(4, static_cast<uint64_t>(-1));
+  assert(writer.Size() == 11 || !"wrong negative varint");
+  writer.Clear();
+  writer.AppendFixed64(47, 0x0102030405060708ULL);
+  assert(bytes(writer) ==
+             std::string("\xf9\x02\x08\x07\x06\x05\x04\x03\x02\x01", 10) ||
+         !"wrong fixed64");
+  writer.Clear();
+  writer.AppendDouble(5, 1.0);
+  assert(bytes(writer) ==
+             std::string("\x29\x00\x00\x00\x00\x00\x00\xf0\x3f", 9) ||
+         !"wrong double");
+
+  // the length of a nested message of 128B or more is widened
+  // and the outer one includes it
+  writer.Clear();
+  std::string text(200, 'a');
+  writer.BeginMessage(1);
+  writer.AppendVarint(1, 1);
+  writer.BeginMessage(2);
+  writer.AppendString(1, text);
+  writer.EndMessage();
+  writer.EndMessage();
+  std::string expected = std::string("\x0a\xd0\x01\x08\x01\x12\xcb\x01", 8) +
+                         std::string("\x0a\xc8\x01", 3) + text;
+  if (bytes(writer) != expected) {
+    std::cerr << "wrong widened message: size " << writer.Size()
+              << std::endl;
+    return 1;
+  }
+  assert(iftracer::ProtoWriter::VarintSize(127) == 1 &&
+         iftracer::ProtoWriter::VarintSize(128) == 2 &&
+         iftracer::ProtoWriter::VarintSize(UINT64_MAX) == 10);
+  return 0;
+}
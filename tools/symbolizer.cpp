@@ -0,0 +1,744 @@
+#include "symbolizer.hpp"
+
+#include <cxxabi.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace iftracer {
+namespace {
+// bounds checked little endian reader of dwarf sections
+class DwarfCursor {
+ public:
+  DwarfCursor(const uint8_t* head, size_t size)
+      : p_(head), end_(head + size) {}
+
+  bool Ok() const { return ok_; }
+  bool AtEnd() const { return !ok_ || p_ >= end_; }
+  const uint8_t* Position() const { return p_; }
+  size_t Remain() const { return end_ - p_; }
+
+  template <class T>
+  T Read() {
+    T v = 0;
+    if (!Check(sizeof(T))) {
+      return v;
+    }
+    memcpy(&v, p_, sizeof(T));
+    p_ += sizeof(T);
+    return v;
+  }
+  uint64_t ReadSized(size_t size) {
+    switch (size) {
+      case 1:
+        return Read<uint8_t>();
+      case 2:
+        return Read<uint16_t>();
+      case 4:
+        return Read<uint32_t>();
+      case 8:
+        return Read<uint64_t>();
+      default:
+        Skip(size);
+        return 0;
+    }
+  }
+  uint64_t ReadULEB128() {
+    uint64_t v = 0;
+    for (int shift = 0; Check(1); shift += 7) {
+      uint8_t b = *p_++;
+      if (shift < 64) {
+        v |= static_cast<uint64_t>(b & 0x7f) << shift;
+      }
+      if ((b & 0x80) == 0) {
+        break;
+      }
+    }
+    return v;
+  }
+  int64_t ReadSLEB128() {
+    int64_t v = 0;
+    int shift = 0;
+    uint8_t b = 0;
+    while (Check(1)) {
+      b = *p_++;
+      if (shift < 64) {
+        v |= static_cast<int64_t>(b & 0x7f) << shift;
+      }
+      shift += 7;
+      if ((b & 0x80) == 0) {
+        break;
+      }
+    }
+    if (shift < 64 && (b & 0x40) != 0) {
+      v |= -(static_cast<int64_t>(1) << shift);
+    }
+    return v;
+  }
+  const char* ReadString() {
+    const uint8_t* s = p_;
+    while (Check(1) && *p_ != '\0') {
+      p_++;
+    }
+    if (!Check(1)) {
+      return "";
+    }
+    p_++;
+    return reinterpret_cast<const char*>(s);
+  }
+  void Skip(size_t n) {
+    if (Check(n)) {
+      p_ += n;
+    }
+  }
+  void Seek(const uint8_t* p) {
+    if (p < p_ || p > end_) {
+      ok_ = false;
+      return;
+    }
+    p_ = p;
+  }
+
+ private:
+  bool Check(size_t n) {
+    if (!ok_ || static_cast<size_t>(end_ - p_) < n) {
+      ok_ = false;
+      return false;
+    }
+    return true;
+  }
+
+  const uint8_t* p_;
+  const uint8_t* end_;
+  bool ok_ = true;
+};
+
+const char* section_string(const uint8_t* section, size_t section_size,
+                           uint64_t offset) {
+  if (section == nullptr || offset >= section_size ||
+      memchr(section + offset, '\0', section_size - offset) == nullptr) {
+    return "";
+  }
+  return reinterpret_cast<const char*>(section + offset);
+}
+
+// DW_FORM_* used by dwarf5 line table headers
+enum DwarfForm : uint64_t {
+  form_block     = 0x09,
+  form_block1    = 0x0a,
+  form_data1     = 0x0b,
+  form_data2     = 0x05,
+  form_data4     = 0x06,
+  form_data8     = 0x07,
+  form_data16    = 0x1e,
+  form_string    = 0x08,
+  form_strp      = 0x0e,
+  form_udata     = 0x0f,
+  form_line_strp = 0x1f,
+};
+// DW_LNCT_*
+constexpr uint64_t lnct_path            = 0x1;
+constexpr uint64_t lnct_directory_index = 0x2;
+
+std::string find_build_id(const uint8_t* note, size_t note_size) {
+  static const char digits[] = "0123456789abcdef";
+  DwarfCursor c(note, note_size);
+  while (!c.AtEnd()) {
+    uint32_t namesz    = c.Read<uint32_t>();
+    uint32_t descsz    = c.Read<uint32_t>();
+    uint32_t type      = c.Read<uint32_t>();
+    const uint8_t* name = c.Position();
+    c.Skip((namesz + 3) & ~3);
+    const uint8_t* desc = c.Position();
+    c.Skip((descsz + 3) & ~3);
+    if (!c.Ok()) {
+      break;
+    }
+    if (type == NT_GNU_BUILD_ID && namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+      std::string build_id;
+      for (uint32_t i = 0; i < descsz; i++) {
+        build_id += digits[desc[i] >> 4];
+        build_id += digits[desc[i] & 0xf];
+      }
+      return build_id;
+    }
+  }
+  return "";
+}
+
+struct EntryValue {
+  const char* string = nullptr;
+  uint64_t number    = 0;
+};
+}  // namespace
+
+constexpr uint32_t Symbolizer::no_file;
+
+bool Symbolizer::Open(const std::string& filename) {
+  Close();
+  filename_ = filename;
+  int fd    = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    AddErrorMessageWithErrono("Open(): open():", errno);
+    return false;
+  }
+  struct stat stbuf;
+  if (fstat(fd, &stbuf) != 0) {
+    AddErrorMessageWithErrono("Open(): fstat():", errno);
+    close(fd);
+    return false;
+  }
+  size_      = stbuf.st_size;
+  void* head = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (size_ == 0 || head == MAP_FAILED) {
+    AddErrorMessageWithErrono("Open(): mmap():", errno);
+    size_ = 0;
+    return false;
+  }
+  head_ = reinterpret_cast<const uint8_t*>(head);
+
+  if (size_ < EI_NIDENT || memcmp(head_, ELFMAG, SELFMAG) != 0) {
+    AddErrorMessage("Open(): not elf file:" + filename + ":");
+    return false;
+  }
+  if (head_[EI_DATA] != ELFDATA2LSB) {
+    AddErrorMessage("Open(): big endian elf is not supported:" + filename +
+                    ":");
+    return false;
+  }
+  bool ret = false;
+  if (head_[EI_CLASS] == ELFCLASS64) {
+    ret = LoadElf<Elf64_Ehdr, Elf64_Shdr, Elf64_Sym>();
+  } else {
+    ret = LoadElf<Elf32_Ehdr, Elf32_Shdr, Elf32_Sym>();
+  }
+  demangled_names_.reset(new std::atomic<std::string*>[raw_names_.size()]);
+  for (size_t i = 0; i < raw_names_.size(); i++) {
+    demangled_names_[i].store(nullptr);
+  }
+  return ret;
+}
+
+void Symbolizer::Close() {
+  if (demangled_names_) {
+    for (size_t i = 0; i < raw_names_.size(); i++) {
+      delete demangled_names_[i].load();
+    }
+    demangled_names_.reset();
+  }
+  if (head_ != nullptr) {
+    munmap(const_cast<uint8_t*>(head_), size_);
+  }
+  head_ = nullptr;
+  size_ = 0;
+  build_id_.clear();
+  symbols_.clear();
+  raw_names_.clear();
+  files_.clear();
+  file_ids_.clear();
+}
+
+template <class Ehdr, class Shdr, class Sym>
+bool Symbolizer::LoadElf() {
+  const Ehdr* ehdr = reinterpret_cast<const Ehdr*>(head_);
+  if (size_ < sizeof(Ehdr) || ehdr->e_shoff == 0 ||
+      ehdr->e_shoff + ehdr->e_shnum * sizeof(Shdr) > size_ ||
+      ehdr->e_shstrndx >= ehdr->e_shnum) {
+    AddErrorMessage("LoadElf(): broken section header:" + filename_ + ":");
+    return false;
+  }
+  // arm thumb mode functions have LSB set
+  if (ehdr->e_machine == EM_ARM) {
+    address_mask_ = ~static_cast<uint64_t>(1);
+  }
+  const Shdr* shdrs = reinterpret_cast<const Shdr*>(head_ + ehdr->e_shoff);
+  size_t shnum      = ehdr->e_shnum;
+  const Shdr& shstr = shdrs[ehdr->e_shstrndx];
+
+  auto section_data = [&](const Shdr& shdr, size_t* size) -> const uint8_t* {
+    if (shdr.sh_type == SHT_NOBITS || shdr.sh_offset + shdr.sh_size > size_) {
+      return nullptr;
+    }
+    *size = shdr.sh_size;
+    return head_ + shdr.sh_offset;
+  };
+  size_t shstr_size          = 0;
+  const uint8_t* shstr_data  = section_data(shstr, &shstr_size);
+  const Shdr* symtab         = nullptr;
+  const Shdr* dynsym         = nullptr;
+  const Shdr* debug_line     = nullptr;
+  const Shdr* debug_line_str = nullptr;
+  const Shdr* debug_str      = nullptr;
+  for (size_t i = 0; i < shnum; i++) {
+    const Shdr& shdr = shdrs[i];
+    std::string name(section_string(shstr_data, shstr_size, shdr.sh_name));
+    if (shdr.sh_type == SHT_NOTE && build_id_.empty()) {
+      size_t note_size         = 0;
+      const uint8_t* note_data = section_data(shdr, &note_size);
+      if (note_data != nullptr) {
+        build_id_ = find_build_id(note_data, note_size);
+      }
+    } else if (shdr.sh_type == SHT_SYMTAB) {
+      symtab = &shdr;
+    } else if (shdr.sh_type == SHT_DYNSYM) {
+      dynsym = &shdr;
+    } else if (name == ".debug_line") {
+      debug_line = &shdr;
+    } else if (name == ".debug_line_str") {
+      debug_line_str = &shdr;
+    } else if (name == ".debug_str") {
+      debug_str = &shdr;
+    }
+  }
+  if (symtab != nullptr) {
+    LoadSymbols<Shdr, Sym>(shdrs, shnum, *symtab);
+  }
+  if (dynsym != nullptr) {
+    LoadSymbols<Shdr, Sym>(shdrs, shnum, *dynsym);
+  }
+  SortSymbols();
+  if (symbols_.empty()) {
+    AddErrorMessage("LoadElf(): no function symbols:" + filename_ + ":");
+    return false;
+  }
+
+  if (debug_line != nullptr) {
+    if ((debug_line->sh_flags & SHF_COMPRESSED) != 0) {
+      // line info is optional
+      AddErrorMessage("LoadElf(): compressed .debug_line is not supported:" +
+                      filename_ + ":");
+      return true;
+    }
+    size_t line_size = 0, line_str_size = 0, str_size = 0;
+    const uint8_t* line_data = section_data(*debug_line, &line_size);
+    const uint8_t* line_str_data =
+        debug_line_str ? section_data(*debug_line_str, &line_str_size)
+                       : nullptr;
+    const uint8_t* str_data =
+        debug_str ? section_data(*debug_str, &str_size) : nullptr;
+    if (line_data != nullptr) {
+      LoadLineTable(line_data, line_size, line_str_data, line_str_size,
+                    str_data, str_size);
+    }
+  }
+  return true;
+}
+
+template <class Shdr, class Sym>
+void Symbolizer::LoadSymbols(const Shdr* shdrs, size_t shnum,
+                             const Shdr& symtab) {
+  if (symtab.sh_link >= shnum || symtab.sh_entsize != sizeof(Sym) ||
+      symtab.sh_offset + symtab.sh_size > size_) {
+    return;
+  }
+  const Shdr& strtab = shdrs[symtab.sh_link];
+  if (strtab.sh_offset + strtab.sh_size > size_) {
+    return;
+  }
+  const uint8_t* strtab_data = head_ + strtab.sh_offset;
+  const Sym* syms = reinterpret_cast<const Sym*>(head_ + symtab.sh_offset);
+  size_t n        = symtab.sh_size / sizeof(Sym);
+  for (size_t i = 0; i < n; i++) {
+    const Sym& sym = syms[i];
+    int type       = sym.st_info & 0xf;
+    if ((type != STT_FUNC && type != STT_GNU_IFUNC) ||
+        sym.st_shndx == SHN_UNDEF || sym.st_value == 0) {
+      continue;
+    }
+    const char* name =
+        section_string(strtab_data, strtab.sh_size, sym.st_name);
+    if (name[0] == '\0') {
+      continue;
+    }
+    Symbol symbol;
+    symbol.start   = sym.st_value & address_mask_;
+    symbol.size    = sym.st_size;
+    symbol.name_id = raw_names_.size();
+    symbol.file_id = no_file;
+    raw_names_.push_back(name);
+    symbols_.push_back(symbol);
+  }
+}
+
+void Symbolizer::SortSymbols() {
+  // .symtab symbols were pushed before .dynsym ones, so stable sort keeps
+  // .symtab names for same start addresses
+  std::stable_sort(
+      symbols_.begin(), symbols_.end(),
+      [](const Symbol& a, const Symbol& b) { return a.start < b.start; });
+  std::vector<Symbol> unique_symbols;
+  unique_symbols.reserve(symbols_.size());
+  for (auto& symbol : symbols_) {
+    if (!unique_symbols.empty() &&
+        unique_symbols.back().start == symbol.start) {
+      if (unique_symbols.back().size == 0) {
+        unique_symbols.back().size = symbol.size;
+      }
+      continue;
+    }
+    unique_symbols.push_back(symbol);
+  }
+  // size 0 symbols (e.g. hand written assembly) extend to next symbol
+  for (size_t i = 0; i + 1 < unique_symbols.size(); i++) {
+    if (unique_symbols[i].size == 0) {
+      unique_symbols[i].size =
+          unique_symbols[i + 1].start - unique_symbols[i].start;
+    }
+  }
+  unique_symbols.shrink_to_fit();
+  symbols_.swap(unique_symbols);
+}
+
+bool Symbolizer::LoadLineTable(const uint8_t* debug_line,
+                               size_t debug_line_size,
+                               const uint8_t* debug_line_str,
+                               size_t debug_line_str_size,
+                               const uint8_t* debug_str,
+                               size_t debug_str_size) {
+  DwarfCursor unit_cursor(debug_line, debug_line_size);
+  while (!unit_cursor.AtEnd()) {
+    uint64_t unit_length = unit_cursor.Read<uint32_t>();
+    size_t offset_size   = 4;
+    if (unit_length == 0xffffffff) {
+      unit_length = unit_cursor.Read<uint64_t>();
+      offset_size = 8;
+    }
+    if (!unit_cursor.Ok() || unit_length > unit_cursor.Remain()) {
+      AddErrorMessage("LoadLineTable(): broken unit_length:");
+      return false;
+    }
+    const uint8_t* unit_end = unit_cursor.Position() + unit_length;
+    DwarfCursor c(unit_cursor.Position(), unit_length);
+    unit_cursor.Seek(unit_end);
+
+    uint16_t version = c.Read<uint16_t>();
+    if (version < 2 || version > 5) {
+      continue;
+    }
+    size_t address_size = sizeof(uint64_t);
+    if (version >= 5) {
+      address_size = c.Read<uint8_t>();
+      c.Read<uint8_t>();  // segment_selector_size
+    }
+    uint64_t header_length      = c.ReadSized(offset_size);
+    const uint8_t* program_head = c.Position() + header_length;
+    uint8_t min_inst_length     = c.Read<uint8_t>();
+    if (version >= 4) {
+      c.Read<uint8_t>();  // maximum_operations_per_instruction
+    }
+    c.Read<uint8_t>();  // default_is_stmt
+    int8_t line_base     = c.Read<int8_t>();
+    uint8_t line_range   = c.Read<uint8_t>();
+    uint8_t opcode_base  = c.Read<uint8_t>();
+    if (!c.Ok() || line_range == 0 || opcode_base == 0) {
+      continue;
+    }
+    std::vector<uint8_t> standard_opcode_lengths(opcode_base, 0);
+    for (int i = 1; i < opcode_base; i++) {
+      standard_opcode_lengths[i] = c.Read<uint8_t>();
+    }
+
+    std::vector<std::string> directories;
+    // file index -> global file id
+    std::vector<uint32_t> file_ids;
+    auto join_path = [&](const char* name, uint64_t dir_index) {
+      std::string path(name);
+      if (!path.empty() && path[0] != '/' && dir_index < directories.size() &&
+          !directories[dir_index].empty()) {
+        path = directories[dir_index] + "/" + path;
+      }
+      return InternFile(path);
+    };
+    if (version < 5) {
+      // directory index 0 is compilation directory (not in the table)
+      directories.push_back("");
+      while (true) {
+        const char* dir = c.ReadString();
+        if (!c.Ok() || dir[0] == '\0') {
+          break;
+        }
+        directories.push_back(dir);
+      }
+      // file index starts from 1
+      file_ids.push_back(no_file);
+      while (true) {
+        const char* name = c.ReadString();
+        if (!c.Ok() || name[0] == '\0') {
+          break;
+        }
+        uint64_t dir_index = c.ReadULEB128();
+        c.ReadULEB128();  // mtime
+        c.ReadULEB128();  // length
+        file_ids.push_back(join_path(name, dir_index));
+      }
+    } else {
+      auto read_entries = [&](std::vector<std::vector<EntryValue>>* entries,
+                              std::vector<uint64_t>* content_types) {
+        uint8_t format_count = c.Read<uint8_t>();
+        std::vector<uint64_t> forms;
+        for (int i = 0; i < format_count; i++) {
+          content_types->push_back(c.ReadULEB128());
+          forms.push_back(c.ReadULEB128());
+        }
+        uint64_t count = c.ReadULEB128();
+        for (uint64_t i = 0; i < count && c.Ok(); i++) {
+          std::vector<EntryValue> values(format_count);
+          for (int j = 0; j < format_count; j++) {
+            EntryValue& value = values[j];
+            switch (forms[j]) {
+              case form_string:
+                value.string = c.ReadString();
+                break;
+              case form_line_strp:
+                value.string =
+                    section_string(debug_line_str, debug_line_str_size,
+                                   c.ReadSized(offset_size));
+                break;
+              case form_strp:
+                value.string = section_string(debug_str, debug_str_size,
+                                              c.ReadSized(offset_size));
+                break;
+              case form_udata:
+                value.number = c.ReadULEB128();
+                break;
+              case form_data1:
+                value.number = c.Read<uint8_t>();
+                break;
+              case form_data2:
+                value.number = c.Read<uint16_t>();
+                break;
+              case form_data4:
+                value.number = c.Read<uint32_t>();
+                break;
+              case form_data8:
+                value.number = c.Read<uint64_t>();
+                break;
+              case form_data16:
+                c.Skip(16);
+                break;
+              case form_block:
+                c.Skip(c.ReadULEB128());
+                break;
+              case form_block1:
+                c.Skip(c.Read<uint8_t>());
+                break;
+              default:
+                // unknown form: can not continue this unit
+                return false;
+            }
+          }
+          entries->push_back(values);
+        }
+        return c.Ok();
+      };
+      std::vector<std::vector<EntryValue>> dir_entries, file_entries;
+      std::vector<uint64_t> dir_types, file_types;
+      if (!read_entries(&dir_entries, &dir_types) ||
+          !read_entries(&file_entries, &file_types)) {
+        continue;
+      }
+      for (auto& entry : dir_entries) {
+        std::string dir;
+        for (size_t j = 0; j < entry.size(); j++) {
+          if (dir_types[j] == lnct_path && entry[j].string != nullptr) {
+            dir = entry[j].string;
+          }
+        }
+        directories.push_back(dir);
+      }
+      for (auto& entry : file_entries) {
+        const char* name   = "";
+        uint64_t dir_index = 0;
+        for (size_t j = 0; j < entry.size(); j++) {
+          if (file_types[j] == lnct_path && entry[j].string != nullptr) {
+            name = entry[j].string;
+          } else if (file_types[j] == lnct_directory_index) {
+            dir_index = entry[j].number;
+          }
+        }
+        file_ids.push_back(join_path(name, dir_index));
+      }
+    }
+
+    // line number program
+    c.Seek(program_head);
+    uint64_t address    = 0;
+    uint64_t file_index = 1;
+    int64_t line        = 1;
+    // previous row of the current sequence
+    bool has_row       = false;
+    uint64_t row_addr  = 0;
+    uint32_t row_file  = no_file;
+    uint32_t row_line  = 0;
+    auto file_id_of    = [&](uint64_t index) {
+      return index < file_ids.size() ? file_ids[index] : no_file;
+    };
+    auto emit_row = [&](bool end_sequence) {
+      if (has_row && address > row_addr) {
+        AssignLine(row_addr, address, row_file, row_line);
+      }
+      has_row  = !end_sequence;
+      row_addr = address;
+      row_file = file_id_of(file_index);
+      row_line = static_cast<uint32_t>(line);
+      if (end_sequence) {
+        address    = 0;
+        file_index = 1;
+        line       = 1;
+      }
+    };
+    while (!c.AtEnd()) {
+      uint8_t opcode = c.Read<uint8_t>();
+      if (opcode >= opcode_base) {
+        uint8_t adjusted = opcode - opcode_base;
+        address += (adjusted / line_range) * min_inst_length;
+        line += line_base + adjusted % line_range;
+        emit_row(false);
+        continue;
+      }
+      switch (opcode) {
+        case 0: {  // extended opcode
+          uint64_t length          = c.ReadULEB128();
+          const uint8_t* next      = c.Position() + length;
+          uint8_t extended_opcode = length > 0 ? c.Read<uint8_t>() : 0;
+          if (extended_opcode == 1) {  // DW_LNE_end_sequence
+            emit_row(true);
+          } else if (extended_opcode == 2) {  // DW_LNE_set_address
+            address = c.ReadSized(length - 1 == 4 ? 4 : address_size);
+            address &= address_mask_;
+          }
+          c.Seek(next);
+          break;
+        }
+        case 1:  // DW_LNS_copy
+          emit_row(false);
+          break;
+        case 2:  // DW_LNS_advance_pc
+          address += c.ReadULEB128() * min_inst_length;
+          break;
+        case 3:  // DW_LNS_advance_line
+          line += c.ReadSLEB128();
+          break;
+        case 4:  // DW_LNS_set_file
+          file_index = c.ReadULEB128();
+          break;
+        case 8:  // DW_LNS_const_add_pc
+          address += ((255 - opcode_base) / line_range) * min_inst_length;
+          break;
+        case 9:  // DW_LNS_fixed_advance_pc
+          address += c.Read<uint16_t>();
+          break;
+        default:
+          // DW_LNS_set_column, DW_LNS_negate_stmt, DW_LNS_set_isa, ...
+          for (int i = 0; i < standard_opcode_lengths[opcode]; i++) {
+            c.ReadULEB128();
+          }
+          break;
+      }
+    }
+  }
+  return true;
+}
+
+void Symbolizer::AssignLine(uint64_t begin, uint64_t end, uint32_t file_id,
+                            uint32_t line) {
+  // assign the row to all functions which start in [begin, end)
+  auto it = std::lower_bound(
+      symbols_.begin(), symbols_.end(), begin,
+      [](const Symbol& symbol, uint64_t addr) { return symbol.start < addr; });
+  for (; it != symbols_.end() && it->start < end; ++it) {
+    if (it->file_id == no_file || it->start == begin) {
+      it->file_id = file_id;
+      it->line    = line;
+    }
+  }
+}
+
+uint32_t Symbolizer::InternFile(const std::string& file) {
+  auto it = file_ids_.find(file);
+  if (it != file_ids_.end()) {
+    return it->second;
+  }
+  uint32_t id = files_.size();
+  files_.push_back(file);
+  file_ids_.emplace(file, id);
+  return id;
+}
+
+const Symbol* Symbolizer::Lookup(uint64_t address) const {
+  address &= address_mask_;
+  auto it = std::upper_bound(
+      symbols_.begin(), symbols_.end(), address,
+      [](uint64_t addr, const Symbol& symbol) { return addr < symbol.start; });
+  if (it == symbols_.begin()) {
+    return nullptr;
+  }
+  --it;
+  if (address != it->start && address - it->start >= it->size) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+const std::string& Symbolizer::Name(uint32_t name_id) const {
+  std::atomic<std::string*>& slot = demangled_names_[name_id];
+  std::string* name               = slot.load(std::memory_order_acquire);
+  if (name != nullptr) {
+    return *name;
+  }
+  const char* raw_name = raw_names_[name_id];
+  int status           = 0;
+  char* demangled = abi::__cxa_demangle(raw_name, nullptr, nullptr, &status);
+  std::string* new_name =
+      new std::string(status == 0 && demangled != nullptr ? demangled
+                                                          : raw_name);
+  free(demangled);
+  if (!slot.compare_exchange_strong(name, new_name,
+                                    std::memory_order_acq_rel)) {
+    // another thread has already set
+    delete new_name;
+    return *name;
+  }
+  return *new_name;
+}
+
+const std::string& Symbolizer::File(uint32_t file_id) const {
+  static const std::string empty;
+  if (file_id >= files_.size()) {
+    return empty;
+  }
+  return files_[file_id];
+}
+
+std::string Symbolizer::Location(const Symbol& symbol) const {
+  if (symbol.file_id == no_file) {
+    return "";
+  }
+  return File(symbol.file_id) + ":" + std::to_string(symbol.line);
+}
+
+std::string Symbolizer::GetErrorMessage() {
+  std::string tmp = error_message_;
+  error_message_.clear();
+  return tmp;
+}
+
+void Symbolizer::AddErrorMessage(std::string message) {
+  error_message_ = message + error_message_;
+}
+void Symbolizer::AddErrorMessageWithErrono(std::string message,
+                                           int errno_value) {
+  error_message_ = message + std::string(std::strerror(errno_value)) + ":" +
+                   filename_ + ":" + error_message_;
+}
+}  // namespace iftracer
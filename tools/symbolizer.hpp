@@ -0,0 +1,85 @@
+#ifndef SYMBOLIZER_HPP_INCLUDED
+#define SYMBOLIZER_HPP_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace iftracer {
+// function symbol interval (sorted by start)
+struct Symbol {
+  uint64_t start   = 0;
+  uint64_t size    = 0;
+  uint32_t name_id = 0;
+  // file_id is no_file if there is no line table entry
+  uint32_t file_id = 0;
+  uint32_t line    = 0;
+};
+
+// resolve addresses by .symtab/.dynsym and .debug_line of one elf file
+// Open() reads the elf file only once, Lookup() is a binary search
+// Lookup()/Name()/File() are thread safe after Open()
+class Symbolizer {
+ public:
+  static constexpr uint32_t no_file = UINT32_MAX;
+
+  Symbolizer(){};
+  ~Symbolizer() { Close(); };
+  Symbolizer(const Symbolizer&) = delete;
+  Symbolizer& operator=(const Symbolizer&) = delete;
+
+  bool Open(const std::string& filename);
+  void Close();
+  // return nullptr if no function contains the address
+  // NOTE: thumb bit of arm elf address is ignored
+  const Symbol* Lookup(uint64_t address) const;
+  // demangled name (memoized)
+  const std::string& Name(uint32_t name_id) const;
+  const char* RawName(uint32_t name_id) const { return raw_names_[name_id]; }
+  const std::string& File(uint32_t file_id) const;
+  // "path:line" or "" if unknown
+  std::string Location(const Symbol& symbol) const;
+
+  const std::vector<Symbol>& Symbols() const { return symbols_; }
+  uint64_t AddressMask() const { return address_mask_; }
+  // hex string of NT_GNU_BUILD_ID or "" if not found
+  const std::string& BuildId() const { return build_id_; }
+  std::string GetErrorMessage();
+
+ private:
+  template <class Ehdr, class Shdr, class Sym>
+  bool LoadElf();
+  template <class Shdr, class Sym>
+  void LoadSymbols(const Shdr* shdrs, size_t shnum, const Shdr& symtab);
+  void SortSymbols();
+  bool LoadLineTable(const uint8_t* debug_line, size_t debug_line_size,
+                     const uint8_t* debug_line_str,
+                     size_t debug_line_str_size, const uint8_t* debug_str,
+                     size_t debug_str_size);
+  void AssignLine(uint64_t begin, uint64_t end, uint32_t file_id,
+                  uint32_t line);
+  uint32_t InternFile(const std::string& file);
+  void AddErrorMessage(std::string message);
+  void AddErrorMessageWithErrono(std::string message, int errno_value);
+
+  std::string filename_  = "";
+  const uint8_t* head_   = nullptr;
+  size_t size_           = 0;
+  uint64_t address_mask_ = ~static_cast<uint64_t>(0);
+  std::string build_id_  = "";
+
+  std::vector<Symbol> symbols_;
+  // names point into .strtab/.dynstr of the mapped file
+  std::vector<const char*> raw_names_;
+  mutable std::unique_ptr<std::atomic<std::string*>[]> demangled_names_;
+  std::vector<std::string> files_;
+  std::unordered_map<std::string, uint32_t> file_ids_;
+
+  std::string error_message_ = "";
+};
+}  // namespace iftracer
+
+#endif  // SYMBOLIZER_HPP_INCLUDED
@@ -0,0 +1,56 @@
+#include <link.h>
+
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "symbolizer.hpp"
+
+namespace sample {
+__attribute__((noinline)) int target_function(int x) { return x * 3 + 1; }
+}  // namespace sample
+
+namespace {
+int main_program_base_callback(struct dl_phdr_info* info, size_t size,
+                               void* data) {
+  // first entry is main program
+  *reinterpret_cast<uintptr_t*>(data) = info->dlpi_addr;
+  return 1;
+}
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+  iftracer::Symbolizer symbolizer;
+  if (!symbolizer.Open("/proc/self/exe")) {
+    std::cerr << symbolizer.GetErrorMessage() << std::endl;
+    return 1;
+  }
+  uintptr_t base = 0;
+  dl_iterate_phdr(main_program_base_callback, &base);
+
+  uintptr_t address =
+      reinterpret_cast<uintptr_t>(&sample::target_function) - base;
+  const iftracer::Symbol* symbol = symbolizer.Lookup(address);
+  assert(symbol != nullptr || !"not found target_function");
+  assert(symbol->start == address || !"wrong start address");
+  std::cout << symbolizer.Name(symbol->name_id) << " "
+            << symbolizer.Location(*symbol) << std::endl;
+  assert(symbolizer.Name(symbol->name_id) == "sample::target_function(int)" ||
+         !"wrong demangled name");
+  assert(std::string(symbolizer.RawName(symbol->name_id)) ==
+             "_ZN6sample15target_functionEi" ||
+         !"wrong raw name");
+  // memoized
+  assert(&symbolizer.Name(symbol->name_id) ==
+             &symbolizer.Name(symbol->name_id) ||
+         !"not memoized");
+  std::string location = symbolizer.Location(*symbol);
+  std::string file     = "symbolizer_test.cpp:";
+  assert(location.find(file) != std::string::npos || !"wrong file");
+
+  // inside of the function
+  assert(symbolizer.Lookup(address + 1) == symbol || !"wrong interval");
+  assert(symbolizer.Lookup(0) == nullptr || !"unexpected symbol");
+  return sample::target_function(0) == 1 ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+#include "tool_common.hpp"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <utility>
+
+#include "trace_reader.hpp"
+
+namespace iftracer {
+namespace {
+const std::string container_suffix = ".chunks";
+
+bool is_digits(const std::string& s) {
+  if (s.empty()) {
+    return false;
+  }
+  for (char c : s) {
+    if (c < '0' || '9' < c) {
+      return false;
+    }
+  }
+  return true;
+}
+}  // namespace
+
+bool ListTraceFiles(const std::vector<std::string>& paths,
+                    const std::string& prefix,
+                    std::vector<std::string>* trace_files,
+                    std::string* error_message) {
+  std::vector<std::string> targets = paths;
+  if (targets.empty()) {
+    targets.push_back(".");
+  }
+  std::vector<std::pair<long, std::string>> found;
+  for (auto& path : targets) {
+    struct stat stbuf;
+    if (stat(path.c_str(), &stbuf) != 0) {
+      *error_message = path + ":" + std::strerror(errno);
+      return false;
+    }
+    if (!S_ISDIR(stbuf.st_mode)) {
+      // explicit files are used as they are
+      found.emplace_back(-1, path);
+      continue;
+    }
+    DIR* dir = opendir(path.c_str());
+    if (dir == nullptr) {
+      *error_message = path + ":" + std::strerror(errno);
+      return false;
+    }
+    std::vector<std::pair<long, std::string>> dir_found;
+    while (struct dirent* entry = readdir(dir)) {
+      std::string name(entry->d_name);
+      if (name.compare(0, prefix.size(), prefix) != 0) {
+        continue;
+      }
+      std::string suffix = name.substr(prefix.size());
+      // container of all threads (IFTRACER_CONTAINER)
+      if (suffix.size() > container_suffix.size() &&
+          suffix.compare(suffix.size() - container_suffix.size(),
+                         std::string::npos, container_suffix) == 0) {
+        suffix.resize(suffix.size() - container_suffix.size());
+      }
+      if (!is_digits(suffix)) {
+        continue;
+      }
+      dir_found.emplace_back(std::strtol(suffix.c_str(), nullptr, 10),
+                             path + "/" + name);
+    }
+    closedir(dir);
+    std::sort(dir_found.begin(), dir_found.end());
+    found.insert(found.end(), dir_found.begin(), dir_found.end());
+  }
+  trace_files->clear();
+  for (auto& f : found) {
+    trace_files->push_back(f.second);
+  }
+  return true;
+}
+
+void RunParallel(size_t n, size_t jobs, std::function<void(size_t)> task) {
+  if (jobs == 0) {
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+  jobs = std::min(jobs, n);
+  std::atomic<size_t> next_index{0};
+  auto worker = [&]() {
+    while (true) {
+      size_t i = next_index.fetch_add(1);
+      if (i >= n) {
+        return;
+      }
+      task(i);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < jobs; i++) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto& w : workers) {
+    w.join();
+  }
+}
+
+std::vector<TraceJob> ListTraceJobs(const std::vector<std::string>& trace_files,
+                                    size_t jobs) {
+  std::vector<size_t> stream_counts(trace_files.size(), 1);
+  RunParallel(trace_files.size(), jobs, [&](size_t i) {
+    TraceReader reader;
+    if (reader.Open(trace_files[i])) {
+      stream_counts[i] = reader.StreamCount();
+    }
+  });
+  std::vector<TraceJob> trace_jobs;
+  for (size_t i = 0; i < trace_files.size(); i++) {
+    for (size_t j = 0; j < stream_counts[i]; j++) {
+      TraceJob job;
+      job.file_index   = i;
+      job.stream_index = j;
+      trace_jobs.push_back(job);
+    }
+  }
+  return trace_jobs;
+}
+}  // namespace iftracer
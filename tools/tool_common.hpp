@@ -0,0 +1,36 @@
+#ifndef TOOL_COMMON_HPP_INCLUDED
+#define TOOL_COMMON_HPP_INCLUDED
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace iftracer {
+constexpr const char* default_trace_file_prefix = "iftracer.out.";
+
+// expand directories in paths to "<dir>/<prefix><tid>" files and
+// "<dir>/<prefix><pid>.chunks" containers sorted by tid or pid
+// (sidecar files like "<prefix><pid>.maps" are skipped)
+// no paths means current directory
+bool ListTraceFiles(const std::vector<std::string>& paths,
+                    const std::string& prefix,
+                    std::vector<std::string>* trace_files,
+                    std::string* error_message);
+
+// call task(i) for i in [0, n) from jobs threads (0: hardware concurrency)
+void RunParallel(size_t n, size_t jobs, std::function<void(size_t)> task);
+
+// one thread of trace_files: a file or a stream of a container
+// (see TraceReader::SelectStream())
+struct TraceJob {
+  size_t file_index   = 0;
+  size_t stream_index = 0;
+};
+// threads of trace_files in order (files are opened in parallel)
+// broken files are one job to report the error
+std::vector<TraceJob> ListTraceJobs(const std::vector<std::string>& trace_files,
+                                    size_t jobs);
+}  // namespace iftracer
+
+#endif  // TOOL_COMMON_HPP_INCLUDED
@@ -0,0 +1,369 @@
+#include "trace_query.hpp"
+
+#include <fnmatch.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "perfetto_proto.hpp"
+#include "proto_writer.hpp"
+
+namespace iftracer {
+namespace {
+const char* kind_name(QuerySpan::Kind kind) {
+  switch (kind) {
+    case QuerySpan::kFunction:
+      return "function";
+    case QuerySpan::kDuration:
+      return "duration";
+    case QuerySpan::kInstant:
+      return "instant";
+    default:
+      return "enclosing";
+  }
+}
+
+// quoted only if needed (RFC 4180)
+void append_csv_field(const std::string& s, OutputBuffer* out) {
+  if (s.find_first_of(",\"\r\n") == std::string::npos) {
+    out->Append(s);
+    return;
+  }
+  out->Append('"');
+  for (char c : s) {
+    if (c == '"') {
+      out->Append('"');
+    }
+    out->Append(c);
+  }
+  out->Append('"');
+}
+
+class PerfettoPacketWriter {
+ public:
+  PerfettoPacketWriter(ProtoWriter* trace, uint32_t sequence_id,
+                       uint64_t track_uuid)
+      : trace_(trace), sequence_id_(sequence_id), track_uuid_(track_uuid) {}
+
+  void WriteThreadTrack(int32_t pid, int32_t tid) {
+    namespace pf = perfetto;
+    BeginPacket();
+    trace_->BeginMessage(pf::packet_track_descriptor);
+    trace_->AppendVarint(pf::track_uuid, track_uuid_);
+    trace_->BeginMessage(pf::track_thread);
+    trace_->AppendVarint(pf::thread_pid, pid);
+    trace_->AppendVarint(pf::thread_tid, tid);
+    trace_->EndMessage();
+    trace_->EndMessage();
+    trace_->EndMessage();
+  }
+  // span is nullptr for the end of a slice
+  void WriteEvent(uint64_t ns, uint64_t type, const QuerySpan* span) {
+    namespace pf = perfetto;
+    BeginPacket();
+    trace_->AppendVarint(pf::packet_timestamp, ns);
+    trace_->BeginMessage(pf::packet_track_event);
+    trace_->AppendVarint(pf::event_type, type);
+    trace_->AppendVarint(pf::event_track_uuid, track_uuid_);
+    if (span != nullptr) {
+      trace_->AppendString(pf::event_categories,
+                           span->kind == QuerySpan::kEnclosing ? "stack"
+                                                               : "match");
+      trace_->AppendString(pf::event_name, span->name);
+    }
+    trace_->EndMessage();
+    trace_->EndMessage();
+  }
+
+ private:
+  void BeginPacket() {
+    trace_->BeginMessage(perfetto::trace_packet);
+    trace_->AppendVarint(perfetto::packet_sequence_id, sequence_id_);
+  }
+
+  ProtoWriter* trace_;
+  uint32_t sequence_id_;
+  uint64_t track_uuid_;
+};
+}  // namespace
+
+bool MatchPatterns(const std::vector<std::string>& patterns,
+                   const std::string& name) {
+  for (const std::string& pattern : patterns) {
+    if (fnmatch(pattern.c_str(), name.c_str(), 0) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+constexpr uint32_t TraceQuery::unknown_function;
+
+TraceQuery::TraceQuery(const QueryFilter& filter)
+    : filter_(filter),
+      match_functions_(!filter.function_patterns.empty() ||
+                       filter.text_patterns.empty()),
+      match_texts_(!filter.text_patterns.empty() ||
+                   filter.function_patterns.empty()) {}
+
+uint32_t TraceQuery::AddFunction(const std::string& name) {
+  Function function;
+  function.name    = name;
+  function.matched = filter_.function_patterns.empty() ||
+                     MatchPatterns(filter_.function_patterns, name);
+  functions_.push_back(function);
+  return functions_.size() - 1;
+}
+
+void TraceQuery::Restore(uint64_t ns, const std::vector<uint32_t>& functions,
+                         uint32_t depth) {
+  for (uint32_t i = 0; i < std::max<size_t>(depth, functions.size()); i++) {
+    Frame frame;
+    frame.function  = i < functions.size() ? functions[i] : unknown_function;
+    frame.enter_ns  = ns;
+    frame.candidate = false;
+    frame.enclosing = false;
+    stack_.push_back(frame);
+  }
+}
+
+void TraceQuery::Enter(uint64_t ns, uint32_t function) {
+  Frame frame;
+  frame.function  = function;
+  frame.enter_ns  = ns;
+  frame.candidate = match_functions_ && functions_[function].matched &&
+                    InRange(ns);
+  frame.enclosing = false;
+  open_candidates_ += frame.candidate;
+  stack_.push_back(frame);
+}
+
+void TraceQuery::Exit(uint64_t ns) {
+  if (stack_.empty()) {
+    return;
+  }
+  PopFrame(ns, true);
+}
+
+void TraceQuery::PopFrame(uint64_t ns, bool end_known) {
+  Frame frame = stack_.back();
+  stack_.pop_back();
+  uint64_t end_ns = std::max(ns, frame.enter_ns);
+  if (frame.candidate) {
+    open_candidates_--;
+    if (end_ns - frame.enter_ns >= filter_.min_duration_ns) {
+      AddMatch(QuerySpan::kFunction, frame.enter_ns, end_ns,
+               Name(frame.function), end_known);
+      return;
+    }
+  }
+  if (frame.enclosing) {
+    QuerySpan span;
+    span.kind      = QuerySpan::kEnclosing;
+    span.begin_ns  = frame.enter_ns;
+    span.end_ns    = end_ns;
+    span.end_known = end_known;
+    span.depth     = stack_.size();
+    span.name      = Name(frame.function);
+    spans_.push_back(std::move(span));
+  }
+}
+
+void TraceQuery::DurationEnter(uint64_t ns) {
+  bool candidate = match_texts_ && InRange(ns);
+  open_candidates_ += candidate;
+  duration_stack_.emplace_back(ns, candidate);
+}
+
+void TraceQuery::DurationExit(uint64_t ns, const char* text,
+                              size_t text_size) {
+  if (duration_stack_.empty()) {
+    return;
+  }
+  uint64_t enter_ns = duration_stack_.back().first;
+  bool candidate    = duration_stack_.back().second;
+  duration_stack_.pop_back();
+  if (!candidate) {
+    return;
+  }
+  open_candidates_--;
+  uint64_t end_ns = std::max(ns, enter_ns);
+  if (end_ns - enter_ns >= filter_.min_duration_ns &&
+      TextMatched(text, text_size)) {
+    AddMatch(QuerySpan::kDuration, enter_ns, end_ns,
+             std::string(text, text_size));
+  }
+}
+
+void TraceQuery::Instant(uint64_t ns, const char* text, size_t text_size) {
+  if (match_texts_ && InRange(ns) && filter_.min_duration_ns == 0 &&
+      TextMatched(text, text_size)) {
+    AddMatch(QuerySpan::kInstant, ns, ns, std::string(text, text_size));
+  }
+}
+
+void TraceQuery::Finish(uint64_t ns) {
+  // the scan stopped (see Done()) or the thread ended before their exits
+  while (!stack_.empty()) {
+    PopFrame(ns, false);
+  }
+  // the text of duration events is recorded at their exit
+  for (const auto& duration : duration_stack_) {
+    open_candidates_ -= duration.second;
+  }
+  duration_stack_.clear();
+  std::stable_sort(spans_.begin(), spans_.end(),
+                   [](const QuerySpan& a, const QuerySpan& b) {
+                     if (a.begin_ns != b.begin_ns) {
+                       return a.begin_ns < b.begin_ns;
+                     }
+                     if (a.end_ns != b.end_ns) {
+                       return a.end_ns > b.end_ns;
+                     }
+                     return a.depth < b.depth;
+                   });
+}
+
+bool TraceQuery::TextMatched(const char* text, size_t text_size) const {
+  return filter_.text_patterns.empty() ||
+         MatchPatterns(filter_.text_patterns, std::string(text, text_size));
+}
+
+void TraceQuery::AddMatch(QuerySpan::Kind kind, uint64_t begin_ns,
+                          uint64_t end_ns, std::string name,
+                          bool end_known) {
+  QuerySpan span;
+  span.kind      = kind;
+  span.begin_ns  = begin_ns;
+  span.end_ns    = end_ns;
+  span.end_known = end_known;
+  span.depth     = stack_.size();
+  span.name      = std::move(name);
+  for (const Frame& frame : stack_) {
+    span.stack.push_back(Name(frame.function));
+  }
+  spans_.push_back(std::move(span));
+  // the outer frames are already marked if the top is
+  for (auto it = stack_.rbegin(); it != stack_.rend() && !it->enclosing;
+       ++it) {
+    it->enclosing = true;
+  }
+}
+
+const std::string& TraceQuery::Name(uint32_t function) const {
+  static const std::string unknown = "[unknown]";
+  return function == unknown_function ? unknown : functions_[function].name;
+}
+
+void WriteQueryCsv(const std::vector<QueryResult>& results,
+                   OutputBuffer* out) {
+  out->Append("pid,tid,begin_ns,duration_ns,depth,kind,name,stack\n");
+  std::string stack;
+  for (const QueryResult& result : results) {
+    for (const QuerySpan& span : result.spans) {
+      if (span.kind == QuerySpan::kEnclosing) {
+        continue;
+      }
+      out->AppendInt(result.pid);
+      out->Append(',');
+      out->AppendInt(result.tid);
+      out->Append(',');
+      out->AppendUint(span.begin_ns);
+      out->Append(',');
+      if (span.end_known) {
+        out->AppendUint(span.end_ns - span.begin_ns);
+      }
+      out->Append(',');
+      out->AppendUint(span.depth);
+      out->Append(',');
+      out->Append(kind_name(span.kind));
+      out->Append(',');
+      append_csv_field(span.name, out);
+      out->Append(',');
+      stack.clear();
+      for (const std::string& name : span.stack) {
+        if (!stack.empty()) {
+          stack += ';';
+        }
+        stack += name;
+      }
+      append_csv_field(stack, out);
+      out->Append('\n');
+    }
+  }
+}
+
+void WriteQueryJson(const std::vector<QueryResult>& results,
+                    OutputBuffer* out) {
+  out->Append("{\"traceEvents\":[\n");
+  bool first = true;
+  for (const QueryResult& result : results) {
+    for (const QuerySpan& span : result.spans) {
+      if (!first) {
+        out->Append(",\n", 2);
+      }
+      first = false;
+      if (span.kind == QuerySpan::kInstant) {
+        out->Append("{\"ph\":\"i\"");
+      } else {
+        out->Append(span.end_known ? "{\"ph\":\"X\"" : "{\"ph\":\"B\"");
+      }
+      out->Append(",\"pid\":");
+      out->AppendInt(result.pid);
+      out->Append(",\"tid\":");
+      out->AppendInt(result.tid);
+      out->Append(",\"ts\":");
+      out->AppendMicroseconds(span.begin_ns);
+      if (span.kind == QuerySpan::kInstant) {
+        out->Append(",\"s\":\"t\"");
+      } else if (span.end_known) {
+        out->Append(",\"dur\":");
+        out->AppendMicroseconds(span.end_ns - span.begin_ns);
+      }
+      out->Append(",\"name\":");
+      out->AppendJsonString(span.name);
+      out->Append(span.kind == QuerySpan::kEnclosing ? ",\"cat\":\"stack\"}"
+                                                     : ",\"cat\":\"match\"}");
+    }
+  }
+  out->Append("\n],\n\"displayTimeUnit\":\"ns\"}\n");
+}
+
+void WriteQueryPerfetto(const std::vector<QueryResult>& results,
+                        OutputBuffer* out) {
+  namespace pf = perfetto;
+  ProtoWriter trace;
+  for (size_t i = 0; i < results.size(); i++) {
+    const QueryResult& result = results[i];
+    if (result.spans.empty()) {
+      continue;
+    }
+    trace.Clear();
+    // same track as iftracer-conv
+    uint64_t uuid = pf::TrackUuid("thread:" + std::to_string(result.pid) +
+                                  ":" + std::to_string(result.tid));
+    PerfettoPacketWriter writer(&trace, i + 1, uuid);
+    writer.WriteThreadTrack(result.pid, result.tid);
+    // spans are sorted by begin (outer first): end the slices which end
+    // before the next begin (UINT64_MAX: the end is unknown)
+    std::vector<uint64_t> ends;
+    for (const QuerySpan& span : result.spans) {
+      while (!ends.empty() && ends.back() <= span.begin_ns) {
+        writer.WriteEvent(ends.back(), pf::type_slice_end, nullptr);
+        ends.pop_back();
+      }
+      if (span.kind == QuerySpan::kInstant) {
+        writer.WriteEvent(span.begin_ns, pf::type_instant, &span);
+        continue;
+      }
+      writer.WriteEvent(span.begin_ns, pf::type_slice_begin, &span);
+      ends.push_back(span.end_known ? span.end_ns : UINT64_MAX);
+    }
+    while (!ends.empty() && ends.back() != UINT64_MAX) {
+      writer.WriteEvent(ends.back(), pf::type_slice_end, nullptr);
+      ends.pop_back();
+    }
+    out->Append(trace.Data(), trace.Size());
+  }
+}
+}  // namespace iftracer
@@ -0,0 +1,146 @@
+#ifndef TRACE_QUERY_HPP_INCLUDED
+#define TRACE_QUERY_HPP_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "output_buffer.hpp"
+
+namespace iftracer {
+// conditions of the spans of iftracer-query
+// without patterns all functions and text events match, with function
+// patterns only the matched functions, with text patterns only the matched
+// text events (and both with both)
+struct QueryFilter {
+  // fnmatch(3) patterns of function names
+  std::vector<std::string> function_patterns;
+  // fnmatch(3) patterns of the text of duration events and instants
+  std::vector<std::string> text_patterns;
+  // range of the begin of a span [begin_ns, end_ns)
+  uint64_t begin_ns        = 0;
+  uint64_t end_ns          = UINT64_MAX;
+  uint64_t min_duration_ns = 0;
+};
+
+// true if name matches one of patterns
+bool MatchPatterns(const std::vector<std::string>& patterns,
+                   const std::string& name);
+
+struct QuerySpan {
+  enum Kind {
+    kFunction,
+    // duration event (IFTRACER_SCOPE)
+    kDuration,
+    kInstant,
+    // function which encloses matched spans (not matched itself)
+    kEnclosing,
+  };
+  Kind kind         = kFunction;
+  uint64_t begin_ns = 0;
+  // same as begin_ns for instants
+  // the last decoded event if !end_known
+  uint64_t end_ns = 0;
+  // false: the exit was not decoded (the scan stopped or the thread ended
+  // before it)
+  bool end_known = true;
+  // number of the enclosing functions
+  uint32_t depth = 0;
+  std::string name;
+  // names of the enclosing functions (outermost first, not for kEnclosing)
+  std::vector<std::string> stack;
+};
+
+// spans of one thread
+struct QueryResult {
+  int32_t pid = 0;
+  int32_t tid = 0;
+  std::vector<QuerySpan> spans;
+};
+
+// replay the events of one thread and collect the spans which match filter
+// and the functions which enclose them
+class TraceQuery {
+ public:
+  explicit TraceQuery(const QueryFilter& filter);
+
+  // index of the function (function patterns are evaluated once)
+  uint32_t AddFunction(const std::string& name);
+  // functions which were running before the first event (outermost first)
+  // depth can be larger than functions (see TraceReader::KeyframeStack())
+  // their begin is unknown: they are enclosing functions only
+  void Restore(uint64_t ns, const std::vector<uint32_t>& functions,
+               uint32_t depth);
+  void Enter(uint64_t ns, uint32_t function);
+  // exits without enter (the trace began in the function) are ignored
+  void Exit(uint64_t ns);
+  void DurationEnter(uint64_t ns);
+  void DurationExit(uint64_t ns, const char* text, size_t text_size);
+  void Instant(uint64_t ns, const char* text, size_t text_size);
+  // true if no span after ns can match (the rest of the thread is skipped)
+  bool Done(uint64_t ns) const {
+    return ns >= filter_.end_ns && open_candidates_ == 0;
+  }
+  // close the functions which are still running at ns (the last decoded
+  // event) without known end
+  // spans are sorted by begin_ns (outer span first)
+  void Finish(uint64_t ns);
+
+  const std::vector<QuerySpan>& Spans() const { return spans_; }
+
+ private:
+  struct Function {
+    std::string name;
+    bool matched;
+  };
+  struct Frame {
+    // unknown_function: restored from a keyframe without address
+    uint32_t function;
+    uint64_t enter_ns;
+    bool candidate;
+    // a matched span is in this frame
+    bool enclosing;
+  };
+  static constexpr uint32_t unknown_function = UINT32_MAX;
+
+  bool InRange(uint64_t ns) const {
+    return ns >= filter_.begin_ns && ns < filter_.end_ns;
+  }
+  bool TextMatched(const char* text, size_t text_size) const;
+  // end_known: ns is the exit of the top frame (else the last event)
+  void PopFrame(uint64_t ns, bool end_known);
+  // add a matched span (stack_ is the enclosing functions)
+  void AddMatch(QuerySpan::Kind kind, uint64_t begin_ns, uint64_t end_ns,
+                std::string name, bool end_known = true);
+  const std::string& Name(uint32_t function) const;
+
+  const QueryFilter& filter_;
+  // functions are candidates without patterns
+  bool match_functions_;
+  bool match_texts_;
+  std::vector<Function> functions_;
+  std::vector<Frame> stack_;
+  // enter_ns of duration events and whether they are candidates
+  std::vector<std::pair<uint64_t, bool>> duration_stack_;
+  // frames and duration events which can match at their exit
+  size_t open_candidates_ = 0;
+  std::vector<QuerySpan> spans_;
+};
+
+// one row per matched span:
+// pid,tid,begin_ns,duration_ns,depth,kind,name,stack ("outer;...;inner")
+// duration_ns is empty if the end is unknown
+void WriteQueryCsv(const std::vector<QueryResult>& results,
+                   OutputBuffer* out);
+// chrome trace json ("cat" of enclosing functions is "stack")
+// spans without known end are "B" events without "E"
+void WriteQueryJson(const std::vector<QueryResult>& results,
+                    OutputBuffer* out);
+// perfetto protobuf trace (one packet sequence per thread)
+// slices without known end are not ended
+void WriteQueryPerfetto(const std::vector<QueryResult>& results,
+                        OutputBuffer* out);
+}  // namespace iftracer
+
+#endif  // TRACE_QUERY_HPP_INCLUDED
@@ -0,0 +1,163 @@
+#include <unistd.h>
+
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "trace_query.hpp"
+
+namespace {
+std::string read_file(const std::string& filename) {
+  std::ifstream ifs(filename);
+  return std::string((std::istreambuf_iterator<char>(ifs)),
+                     std::istreambuf_iterator<char>());
+}
+
+std::string join(const std::vector<std::string>& names) {
+  std::string s;
+  for (const std::string& name : names) {
+    s += (s.empty() ? "" : ";") + name;
+  }
+  return s;
+}
+}  // namespace
+
+int main() {
+  // calls of Foo::* over 50ns which begin in [100, 1000)
+  iftracer::QueryFilter filter;
+  filter.function_patterns.push_back("Foo::*");
+  filter.begin_ns        = 100;
+  filter.end_ns          = 1000;
+  filter.min_duration_ns = 50;
+  iftracer::TraceQuery query(filter);
+  uint32_t main_function = query.AddFunction("main");
+  uint32_t helper        = query.AddFunction("helper");
+  uint32_t bar           = query.AddFunction("Foo::Bar");
+  uint32_t baz           = query.AddFunction("Foo::Baz");
+  // decoded from a keyframe in main and an inner function without address
+  query.Restore(90, {main_function}, 2);
+  query.Enter(100, helper);
+  query.Enter(110, bar);
+  query.Exit(200);
+  query.Exit(210);
+  query.Enter(300, baz);
+  query.Exit(320);
+  query.DurationEnter(400);
+  query.Instant(500, "instant", 7);
+  query.DurationExit(600, "scope", 5);
+  query.Enter(990, bar);
+  assert(!query.Done(1000) || !"running candidate is skipped");
+  query.Exit(1100);
+  assert(query.Done(1100) || !"no candidate after the range");
+  // the scan stops in main: the exits of main and [unknown] are not decoded
+  query.Finish(1100);
+
+  struct Expected {
+    iftracer::QuerySpan::Kind kind;
+    uint64_t begin_ns, end_ns;
+    bool end_known;
+    uint32_t depth;
+    std::string name, stack;
+  } expected[] = {
+      {iftracer::QuerySpan::kEnclosing, 90, 1100, false, 0, "main", ""},
+      {iftracer::QuerySpan::kEnclosing, 90, 1100, false, 1, "[unknown]", ""},
+      {iftracer::QuerySpan::kEnclosing, 100, 210, true, 2, "helper", ""},
+      {iftracer::QuerySpan::kFunction, 110, 200, true, 3, "Foo::Bar",
+       "main;[unknown];helper"},
+      {iftracer::QuerySpan::kFunction, 990, 1100, true, 2, "Foo::Bar",
+       "main;[unknown]"},
+  };
+  const std::vector<iftracer::QuerySpan>& spans = query.Spans();
+  assert(spans.size() == sizeof(expected) / sizeof(expected[0]) ||
+         !"wrong number of spans");
+  for (size_t i = 0; i < spans.size(); i++) {
+    const iftracer::QuerySpan& span = spans[i];
+    const Expected& e               = expected[i];
+    if (span.kind != e.kind || span.begin_ns != e.begin_ns ||
+        span.end_ns != e.end_ns || span.end_known != e.end_known ||
+        span.depth != e.depth ||
+        span.name != e.name || join(span.stack) != e.stack) {
+      std::cerr << "wrong span " << i << ": " << span.name << " "
+                << span.begin_ns << "-" << span.end_ns << " depth "
+                << span.depth << " stack " << join(span.stack) << std::endl;
+      return 1;
+    }
+  }
+
+  // text events of "sc*" (functions are enclosing only)
+  iftracer::QueryFilter text_filter;
+  text_filter.text_patterns.push_back("sc*");
+  iftracer::TraceQuery text_query(text_filter);
+  uint32_t f = text_query.AddFunction("f<a, b>");
+  text_query.DurationEnter(10);
+  text_query.Enter(20, f);
+  text_query.Instant(30, "scope_i", 7);
+  text_query.Instant(35, "other", 5);
+  text_query.Exit(40);
+  text_query.DurationExit(50, "scope", 5);
+  text_query.Finish(50);
+
+  std::vector<iftracer::QueryResult> results(1);
+  results[0].pid   = 1;
+  results[0].tid   = 2;
+  results[0].spans = text_query.Spans();
+  std::string filename = "trace_query_test.out";
+  iftracer::OutputBuffer out;
+  bool ret = out.Open(filename);
+  assert(ret || !"failed to open output");
+  iftracer::WriteQueryCsv(results, &out);
+  ret = out.Close();
+  assert(ret || !"failed to write csv");
+  std::string csv = read_file(filename);
+  if (csv !=
+      "pid,tid,begin_ns,duration_ns,depth,kind,name,stack\n"
+      "1,2,10,40,0,duration,scope,\n"
+      "1,2,30,0,1,instant,scope_i,\"f<a, b>\"\n") {
+    std::cerr << "wrong csv:\n" << csv << std::endl;
+    return 1;
+  }
+
+  ret = out.Open(filename);
+  assert(ret || !"failed to open output");
+  iftracer::WriteQueryJson(results, &out);
+  ret = out.Close();
+  assert(ret || !"failed to write json");
+  std::string json = read_file(filename);
+  if (json.find("{\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":0.020,\"dur\":0.020,"
+                "\"name\":\"f<a, b>\",\"cat\":\"stack\"}") ==
+      std::string::npos) {
+    std::cerr << "wrong json:\n" << json << std::endl;
+    return 1;
+  }
+
+  // the thread ends in f and a running candidate g
+  iftracer::QueryFilter end_filter;
+  end_filter.function_patterns.push_back("g");
+  iftracer::TraceQuery end_query(end_filter);
+  uint32_t end_f = end_query.AddFunction("f");
+  uint32_t end_g = end_query.AddFunction("g");
+  end_query.Enter(0, end_f);
+  end_query.Enter(10, end_g);
+  end_query.Finish(30);
+  results[0].spans = end_query.Spans();
+  ret              = out.Open(filename);
+  assert(ret || !"failed to open output");
+  iftracer::WriteQueryCsv(results, &out);
+  iftracer::WriteQueryJson(results, &out);
+  ret = out.Close();
+  assert(ret || !"failed to write csv and json");
+  std::string unknown_end = read_file(filename);
+  if (unknown_end.find("1,2,10,,1,function,g,f\n") == std::string::npos ||
+      unknown_end.find("{\"ph\":\"B\",\"pid\":1,\"tid\":2,\"ts\":0.000,"
+                       "\"name\":\"f\",\"cat\":\"stack\"}") ==
+          std::string::npos ||
+      unknown_end.find("\"dur\"") != std::string::npos) {
+    std::cerr << "wrong spans without end:\n" << unknown_end << std::endl;
+    return 1;
+  }
+  unlink(filename.c_str());
+  return 0;
+}
@@ -0,0 +1,1043 @@
+#include "trace_reader.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <tuple>
+
+#include "lz_codec.hpp"
+
+namespace iftracer {
+namespace {
+template <class T>
+T load(const uint8_t* p) {
+  T v;
+  memcpy(&v, p, sizeof(T));
+  return v;
+}
+}  // namespace
+
+bool TraceReader::Open(const std::string& filename) {
+  Close();
+  filename_ = filename;
+  int fd    = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    AddErrorMessageWithErrono("Open(): open():", errno);
+    return false;
+  }
+  struct stat stbuf;
+  if (fstat(fd, &stbuf) != 0) {
+    AddErrorMessageWithErrono("Open(): fstat():", errno);
+    close(fd);
+    return false;
+  }
+  size_ = stbuf.st_size;
+  if (size_ > 0) {
+    void* head = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (head == MAP_FAILED) {
+      AddErrorMessageWithErrono("Open(): mmap():", errno);
+      close(fd);
+      return false;
+    }
+    // the file is decoded from the beginning to the end only once
+    madvise(head, size_, MADV_SEQUENTIAL);
+    head_ = reinterpret_cast<const uint8_t*>(head);
+  }
+  close(fd);
+  if (size_ >= sizeof(uint32_t) &&
+      load<uint32_t>(head_) == format::frame_magic && !DecodeFrames()) {
+    return false;
+  }
+  cursor_ = head_;
+  end_    = head_ + size_;
+  return ReadHeader();
+}
+
+bool TraceReader::DecodeFrames() {
+  using format::FrameHeader;
+  std::vector<uint8_t> data;
+  const uint8_t* p   = head_;
+  const uint8_t* end = head_ + size_;
+  while (static_cast<size_t>(end - p) >= sizeof(FrameHeader)) {
+    FrameHeader header;
+    memcpy(&header, p, sizeof(header));
+    // zero filled or truncated frame at abnormal termination
+    if (header.magic != format::frame_magic ||
+        static_cast<size_t>(end - p) - sizeof(header) <
+            header.compressed_size) {
+      break;
+    }
+    p += sizeof(header);
+    size_t offset = data.size();
+    data.resize(offset + header.raw_size);
+    if (header.compressed_size == header.raw_size) {
+      memcpy(&data[offset], p, header.raw_size);
+    } else if (!lz::Decompress(p, header.compressed_size, &data[offset],
+                               header.raw_size)) {
+      AddErrorMessage("DecodeFrames(): broken frame at " +
+                      std::to_string(p - sizeof(header) - head_) + ":");
+      return false;
+    }
+    p += header.compressed_size;
+  }
+  munmap(const_cast<uint8_t*>(head_), size_);
+  frame_data_.swap(data);
+  head_ = frame_data_.empty() ? nullptr : frame_data_.data();
+  size_ = frame_data_.size();
+  return true;
+}
+
+void TraceReader::Close() {
+  if (head_ != nullptr && frame_data_.empty()) {
+    munmap(const_cast<uint8_t*>(head_), size_);
+  }
+  frame_data_.clear();
+  frame_data_.shrink_to_fit();
+  head_   = nullptr;
+  cursor_ = nullptr;
+  end_    = nullptr;
+  size_   = 0;
+  function_table_.clear();
+  string_table_.clear();
+  args_.clear();
+  container_ = false;
+  chunks_.clear();
+  streams_.clear();
+  chunk_index_     = 0;
+  chunk_end_index_ = 0;
+  stream_index_    = 0;
+  keyframe_stack_.clear();
+  keyframe_depth_ = 0;
+  index_.clear();
+  index_loaded_ = false;
+}
+
+bool TraceReader::ReadHeader() {
+  size_t size = end_ - cursor_;
+  if (size >= sizeof(uint32_t) &&
+      load<uint32_t>(cursor_) == format::container_magic) {
+    return ReadContainerHeader();
+  }
+  if (size >= sizeof(uint32_t) && load<uint32_t>(cursor_) == format::file_magic) {
+    format::FileHeader header;
+    // header_size and version must be read before the whole header
+    size_t min_size = sizeof(uint32_t) + sizeof(uint16_t) * 2;
+    if (size < min_size) {
+      AddErrorMessage("ReadHeader(): too small file:");
+      return false;
+    }
+    memcpy(&header, cursor_, min_size);
+    if (header.header_size < sizeof(header) || size < header.header_size) {
+      AddErrorMessage("ReadHeader(): broken header:");
+      return false;
+    }
+    memcpy(&header, cursor_, sizeof(header));
+    version_          = header.version;
+    pid_              = header.pid;
+    tid_              = header.tid;
+    base_timestamp_   = header.base_timestamp;
+    ticks_per_second_ = header.ticks_per_second;
+    clock_source_     = header.clock_source;
+    hook_overhead_ps_ = header.hook_overhead_ps;
+    if (ticks_per_second_ == 0) {
+      AddErrorMessage("ReadHeader(): invalid ticks_per_second:");
+      return false;
+    }
+    cursor_ += header.header_size;
+  } else {
+    if (size < format::legacy_header_size) {
+      AddErrorMessage("ReadHeader(): too small file:");
+      return false;
+    }
+    version_        = 0;
+    base_timestamp_ = load<uint64_t>(cursor_);
+    pid_            = load<int32_t>(cursor_ + sizeof(uint64_t));
+    tid_ = load<int32_t>(cursor_ + sizeof(uint64_t) + sizeof(int32_t));
+    ticks_per_second_ = 1000 * 1000;
+    clock_source_     = format::clock_system;
+    hook_overhead_ps_ = 0;
+    cursor_ += format::legacy_header_size;
+  }
+  timestamp_             = base_timestamp_;
+  hook_events_           = 0;
+  compensated_timestamp_ = 0;
+  keyframe_stack_.clear();
+  keyframe_depth_ = 0;
+  return true;
+}
+
+bool TraceReader::ReadContainerHeader() {
+  using namespace iftracer::format;
+  ContainerHeader header;
+  size_t size     = end_ - cursor_;
+  size_t min_size = sizeof(uint32_t) + sizeof(uint16_t) * 2;
+  if (size < min_size) {
+    AddErrorMessage("ReadContainerHeader(): too small file:");
+    return false;
+  }
+  memcpy(&header, cursor_, min_size);
+  if (header.header_size < sizeof(header) || size < header.header_size) {
+    AddErrorMessage("ReadContainerHeader(): broken header:");
+    return false;
+  }
+  memcpy(&header, cursor_, sizeof(header));
+  if (header.chunk_size < header.header_size ||
+      header.chunk_size <= sizeof(ChunkHeader)) {
+    AddErrorMessage("ReadContainerHeader(): invalid chunk_size:");
+    return false;
+  }
+  if (header.ticks_per_second == 0) {
+    AddErrorMessage("ReadContainerHeader(): invalid ticks_per_second:");
+    return false;
+  }
+  container_        = true;
+  version_          = header.version;
+  pid_              = header.pid;
+  base_timestamp_   = header.base_timestamp;
+  ticks_per_second_ = header.ticks_per_second;
+  clock_source_     = header.clock_source;
+  hook_overhead_ps_ = header.hook_overhead_ps;
+  // chunks of a stream are scattered
+  madvise(const_cast<uint8_t*>(head_), size_, MADV_NORMAL);
+  // the first slot is the header
+  for (size_t offset = header.chunk_size; offset + header.chunk_size <= size_;
+       offset += header.chunk_size) {
+    ChunkHeader chunk_header;
+    memcpy(&chunk_header, head_ + offset, sizeof(chunk_header));
+    // unused slot
+    if (chunk_header.magic != chunk_magic) {
+      continue;
+    }
+    size_t data_size = header.chunk_size - sizeof(chunk_header);
+    if (chunk_header.data_size > data_size) {
+      AddErrorMessage("ReadContainerHeader(): broken chunk at " +
+                      std::to_string(offset) + ":");
+      return false;
+    }
+    if (chunk_header.data_size != 0) {
+      data_size = chunk_header.data_size;
+    }
+    Chunk chunk;
+    chunk.stream_id       = chunk_header.stream_id;
+    chunk.sequence        = chunk_header.sequence;
+    chunk.tid             = chunk_header.tid;
+    chunk.first_timestamp = chunk_header.first_timestamp;
+    chunk.begin           = head_ + offset + sizeof(chunk_header);
+    chunk.end             = chunk.begin + data_size;
+    chunks_.push_back(chunk);
+  }
+  std::sort(chunks_.begin(), chunks_.end(),
+            [](const Chunk& a, const Chunk& b) {
+              return std::tie(a.stream_id, a.sequence) <
+                     std::tie(b.stream_id, b.sequence);
+            });
+  for (size_t i = 0; i < chunks_.size(); i++) {
+    if (i == 0 || chunks_[i].stream_id != chunks_[i - 1].stream_id) {
+      streams_.push_back(i);
+    }
+  }
+  if (streams_.empty()) {
+    // no events
+    cursor_ = end_;
+    return true;
+  }
+  return SelectStream(0);
+}
+
+bool TraceReader::SelectStream(size_t index) {
+  if (!container_) {
+    if (index != 0) {
+      AddErrorMessage("SelectStream(): out of range:");
+      return false;
+    }
+    cursor_ = head_;
+    function_table_.clear();
+    string_table_.clear();
+    return ReadHeader();
+  }
+  if (index >= streams_.size()) {
+    AddErrorMessage("SelectStream(): out of range:");
+    return false;
+  }
+  function_table_.clear();
+  string_table_.clear();
+  keyframe_stack_.clear();
+  keyframe_depth_  = 0;
+  stream_index_    = index;
+  chunk_index_     = streams_[index];
+  chunk_end_index_ =
+      index + 1 < streams_.size() ? streams_[index + 1] : chunks_.size();
+  const Chunk& chunk     = chunks_[chunk_index_];
+  tid_                   = chunk.tid;
+  cursor_                = chunk.begin;
+  end_                   = chunk.end;
+  timestamp_             = chunk.first_timestamp;
+  hook_events_           = 0;
+  compensated_timestamp_ = 0;
+  return true;
+}
+
+bool TraceReader::NextChunk() {
+  if (!container_ || chunk_index_ + 1 >= chunk_end_index_) {
+    return false;
+  }
+  const Chunk& chunk = chunks_[++chunk_index_];
+  if (chunk.sequence != chunks_[chunk_index_ - 1].sequence + 1) {
+    AddErrorMessage("NextChunk(): missing chunk before " +
+                    std::to_string(chunk.begin - head_) + ":");
+    return false;
+  }
+  cursor_    = chunk.begin;
+  end_       = chunk.end;
+  timestamp_ = chunk.first_timestamp;
+  return true;
+}
+
+bool TraceReader::Next(TraceEvent* event) {
+  while (true) {
+    bool ret = version_ == format::file_version_varint ? NextVarint(event)
+                                                       : NextFixed(event);
+    if (ret && compensation_ && hook_overhead_ps_ != 0) {
+      Compensate(event);
+    }
+    // the stream continues in the next chunk of the container
+    if (ret || HasError() || !NextChunk()) {
+      return ret;
+    }
+  }
+}
+
+// every hook adds its cost to the events after it
+void TraceReader::Compensate(TraceEvent* event) {
+  uint64_t overhead = static_cast<uint64_t>(
+      static_cast<unsigned __int128>(hook_events_) * hook_overhead_ps_ *
+      ticks_per_second_ / 1000000000000ULL);
+  uint64_t timestamp =
+      event->timestamp > overhead ? event->timestamp - overhead : 0;
+  // events closer than the estimated cost keep their order
+  timestamp              = std::max(timestamp, compensated_timestamp_);
+  compensated_timestamp_ = timestamp;
+  event->timestamp       = timestamp;
+  if (event->type == TraceEvent::kEnter || event->type == TraceEvent::kExit) {
+    hook_events_++;
+  }
+}
+
+bool TraceReader::NextFixed(TraceEvent* event) {
+  using namespace iftracer::format;
+  if (end_ - cursor_ < static_cast<ptrdiff_t>(sizeof(uint32_t))) {
+    return false;
+  }
+  uint32_t timestamp_diff = load<uint32_t>(cursor_);
+  // zero filled tail of a file which was not closed normally
+  if (timestamp_diff == 0) {
+    return false;
+  }
+  ExtraInfo flag          = timestamp_diff & flag_mask;
+  uint32_t timestamp_data = timestamp_diff & unset_flag_mask;
+  if (timestamp_data < timestamp_diff_offset) {
+    AddErrorMessage("Next(): broken timestamp_diff at " +
+                    std::to_string(Offset()) + ":");
+    return false;
+  }
+  const uint8_t* p = cursor_ + sizeof(uint32_t);
+  timestamp_ += timestamp_data - timestamp_diff_offset;
+
+  *event           = TraceEvent();
+  event->timestamp = timestamp_;
+  if (flag == normal_enter_flag) {
+    if (static_cast<size_t>(end_ - p) < address_size_) {
+      return false;
+    }
+    event->type = TraceEvent::kEnter;
+    if (address_size_ == sizeof(uint32_t)) {
+      event->address = load<uint32_t>(p);
+    } else {
+      event->address = load<uint64_t>(p);
+    }
+    p += address_size_;
+  } else if (flag == normal_exit_flag) {
+    event->type = TraceEvent::kExit;
+  } else {
+    if (end_ - p < static_cast<ptrdiff_t>(sizeof(ExtendType))) {
+      return false;
+    }
+    ExtendType extend_word = load<ExtendType>(p);
+    ExtendType extend_type = extend_word & extend_type_mask;
+    p += sizeof(ExtendType);
+    event->extend_type = extend_type;
+    if (extend_type == timestamp_sync) {
+      if (end_ - p < static_cast<ptrdiff_t>(sizeof(uint64_t))) {
+        return false;
+      }
+      // not an event: restart timestamp accumulation
+      timestamp_ = load<uint64_t>(p);
+      cursor_    = p + sizeof(uint64_t);
+      return NextFixed(event);
+    }
+    if (extend_type == keyframe) {
+      uint64_t hook_events = 0;
+      if (!ReadKeyframe(&p, &hook_events)) {
+        return false;
+      }
+      cursor_ = p;
+      return NextFixed(event);
+    }
+    if (extend_type == string_define) {
+      if (end_ - p < static_cast<ptrdiff_t>(sizeof(uint32_t) * 2)) {
+        return false;
+      }
+      uint32_t string_id = load<uint32_t>(p);
+      int32_t text_size  = load<int32_t>(p + sizeof(uint32_t));
+      p += sizeof(uint32_t) * 2;
+      if (text_size < 0 ||
+          static_cast<size_t>(end_ - p) < aligned_text_size(text_size)) {
+        AddErrorMessage("Next(): broken text size at " +
+                        std::to_string(Offset()) + ":");
+        return false;
+      }
+      DefineString(string_id, p, text_size);
+      cursor_ = p + aligned_text_size(text_size);
+      return NextFixed(event);
+    }
+    if (extend_type == counter) {
+      if (end_ - p < static_cast<ptrdiff_t>(sizeof(uint32_t) +
+                                            sizeof(uint64_t))) {
+        return false;
+      }
+      if (!LookupString(load<uint32_t>(p), event) ||
+          !SetCounterValue(extend_word >> extend_payload_shift,
+                           load<uint64_t>(p + sizeof(uint32_t)), event)) {
+        return false;
+      }
+      cursor_ = p + sizeof(uint32_t) + sizeof(uint64_t);
+      return true;
+    }
+    if (extend_type == id_event) {
+      if (end_ - p < static_cast<ptrdiff_t>(sizeof(uint32_t) +
+                                            sizeof(uint64_t))) {
+        return false;
+      }
+      if (!LookupString(load<uint32_t>(p), event) ||
+          !SetIdEvent(extend_word >> extend_payload_shift,
+                      load<uint64_t>(p + sizeof(uint32_t)), event)) {
+        return false;
+      }
+      cursor_ = p + sizeof(uint32_t) + sizeof(uint64_t);
+      return true;
+    }
+    bool has_string_id = (extend_type & string_id_flag) != 0;
+    bool has_args      = (extend_type & args_flag) != 0;
+    extend_type &= ~(string_id_flag | args_flag);
+    event->extend_type = extend_type;
+    // duration_enter has no text
+    if ((has_string_id || has_args) && extend_type == duration_enter) {
+      AddErrorMessage("Next(): unknown extend type " +
+                      std::to_string(extend_word) + " at " +
+                      std::to_string(Offset()) + ":");
+      return false;
+    }
+    switch (extend_type) {
+      case duration_enter:
+        event->type = TraceEvent::kDurationEnter;
+        break;
+      case duration_exit:
+        event->type = TraceEvent::kDurationExit;
+        break;
+      case async_enter:
+        event->type = TraceEvent::kAsyncEnter;
+        break;
+      case async_exit:
+        event->type = TraceEvent::kAsyncExit;
+        break;
+      case instant:
+        event->type = TraceEvent::kInstant;
+        break;
+      case cpu_migration:
+        event->type   = TraceEvent::kCpuMigration;
+        event->cpu_id = extend_word >> extend_payload_shift;
+        cursor_       = p;
+        return true;
+      default:
+        AddErrorMessage("Next(): unknown extend type " +
+                        std::to_string(extend_type) + " at " +
+                        std::to_string(Offset()) + ":");
+        return false;
+    }
+    if (has_string_id) {
+      if (end_ - p < static_cast<ptrdiff_t>(sizeof(uint32_t))) {
+        return false;
+      }
+      if (!LookupString(load<uint32_t>(p), event)) {
+        return false;
+      }
+      p += sizeof(uint32_t);
+    } else if (extend_type != duration_enter) {
+      if (end_ - p < static_cast<ptrdiff_t>(sizeof(int32_t))) {
+        return false;
+      }
+      int32_t text_size = load<int32_t>(p);
+      p += sizeof(int32_t);
+      if (text_size < 0 ||
+          static_cast<size_t>(end_ - p) < aligned_text_size(text_size)) {
+        AddErrorMessage("Next(): broken text size at " +
+                        std::to_string(Offset()) + ":");
+        return false;
+      }
+      event->text      = reinterpret_cast<const char*>(p);
+      event->text_size = text_size;
+      p += aligned_text_size(text_size);
+    }
+    if (has_args && !ReadArgs(&p, event)) {
+      return false;
+    }
+  }
+  cursor_ = p;
+  return true;
+}
+
+void TraceReader::DefineString(uint64_t string_id, const uint8_t* text,
+                               size_t text_size) {
+  if (string_id >= string_table_.size()) {
+    string_table_.resize(string_id + 1);
+  }
+  string_table_[string_id].text = reinterpret_cast<const char*>(text);
+  string_table_[string_id].size = text_size;
+}
+
+bool TraceReader::LookupString(uint64_t string_id, TraceEvent* event) {
+  return LookupString(string_id, &event->text, &event->text_size);
+}
+
+bool TraceReader::LookupString(uint64_t string_id, const char** text,
+                               uint32_t* size) {
+  if (string_id >= string_table_.size() ||
+      string_table_[string_id].text == nullptr) {
+    AddErrorMessage("LookupString(): undefined string id " +
+                    std::to_string(string_id) + " at " +
+                    std::to_string(Offset()) + ":");
+    return false;
+  }
+  *text = string_table_[string_id].text;
+  *size = string_table_[string_id].size;
+  return true;
+}
+
+bool TraceReader::SetCounterValue(uint64_t value_type, uint64_t value,
+                                  TraceEvent* event) {
+  using namespace iftracer::format;
+  if (value_type != arg_int64 && value_type != arg_double) {
+    AddErrorMessage("SetCounterValue(): unknown counter value type " +
+                    std::to_string(value_type) + " at " +
+                    std::to_string(Offset()) + ":");
+    return false;
+  }
+  event->type       = TraceEvent::kCounter;
+  event->value_type = value_type;
+  if (value_type == arg_int64) {
+    event->int_value = static_cast<int64_t>(value);
+  } else {
+    memcpy(&event->double_value, &value, sizeof(value));
+  }
+  return true;
+}
+
+bool TraceReader::SetIdEvent(uint64_t phase, uint64_t id, TraceEvent* event) {
+  using namespace iftracer::format;
+  switch (phase) {
+    case id_flow_start:
+      event->type = TraceEvent::kFlowStart;
+      break;
+    case id_flow_step:
+      event->type = TraceEvent::kFlowStep;
+      break;
+    case id_flow_end:
+      event->type = TraceEvent::kFlowEnd;
+      break;
+    case id_async_begin:
+      event->type = TraceEvent::kIdAsyncBegin;
+      break;
+    case id_async_end:
+      event->type = TraceEvent::kIdAsyncEnd;
+      break;
+    default:
+      AddErrorMessage("SetIdEvent(): unknown phase " + std::to_string(phase) +
+                      " at " + std::to_string(Offset()) + ":");
+      return false;
+  }
+  event->id = id;
+  return true;
+}
+
+bool TraceReader::ReadKeyframe(const uint8_t** p, uint64_t* hook_events) {
+  using namespace iftracer::format;
+  uint64_t timestamp  = 0;
+  uint64_t depth      = 0;
+  uint64_t stack_size = 0;
+  bool varint         = version_ == file_version_varint;
+  if (varint) {
+    if (!ReadVarint(p, &timestamp) || !ReadVarint(p, hook_events) ||
+        !ReadVarint(p, &depth) || !ReadVarint(p, &stack_size)) {
+      return false;
+    }
+  } else {
+    if (end_ - *p < static_cast<ptrdiff_t>(sizeof(uint64_t) * 2 +
+                                           sizeof(uint32_t) * 2)) {
+      return false;
+    }
+    timestamp    = load<uint64_t>(*p);
+    *hook_events = load<uint64_t>(*p + sizeof(uint64_t));
+    depth        = load<uint32_t>(*p + sizeof(uint64_t) * 2);
+    stack_size = load<uint32_t>(*p + sizeof(uint64_t) * 2 + sizeof(uint32_t));
+    *p += sizeof(uint64_t) * 2 + sizeof(uint32_t) * 2;
+  }
+  if (depth > UINT32_MAX || stack_size > depth ||
+      stack_size > max_keyframe_stack) {
+    AddErrorMessage("ReadKeyframe(): broken keyframe at " +
+                    std::to_string(Offset()) + ":");
+    return false;
+  }
+  keyframe_stack_.resize(stack_size);
+  for (uint64_t& address : keyframe_stack_) {
+    if (varint) {
+      if (!ReadVarint(p, &address)) {
+        return false;
+      }
+      continue;
+    }
+    if (static_cast<size_t>(end_ - *p) < address_size_) {
+      return false;
+    }
+    if (address_size_ == sizeof(uint32_t)) {
+      address = load<uint32_t>(*p);
+    } else {
+      address = load<uint64_t>(*p);
+    }
+    *p += address_size_;
+  }
+  keyframe_depth_ = depth;
+  timestamp_      = timestamp;
+  return true;
+}
+
+void TraceReader::LoadIndex() {
+  using format::IndexEntry;
+  using format::IndexHeader;
+  index_loaded_ = true;
+  index_.clear();
+  std::ifstream ifs(filename_ + ".index", std::ios::in | std::ios::binary);
+  IndexHeader header;
+  if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      header.magic != format::index_magic ||
+      header.header_size < sizeof(header) ||
+      header.entry_size < sizeof(IndexEntry) ||
+      !ifs.seekg(header.header_size)) {
+    return;
+  }
+  std::vector<char> entry(header.entry_size);
+  while (ifs.read(entry.data(), entry.size())) {
+    index_.emplace_back();
+    memcpy(&index_.back(), entry.data(), sizeof(IndexEntry));
+  }
+  std::sort(index_.begin(), index_.end(),
+            [](const IndexEntry& a, const IndexEntry& b) {
+              return std::tie(a.stream_id, a.timestamp) <
+                     std::tie(b.stream_id, b.timestamp);
+            });
+}
+
+bool TraceReader::Seek(uint64_t timestamp) {
+  using format::IndexEntry;
+  if (container_ && streams_.empty()) {
+    return true;
+  }
+  if (!SelectStream(stream_index_)) {
+    return false;
+  }
+  if (!index_loaded_) {
+    LoadIndex();
+  }
+  uint32_t stream_id =
+      container_ ? chunks_[streams_[stream_index_]].stream_id : 0;
+  IndexEntry key;
+  key.stream_id = stream_id;
+  key.timestamp = timestamp;
+  auto it       = std::upper_bound(
+      index_.begin(), index_.end(), key,
+      [](const IndexEntry& a, const IndexEntry& b) {
+        return std::tie(a.stream_id, a.timestamp) <
+               std::tie(b.stream_id, b.timestamp);
+      });
+  if (it == index_.begin() || (--it)->stream_id != stream_id) {
+    return true;
+  }
+  const uint8_t* record = head_ + it->offset;
+  if (container_) {
+    // the chunk of the keyframe
+    size_t i = chunk_index_;
+    while (i < chunk_end_index_ &&
+           !(chunks_[i].begin <= record && record < chunks_[i].end)) {
+      i++;
+    }
+    if (i == chunk_end_index_) {
+      AddErrorMessage("Seek(): no chunk at " + std::to_string(it->offset) +
+                      ":");
+      return false;
+    }
+    chunk_index_ = i;
+    end_         = chunks_[i].end;
+  } else if (it->offset >= size_ || record < cursor_) {
+    AddErrorMessage("Seek(): out of range offset " +
+                    std::to_string(it->offset) + ":");
+    return false;
+  }
+  cursor_ = record;
+  // the head of a keyframe has no timestamp_diff
+  const uint8_t* p = cursor_;
+  bool ret         = false;
+  if (version_ == format::file_version_varint) {
+    uint64_t head        = 0;
+    uint64_t extend_type = 0;
+    ret = ReadVarint(&p, &head) && ReadVarint(&p, &extend_type) &&
+          head == format::varint_head(0, format::varint_extend_kind) &&
+          extend_type == format::keyframe;
+  } else if (end_ - p >= static_cast<ptrdiff_t>(sizeof(uint32_t) * 2)) {
+    ret = load<uint32_t>(p) ==
+              format::set_flag_to_timestamp(format::timestamp_diff_offset,
+                                            format::extend_enter_flag) &&
+          load<uint32_t>(p + sizeof(uint32_t)) == format::keyframe;
+    p += sizeof(uint32_t) * 2;
+  }
+  uint64_t hook_events = 0;
+  if (!ret || !ReadKeyframe(&p, &hook_events)) {
+    AddErrorMessage("Seek(): no keyframe at " + std::to_string(it->offset) +
+                    ":");
+    return false;
+  }
+  cursor_ = p;
+  // compensation continues from the keyframe
+  hook_events_           = hook_events;
+  compensated_timestamp_ = 0;
+  return true;
+}
+
+bool TraceReader::ReadArgs(const uint8_t** p, TraceEvent* event) {
+  using namespace iftracer::format;
+  bool varint        = version_ == file_version_varint;
+  uint64_t arg_count = 0;
+  if (varint) {
+    if (!ReadVarint(p, &arg_count)) {
+      return false;
+    }
+  } else {
+    if (end_ - *p < static_cast<ptrdiff_t>(sizeof(uint32_t))) {
+      return false;
+    }
+    arg_count = load<uint32_t>(*p);
+    *p += sizeof(uint32_t);
+  }
+  if (arg_count > max_args) {
+    AddErrorMessage("ReadArgs(): broken arg count at " +
+                    std::to_string(Offset()) + ":");
+    return false;
+  }
+  args_.assign(arg_count, TraceArg());
+  for (TraceArg& arg : args_) {
+    uint64_t key   = 0;
+    uint64_t type  = 0;
+    uint64_t value = 0;
+    if (varint) {
+      if (!ReadVarint(p, &key) || !ReadVarint(p, &type)) {
+        return false;
+      }
+      if (type == arg_double) {
+        if (end_ - *p < static_cast<ptrdiff_t>(sizeof(uint64_t))) {
+          return false;
+        }
+        value = load<uint64_t>(*p);
+        *p += sizeof(uint64_t);
+      } else if (!ReadVarint(p, &value)) {
+        return false;
+      } else if (type == arg_int64) {
+        value = static_cast<uint64_t>(zigzag_decode(value));
+      }
+    } else {
+      if (end_ - *p < static_cast<ptrdiff_t>(fixed_arg_size)) {
+        return false;
+      }
+      key   = load<uint32_t>(*p);
+      type  = load<uint32_t>(*p + sizeof(uint32_t));
+      value = load<uint64_t>(*p + sizeof(uint32_t) * 2);
+      *p += fixed_arg_size;
+    }
+    if (type > arg_string) {
+      AddErrorMessage("ReadArgs(): unknown arg type " + std::to_string(type) +
+                      " at " + std::to_string(Offset()) + ":");
+      return false;
+    }
+    if (!LookupString(key, &arg.key, &arg.key_size)) {
+      return false;
+    }
+    arg.type = type;
+    memcpy(&arg.int_value, &value, sizeof(value));
+    if (type == arg_string && !LookupString(value, &arg.text, &arg.text_size)) {
+      return false;
+    }
+  }
+  event->args      = args_.data();
+  event->arg_count = args_.size();
+  return true;
+}
+
+bool TraceReader::ReadVarint(const uint8_t** p, uint64_t* value) {
+  uint64_t v = 0;
+  for (int shift = 0; *p < end_ && shift < 64; shift += 7) {
+    uint8_t b = *(*p)++;
+    v |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) {
+      *value = v;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TraceReader::NextVarint(TraceEvent* event) {
+  using namespace iftracer::format;
+  while (cursor_ < end_) {
+    // zero filled tail of a file which was not closed normally
+    if (*cursor_ == 0) {
+      return false;
+    }
+    const uint8_t* p = cursor_;
+    uint64_t head    = 0;
+    if (!ReadVarint(&p, &head)) {
+      return false;
+    }
+    uint64_t kind = head & varint_kind_mask;
+    // sign extension of 62bit timestamp_diff
+    int64_t timestamp_diff = static_cast<int64_t>(head) >> varint_kind_bits;
+    timestamp_ += static_cast<uint64_t>(timestamp_diff);
+
+    *event           = TraceEvent();
+    event->timestamp = timestamp_;
+    if (kind == varint_enter_kind) {
+      uint64_t function_id = 0;
+      if (!ReadVarint(&p, &function_id)) {
+        return false;
+      }
+      if (function_id >= function_table_.size()) {
+        AddErrorMessage("NextVarint(): undefined function id at " +
+                        std::to_string(Offset()) + ":");
+        return false;
+      }
+      event->type    = TraceEvent::kEnter;
+      event->address = function_table_[function_id];
+    } else if (kind == varint_exit_kind) {
+      event->type = TraceEvent::kExit;
+    } else if (kind == varint_extend_kind) {
+      uint64_t extend_word = 0;
+      if (!ReadVarint(&p, &extend_word)) {
+        return false;
+      }
+      uint64_t extend_type = extend_word & extend_type_mask;
+      event->extend_type   = extend_type;
+      if (extend_type == function_define) {
+        uint64_t function_id = 0;
+        uint64_t address     = 0;
+        if (!ReadVarint(&p, &function_id) || !ReadVarint(&p, &address)) {
+          return false;
+        }
+        if (function_id >= function_table_.size()) {
+          function_table_.resize(function_id + 1, 0);
+        }
+        function_table_[function_id] = address;
+        cursor_                      = p;
+        continue;
+      }
+      if (extend_type == timestamp_sync) {
+        uint64_t timestamp = 0;
+        if (!ReadVarint(&p, &timestamp)) {
+          return false;
+        }
+        timestamp_ = timestamp;
+        cursor_    = p;
+        continue;
+      }
+      if (extend_type == keyframe) {
+        uint64_t hook_events = 0;
+        if (!ReadKeyframe(&p, &hook_events)) {
+          return false;
+        }
+        cursor_ = p;
+        continue;
+      }
+      if (extend_type == string_define) {
+        uint64_t string_id = 0;
+        uint64_t text_size = 0;
+        if (!ReadVarint(&p, &string_id) || !ReadVarint(&p, &text_size)) {
+          return false;
+        }
+        if (string_id > UINT32_MAX ||
+            text_size > static_cast<uint64_t>(end_ - p)) {
+          AddErrorMessage("NextVarint(): broken string_define at " +
+                          std::to_string(Offset()) + ":");
+          return false;
+        }
+        DefineString(string_id, p, text_size);
+        cursor_ = p + text_size;
+        continue;
+      }
+      if (extend_type == counter) {
+        uint64_t value_type = extend_word >> extend_payload_shift;
+        uint64_t string_id  = 0;
+        uint64_t value      = 0;
+        if (!ReadVarint(&p, &string_id)) {
+          return false;
+        }
+        if (value_type == arg_int64) {
+          if (!ReadVarint(&p, &value)) {
+            return false;
+          }
+          value = static_cast<uint64_t>(zigzag_decode(value));
+        } else {
+          if (end_ - p < static_cast<ptrdiff_t>(sizeof(uint64_t))) {
+            return false;
+          }
+          value = load<uint64_t>(p);
+          p += sizeof(uint64_t);
+        }
+        if (!LookupString(string_id, event) ||
+            !SetCounterValue(value_type, value, event)) {
+          return false;
+        }
+        cursor_ = p;
+        return true;
+      }
+      if (extend_type == id_event) {
+        uint64_t string_id = 0;
+        uint64_t id        = 0;
+        if (!ReadVarint(&p, &string_id) || !ReadVarint(&p, &id)) {
+          return false;
+        }
+        if (!LookupString(string_id, event) ||
+            !SetIdEvent(extend_word >> extend_payload_shift, id, event)) {
+          return false;
+        }
+        cursor_ = p;
+        return true;
+      }
+      bool has_string_id = (extend_type & string_id_flag) != 0;
+      bool has_args      = (extend_type & args_flag) != 0;
+      extend_type &= ~(string_id_flag | args_flag);
+      event->extend_type = extend_type;
+      // duration_enter has no text
+      if ((has_string_id || has_args) && extend_type == duration_enter) {
+        AddErrorMessage("NextVarint(): unknown extend type " +
+                        std::to_string(extend_word) + " at " +
+                        std::to_string(Offset()) + ":");
+        return false;
+      }
+      switch (extend_type) {
+        case duration_enter:
+          event->type = TraceEvent::kDurationEnter;
+          break;
+        case duration_exit:
+          event->type = TraceEvent::kDurationExit;
+          break;
+        case async_enter:
+          event->type = TraceEvent::kAsyncEnter;
+          break;
+        case async_exit:
+          event->type = TraceEvent::kAsyncExit;
+          break;
+        case instant:
+          event->type = TraceEvent::kInstant;
+          break;
+        case cpu_migration:
+          event->type   = TraceEvent::kCpuMigration;
+          event->cpu_id = extend_word >> extend_payload_shift;
+          cursor_       = p;
+          return true;
+        default:
+          AddErrorMessage("NextVarint(): unknown extend type " +
+                          std::to_string(extend_type) + " at " +
+                          std::to_string(Offset()) + ":");
+          return false;
+      }
+      if (has_string_id) {
+        uint64_t string_id = 0;
+        if (!ReadVarint(&p, &string_id)) {
+          return false;
+        }
+        if (!LookupString(string_id, event)) {
+          return false;
+        }
+      } else if (extend_type != duration_enter) {
+        uint64_t text_size = 0;
+        if (!ReadVarint(&p, &text_size)) {
+          return false;
+        }
+        if (text_size > static_cast<uint64_t>(end_ - p)) {
+          AddErrorMessage("NextVarint(): broken text size at " +
+                          std::to_string(Offset()) + ":");
+          return false;
+        }
+        event->text      = reinterpret_cast<const char*>(p);
+        event->text_size = text_size;
+        p += text_size;
+      }
+      if (has_args && !ReadArgs(&p, event)) {
+        return false;
+      }
+    } else {
+      AddErrorMessage("NextVarint(): broken record at " +
+                      std::to_string(Offset()) + ":");
+      return false;
+    }
+    cursor_ = p;
+    return true;
+  }
+  return false;
+}
+
+uint64_t TraceReader::TicksToNanoseconds(uint64_t ticks) const {
+  constexpr uint64_t nano = 1000 * 1000 * 1000;
+  if (ticks_per_second_ == nano) {
+    return ticks;
+  }
+  return static_cast<uint64_t>(static_cast<unsigned __int128>(ticks) * nano /
+                               ticks_per_second_);
+}
+
+uint64_t TraceReader::NanosecondsToTicks(uint64_t ns) const {
+  constexpr uint64_t nano = 1000 * 1000 * 1000;
+  if (ticks_per_second_ == nano) {
+    return ns;
+  }
+  return static_cast<uint64_t>(static_cast<unsigned __int128>(ns) *
+                               ticks_per_second_ / nano);
+}
+
+std::string TraceReader::GetErrorMessage() {
+  std::string tmp = error_message_;
+  error_message_.clear();
+  return tmp;
+}
+
+void TraceReader::AddErrorMessage(std::string message) {
+  error_message_ = message + error_message_;
+}
+void TraceReader::AddErrorMessageWithErrono(std::string message,
+                                            int errno_value) {
+  error_message_ = message + std::string(std::strerror(errno_value)) + ":" +
+                   filename_ + ":" + error_message_;
+}
+}  // namespace iftracer
@@ -0,0 +1,223 @@
+#ifndef TRACE_READER_HPP_INCLUDED
+#define TRACE_READER_HPP_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "trace_format.hpp"
+
+namespace iftracer {
+// typed arg of extend events (format::args_flag)
+struct TraceArg {
+  // interned key (not NULL terminated)
+  const char* key   = nullptr;
+  uint32_t key_size = 0;
+  // format::arg_*
+  uint32_t type = format::arg_int64;
+  union {
+    int64_t int_value;
+    double double_value;
+    // arg_pointer
+    uint64_t pointer_value;
+  };
+  // arg_string only (not NULL terminated)
+  const char* text   = nullptr;
+  uint32_t text_size = 0;
+
+  TraceArg() : int_value(0) {}
+};
+
+struct TraceEvent {
+  enum Type {
+    kEnter,
+    kExit,
+    kDurationEnter,
+    kDurationExit,
+    kAsyncEnter,
+    kAsyncExit,
+    kInstant,
+    kCpuMigration,
+    kCounter,
+    // linked by id across threads (format::id_event)
+    kFlowStart,
+    kFlowStep,
+    kFlowEnd,
+    kIdAsyncBegin,
+    kIdAsyncEnd,
+    kUnknown,
+  };
+  Type type = kUnknown;
+  // absolute timestamp (clock ticks)
+  uint64_t timestamp = 0;
+  // kEnter only
+  uint64_t address = 0;
+  // without payload
+  format::ExtendType extend_type = 0;
+  // kCpuMigration only (format::no_cpu_id: end of cpu tracking)
+  uint32_t cpu_id = 0;
+  // kCounter only (format::arg_int64 or arg_double, name is text)
+  uint32_t value_type = format::arg_int64;
+  int64_t int_value   = 0;
+  double double_value = 0;
+  // kFlow* and kIdAsync* only (name is text)
+  uint64_t id = 0;
+  // NOTE: text points into the mapped (or decompressed) file
+  // (not NULL terminated)
+  // (also for interned strings recorded by string_id)
+  const char* text   = nullptr;
+  uint32_t text_size = 0;
+  // valid until the next call of TraceReader::Next()
+  const TraceArg* args = nullptr;
+  uint32_t arg_count   = 0;
+};
+
+// read-only decoder of one iftracer.out.<tid> file
+// or one thread (stream) of an iftracer.out.<pid>.chunks container
+class TraceReader {
+ public:
+  TraceReader(){};
+  ~TraceReader() { Close(); };
+  TraceReader(const TraceReader&) = delete;
+  TraceReader& operator=(const TraceReader&) = delete;
+
+  // size of function address recorded by target (4 for 32bit targets)
+  void SetAddressSize(size_t address_size) { address_size_ = address_size; }
+  // subtract the cost of the hooks before each event from its timestamp
+  // (format::FileHeader::hook_overhead_ps, no effect if it is 0)
+  // durations exclude the hooks of descendants and the timestamps of a
+  // thread never go backward
+  void SetCompensation(bool compensation) { compensation_ = compensation; }
+  bool Open(const std::string& filename);
+  void Close();
+  // return false at end of data or on error (see HasError())
+  bool Next(TraceEvent* event);
+
+  // a container has one stream per thread and the others have one stream
+  // the first stream is selected by Open()
+  size_t StreamCount() const { return container_ ? streams_.size() : 1; }
+  // decode the stream from the beginning (Tid() is the tid of the stream)
+  bool SelectStream(size_t index);
+  bool IsContainer() const { return container_; }
+  // decode the selected stream from the last keyframe at or before timestamp
+  // (clock ticks) found in "<file>.index" (format::IndexHeader)
+  // the stream is decoded from the beginning without such keyframe
+  // NOTE: events before timestamp are also returned by Next()
+  bool Seek(uint64_t timestamp);
+  // functions which were entered and not exited at the last keyframe
+  // (outermost first, at most format::max_keyframe_stack of KeyframeDepth())
+  // empty at the beginning of the stream
+  const std::vector<uint64_t>& KeyframeStack() const {
+    return keyframe_stack_;
+  }
+  uint32_t KeyframeDepth() const { return keyframe_depth_; }
+
+  int32_t Pid() const { return pid_; }
+  int32_t Tid() const { return tid_; }
+  uint64_t BaseTimestamp() const { return base_timestamp_; }
+  uint64_t TicksPerSecond() const { return ticks_per_second_; }
+  // format::clock_* (clock_system for legacy files)
+  uint32_t ClockSource() const { return clock_source_; }
+  // 0 for legacy files without FileHeader, format::file_version_*
+  uint32_t Version() const { return version_; }
+  // 0 if not measured
+  uint32_t HookOverheadPs() const { return hook_overhead_ps_; }
+  uint64_t TicksToNanoseconds(uint64_t ticks) const;
+  // inverse of TicksToNanoseconds() (rounded down, e.g. for Seek())
+  uint64_t NanosecondsToTicks(uint64_t ns) const;
+  size_t Offset() const { return cursor_ - head_; }
+  size_t Size() const { return size_; }
+
+  bool HasError() const { return !error_message_.empty(); }
+  std::string GetErrorMessage();
+
+ private:
+  // IFTRACER_COMPRESS: replace the mapped file with decompressed frames
+  bool DecodeFrames();
+  bool ReadHeader();
+  bool ReadContainerHeader();
+  // move to the next chunk of the stream (false at end of the stream)
+  bool NextChunk();
+  bool NextFixed(TraceEvent* event);
+  bool NextVarint(TraceEvent* event);
+  // return false at end of data
+  bool ReadVarint(const uint8_t** p, uint64_t* value);
+  void DefineString(uint64_t string_id, const uint8_t* text, size_t text_size);
+  // set text of event (error if string_id is not defined yet)
+  bool LookupString(uint64_t string_id, TraceEvent* event);
+  bool LookupString(uint64_t string_id, const char** text, uint32_t* size);
+  // args after the text payload (format::args_flag)
+  bool ReadArgs(const uint8_t** p, TraceEvent* event);
+  // set counter value of event from raw bits
+  bool SetCounterValue(uint64_t value_type, uint64_t value, TraceEvent* event);
+  bool SetIdEvent(uint64_t phase, uint64_t id, TraceEvent* event);
+  // payload of format::keyframe (after the extend type)
+  bool ReadKeyframe(const uint8_t** p, uint64_t* hook_events);
+  // entries of "<file>.index" (empty if there is no valid index)
+  void LoadIndex();
+  void Compensate(TraceEvent* event);
+  void AddErrorMessage(std::string message);
+  void AddErrorMessageWithErrono(std::string message, int errno_value);
+
+  std::string filename_ = "";
+  const uint8_t* head_  = nullptr;
+  const uint8_t* cursor_ = nullptr;
+  const uint8_t* end_    = nullptr;
+  size_t size_           = 0;
+  size_t address_size_   = sizeof(uint64_t);
+  // decompressed data of a file of frames (head_ points to it)
+  std::vector<uint8_t> frame_data_;
+
+  int32_t pid_               = 0;
+  int32_t tid_               = 0;
+  uint64_t base_timestamp_   = 0;
+  uint64_t ticks_per_second_ = 1000 * 1000;
+  uint32_t clock_source_     = format::clock_system;
+  uint32_t version_          = 0;
+  uint64_t timestamp_        = 0;
+  uint32_t hook_overhead_ps_ = 0;
+  bool compensation_         = false;
+  // enter and exit records before the event and the last timestamp
+  // (SetCompensation())
+  uint64_t hook_events_           = 0;
+  uint64_t compensated_timestamp_ = 0;
+  // function_id -> address (file_version_varint)
+  std::vector<uint64_t> function_table_;
+  // string_id -> text in the mapped file (string_define)
+  struct StringEntry {
+    const char* text = nullptr;
+    uint32_t size    = 0;
+  };
+  std::vector<StringEntry> string_table_;
+  // args of the last event
+  std::vector<TraceArg> args_;
+  // the last keyframe
+  std::vector<uint64_t> keyframe_stack_;
+  uint32_t keyframe_depth_ = 0;
+  // sorted by (stream_id, timestamp) (loaded by the first Seek())
+  std::vector<format::IndexEntry> index_;
+  bool index_loaded_ = false;
+
+  // container: chunks sorted by (stream_id, sequence)
+  struct Chunk {
+    uint32_t stream_id       = 0;
+    uint32_t sequence        = 0;
+    int32_t tid              = 0;
+    uint64_t first_timestamp = 0;
+    const uint8_t* begin     = nullptr;
+    const uint8_t* end       = nullptr;
+  };
+  bool container_ = false;
+  std::vector<Chunk> chunks_;
+  // index of the first chunk of each stream in chunks_
+  std::vector<size_t> streams_;
+  // current chunk and end of the selected stream
+  size_t chunk_index_     = 0;
+  size_t chunk_end_index_ = 0;
+  size_t stream_index_    = 0;
+
+  std::string error_message_ = "";
+};
+}  // namespace iftracer
+
+#endif  // TRACE_READER_HPP_INCLUDED
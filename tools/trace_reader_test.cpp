@@ -0,0 +1,711 @@
+#include <unistd.h>
+
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "lz_codec.hpp"
+#include "trace_format.hpp"
+#include "trace_reader.hpp"
+
+namespace {
+using namespace iftracer::format;
+
+class TraceBuilder {
+ public:
+  template <class T>
+  void Put(T v) {
+    const char* p = reinterpret_cast<const char*>(&v);
+    data_.insert(data_.end(), p, p + sizeof(T));
+  }
+  void LegacyHeader(uint64_t base_timestamp, int32_t pid, int32_t tid) {
+    Put<uint64_t>(base_timestamp);
+    Put<int32_t>(pid);
+    Put<int32_t>(tid);
+  }
+  void Header(const FileHeader& header) { Put<FileHeader>(header); }
+  void Sync(uint64_t timestamp) {
+    Timestamp(0, extend_enter_flag);
+    Put<ExtendType>(timestamp_sync);
+    Put<uint64_t>(timestamp);
+  }
+  void Varint(uint64_t v) {
+    uint8_t buf[max_varint_size];
+    uint8_t* end = write_varint(buf, v);
+    data_.insert(data_.end(), buf, end);
+  }
+  void Timestamp(uint32_t diff, ExtraInfo flag) {
+    Put<uint32_t>(set_flag_to_timestamp(diff + timestamp_diff_offset, flag));
+  }
+  void Enter(uint32_t diff, uint64_t address) {
+    Timestamp(diff, normal_enter_flag);
+    Put<uint64_t>(address);
+  }
+  void Exit(uint32_t diff) { Timestamp(diff, normal_exit_flag); }
+  void Keyframe(bool varint, uint64_t timestamp, uint64_t hook_events,
+                uint32_t depth, const std::vector<uint64_t>& stack) {
+    if (varint) {
+      Varint(varint_head(0, varint_extend_kind));
+      Varint(keyframe);
+      Varint(timestamp);
+      Varint(hook_events);
+      Varint(depth);
+      Varint(stack.size());
+      for (uint64_t address : stack) {
+        Varint(address);
+      }
+      return;
+    }
+    Timestamp(0, extend_enter_flag);
+    Put<ExtendType>(keyframe);
+    Put<uint64_t>(timestamp);
+    Put<uint64_t>(hook_events);
+    Put<uint32_t>(depth);
+    Put<uint32_t>(stack.size());
+    for (uint64_t address : stack) {
+      Put<uint64_t>(address);
+    }
+  }
+  void Index(const std::vector<IndexEntry>& entries) {
+    IndexHeader header;
+    header.entry_size = sizeof(IndexEntry);
+    Put<IndexHeader>(header);
+    for (const IndexEntry& entry : entries) {
+      Put<IndexEntry>(entry);
+    }
+  }
+  void Extend(uint32_t diff, ExtraInfo flag, ExtendType extend_type,
+              const std::string& text) {
+    Timestamp(diff, flag);
+    Put<ExtendType>(extend_type);
+    Put<int32_t>(text.size());
+    data_.insert(data_.end(), text.begin(), text.end());
+    data_.resize(data_.size() + aligned_text_size(text.size()) - text.size(),
+                 '\xff');
+  }
+  // chunk of a container padded to chunk_size
+  // (closed: data_size is recorded, otherwise zero filled tail)
+  void Chunk(ChunkHeader header, const TraceBuilder& records, bool closed,
+             size_t chunk_size) {
+    header.data_size = closed ? records.data_.size() : 0;
+    size_t begin     = data_.size();
+    Put<ChunkHeader>(header);
+    data_.insert(data_.end(), records.data_.begin(), records.data_.end());
+    data_.resize(begin + chunk_size, 0);
+  }
+  // IFTRACER_COMPRESS frame of records (stored if not compressed)
+  void Frame(const std::vector<char>& records, bool compress) {
+    std::vector<uint8_t> compressed(
+        iftracer::lz::CompressBound(records.size()));
+    FrameHeader header;
+    header.raw_size        = records.size();
+    header.compressed_size = records.size();
+    if (compress) {
+      header.compressed_size = iftracer::lz::Compress(
+          reinterpret_cast<const uint8_t*>(records.data()), records.size(),
+          compressed.data(), compressed.size());
+    } else {
+      compressed.assign(records.begin(), records.end());
+    }
+    Put<FrameHeader>(header);
+    data_.insert(data_.end(), compressed.begin(),
+                 compressed.begin() + header.compressed_size);
+  }
+  bool Save(const std::string& filename) {
+    std::ofstream ofs(filename, std::ios::out | std::ios::binary);
+    ofs.write(data_.data(), data_.size());
+    return ofs.good();
+  }
+
+  std::vector<char> data_;
+};
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+  std::string filename = "trace_reader_test.bin";
+  TraceBuilder builder;
+  builder.LegacyHeader(1000, 10, 11);
+  builder.Enter(0, 0x401000);
+  builder.Extend(3, extend_enter_flag, async_enter, "CPU:1");
+  builder.Timestamp(2, extend_enter_flag);
+  builder.Put<ExtendType>(duration_enter);
+  builder.Extend(5, extend_exit_flag, duration_exit, "scope");
+  // 8B record with cpu id in the upper bits of extend type
+  builder.Timestamp(1, extend_exit_flag);
+  builder.Put<ExtendType>(cpu_migration_type(3));
+  // interned text: string_define -> use by string_id
+  builder.Timestamp(0, extend_exit_flag);
+  builder.Put<ExtendType>(string_define);
+  builder.Put<uint32_t>(7);
+  builder.Put<int32_t>(5);
+  builder.data_.insert(builder.data_.end(), "eaten", "eaten" + 5);
+  builder.data_.resize(builder.data_.size() + aligned_text_size(5) - 5, '\xff');
+  builder.Timestamp(2, extend_exit_flag);
+  builder.Put<ExtendType>(instant | string_id_flag);
+  builder.Put<uint32_t>(7);
+  // typed args: {key string_id, arg type, value}
+  builder.Timestamp(0, extend_exit_flag);
+  builder.Put<ExtendType>(instant | string_id_flag | args_flag);
+  builder.Put<uint32_t>(7);
+  builder.Put<uint32_t>(2);
+  builder.Put<uint32_t>(7);
+  builder.Put<uint32_t>(arg_int64);
+  builder.Put<int64_t>(-5);
+  builder.Put<uint32_t>(7);
+  builder.Put<uint32_t>(arg_string);
+  builder.Put<uint64_t>(7);
+  // counter: string_id(4B) -> value(8B)
+  builder.Timestamp(1, extend_exit_flag);
+  builder.Put<ExtendType>(counter_type(arg_int64));
+  builder.Put<uint32_t>(7);
+  builder.Put<int64_t>(-42);
+  // id_event: string_id(4B) -> id(8B)
+  builder.Timestamp(0, extend_exit_flag);
+  builder.Put<ExtendType>(id_event_type(id_flow_start));
+  builder.Put<uint32_t>(7);
+  builder.Put<uint64_t>(0x123400000001ULL);
+  builder.Exit(4);
+  // zero filled tail of an abnormally terminated process
+  builder.data_.resize(builder.data_.size() + 64, 0);
+  if (!builder.Save(filename)) {
+    std::cerr << "failed to write " << filename << std::endl;
+    return 1;
+  }
+
+  iftracer::TraceReader reader;
+  if (!reader.Open(filename)) {
+    std::cerr << reader.GetErrorMessage() << std::endl;
+    return 1;
+  }
+  assert(reader.Pid() == 10 || !"wrong pid");
+  assert(reader.Tid() == 11 || !"wrong tid");
+
+  using iftracer::TraceEvent;
+  struct Expected {
+    TraceEvent::Type type;
+    uint64_t timestamp;
+    std::string text;
+  } expected[] = {
+      {TraceEvent::kEnter, 1000, ""},
+      {TraceEvent::kAsyncEnter, 1003, "CPU:1"},
+      {TraceEvent::kDurationEnter, 1005, ""},
+      {TraceEvent::kDurationExit, 1010, "scope"},
+      {TraceEvent::kCpuMigration, 1011, ""},
+      {TraceEvent::kInstant, 1013, "eaten"},
+      {TraceEvent::kInstant, 1013, "eaten"},
+      {TraceEvent::kCounter, 1014, "eaten"},
+      {TraceEvent::kFlowStart, 1014, "eaten"},
+      {TraceEvent::kExit, 1018, ""},
+  };
+  TraceEvent event;
+  for (auto& e : expected) {
+    bool ret = reader.Next(&event);
+    assert(ret || !"too few events");
+    assert(event.type == e.type || !"wrong type");
+    assert(event.timestamp == e.timestamp || !"wrong timestamp");
+    assert(std::string(event.text, event.text_size) == e.text ||
+           !"wrong text");
+    if (event.type == TraceEvent::kCpuMigration) {
+      assert(event.cpu_id == 3 || !"wrong cpu id");
+      assert(event.extend_type == cpu_migration || !"wrong extend type");
+    }
+    if (event.type == TraceEvent::kCounter) {
+      assert(event.value_type == arg_int64 || !"wrong counter type");
+      assert(event.int_value == -42 || !"wrong counter value");
+    }
+    if (event.type == TraceEvent::kFlowStart) {
+      assert(event.id == 0x123400000001ULL || !"wrong flow id");
+    }
+    if (event.arg_count != 0) {
+      assert(event.arg_count == 2 || !"wrong arg count");
+      assert(std::string(event.args[0].key, event.args[0].key_size) ==
+                 "eaten" ||
+             !"wrong arg key");
+      assert(event.args[0].type == arg_int64 || !"wrong arg type");
+      assert(event.args[0].int_value == -5 || !"wrong int arg");
+      assert(event.args[1].type == arg_string || !"wrong arg type");
+      assert(std::string(event.args[1].text, event.args[1].text_size) ==
+                 "eaten" ||
+             !"wrong string arg");
+    }
+  }
+  assert(event.address == 0 || !"exit has no address");
+  assert(!reader.Next(&event) || !"too many events");
+  assert(!reader.HasError() || !"unexpected error");
+  assert(reader.TicksToNanoseconds(3) == 3000 || !"wrong tick scale");
+  assert(reader.Version() == 0 || !"wrong legacy version");
+
+  // FileHeader with tsc ticks and timestamp_sync
+  TraceBuilder tsc_builder;
+  FileHeader header;
+  header.pid              = 20;
+  header.tid              = 21;
+  header.base_timestamp   = 3000000000ULL;
+  header.ticks_per_second = 3000000000ULL;
+  header.clock_source     = clock_tsc;
+  tsc_builder.Header(header);
+  tsc_builder.Enter(3, 0x401000);
+  // diff larger than 30bit
+  tsc_builder.Sync(9000000000ULL);
+  tsc_builder.Exit(0);
+  tsc_builder.Exit(6);
+  if (!tsc_builder.Save(filename)) {
+    std::cerr << "failed to write " << filename << std::endl;
+    return 1;
+  }
+  if (!reader.Open(filename)) {
+    std::cerr << reader.GetErrorMessage() << std::endl;
+    return 1;
+  }
+  assert(reader.Pid() == 20 || !"wrong pid");
+  assert(reader.Tid() == 21 || !"wrong tid");
+  assert(reader.Version() == file_version_fixed || !"wrong version");
+  assert(reader.ClockSource() == clock_tsc || !"wrong clock source");
+  uint64_t expected_timestamps[] = {3000000003ULL, 9000000000ULL,
+                                    9000000006ULL};
+  for (uint64_t timestamp : expected_timestamps) {
+    bool ret = reader.Next(&event);
+    assert(ret || !"too few events");
+    assert(event.timestamp == timestamp || !"wrong timestamp after sync");
+  }
+  assert(!reader.Next(&event) || !"too many events");
+  assert(!reader.HasError() || !"unexpected error");
+  assert(reader.TicksToNanoseconds(9000000006ULL) == 3000000002ULL ||
+         !"wrong tick scale");
+
+  // hook overhead compensation: 10 ticks per enter/exit before the event
+  TraceBuilder overhead_builder;
+  FileHeader overhead_header;
+  overhead_header.base_timestamp   = 1000;
+  overhead_header.ticks_per_second = 1000000000ULL;
+  overhead_header.hook_overhead_ps = 10000;
+  overhead_builder.Header(overhead_header);
+  overhead_builder.Enter(100, 0x401000);
+  overhead_builder.Enter(50, 0x401000);
+  // closer than the overhead
+  overhead_builder.Exit(5);
+  overhead_builder.Exit(100);
+  if (!overhead_builder.Save(filename)) {
+    std::cerr << "failed to write " << filename << std::endl;
+    return 1;
+  }
+  uint64_t raw_timestamps[]         = {1100, 1150, 1155, 1255};
+  uint64_t compensated_timestamps[] = {1100, 1140, 1140, 1225};
+  for (bool compensation : {false, true}) {
+    reader.SetCompensation(compensation);
+    if (!reader.Open(filename)) {
+      std::cerr << reader.GetErrorMessage() << std::endl;
+      return 1;
+    }
+    assert(reader.HookOverheadPs() == 10000 || !"wrong hook overhead");
+    for (int i = 0; i < 4; i++) {
+      bool ret = reader.Next(&event);
+      assert(ret || !"too few events");
+      assert(event.timestamp == (compensation ? compensated_timestamps[i]
+                                              : raw_timestamps[i]) ||
+             !"wrong compensated timestamp");
+    }
+    assert(!reader.Next(&event) || !"too many events");
+  }
+  reader.SetCompensation(false);
+
+  // varint encoding
+  TraceBuilder varint_builder;
+  header.version = file_version_varint;
+  varint_builder.Header(header);
+  varint_builder.Varint(varint_head(0, varint_extend_kind));
+  varint_builder.Varint(function_define);
+  varint_builder.Varint(5);
+  varint_builder.Varint(0x401000);
+  varint_builder.Varint(varint_head(3, varint_enter_kind));
+  varint_builder.Varint(5);
+  varint_builder.Varint(varint_head(200, varint_extend_kind));
+  varint_builder.Varint(async_enter);
+  varint_builder.Varint(5);
+  varint_builder.data_.insert(varint_builder.data_.end(), "CPU:1", "CPU:1" + 5);
+  varint_builder.Varint(varint_head(1, varint_extend_kind));
+  varint_builder.Varint(cpu_migration_type(no_cpu_id));
+  varint_builder.Varint(varint_head(0, varint_extend_kind));
+  varint_builder.Varint(string_define);
+  varint_builder.Varint(300);
+  varint_builder.Varint(5);
+  varint_builder.data_.insert(varint_builder.data_.end(), "eaten", "eaten" + 5);
+  varint_builder.Varint(varint_head(0, varint_extend_kind));
+  varint_builder.Varint(async_exit | string_id_flag);
+  varint_builder.Varint(300);
+  // args after the text: int64 is zigzag, double is 8B
+  varint_builder.Varint(varint_head(0, varint_extend_kind));
+  varint_builder.Varint(instant | args_flag);
+  varint_builder.Varint(4);
+  varint_builder.data_.insert(varint_builder.data_.end(), "args", "args" + 4);
+  varint_builder.Varint(3);
+  varint_builder.Varint(300);
+  varint_builder.Varint(arg_int64);
+  varint_builder.Varint(zigzag_encode(-300));
+  varint_builder.Varint(300);
+  varint_builder.Varint(arg_double);
+  varint_builder.Put<double>(1.5);
+  varint_builder.Varint(300);
+  varint_builder.Varint(arg_pointer);
+  varint_builder.Varint(0x7fff1234);
+  varint_builder.Varint(varint_head(0, varint_extend_kind));
+  varint_builder.Varint(counter_type(arg_double));
+  varint_builder.Varint(300);
+  varint_builder.Put<double>(2.5);
+  varint_builder.Varint(varint_head(0, varint_extend_kind));
+  varint_builder.Varint(id_event_type(id_async_end));
+  varint_builder.Varint(300);
+  varint_builder.Varint(0x123400000002ULL);
+  // negative diff (two's complement)
+  varint_builder.Varint(varint_head(static_cast<uint64_t>(-1),
+                                    varint_exit_kind));
+  varint_builder.data_.resize(varint_builder.data_.size() + 16, 0);
+  if (!varint_builder.Save(filename)) {
+    std::cerr << "failed to write " << filename << std::endl;
+    return 1;
+  }
+  if (!reader.Open(filename)) {
+    std::cerr << reader.GetErrorMessage() << std::endl;
+    return 1;
+  }
+  assert(reader.Version() == file_version_varint || !"wrong version");
+  Expected varint_expected[] = {
+      {TraceEvent::kEnter, 3000000003ULL, ""},
+      {TraceEvent::kAsyncEnter, 3000000203ULL, "CPU:1"},
+      {TraceEvent::kCpuMigration, 3000000204ULL, ""},
+      {TraceEvent::kAsyncExit, 3000000204ULL, "eaten"},
+      {TraceEvent::kInstant, 3000000204ULL, "args"},
+      {TraceEvent::kCounter, 3000000204ULL, "eaten"},
+      {TraceEvent::kIdAsyncEnd, 3000000204ULL, "eaten"},
+      {TraceEvent::kExit, 3000000203ULL, ""},
+  };
+  for (auto& e : varint_expected) {
+    bool ret = reader.Next(&event);
+    assert(ret || !"too few varint events");
+    assert(event.type == e.type || !"wrong varint type");
+    assert(event.timestamp == e.timestamp || !"wrong varint timestamp");
+    assert(std::string(event.text, event.text_size) == e.text ||
+           !"wrong varint text");
+    if (event.type == TraceEvent::kEnter) {
+      assert(event.address == 0x401000 || !"wrong function id");
+    }
+    if (event.type == TraceEvent::kCpuMigration) {
+      assert(event.cpu_id == no_cpu_id || !"wrong varint cpu id");
+    }
+    if (event.type == TraceEvent::kInstant) {
+      assert(event.arg_count == 3 || !"wrong varint arg count");
+      assert(event.args[0].int_value == -300 || !"wrong varint int arg");
+      assert(event.args[1].double_value == 1.5 || !"wrong varint double arg");
+      assert(event.args[2].type == arg_pointer || !"wrong varint arg type");
+      assert(event.args[2].pointer_value == 0x7fff1234 ||
+             !"wrong varint pointer arg");
+    }
+    if (event.type == TraceEvent::kCounter) {
+      assert(event.value_type == arg_double || !"wrong varint counter type");
+      assert(event.double_value == 2.5 || !"wrong varint counter value");
+    }
+    if (event.type == TraceEvent::kIdAsyncEnd) {
+      assert(event.id == 0x123400000002ULL || !"wrong varint async id");
+    }
+  }
+  assert(!reader.Next(&event) || !"too many varint events");
+  assert(!reader.HasError() || !"unexpected varint error");
+
+  // compressed frames are decoded as one file (truncated frame is ignored)
+  TraceBuilder frame_builder;
+  size_t split = varint_builder.data_.size() / 2;
+  frame_builder.Frame(std::vector<char>(varint_builder.data_.begin(),
+                                        varint_builder.data_.begin() + split),
+                      true);
+  frame_builder.Frame(std::vector<char>(varint_builder.data_.begin() + split,
+                                        varint_builder.data_.end()),
+                      false);
+  frame_builder.Frame(varint_builder.data_, true);
+  frame_builder.data_.resize(frame_builder.data_.size() - 1);
+  if (!frame_builder.Save(filename)) {
+    std::cerr << "failed to write " << filename << std::endl;
+    return 1;
+  }
+  if (!reader.Open(filename)) {
+    std::cerr << reader.GetErrorMessage() << std::endl;
+    return 1;
+  }
+  assert(reader.Size() == varint_builder.data_.size() ||
+         !"wrong decompressed size");
+  for (auto& e : varint_expected) {
+    bool ret = reader.Next(&event);
+    assert(ret || !"too few frame events");
+    assert(event.type == e.type || !"wrong frame type");
+    assert(event.timestamp == e.timestamp || !"wrong frame timestamp");
+  }
+  assert(!reader.Next(&event) || !"too many frame events");
+  assert(!reader.HasError() || !"unexpected frame error");
+
+  // codec round trip: overlapped matches, long lengths and random data
+  std::vector<uint8_t> raw;
+  for (int i = 0; i < 5000; i++) {
+    uint8_t record[] = {uint8_t(i % 7), 0x10, 0x20, 0x30, 0, 0, 0, 0x40};
+    raw.insert(raw.end(), record, record + sizeof(record));
+  }
+  raw.resize(raw.size() + 1000, 0);
+  uint32_t seed = 1;
+  for (int i = 0; i < 1000; i++) {
+    seed = seed * 1103515245 + 12345;
+    raw.push_back(seed >> 24);
+  }
+  std::vector<uint8_t> compressed(iftracer::lz::CompressBound(raw.size()));
+  size_t compressed_size = iftracer::lz::Compress(
+      raw.data(), raw.size(), compressed.data(), compressed.size());
+  assert((compressed_size != 0 && compressed_size < raw.size() / 4) ||
+         !"not compressed");
+  std::vector<uint8_t> decompressed(raw.size());
+  bool decompressed_ret = iftracer::lz::Decompress(
+      compressed.data(), compressed_size, decompressed.data(), raw.size());
+  assert((decompressed_ret && decompressed == raw) || !"wrong round trip");
+  assert(!iftracer::lz::Decompress(compressed.data(), compressed_size - 1,
+                                   decompressed.data(), raw.size()) ||
+         !"truncated data is decompressed");
+  assert(iftracer::lz::Compress(raw.data() + raw.size() - 1000, 1000,
+                                compressed.data(), 999) == 0 ||
+         !"random data is compressed");
+
+  // container: chunks of two streams are out of order in the file
+  const size_t chunk_size = 256;
+  TraceBuilder container_builder;
+  ContainerHeader container_header;
+  container_header.pid              = 30;
+  container_header.chunk_size       = chunk_size;
+  container_header.base_timestamp   = 1000;
+  container_header.ticks_per_second = 1000000000ULL;
+  container_header.clock_source     = clock_monotonic_raw;
+  container_builder.Put<ContainerHeader>(container_header);
+  container_builder.data_.resize(chunk_size, 0);
+  ChunkHeader chunk_header;
+  TraceBuilder records[4];
+  records[0].Enter(0, 0x402000);
+  chunk_header.tid             = 32;
+  chunk_header.stream_id       = 2;
+  chunk_header.first_timestamp = 6000;
+  container_builder.Chunk(chunk_header, records[0], true, chunk_size);
+  // string_id defined in the previous chunk of the stream
+  records[1].Timestamp(2, extend_exit_flag);
+  records[1].Put<ExtendType>(instant | string_id_flag);
+  records[1].Put<uint32_t>(7);
+  records[1].Exit(3);
+  chunk_header.tid             = 31;
+  chunk_header.stream_id       = 1;
+  chunk_header.sequence        = 1;
+  chunk_header.first_timestamp = 5010;
+  container_builder.Chunk(chunk_header, records[1], true, chunk_size);
+  // unused slot
+  container_builder.data_.resize(container_builder.data_.size() + chunk_size,
+                                 0);
+  records[2].Timestamp(0, extend_exit_flag);
+  records[2].Put<ExtendType>(string_define);
+  records[2].Put<uint32_t>(7);
+  records[2].Put<int32_t>(5);
+  records[2].data_.insert(records[2].data_.end(), "eaten", "eaten" + 5);
+  records[2].data_.resize(records[2].data_.size() + aligned_text_size(5) - 5,
+                          '\xff');
+  records[2].Enter(1, 0x401000);
+  chunk_header.sequence        = 0;
+  chunk_header.first_timestamp = 5000;
+  container_builder.Chunk(chunk_header, records[2], true, chunk_size);
+  // last chunk of a process which was not terminated normally
+  records[3].Exit(5);
+  chunk_header.tid             = 32;
+  chunk_header.stream_id       = 2;
+  chunk_header.sequence        = 1;
+  chunk_header.first_timestamp = 7000;
+  container_builder.Chunk(chunk_header, records[3], false, chunk_size);
+  if (!container_builder.Save(filename)) {
+    std::cerr << "failed to write " << filename << std::endl;
+    return 1;
+  }
+  if (!reader.Open(filename)) {
+    std::cerr << reader.GetErrorMessage() << std::endl;
+    return 1;
+  }
+  assert(reader.IsContainer() || !"not container");
+  assert(reader.StreamCount() == 2 || !"wrong stream count");
+  assert(reader.Pid() == 30 || !"wrong container pid");
+  struct StreamExpected {
+    int32_t tid;
+    std::vector<Expected> events;
+  } stream_expected[] = {
+      {31,
+       {{TraceEvent::kEnter, 5001, ""},
+        {TraceEvent::kInstant, 5012, "eaten"},
+        {TraceEvent::kExit, 5015, ""}}},
+      {32, {{TraceEvent::kEnter, 6000, ""}, {TraceEvent::kExit, 7005, ""}}},
+  };
+  // streams can be selected again in any order
+  for (size_t i : {1, 0, 1}) {
+    bool ret = reader.SelectStream(i);
+    assert(ret || !"failed to select stream");
+    assert(reader.Tid() == stream_expected[i].tid || !"wrong stream tid");
+    for (auto& e : stream_expected[i].events) {
+      ret = reader.Next(&event);
+      assert(ret || !"too few stream events");
+      assert(event.type == e.type || !"wrong stream type");
+      assert(event.timestamp == e.timestamp || !"wrong stream timestamp");
+      assert(std::string(event.text, event.text_size) == e.text ||
+             !"wrong stream text");
+    }
+    assert(!reader.Next(&event) || !"too many stream events");
+    assert(!reader.HasError() || !"unexpected stream error");
+  }
+
+  // keyframes: Seek() starts at the last keyframe before the timestamp in
+  // the index and compensation continues from the hook_events of it
+  std::string index_filename = filename + ".index";
+  for (bool varint : {false, true}) {
+    TraceBuilder keyframe_builder;
+    overhead_header.version =
+        varint ? file_version_varint : file_version_fixed;
+    keyframe_builder.Header(overhead_header);
+    if (varint) {
+      for (uint64_t id : {1, 2}) {
+        keyframe_builder.Varint(varint_head(0, varint_extend_kind));
+        keyframe_builder.Varint(function_define);
+        keyframe_builder.Varint(id);
+        keyframe_builder.Varint(0x400000 + id * 0x1000);
+      }
+      keyframe_builder.Varint(varint_head(0, varint_enter_kind));
+      keyframe_builder.Varint(1);
+      keyframe_builder.Varint(varint_head(10, varint_enter_kind));
+      keyframe_builder.Varint(2);
+    } else {
+      keyframe_builder.Enter(0, 0x401000);
+      keyframe_builder.Enter(10, 0x402000);
+    }
+    std::vector<IndexEntry> entries(2);
+    entries[0].timestamp = 1020;
+    entries[0].offset    = keyframe_builder.data_.size();
+    entries[0].depth     = 2;
+    keyframe_builder.Keyframe(varint, 1020, 2, 2, {0x401000, 0x402000});
+    if (varint) {
+      keyframe_builder.Varint(varint_head(5, varint_exit_kind));
+    } else {
+      keyframe_builder.Exit(5);
+    }
+    entries[1].timestamp = 2000;
+    entries[1].offset    = keyframe_builder.data_.size();
+    entries[1].depth     = 1;
+    // without the stack (IFTRACER_KEYFRAME_STACK=0)
+    keyframe_builder.Keyframe(varint, 2000, 3, 1, {});
+    if (varint) {
+      keyframe_builder.Varint(varint_head(10, varint_exit_kind));
+    } else {
+      keyframe_builder.Exit(10);
+    }
+    TraceBuilder index_builder;
+    index_builder.Index(entries);
+    if (!keyframe_builder.Save(filename) ||
+        !index_builder.Save(index_filename)) {
+      std::cerr << "failed to write " << filename << std::endl;
+      return 1;
+    }
+    reader.SetCompensation(true);
+    if (!reader.Open(filename)) {
+      std::cerr << reader.GetErrorMessage() << std::endl;
+      return 1;
+    }
+    // keyframes are not events
+    uint64_t keyframe_timestamps[] = {1000, 1000, 1005, 1980};
+    for (uint64_t timestamp : keyframe_timestamps) {
+      bool ret = reader.Next(&event);
+      assert(ret || !"too few keyframe events");
+      assert(event.timestamp == timestamp || !"wrong keyframe timestamp");
+    }
+    assert(!reader.Next(&event) || !"too many keyframe events");
+    assert(reader.KeyframeDepth() == 1 || !"wrong keyframe depth");
+    struct SeekExpected {
+      uint64_t seek_timestamp;
+      uint32_t depth;
+      std::vector<uint64_t> stack;
+      std::vector<uint64_t> timestamps;
+    } seek_expected[] = {
+        {1500, 2, {0x401000, 0x402000}, {1005, 1980}},
+        {999, 0, {}, {1000, 1000, 1005, 1980}},
+        {5000, 1, {}, {1980}},
+    };
+    for (auto& e : seek_expected) {
+      bool ret = reader.Seek(e.seek_timestamp);
+      assert(ret || !"failed to seek");
+      assert(reader.KeyframeDepth() == e.depth || !"wrong seek depth");
+      assert(reader.KeyframeStack() == e.stack || !"wrong seek stack");
+      for (uint64_t timestamp : e.timestamps) {
+        ret = reader.Next(&event);
+        assert(ret || !"too few events after seek");
+        assert(event.timestamp == timestamp || !"wrong timestamp after seek");
+      }
+      assert(!reader.Next(&event) || !"too many events after seek");
+      assert(!reader.HasError() || !"unexpected seek error");
+    }
+    reader.SetCompensation(false);
+  }
+
+  // container: entries of streams in one index of absolute file offsets
+  TraceBuilder keyframe_container;
+  keyframe_container.Put<ContainerHeader>(container_header);
+  keyframe_container.data_.resize(chunk_size, 0);
+  TraceBuilder keyframe_records[3];
+  keyframe_records[0].Enter(0, 0x401000);
+  keyframe_records[1].Exit(0);
+  keyframe_records[2].Keyframe(false, 6000, 1, 1, {0x401000});
+  keyframe_records[2].Exit(10);
+  chunk_header.tid       = 41;
+  chunk_header.stream_id = 1;
+  for (uint32_t i = 0; i < 3; i++) {
+    // stream 2 has no keyframe
+    chunk_header.stream_id       = i == 1 ? 2 : 1;
+    chunk_header.sequence        = i == 2 ? 1 : 0;
+    chunk_header.first_timestamp = 5000;
+    keyframe_container.Chunk(chunk_header, keyframe_records[i], true,
+                             chunk_size);
+  }
+  std::vector<IndexEntry> container_entries(1);
+  container_entries[0].timestamp = 6000;
+  container_entries[0].offset    = chunk_size * 3 + sizeof(ChunkHeader);
+  container_entries[0].stream_id = 1;
+  container_entries[0].depth     = 1;
+  TraceBuilder container_index;
+  container_index.Index(container_entries);
+  if (!keyframe_container.Save(filename) ||
+      !container_index.Save(index_filename)) {
+    std::cerr << "failed to write " << filename << std::endl;
+    return 1;
+  }
+  if (!reader.Open(filename)) {
+    std::cerr << reader.GetErrorMessage() << std::endl;
+    return 1;
+  }
+  struct ContainerSeekExpected {
+    size_t stream;
+    uint32_t depth;
+    std::vector<uint64_t> timestamps;
+  } container_seek_expected[] = {
+      {0, 1, {6010}},
+      {1, 0, {5000}},
+  };
+  for (auto& e : container_seek_expected) {
+    bool ret = reader.SelectStream(e.stream) && reader.Seek(7000);
+    assert(ret || !"failed to seek stream");
+    assert(reader.KeyframeDepth() == e.depth || !"wrong stream seek depth");
+    for (uint64_t timestamp : e.timestamps) {
+      ret = reader.Next(&event);
+      assert(ret || !"too few events after stream seek");
+      assert(event.timestamp == timestamp ||
+             !"wrong timestamp after stream seek");
+    }
+    assert(!reader.Next(&event) || !"too many events after stream seek");
+    assert(!reader.HasError() || !"unexpected stream seek error");
+  }
+  unlink(index_filename.c_str());
+  unlink(filename.c_str());
+  return 0;
+}
@@ -0,0 +1,166 @@
+#include "trace_clock.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+namespace iftracer {
+namespace trace_clock {
+uint32_t current_source = format::clock_unknown;
+
+namespace {
+bool has_invariant_tsc() {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+  if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0) {
+    return false;
+  }
+  return (edx & (1u << 8)) != 0;
+#else
+  return false;
+#endif
+}
+
+uint32_t default_source() {
+#if defined(__x86_64__) || defined(__i386__)
+  if (has_invariant_tsc()) {
+    return format::clock_tsc;
+  }
+#elif defined(__aarch64__)
+  return format::clock_cntvct;
+#endif
+  return format::clock_monotonic_raw;
+}
+
+bool is_available(uint32_t source) {
+  switch (source) {
+#if defined(__x86_64__) || defined(__i386__)
+    case format::clock_tsc:
+      return true;
+#endif
+#if defined(__aarch64__)
+    case format::clock_cntvct:
+      return true;
+#endif
+    case format::clock_monotonic_raw:
+    case format::clock_system:
+      return true;
+    default:
+      return false;
+  }
+}
+
+uint32_t select_source() {
+  if (fixed_source != format::clock_unknown) {
+    return fixed_source;
+  }
+  char* env = getenv("IFTRACER_CLOCK");
+  if (env == nullptr || std::string(env).empty()) {
+    return default_source();
+  }
+  for (uint32_t source : {format::clock_system, format::clock_monotonic_raw,
+                          format::clock_tsc, format::clock_cntvct}) {
+    if (std::string(env) == SourceName(source)) {
+      if (is_available(source)) {
+        return source;
+      }
+      break;
+    }
+  }
+  std::cerr << "[iftracer] IFTRACER_CLOCK=" << env
+            << " is not available, use " << SourceName(default_source())
+            << std::endl;
+  return default_source();
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+uint64_t tsc_frequency() {
+  char* env = getenv("IFTRACER_TSC_FREQUENCY");
+  if (env != nullptr) {
+    uint64_t frequency = std::strtoull(env, nullptr, 10);
+    if (frequency != 0) {
+      return frequency;
+    }
+  }
+  // leaf 0x15: tsc/crystal ratio and crystal clock (often 0 on VMs)
+  unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+  if (__get_cpuid(0x15, &eax, &ebx, &ecx, &edx) != 0 && eax != 0 &&
+      ebx != 0 && ecx != 0) {
+    return static_cast<uint64_t>(ecx) * ebx / eax;
+  }
+  // measure against CLOCK_MONOTONIC_RAW
+  const uint64_t calibration_ns = 10 * 1000 * 1000;
+  uint64_t start_ns             = ReadMonotonicRaw();
+  uint64_t start_tsc            = ReadTsc();
+  uint64_t end_ns               = start_ns;
+  while (end_ns - start_ns < calibration_ns) {
+    end_ns = ReadMonotonicRaw();
+  }
+  uint64_t end_tsc = ReadTsc();
+  return static_cast<uint64_t>(
+      static_cast<unsigned __int128>(end_tsc - start_tsc) * 1000000000 /
+      (end_ns - start_ns));
+}
+#endif
+
+#if defined(__aarch64__)
+uint64_t cntvct_frequency() {
+  uint64_t v;
+  asm volatile("mrs %0, cntfrq_el0" : "=r"(v));
+  return v;
+}
+#endif
+
+uint64_t calibrate(uint32_t source) {
+  switch (source) {
+#if defined(__x86_64__) || defined(__i386__)
+    case format::clock_tsc:
+      return tsc_frequency();
+#endif
+#if defined(__aarch64__)
+    case format::clock_cntvct:
+      return cntvct_frequency();
+#endif
+    case format::clock_system:
+      return 1000 * 1000;
+    default:
+      return 1000 * 1000 * 1000;
+  }
+}
+}  // namespace
+
+uint32_t Source() {
+  static uint32_t source = []() {
+    uint32_t source = select_source();
+    current_source  = source;
+    return source;
+  }();
+  return source;
+}
+
+uint64_t TicksPerSecond() {
+  static uint64_t ticks_per_second = calibrate(Source());
+  return ticks_per_second;
+}
+
+const char* SourceName(uint32_t source) {
+  switch (source) {
+    case format::clock_system:
+      return "system";
+    case format::clock_monotonic_raw:
+      return "monotonic_raw";
+    case format::clock_tsc:
+      return "tsc";
+    case format::clock_cntvct:
+      return "cntvct";
+    default:
+      return "unknown";
+  }
+}
+}  // namespace trace_clock
+}  // namespace iftracer
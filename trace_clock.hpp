@@ -0,0 +1,95 @@
+#ifndef TRACE_CLOCK_HPP_INCLUDED
+#define TRACE_CLOCK_HPP_INCLUDED
+
+#include <time.h>
+
+#include <chrono>
+#include <cstdint>
+
+#include "trace_format.hpp"
+
+// timestamp source of trace events
+//
+// the clock is selected at build time by one of
+//   -DIFTRACER_CLOCK_TSC, -DIFTRACER_CLOCK_CNTVCT,
+//   -DIFTRACER_CLOCK_MONOTONIC_RAW, -DIFTRACER_CLOCK_SYSTEM
+// or at runtime by IFTRACER_CLOCK=tsc|cntvct|monotonic_raw|system
+// (default: tsc on x86-64 with invariant tsc, cntvct on aarch64,
+// otherwise monotonic_raw)
+namespace iftracer {
+namespace trace_clock {
+#if defined(IFTRACER_CLOCK_TSC)
+constexpr uint32_t fixed_source = format::clock_tsc;
+#elif defined(IFTRACER_CLOCK_CNTVCT)
+constexpr uint32_t fixed_source = format::clock_cntvct;
+#elif defined(IFTRACER_CLOCK_MONOTONIC_RAW)
+constexpr uint32_t fixed_source = format::clock_monotonic_raw;
+#elif defined(IFTRACER_CLOCK_SYSTEM)
+constexpr uint32_t fixed_source = format::clock_system;
+#else
+constexpr uint32_t fixed_source = format::clock_unknown;
+#endif
+
+// format::clock_* (selected at first call)
+uint32_t Source();
+// calibrated at first call (tsc takes about 10ms)
+uint64_t TicksPerSecond();
+const char* SourceName(uint32_t source);
+
+// clock_unknown until Source() is called
+extern uint32_t current_source;
+
+#if defined(__x86_64__) || defined(__i386__)
+inline uint64_t ReadTsc() { return __builtin_ia32_rdtsc(); }
+#endif
+#if defined(__aarch64__)
+inline uint64_t ReadCntvct() {
+  uint64_t v;
+  // NOTE: no isb for lower overhead (events are not reordered much)
+  asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+  return v;
+}
+#endif
+inline uint64_t ReadMonotonicRaw() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+inline uint64_t ReadSystem() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+inline uint64_t Read(uint32_t source) {
+  switch (source) {
+#if defined(__x86_64__) || defined(__i386__)
+    case format::clock_tsc:
+      return ReadTsc();
+#endif
+#if defined(__aarch64__)
+    case format::clock_cntvct:
+      return ReadCntvct();
+#endif
+    case format::clock_system:
+      return ReadSystem();
+    default:
+      return ReadMonotonicRaw();
+  }
+}
+
+// current time in ticks of Source()
+inline uint64_t Now() {
+  if (fixed_source != format::clock_unknown) {
+    return Read(fixed_source);
+  }
+  uint32_t source = current_source;
+  if (__builtin_expect(source == format::clock_unknown, 0)) {
+    source = Source();
+  }
+  return Read(source);
+}
+}  // namespace trace_clock
+}  // namespace iftracer
+
+#endif  // TRACE_CLOCK_HPP_INCLUDED
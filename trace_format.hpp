@@ -0,0 +1,294 @@
+#ifndef TRACE_FORMAT_HPP_INCLUDED
+#define TRACE_FORMAT_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+// binary layout of iftracer.out.* files (see "data format" in README.md)
+// shared by iftracer_hook.cpp (writer) and tools/ (reader)
+namespace iftracer {
+namespace format {
+using ExtraInfo  = uint32_t;
+using ExtendType = uint32_t;
+
+constexpr uint32_t timestamp_size     = sizeof(uint32_t) * 8;
+constexpr ExtraInfo unset_flag_mask   = (0x1UL << (timestamp_size - 2)) - 1;
+constexpr ExtraInfo flag_mask         = ~unset_flag_mask;
+constexpr ExtraInfo normal_enter_flag = 0x0UL << (timestamp_size - 2);
+constexpr ExtraInfo extend_enter_flag = 0x1UL << (timestamp_size - 2);
+constexpr ExtraInfo normal_exit_flag  = 0x2UL << (timestamp_size - 2);
+constexpr ExtraInfo extend_exit_flag  = 0x3UL << (timestamp_size - 2);
+
+// timestamp_diff is stored as (diff + 1) so that 0 means "no more data"
+constexpr uint32_t timestamp_diff_offset = 1;
+// larger diff is recorded by timestamp_sync
+constexpr uint64_t max_timestamp_diff_with_offset = unset_flag_mask;
+
+constexpr ExtendType duration_enter = 0x0;
+constexpr ExtendType duration_exit  = 0x1;
+constexpr ExtendType async_enter    = 0x2;
+constexpr ExtendType async_exit     = 0x3;
+constexpr ExtendType instant        = 0x4;
+// absolute timestamp(8B) follows (used when timestamp_diff overflows)
+constexpr ExtendType timestamp_sync = 0x5;
+constexpr size_t timestamp_sync_size =
+    sizeof(uint32_t) + sizeof(ExtendType) + sizeof(uint64_t);
+// varint encoding only: function_id(varint) -> function address(varint)
+constexpr ExtendType function_define = 0x6;
+// the thread runs on cpu_id from this timestamp (no payload)
+// cpu_id is stored in the upper bits of the extend type, so fixed records are
+// 8B (timestamp_diff(4B) -> extend type(4B))
+constexpr ExtendType cpu_migration = 0x7;
+// cpu_migration to no_cpu_id ends cpu tracking of the thread
+constexpr uint32_t no_cpu_id = 0xffff;
+
+// text types | string_id_flag: string_id(4B) instead of text_size and text
+constexpr ExtendType string_id_flag = 0x8;
+// string_id(4B) -> text_size -> text (no timestamp meaning)
+// written once per file before the first use of the string_id
+constexpr ExtendType string_define = 0x10;
+
+// text types | args_flag: arg_count -> args follow the text (or string_id)
+//   fixed : arg_count(4B) -> {key string_id(4B), arg type(4B), value(8B)}...
+//   varint: arg_count -> {key string_id, arg type, value}... (varints)
+//     value: arg_int64 is zigzag, arg_double is 8B little endian
+constexpr ExtendType args_flag = 0x20;
+constexpr uint32_t max_args    = 16;
+constexpr size_t fixed_arg_size =
+    sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint64_t);
+// arg type (same as iftracer::Arg::Type)
+constexpr uint32_t arg_int64   = 0x0;
+constexpr uint32_t arg_double  = 0x1;
+constexpr uint32_t arg_pointer = 0x2;
+// interned string (string_id)
+constexpr uint32_t arg_string = 0x3;
+
+// counter track sample (value type in the upper bits of the extend type)
+//   fixed : string_id(4B) -> value(8B) (20B record)
+//   varint: string_id(varint) -> value (zigzag int64 or 8B double)
+// value type is arg_int64 or arg_double
+constexpr ExtendType counter = 0x40;
+// event linked across threads by a 64bit id (phase in the upper bits)
+// written into the buffer of the calling thread like other events
+//   fixed : string_id(4B) -> id(8B) (20B record)
+//   varint: string_id(varint) -> id(varint)
+constexpr ExtendType id_event = 0x41;
+// flow arrow: start -> step... -> end
+constexpr uint32_t id_flow_start = 0x0;
+constexpr uint32_t id_flow_step  = 0x1;
+constexpr uint32_t id_flow_end   = 0x2;
+// async span which can begin and end on different threads
+constexpr uint32_t id_async_begin = 0x3;
+constexpr uint32_t id_async_end   = 0x4;
+// decoding of the thread can start at this record (IFTRACER_KEYFRAME)
+//   fixed : timestamp_diff(4B, no diff) -> extend type(4B) -> timestamp(8B)
+//           -> hook_events(8B) -> depth(4B) -> stack_size(4B)
+//           -> function addresses(address size)...
+//   varint: head(no diff) -> extend type -> timestamp -> hook_events -> depth
+//           -> stack_size -> function addresses... (varints)
+// hook_events: enter and exit records before the keyframe
+// the stack is the outermost stack_size (<= depth) functions which are
+// entered and not exited yet (stack_size is 0 with IFTRACER_KEYFRAME_STACK=0)
+// string_define and function_define before a keyframe are written again
+// before their first use after it
+constexpr ExtendType keyframe         = 0x42;
+constexpr uint32_t max_keyframe_stack = 256;
+// also enough for the varint encoding
+inline size_t max_keyframe_size(uint32_t stack_size) {
+  return sizeof(uint32_t) + sizeof(ExtendType) + sizeof(uint64_t) * 2 +
+         sizeof(uint32_t) * 2 + (sizeof(uint64_t) + 2) * (stack_size + 2);
+}
+
+inline uint64_t zigzag_encode(int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+inline int64_t zigzag_decode(uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+// extend type = (payload << extend_payload_shift) | type
+constexpr uint32_t extend_payload_shift = 16;
+constexpr ExtendType extend_type_mask   = (0x1UL << extend_payload_shift) - 1;
+inline ExtendType cpu_migration_type(uint32_t cpu_id) {
+  if (cpu_id > no_cpu_id) {
+    cpu_id = no_cpu_id;
+  }
+  return (cpu_id << extend_payload_shift) | cpu_migration;
+}
+inline ExtendType counter_type(uint32_t value_type) {
+  return (value_type << extend_payload_shift) | counter;
+}
+inline ExtendType id_event_type(uint32_t phase) {
+  return (phase << extend_payload_shift) | id_event;
+}
+
+constexpr size_t text_align = 4;
+
+// clock source of timestamps
+constexpr uint32_t clock_unknown       = 0x0;
+// CLOCK_REALTIME in microseconds (legacy files)
+constexpr uint32_t clock_system        = 0x1;
+constexpr uint32_t clock_monotonic_raw = 0x2;
+constexpr uint32_t clock_tsc           = 0x3;
+constexpr uint32_t clock_cntvct        = 0x4;
+
+// "IFTR" (little endian)
+constexpr uint32_t file_magic = 0x52544649;
+// fixed size records (timestamp_diff(4B) + function address)
+constexpr uint16_t file_version_fixed = 1;
+// LEB128 records with function id dictionary (see below)
+constexpr uint16_t file_version_varint = 2;
+
+// NOTE: readers must skip header_size bytes so that fields can be appended
+struct FileHeader {
+  uint32_t magic            = file_magic;
+  uint16_t version          = file_version_fixed;
+  uint16_t header_size      = sizeof(FileHeader);
+  int32_t pid               = 0;
+  int32_t tid               = 0;
+  uint64_t base_timestamp   = 0;
+  uint64_t ticks_per_second = 0;
+  uint32_t clock_source     = clock_unknown;
+  // cost of one hook (half of enter + exit) measured at startup
+  // (0: not measured, see IFTRACER_CALIBRATE)
+  uint32_t hook_overhead_ps = 0;
+};
+static_assert(sizeof(FileHeader) == 40, "unexpected FileHeader layout");
+
+// container of all threads (IFTRACER_CONTAINER): "<prefix><pid>.chunks"
+//
+// the file is split into chunk_size slots: ContainerHeader is in the first
+// slot and chunk i is at (i + 1) * chunk_size
+// a chunk is ChunkHeader -> records of one thread (encoding is the version)
+// records never straddle chunks and the chunks of a stream (stream_id) are
+// decoded in sequence order as one file, slots without chunk_magic are unused
+// "IFTC" (little endian)
+constexpr uint32_t container_magic = 0x43544649;
+// "IFCK" (little endian)
+constexpr uint32_t chunk_magic = 0x4b434649;
+struct ContainerHeader {
+  uint32_t magic            = container_magic;
+  uint16_t version          = file_version_fixed;
+  uint16_t header_size      = sizeof(ContainerHeader);
+  int32_t pid               = 0;
+  uint32_t chunk_size       = 0;
+  uint64_t base_timestamp   = 0;
+  uint64_t ticks_per_second = 0;
+  uint32_t clock_source     = clock_unknown;
+  uint32_t hook_overhead_ps = 0;
+};
+static_assert(sizeof(ContainerHeader) == 40,
+              "unexpected ContainerHeader layout");
+struct ChunkHeader {
+  uint32_t magic = chunk_magic;
+  int32_t tid    = 0;
+  // unique in the container because tids are reused by the kernel
+  uint32_t stream_id = 0;
+  uint32_t sequence  = 0;
+  // absolute timestamp before the first record of the chunk
+  uint64_t first_timestamp = 0;
+  // size of records after the header
+  // (0: not closed normally, records end at the zero filled tail)
+  uint32_t data_size = 0;
+  uint32_t reserved  = 0;
+};
+static_assert(sizeof(ChunkHeader) == 32, "unexpected ChunkHeader layout");
+
+// IFTRACER_COMPRESS: the whole file (header and records) is a sequence of
+// frames, each of which is a flushed buffer compressed by lz_codec.hpp
+// frames end at the end of the file or at a zero filled or truncated frame
+// "IFTZ" (little endian)
+constexpr uint32_t frame_magic = 0x5a544649;
+struct FrameHeader {
+  uint32_t magic    = frame_magic;
+  uint32_t raw_size = 0;
+  // == raw_size: stored without compression
+  uint32_t compressed_size = 0;
+  uint32_t reserved        = 0;
+};
+static_assert(sizeof(FrameHeader) == 16, "unexpected FrameHeader layout");
+
+// sidecar index of keyframes: "<trace file>.index"
+// IndexHeader -> IndexEntry... (sorted by timestamp in each stream)
+// written when a thread ends (container: appended by each thread), so the
+// keyframes after the last entry are found only by decoding
+// "IFTI" (little endian)
+constexpr uint32_t index_magic = 0x49544649;
+struct IndexHeader {
+  uint32_t magic       = index_magic;
+  uint16_t version     = 1;
+  uint16_t header_size = sizeof(IndexHeader);
+  uint32_t entry_size  = 0;
+  uint32_t reserved    = 0;
+};
+static_assert(sizeof(IndexHeader) == 16, "unexpected IndexHeader layout");
+struct IndexEntry {
+  // absolute timestamp of the keyframe
+  uint64_t timestamp = 0;
+  // file offset of the keyframe record
+  // (IFTRACER_COMPRESS: offset in the decompressed data)
+  uint64_t offset = 0;
+  // ChunkHeader::stream_id (0 for a file of a thread)
+  uint32_t stream_id = 0;
+  uint32_t depth     = 0;
+};
+static_assert(sizeof(IndexEntry) == 24, "unexpected IndexEntry layout");
+
+// files without magic: base_timestamp(8B) -> pid(4B) -> tid(4B)
+// timestamps are CLOCK_REALTIME microseconds
+constexpr size_t legacy_header_size = sizeof(uint64_t) + sizeof(int32_t) * 2;
+
+inline uint32_t set_flag_to_timestamp(uint32_t timestamp, ExtraInfo flag) {
+  return (timestamp & unset_flag_mask) | flag;
+}
+inline size_t aligned_text_size(size_t text_size) {
+  return ((text_size + (text_align - 1)) & ~(text_align - 1));
+}
+
+// varint encoding (file_version_varint)
+//
+// each record starts with head = (timestamp_diff << 2) | kind (LEB128)
+//   enter : head -> function_id(varint)
+//   exit  : head
+//   extend: head -> extend type(varint) -> payload
+//     text types: text_size(varint) -> text (no padding)
+//     text types | string_id_flag: string_id(varint)
+//     text types | args_flag: text payload -> arg_count(varint) -> args
+//     string_define: string_id(varint) -> text_size(varint) -> text
+//     counter: string_id(varint) -> value
+//     id_event: string_id(varint) -> id(varint)
+//     function_define: function_id(varint) -> function address(varint)
+// timestamp_diff is 62bit two's complement, so timestamp_sync is not needed
+// kind 0 is not used so that zero filled tail is "no more data"
+//
+// function_id is the slot of the writer's direct-mapped address cache;
+// function_define (re)binds the slot before the first enter which uses it
+constexpr uint64_t varint_kind_bits   = 2;
+constexpr uint64_t varint_kind_mask   = (0x1UL << varint_kind_bits) - 1;
+constexpr uint64_t varint_enter_kind  = 0x1;
+constexpr uint64_t varint_exit_kind   = 0x2;
+constexpr uint64_t varint_extend_kind = 0x3;
+constexpr size_t max_varint_size      = 10;
+constexpr size_t function_id_cache_size = 1024;
+
+inline uint32_t function_id_slot(uintptr_t address) {
+  // functions are at least 2B aligned
+  uint64_t v = static_cast<uint64_t>(address) >> 1;
+  return static_cast<uint32_t>((v ^ (v >> 10) ^ (v >> 20)) &
+                               (function_id_cache_size - 1));
+}
+inline uint8_t* write_varint(uint8_t* p, uint64_t v) {
+  while (v >= 0x80) {
+    *p++ = static_cast<uint8_t>(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = static_cast<uint8_t>(v);
+  return p;
+}
+inline uint64_t varint_head(uint64_t timestamp_diff, uint64_t kind) {
+  return (timestamp_diff << varint_kind_bits) | kind;
+}
+}  // namespace format
+}  // namespace iftracer
+
+#endif  // TRACE_FORMAT_HPP_INCLUDED
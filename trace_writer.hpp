@@ -0,0 +1,80 @@
+#ifndef TRACE_WRITER_HPP_INCLUDED
+#define TRACE_WRITER_HPP_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// output backend of a thread's trace file (IFTRACER_WRITER)
+//
+// records are written at Cursor() and committed by Seek() in the hot path
+// (non-virtual), and a backend only decides where the buffer comes from and
+// how the written bytes reach the file (virtual, slow path)
+//   MmapWriter    : MAP_SHARED file mapping (default)
+//   BufferedWriter: anonymous double buffers written by a background thread
+class TraceWriter {
+ public:
+  TraceWriter(){};
+  virtual ~TraceWriter(){};
+  TraceWriter(const TraceWriter&) = delete;
+  TraceWriter& operator=(const TraceWriter&) = delete;
+
+  bool IsOpen() { return is_open_; }
+  // offset == 0: truncate file
+  // offset  < 0: seek to last offset, extend size
+  virtual bool Open(std::string filename, size_t size, int64_t offset) = 0;
+  virtual bool Close() = 0;
+  // hand the first size bytes of the buffer to the file (if supported)
+  virtual bool Flush(size_t size) = 0;
+  // make room for size bytes at Cursor()
+  virtual bool PrepareWrite(size_t size) = 0;
+
+  size_t BufferedDataSize() { return local_offset_; };
+  bool CheckCapacity(size_t size) { return local_offset_ + size <= map_size_; }
+  void Seek(size_t n) {
+    file_offset_ += n;
+    local_offset_ += n;
+    cursor_ += n;
+  }
+  // discard last n bytes written (zero filled again)
+  // return false if they are already flushed
+  bool Rewind(size_t n) {
+    if (n > local_offset_) {
+      return false;
+    }
+    file_offset_ -= n;
+    local_offset_ -= n;
+    cursor_ -= n;
+    // keep "zero filled tail is no more data" for abnormal termination
+    memset(cursor_, 0, n);
+    return true;
+  }
+  size_t FileOffset() { return file_offset_; }
+  uint8_t* Cursor() { return cursor_; }
+  std::string GetErrorMessage() {
+    std::string tmp = error_message_;
+    error_message_.clear();
+    return tmp;
+  }
+
+  // private:
+  void AddErrorMessage(std::string message) {
+    error_message_ = message + error_message_;
+  }
+  void AddErrorMessageWithErrono(std::string message, int errno_value) {
+    error_message_ = message + std::string(std::strerror(errno_value)) + ":" +
+                     error_message_;
+  }
+
+  bool is_open_    = false;
+  uint8_t* head_   = nullptr;
+  size_t map_size_ = 0;
+  // offset of cursor_ in the file
+  size_t file_offset_  = 0;
+  size_t local_offset_ = 0;
+  // NOTE: cursor_ = head_ + local_offset_
+  uint8_t* cursor_           = nullptr;
+  std::string error_message_ = "";
+};
+
+#endif  // TRACE_WRITER_HPP_INCLUDED